@@ -21,19 +21,102 @@
 
 #include <config.h>
 
+#include <math.h>
+#include <string.h>
+
 #include "sbu-plugin.h"
 #include "sbu-plugin-vfuncs.h"
 
+#define DUMMY_SOLAR_PEAK		3000.f	/* W */
+#define DUMMY_LOAD_BASE			250.f	/* W */
+#define DUMMY_BATTERY_CAPACITY		5000.f	/* Wh */
+#define DUMMY_BACKFILL_STEP		60	/* s between backfilled samples */
+#define DUMMY_BACKFILL_CHUNK		86400	/* s of history written per idle */
+
+static const SbuNodeKind dummy_nodes[] = {
+	SBU_NODE_KIND_SOLAR,
+	SBU_NODE_KIND_BATTERY,
+	SBU_NODE_KIND_UTILITY,
+	SBU_NODE_KIND_LOAD,
+	SBU_NODE_KIND_UNKNOWN };
+
+static const SbuNodeKind dummy_links[] = {
+	SBU_NODE_KIND_SOLAR,	SBU_NODE_KIND_BATTERY,
+	SBU_NODE_KIND_SOLAR,	SBU_NODE_KIND_LOAD,
+	SBU_NODE_KIND_BATTERY,	SBU_NODE_KIND_LOAD,
+	SBU_NODE_KIND_UTILITY,	SBU_NODE_KIND_LOAD,
+	SBU_NODE_KIND_UTILITY,	SBU_NODE_KIND_BATTERY,
+	SBU_NODE_KIND_UNKNOWN,	SBU_NODE_KIND_UNKNOWN };
+
+#define DUMMY_LINK_LAST			(G_N_ELEMENTS (dummy_links) / 2 - 1)
+
+/* the properties the daemon saves as history */
+static const SbuDeviceProperty dummy_props[] = {
+	SBU_DEVICE_PROPERTY_POWER,
+	SBU_DEVICE_PROPERTY_VOLTAGE,
+	SBU_DEVICE_PROPERTY_CURRENT,
+	SBU_DEVICE_PROPERTY_FREQUENCY,
+	SBU_DEVICE_PROPERTY_UNKNOWN };
+
+typedef struct {
+	gdouble		 values[SBU_NODE_KIND_LAST][SBU_DEVICE_PROPERTY_LAST];
+	gboolean	 active[DUMMY_LINK_LAST];
+} DummySample;
+
+typedef struct {
+	SbuPlugin	*plugin;
+	SbuDeviceImpl	*device;
+	GRand		*rand;
+	gdouble		 scale;		/* size of the installation */
+	gdouble		 soc;		/* 0..1 */
+	gdouble		 cloud;		/* 0..1 */
+	gboolean	 on_utility;
+	gint64		 ts_last;
+	gint64		 backfill_ts;
+	gint64		 backfill_end;
+	guint		 backfill_id;
+	guint		 sample_id;
+} DummyDevice;
+
 struct SbuPluginData {
 	guint		 timeout_id;
-	guint		 active_id;
-	SbuDeviceImpl	*device;
+	guint		 device_count;
+	guint		 interval;	/* ms, or 0 to use the daemon poll */
+	guint		 backfill_days;
+	GPtrArray	*devices;	/* of DummyDevice */
 };
 
+static void
+dummy_device_free (DummyDevice *dev)
+{
+	if (dev->backfill_id != 0)
+		g_source_remove (dev->backfill_id);
+	if (dev->sample_id != 0)
+		g_source_remove (dev->sample_id);
+	g_object_unref (dev->device);
+	g_rand_free (dev->rand);
+	g_free (dev);
+}
+
+static guint
+dummy_getenv_uint (const gchar *name, guint value_default)
+{
+	const gchar *tmp = g_getenv (name);
+	if (tmp == NULL || tmp[0] == '\0')
+		return value_default;
+	return (guint) g_ascii_strtoull (tmp, NULL, 10);
+}
+
+guint
+sbu_plugin_get_abi_version (void)
+{
+	return SBU_PLUGIN_ABI_VERSION;
+}
+
 void
 sbu_plugin_initialize (SbuPlugin *plugin)
 {
-	sbu_plugin_alloc_data (plugin, sizeof(SbuPluginData));
+	SbuPluginData *self = sbu_plugin_alloc_data (plugin, sizeof(SbuPluginData));
 
 	if (g_getenv ("SBU_DUMMY_ENABLE") == NULL) {
 		g_debug ("disabling '%s' as not testing",
@@ -41,106 +124,330 @@ sbu_plugin_initialize (SbuPlugin *plugin)
 		sbu_plugin_set_enabled (plugin, FALSE);
 		return;
 	}
+
+	/* load generator settings */
+	self->device_count = MAX (dummy_getenv_uint ("SBU_DUMMY_DEVICES", 1), 1);
+	self->interval = dummy_getenv_uint ("SBU_DUMMY_INTERVAL", 0);
+	self->backfill_days = dummy_getenv_uint ("SBU_DUMMY_BACKFILL_DAYS", 0);
+	self->devices = g_ptr_array_new_with_free_func ((GDestroyNotify) dummy_device_free);
+}
+
+/* a smooth bump centered on @center hours with a width of @width hours */
+static gdouble
+dummy_bump (gdouble hour, gdouble center, gdouble width)
+{
+	return exp (-pow (hour - center, 2) / (2 * width * width));
+}
+
+/* advance the model by @dt seconds to @ts, which must be monotonic */
+static void
+dummy_device_sample (DummyDevice *dev, gint64 ts, gdouble dt, DummySample *s)
+{
+	gdouble hour = (gdouble) (ts % 86400) / 3600.f;
+	gdouble doy = (gdouble) ((ts / 86400) % 365);
+	gdouble seasonal = 0.75f + 0.25f * cos (2 * G_PI * (doy - 172) / 365.f);
+	gdouble daylight = MAX (sin (G_PI * (hour - 6) / 12.f), 0.f);
+	gdouble solar;
+	gdouble load;
+	gdouble battery;
+	gdouble battery_voltage;
+	gdouble utility_voltage;
+	gdouble utility_frequency;
+
+	memset (s, 0, sizeof(DummySample));
+
+	/* clouds drift in and out */
+	dev->cloud += g_rand_double_range (dev->rand, -0.02f, 0.02f) * MIN (dt / 10.f, 10.f);
+	dev->cloud = CLAMP (dev->cloud, 0.2f, 1.f);
+	solar = DUMMY_SOLAR_PEAK * dev->scale * seasonal * dev->cloud * daylight;
+
+	/* a base load with peaks at breakfast and dinner */
+	load = DUMMY_LOAD_BASE + 800.f * dummy_bump (hour, 7.5f, 0.7f) +
+	       1500.f * dummy_bump (hour, 19.f, 1.5f);
+	load = load * dev->scale + g_rand_double_range (dev->rand, -50.f, 50.f);
+	load = MAX (load, 0.f);
+
+	/* switch to the utility when the battery is low, with hysteresis */
+	if (dev->soc < 0.25f)
+		dev->on_utility = TRUE;
+	else if (dev->soc > 0.4f)
+		dev->on_utility = FALSE;
+	battery = dev->on_utility ? solar : solar - load;
+	if (dev->soc >= 1.f && battery > 0.f)
+		battery = 0.f;
+	dev->soc += battery * dt / 3600.f / (DUMMY_BATTERY_CAPACITY * dev->scale);
+	dev->soc = CLAMP (dev->soc, 0.f, 1.f);
+	battery_voltage = 23.f + 4.f * dev->soc + (battery > 0.f ? 0.8f : -0.3f);
+
+	utility_voltage = 230.f + g_rand_double_range (dev->rand, -3.f, 3.f);
+	utility_frequency = 50.f + g_rand_double_range (dev->rand, -0.05f, 0.05f);
+
+	s->values[SBU_NODE_KIND_SOLAR][SBU_DEVICE_PROPERTY_POWER] = solar;
+	if (solar > 0.f) {
+		gdouble voltage = 60.f + 20.f * daylight;
+		s->values[SBU_NODE_KIND_SOLAR][SBU_DEVICE_PROPERTY_VOLTAGE] = voltage;
+		s->values[SBU_NODE_KIND_SOLAR][SBU_DEVICE_PROPERTY_CURRENT] = solar / voltage;
+	}
+	/* like the hardware, positive when discharging */
+	s->values[SBU_NODE_KIND_BATTERY][SBU_DEVICE_PROPERTY_POWER] = -battery;
+	s->values[SBU_NODE_KIND_BATTERY][SBU_DEVICE_PROPERTY_VOLTAGE] = battery_voltage;
+	s->values[SBU_NODE_KIND_BATTERY][SBU_DEVICE_PROPERTY_CURRENT] = -battery / battery_voltage;
+	s->values[SBU_NODE_KIND_UTILITY][SBU_DEVICE_PROPERTY_VOLTAGE] = utility_voltage;
+	s->values[SBU_NODE_KIND_UTILITY][SBU_DEVICE_PROPERTY_FREQUENCY] = utility_frequency;
+	if (dev->on_utility) {
+		s->values[SBU_NODE_KIND_UTILITY][SBU_DEVICE_PROPERTY_POWER] = load;
+		s->values[SBU_NODE_KIND_UTILITY][SBU_DEVICE_PROPERTY_CURRENT] = load / utility_voltage;
+	}
+	s->values[SBU_NODE_KIND_LOAD][SBU_DEVICE_PROPERTY_POWER] = load;
+	s->values[SBU_NODE_KIND_LOAD][SBU_DEVICE_PROPERTY_VOLTAGE] = 230.f;
+	s->values[SBU_NODE_KIND_LOAD][SBU_DEVICE_PROPERTY_CURRENT] = load / 230.f;
+	s->values[SBU_NODE_KIND_LOAD][SBU_DEVICE_PROPERTY_FREQUENCY] = 50.f;
+
+	/* in the same order as dummy_links */
+	s->active[0] = solar > 0.f && battery > 0.f;
+	s->active[1] = solar > 0.f && !dev->on_utility;
+	s->active[2] = !dev->on_utility;
+	s->active[3] = dev->on_utility;
+	s->active[4] = FALSE;
+	dev->ts_last = ts;
+}
+
+static void
+dummy_device_apply (DummyDevice *dev, const DummySample *s)
+{
+	for (guint i = 0; dummy_nodes[i] != SBU_NODE_KIND_UNKNOWN; i++) {
+		for (guint j = 0; dummy_props[j] != SBU_DEVICE_PROPERTY_UNKNOWN; j++) {
+			sbu_device_impl_set_node_value (dev->device,
+							dummy_nodes[i],
+							dummy_props[j],
+							s->values[dummy_nodes[i]][dummy_props[j]]);
+		}
+	}
+	for (guint i = 0; i < DUMMY_LINK_LAST; i++) {
+		sbu_device_impl_set_link_active (dev->device,
+						 dummy_links[i * 2],
+						 dummy_links[i * 2 + 1],
+						 s->active[i]);
+	}
+}
+
+static void
+dummy_device_refresh (DummyDevice *dev)
+{
+	DummySample s;
+	gint64 ts = g_get_real_time () / G_USEC_PER_SEC;
+
+	/* still writing the history */
+	if (dev->backfill_id != 0)
+		return;
+	dummy_device_sample (dev, ts, (gdouble) (ts - dev->ts_last), &s);
+	dummy_device_apply (dev, &s);
+	if (dev->soc >= 1.f)
+		sbu_device_impl_set_battery_full (dev->device);
+
+	/* save raw value */
+	sbu_plugin_update_metadata (dev->plugin, dev->device, "TestKey", 123456);
+}
+
+static gboolean
+dummy_device_sample_cb (gpointer user_data)
+{
+	DummyDevice *dev = (DummyDevice *) user_data;
+	sbu_device_impl_begin_update (dev->device);
+	dummy_device_refresh (dev);
+	sbu_device_impl_commit_update (dev->device);
+	return TRUE;
+}
+
+static void
+dummy_backfill_add (GPtrArray *items, gint64 ts, gint val)
+{
+	SbuDatabaseItem *item;
+
+	/* the daemon would not save repeated values either */
+	if (items->len > 0) {
+		item = g_ptr_array_index (items, items->len - 1);
+		if (item->val == val)
+			return;
+	}
+	item = g_new0 (SbuDatabaseItem, 1);
+	item->ts = ts;
+	item->val = val;
+	g_ptr_array_add (items, item);
 }
 
 static gboolean
-dummy_device_add_cb (gpointer user_data)
+dummy_device_backfill_cb (gpointer user_data)
 {
-	SbuPlugin *plugin = SBU_PLUGIN (user_data);
-	SbuPluginData *self = sbu_plugin_get_data (plugin);
-	SbuNodeKind nodes[] = { SBU_NODE_KIND_SOLAR,
-				SBU_NODE_KIND_BATTERY,
-				SBU_NODE_KIND_UTILITY,
-				SBU_NODE_KIND_LOAD,
-				SBU_NODE_KIND_UNKNOWN };
-	SbuNodeKind links[] = { SBU_NODE_KIND_SOLAR,	SBU_NODE_KIND_BATTERY,
-				SBU_NODE_KIND_SOLAR,	SBU_NODE_KIND_LOAD,
-				SBU_NODE_KIND_BATTERY,	SBU_NODE_KIND_LOAD,
-				SBU_NODE_KIND_UTILITY,	SBU_NODE_KIND_LOAD,
-				SBU_NODE_KIND_UTILITY,	SBU_NODE_KIND_BATTERY,
-				SBU_NODE_KIND_UNKNOWN,	SBU_NODE_KIND_UNKNOWN };
+	DummyDevice *dev = (DummyDevice *) user_data;
+	SbuDatabase *database = sbu_device_impl_get_database (dev->device);
+	GPtrArray *arrays[SBU_NODE_KIND_LAST][SBU_DEVICE_PROPERTY_LAST] = { { NULL } };
+	GPtrArray *arrays_link[DUMMY_LINK_LAST] = { NULL };
+	const gchar *device_path = sbu_device_impl_get_object_path (dev->device);
+	gint64 ts_end = MIN (dev->backfill_ts + DUMMY_BACKFILL_CHUNK, dev->backfill_end);
+	gboolean ret = TRUE;
+
+	/* collect a chunk of samples for each key */
+	for (guint i = 0; dummy_nodes[i] != SBU_NODE_KIND_UNKNOWN; i++) {
+		for (guint j = 0; dummy_props[j] != SBU_DEVICE_PROPERTY_UNKNOWN; j++)
+			arrays[dummy_nodes[i]][dummy_props[j]] = g_ptr_array_new_with_free_func (g_free);
+	}
+	for (guint i = 0; i < DUMMY_LINK_LAST; i++)
+		arrays_link[i] = g_ptr_array_new_with_free_func (g_free);
+	for (; dev->backfill_ts < ts_end; dev->backfill_ts += DUMMY_BACKFILL_STEP) {
+		DummySample s;
+		dummy_device_sample (dev, dev->backfill_ts, DUMMY_BACKFILL_STEP, &s);
+		for (guint i = 0; dummy_nodes[i] != SBU_NODE_KIND_UNKNOWN; i++) {
+			for (guint j = 0; dummy_props[j] != SBU_DEVICE_PROPERTY_UNKNOWN; j++) {
+				SbuNodeKind kind = dummy_nodes[i];
+				SbuDeviceProperty prop = dummy_props[j];
+				dummy_backfill_add (arrays[kind][prop], dev->backfill_ts,
+						    s.values[kind][prop] * 1000.f);
+			}
+		}
+		for (guint i = 0; i < DUMMY_LINK_LAST; i++)
+			dummy_backfill_add (arrays_link[i], dev->backfill_ts, s.active[i]);
+	}
+
+	/* use the same keys as the daemon */
+	if (g_str_has_prefix (device_path, SBU_DBUS_PATH_DEVICE))
+		device_path += strlen (SBU_DBUS_PATH_DEVICE);
+	for (guint i = 0; ret && dummy_nodes[i] != SBU_NODE_KIND_UNKNOWN; i++) {
+		for (guint j = 0; ret && dummy_props[j] != SBU_DEVICE_PROPERTY_UNKNOWN; j++) {
+			g_autofree gchar *key = NULL;
+			g_autoptr(GError) error = NULL;
+			key = g_strdup_printf ("%s/node_%s:%s", device_path,
+					       sbu_node_kind_to_string (dummy_nodes[i]),
+					       sbu_device_property_to_string (dummy_props[j]));
+			ret = sbu_database_save_items (database, key,
+						       arrays[dummy_nodes[i]][dummy_props[j]],
+						       &error);
+			if (!ret)
+				g_warning ("failed to backfill %s: %s", key, error->message);
+		}
+	}
+	for (guint i = 0; ret && i < DUMMY_LINK_LAST; i++) {
+		g_autofree gchar *key = NULL;
+		g_autoptr(GError) error = NULL;
+		key = g_strdup_printf ("%s/link_%s_%s:active", device_path,
+				       sbu_node_kind_to_string (dummy_links[i * 2]),
+				       sbu_node_kind_to_string (dummy_links[i * 2 + 1]));
+		ret = sbu_database_save_items (database, key, arrays_link[i], &error);
+		if (!ret)
+			g_warning ("failed to backfill %s: %s", key, error->message);
+	}
+	for (guint i = 0; i < SBU_NODE_KIND_LAST; i++) {
+		for (guint j = 0; j < SBU_DEVICE_PROPERTY_LAST; j++) {
+			if (arrays[i][j] != NULL)
+				g_ptr_array_unref (arrays[i][j]);
+		}
+	}
+	for (guint i = 0; i < DUMMY_LINK_LAST; i++)
+		g_ptr_array_unref (arrays_link[i]);
+
+	/* more to do */
+	if (ret && dev->backfill_ts < dev->backfill_end)
+		return TRUE;
+
+	/* go live */
+	g_debug ("backfill of %s complete", sbu_device_impl_get_object_path (dev->device));
+	dev->backfill_id = 0;
+	return FALSE;
+}
+
+static DummyDevice *
+dummy_device_new (SbuPlugin *plugin, guint idx)
+{
+	DummyDevice *dev = g_new0 (DummyDevice, 1);
+	g_autofree gchar *serial = g_strdup_printf ("%03u", idx);
+
+	/* each installation is different, but the same between runs */
+	dev->plugin = plugin;
+	dev->rand = g_rand_new_with_seed (idx);
+	dev->scale = g_rand_double_range (dev->rand, 0.5f, 1.5f);
+	dev->soc = g_rand_double_range (dev->rand, 0.5f, 1.f);
+	dev->cloud = 1.f;
+	dev->ts_last = g_get_real_time () / G_USEC_PER_SEC;
 
 	/* create fake device */
-	self->device = sbu_device_impl_new ();
-	g_object_set (self->device,
+	dev->device = sbu_device_impl_new ();
+	g_object_set (dev->device,
 		      "firmware-version", "123.456",
 		      "description", "PIP-MSX",
-		      "serial-number", "007",
+		      "serial-number", serial,
 		      NULL);
 
 	/* add all the nodes */
-	for (guint i = 0; nodes[i] != SBU_NODE_KIND_UNKNOWN; i++) {
-		g_autoptr(SbuNodeImpl) node = sbu_node_impl_new (nodes[i]);
+	for (guint i = 0; dummy_nodes[i] != SBU_NODE_KIND_UNKNOWN; i++) {
+		g_autoptr(SbuNodeImpl) node = sbu_node_impl_new (dummy_nodes[i]);
 		g_object_set (node,
-			      "voltage", 12.34f * nodes[i],
-			      "voltage-max", 12.34f * nodes[i] * 10,
-			      "current", 56.78f,
-			      "current-max", 56.78f * 10,
-			      "power", 87.65f,
-			      "power-max", 87.65f * 10,
-			      "frequency", 43.21f,
+			      "voltage-max", dummy_nodes[i] == SBU_NODE_KIND_BATTERY ? 30.f : 250.f,
+			      "current-max", 50.f * dev->scale,
+			      "power-max", 5000.f * dev->scale,
 			      NULL);
-		sbu_device_impl_add_node (self->device, node);
+		sbu_device_impl_add_node (dev->device, node);
 	}
 
 	/* add all the links */
-	for (guint i = 0; links[i] != SBU_NODE_KIND_UNKNOWN; i += 2) {
-		g_autoptr(SbuLinkImpl) link = sbu_link_impl_new (links[i], links[i+1]);
-		g_object_set (link, "active", TRUE, NULL);
-		sbu_device_impl_add_link (self->device, link);
+	for (guint i = 0; dummy_links[i] != SBU_NODE_KIND_UNKNOWN; i += 2) {
+		g_autoptr(SbuLinkImpl) link = sbu_link_impl_new (dummy_links[i],
+								 dummy_links[i+1]);
+		sbu_device_impl_add_link (dev->device, link);
 	}
-
-	/* add the device */
-	sbu_plugin_add_device (plugin, self->device);
-
-	/* never again... */
-	self->timeout_id = 0;
-	return FALSE;
+	return dev;
 }
 
 static gboolean
-dummy_device_active_cb (gpointer user_data)
+dummy_device_add_cb (gpointer user_data)
 {
 	SbuPlugin *plugin = SBU_PLUGIN (user_data);
 	SbuPluginData *self = sbu_plugin_get_data (plugin);
-	gboolean active;
-
-	active = sbu_device_impl_get_link_active (self->device,
-						  SBU_NODE_KIND_SOLAR,
-						  SBU_NODE_KIND_BATTERY);
-	sbu_device_impl_set_link_active (self->device,
-					 SBU_NODE_KIND_SOLAR,
-					 SBU_NODE_KIND_BATTERY,
-					 !active);
-	return TRUE;
+	gint64 ts_now = g_get_real_time () / G_USEC_PER_SEC;
+
+	for (guint i = 0; i < self->device_count; i++) {
+		DummyDevice *dev = dummy_device_new (plugin, i);
+		g_ptr_array_add (self->devices, dev);
+
+		/* add the device */
+		sbu_plugin_add_device (plugin, dev->device);
+
+		/* write history from the past, a day at a time */
+		if (self->backfill_days > 0) {
+			if (sbu_device_impl_get_database (dev->device) == NULL) {
+				g_warning ("no database to backfill");
+			} else {
+				dev->backfill_end = ts_now;
+				dev->backfill_ts = ts_now - (gint64) self->backfill_days * 86400;
+				dev->backfill_ts -= dev->backfill_ts % DUMMY_BACKFILL_STEP;
+				dev->backfill_id = g_idle_add (dummy_device_backfill_cb, dev);
+			}
+		}
+
+		/* sample faster than the daemon polls */
+		if (self->interval > 0) {
+			dev->sample_id = g_timeout_add (self->interval,
+							dummy_device_sample_cb,
+							dev);
+		}
+	}
+
+	/* never again... */
+	self->timeout_id = 0;
+	return FALSE;
 }
 
 gboolean
 sbu_plugin_refresh (SbuPlugin *plugin, GCancellable *cancellable, GError **error)
 {
 	SbuPluginData *self = sbu_plugin_get_data (plugin);
-	gdouble tmp;
-
-	/* make the panel more volt-y */
-	tmp = sbu_device_impl_get_node_value (self->device,
-					      SBU_NODE_KIND_BATTERY,
-					      SBU_DEVICE_PROPERTY_VOLTAGE);
-	sbu_device_impl_set_node_value (self->device,
-					SBU_NODE_KIND_BATTERY,
-					SBU_DEVICE_PROPERTY_VOLTAGE,
-					tmp + g_random_double_range (-.2f, .2f));
-
-	/* make the utlity more powerful */
-	tmp = sbu_device_impl_get_node_value (self->device,
-					      SBU_NODE_KIND_UTILITY,
-					      SBU_DEVICE_PROPERTY_POWER);
-	sbu_device_impl_set_node_value (self->device,
-					SBU_NODE_KIND_UTILITY,
-					SBU_DEVICE_PROPERTY_POWER,
-					tmp + g_random_double_range (-10.f, 10.f));
 
-	/* save raw value */
-	sbu_plugin_update_metadata (plugin, self->device, "TestKey", 123456);
+	/* each device has its own timer */
+	if (self->interval > 0)
+		return TRUE;
+	for (guint i = 0; i < self->devices->len; i++) {
+		DummyDevice *dev = g_ptr_array_index (self->devices, i);
+		dummy_device_refresh (dev);
+	}
 	return TRUE;
 }
 
@@ -148,8 +455,9 @@ gboolean
 sbu_plugin_setup (SbuPlugin *plugin, GCancellable *cancellable, GError **error)
 {
 	SbuPluginData *self = sbu_plugin_get_data (plugin);
+	g_debug ("creating %u devices sampled every %ums with %u days of history",
+		 self->device_count, self->interval, self->backfill_days);
 	self->timeout_id = g_timeout_add_seconds (2, dummy_device_add_cb, plugin);
-	self->active_id = g_timeout_add_seconds (5, dummy_device_active_cb, plugin);
 	return TRUE;
 }
 
@@ -157,9 +465,8 @@ void
 sbu_plugin_destroy (SbuPlugin *plugin)
 {
 	SbuPluginData *self = sbu_plugin_get_data (plugin);
-	g_object_unref (self->device);
+	if (self->devices != NULL)
+		g_ptr_array_unref (self->devices);
 	if (self->timeout_id != 0)
 		g_source_remove (self->timeout_id);
-	if (self->active_id != 0)
-		g_source_remove (self->active_id);
 }
@@ -0,0 +1,62 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include "msx-device.h"
+#include "msx-emulator.h"
+#include "msx-fuzz.h"
+
+/* the first byte of the input picks which response to replace */
+static const gchar *msx_fuzz_device_cmds[] = {
+	"QPI",
+	"QID",
+	"QVFW",
+	"QVFW2",
+	"QPIRI",
+	"QPIGS",
+	"QFLAG",
+	"QPIWS",
+};
+
+int
+LLVMFuzzerTestOneInput (const guint8 *data, gsize size)
+{
+	const gchar *cmd;
+	g_autoptr(GBytes) payload = NULL;
+	g_autoptr(MsxDevice) device = NULL;
+	g_autoptr(MsxEmulator) emulator = NULL;
+
+	if (size < 1)
+		return 0;
+	cmd = msx_fuzz_device_cmds[data[0] % G_N_ELEMENTS (msx_fuzz_device_cmds)];
+	payload = g_bytes_new (data + 1, size - 1);
+
+	/* everything else is answered normally */
+	emulator = msx_emulator_new ();
+	msx_emulator_set_response (emulator, cmd, payload);
+	device = msx_device_new_emulated (emulator);
+	if (!msx_device_open (device, NULL))
+		return 0;
+	msx_device_refresh (device, NULL);
+	msx_device_close (device, NULL);
+	return 0;
+}
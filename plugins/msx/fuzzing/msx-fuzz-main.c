@@ -0,0 +1,77 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "msx-fuzz.h"
+
+/* used when libFuzzer is not available, e.g. for AFL or replaying a corpus */
+
+static gboolean
+msx_fuzz_run_file (const gchar *filename, GError **error)
+{
+	gsize len = 0;
+	g_autofree gchar *data = NULL;
+
+	if (!g_file_get_contents (filename, &data, &len, error))
+		return FALSE;
+	LLVMFuzzerTestOneInput ((const guint8 *) data, len);
+	return TRUE;
+}
+
+static gboolean
+msx_fuzz_run_path (const gchar *path, GError **error)
+{
+	const gchar *name;
+	g_autoptr(GDir) dir = NULL;
+
+	if (!g_file_test (path, G_FILE_TEST_IS_DIR))
+		return msx_fuzz_run_file (path, error);
+	dir = g_dir_open (path, 0, error);
+	if (dir == NULL)
+		return FALSE;
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		g_autofree gchar *fn = g_build_filename (path, name, NULL);
+		if (!msx_fuzz_run_file (fn, error))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+	LLVMFuzzerInitialize (&argc, &argv);
+	if (argc < 2) {
+		g_printerr ("Usage: %s FILE|DIRECTORY...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	for (gint i = 1; i < argc; i++) {
+		g_autoptr(GError) error = NULL;
+		if (!msx_fuzz_run_path (argv[i], &error)) {
+			g_printerr ("%s\n", error->message);
+			return EXIT_FAILURE;
+		}
+	}
+	return EXIT_SUCCESS;
+}
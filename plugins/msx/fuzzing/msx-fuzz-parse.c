@@ -0,0 +1,62 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "msx-common.h"
+#include "msx-fuzz.h"
+
+static void
+msx_fuzz_parse_offsets (const gchar *buf, gsize len, const MsxCommonOffset *offsets)
+{
+	gboolean ret1;
+	gboolean ret2;
+	gint values1[MSX_DEVICE_KEY_LAST] = { 0 };
+	gint values2[MSX_DEVICE_KEY_LAST] = { 0 };
+
+	/* the fast parser has to agree with the reference one */
+	ret1 = msx_common_parse_offsets (buf, len, offsets, values1, NULL);
+	ret2 = msx_common_parse_fields (buf, len, offsets, values2, NULL);
+	if (ret1 != ret2)
+		g_error ("parsers disagree on '%.*s'", (gint) len, buf);
+	if (ret1 && memcmp (values1, values2, sizeof (values1)) != 0)
+		g_error ("parsers returned different values for '%.*s'", (gint) len, buf);
+}
+
+int
+LLVMFuzzerTestOneInput (const guint8 *data, gsize size)
+{
+	g_autofree gchar *buf = NULL;
+
+	if (size == 0)
+		return 0;
+
+	/* the parsers never see the data NUL terminated */
+	buf = g_malloc (size);
+	memcpy (buf, data, size);
+	for (gsize i = 0; i < size && i < 8; i++)
+		msx_common_parse_int (buf, i, size, NULL);
+	msx_fuzz_parse_offsets (buf, size, msx_common_get_qpigs_offsets ());
+	msx_fuzz_parse_offsets (buf, size, msx_common_get_qpiri_offsets ());
+	return 0;
+}
@@ -0,0 +1,43 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include "msx-device.h"
+#include "msx-emulator.h"
+#include "msx-fuzz.h"
+
+int
+LLVMFuzzerTestOneInput (const guint8 *data, gsize size)
+{
+	g_autoptr(GBytes) raw = NULL;
+	g_autoptr(GBytes) response = NULL;
+	g_autoptr(MsxDevice) device = NULL;
+	g_autoptr(MsxEmulator) emulator = NULL;
+
+	/* the input is sent as-is, in 8 byte chunks */
+	raw = g_bytes_new (data, size);
+	emulator = msx_emulator_new ();
+	msx_emulator_set_raw_response (emulator, raw);
+	device = msx_device_new_emulated (emulator);
+	response = msx_device_send_command (device, "QPIGS", NULL);
+	return 0;
+}
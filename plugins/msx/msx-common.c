@@ -38,7 +38,7 @@ msx_common_parse_int (const gchar *buf, gsize off, gssize buflen, GError **error
 	guint j = 0;
 
 	/* invalid */
-	if (buf == NULL || buf[0] == '\0') {
+	if (buf == NULL || buflen == 0 || buf[0] == '\0') {
 		g_set_error_literal (error,
 				     G_IO_ERROR,
 				     G_IO_ERROR_INVALID_DATA,
@@ -128,6 +128,313 @@ msx_common_parse_int (const gchar *buf, gsize off, gssize buflen, GError **error
 	return (val1 * 1000) + val2;
 }
 
+guint16
+msx_common_crc (const guint8 *pin, gsize len)
+{
+	const guint8 *ptr;
+	guint16 crc;
+	guint8 da;
+	guint8 crc_hi;
+	guint8 crc_lo;
+	guint16 crc_ta[16] = {
+		0x0000, 0x1021, 0x2042, 0x3063,
+		0x4084, 0x50a5, 0x60c6, 0x70e7,
+		0x8108, 0x9129, 0xa14a, 0xb16b,
+		0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+	};
+	ptr = pin;
+	crc = 0;
+
+	while (len-- != 0)  {
+		da = ((guint8)(crc>>8))>>4;
+		crc <<= 4;
+		crc ^= crc_ta[da^(*ptr>>4)];
+		da = ((guint8) (crc>>8))>>4;
+		crc <<= 4;
+		crc ^= crc_ta[da^(*ptr&0x0f)];
+		ptr++;
+	}
+	crc_lo = crc;
+	crc_hi = (guint8) (crc >> 8);
+
+	if (crc_lo == 0x28 || crc_lo == 0x0d || crc_lo == 0x0a)
+		crc_lo++;
+	if (crc_hi == 0x28 || crc_hi == 0x0d || crc_hi == 0x0a)
+		crc_hi++;
+	crc = ((guint16) crc_hi) << 8;
+	crc += crc_lo;
+	return crc;
+}
+
+static const MsxCommonOffset msx_common_qpiri_offsets[] = {
+	{ 0x00,		MSX_DEVICE_KEY_GRID_RATING_VOLTAGE },
+	{ 0x06,		MSX_DEVICE_KEY_GRID_RATING_CURRENT },
+	{ 0x0b,		MSX_DEVICE_KEY_AC_OUTPUT_RATING_VOLTAGE },
+	{ 0x11,		MSX_DEVICE_KEY_AC_OUTPUT_RATING_FREQUENCY },
+	{ 0x16,		MSX_DEVICE_KEY_AC_OUTPUT_RATING_CURRENT },
+	{ 0x1b,		MSX_DEVICE_KEY_AC_OUTPUT_RATING_APPARENT_POWER },
+	{ 0x20,		MSX_DEVICE_KEY_AC_OUTPUT_RATING_ACTIVE_POWER },
+	{ 0x25,		MSX_DEVICE_KEY_BATTERY_RATING_VOLTAGE },
+	{ 0x2a,		MSX_DEVICE_KEY_BATTERY_RECHARGE_VOLTAGE },
+	{ 0x2f,		MSX_DEVICE_KEY_BATTERY_UNDER_VOLTAGE },
+	{ 0x34,		MSX_DEVICE_KEY_BATTERY_BULK_VOLTAGE },
+	{ 0x39,		MSX_DEVICE_KEY_BATTERY_FLOAT_VOLTAGE },
+	{ 0x3e,		MSX_DEVICE_KEY_BATTERY_TYPE },
+	{ 0x40,		MSX_DEVICE_KEY_PRESENT_MAX_AC_CHARGING_CURRENT },
+	{ 0x43,		MSX_DEVICE_KEY_PRESENT_MAX_CHARGING_CURRENT },
+	{ 0x46,		MSX_DEVICE_KEY_INPUT_VOLTAGE_RANGE },
+	{ 0x48,		MSX_DEVICE_KEY_OUTPUT_SOURCE_PRIORITY },
+	{ 0x4a,		MSX_DEVICE_KEY_CHARGER_SOURCE_PRIORITY },
+	{ 0x4c,		MSX_DEVICE_KEY_PARALLEL_MAX_NUM },
+	{ 0x4e,		MSX_DEVICE_KEY_MACHINE_TYPE },
+	{ 0x51,		MSX_DEVICE_KEY_TOPOLOGY },
+	{ 0x53,		MSX_DEVICE_KEY_OUTPUT_MODE },
+	{ 0x55,		MSX_DEVICE_KEY_BATTERY_REDISCHARGE_VOLTAGE },
+	{ 0x5a,		MSX_DEVICE_KEY_PV_OK_CONDITION_FOR_PARALLEL },
+	{ 0x5c,		MSX_DEVICE_KEY_PV_POWER_BALANCE },
+	{ 0x5d,		MSX_DEVICE_KEY_UNKNOWN }
+};
+
+static const MsxCommonOffset msx_common_qpigs_offsets[] = {
+	{ 0x00,		MSX_DEVICE_KEY_GRID_VOLTAGE },
+	{ 0x06,		MSX_DEVICE_KEY_GRID_FREQUENCY },
+	{ 0x0b,		MSX_DEVICE_KEY_AC_OUTPUT_VOLTAGE },
+	{ 0x11,		MSX_DEVICE_KEY_AC_OUTPUT_FREQUENCY },
+	{ 0x16,		MSX_DEVICE_KEY_AC_OUTPUT_POWER },
+	{ 0x1b,		MSX_DEVICE_KEY_AC_OUTPUT_ACTIVE_POWER },
+	{ 0x20,		MSX_DEVICE_KEY_MAXIMUM_POWER_PERCENTAGE },
+	{ 0x24,		MSX_DEVICE_KEY_BUS_VOLTAGE },
+	{ 0x28,		MSX_DEVICE_KEY_BATTERY_VOLTAGE },
+	{ 0x2e,		MSX_DEVICE_KEY_BATTERY_CURRENT },
+	{ 0x32,		MSX_DEVICE_KEY_BATTERY_CAPACITY },
+	{ 0x36,		MSX_DEVICE_KEY_INVERTER_HEATSINK_TEMPERATURE },
+	{ 0x3b,		MSX_DEVICE_KEY_PV_INPUT_CURRENT_FOR_BATTERY },
+	{ 0x40,		MSX_DEVICE_KEY_PV_INPUT_VOLTAGE },
+	{ 0x46,		MSX_DEVICE_KEY_BATTERY_VOLTAGE_FROM_SCC },
+	{ 0x4c,		MSX_DEVICE_KEY_BATTERY_DISCHARGE_CURRENT },
+	{ 0x5b,		MSX_DEVICE_KEY_BATTERY_VOLTAGE_OFFSET_FOR_FANS },
+	{ 0x5e,		MSX_DEVICE_KEY_EEPROM_VERSION },
+	{ 0x61,		MSX_DEVICE_KEY_PV_CHARGING_POWER },
+	{ 0x6a,		MSX_DEVICE_KEY_UNKNOWN }
+};
+
+const MsxCommonOffset *
+msx_common_get_qpiri_offsets (void)
+{
+	return msx_common_qpiri_offsets;
+}
+
+const MsxCommonOffset *
+msx_common_get_qpigs_offsets (void)
+{
+	return msx_common_qpigs_offsets;
+}
+
+static gboolean
+msx_common_check_size (gsize buflen, const MsxCommonOffset *offsets, GError **error)
+{
+	guint i;
+	for (i = 0; offsets[i].key != MSX_DEVICE_KEY_UNKNOWN; i++);
+	if (buflen != offsets[i].off) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "got %" G_GSIZE_FORMAT " bytes, expected %" G_GSIZE_FORMAT,
+			     buflen, offsets[i].off);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * msx_common_parse_offsets:
+ * @buf: response data, without the leading '(' or the CRC
+ * @buflen: size of @buf
+ * @offsets: fixed field offsets, terminated by MSX_DEVICE_KEY_UNKNOWN at
+ *	     the expected response length
+ * @values: array of MSX_DEVICE_KEY_LAST values, indexed by key
+ * @error: a #GError, or %NULL
+ *
+ * Parses a fixed-field response such as QPIGS or QPIRI.
+ *
+ * Return value: %TRUE if every field was valid
+ **/
+gboolean
+msx_common_parse_offsets (const gchar *buf,
+			  gsize buflen,
+			  const MsxCommonOffset *offsets,
+			  gint *values,
+			  GError **error)
+{
+	guint i;
+
+	/* check the size */
+	if (!msx_common_check_size (buflen, offsets, error))
+		return FALSE;
+
+	/* parse each value */
+	for (i = 0; offsets[i].key != MSX_DEVICE_KEY_UNKNOWN; i++) {
+		gint val = msx_common_parse_int (buf, offsets[i].off, buflen, error);
+		if (val == G_MAXINT) {
+			g_prefix_error (error,
+					"failed to parse %s @%02x: ",
+					sbu_device_key_to_string (offsets[i].key),
+					(guint) offsets[i].off);
+			return FALSE;
+		}
+		values[offsets[i].key] = val;
+	}
+	return TRUE;
+}
+
+#define MSX_COMMON_SWAR_ONES	G_GUINT64_CONSTANT(0x0101010101010101)
+#define MSX_COMMON_SWAR_HIGH	G_GUINT64_CONSTANT(0x8080808080808080)
+
+/* high bit set in every byte of @w that is not an ASCII digit */
+static guint64
+msx_common_swar_nondigits (guint64 w)
+{
+	guint64 x = (w & ~MSX_COMMON_SWAR_HIGH) | MSX_COMMON_SWAR_HIGH;
+	guint64 ge_0 = (x - MSX_COMMON_SWAR_ONES * '0') & MSX_COMMON_SWAR_HIGH;
+	guint64 gt_9 = (x - MSX_COMMON_SWAR_ONES * ('9' + 1)) & MSX_COMMON_SWAR_HIGH;
+	return ~(ge_0 & ~gt_9 & ~w) & MSX_COMMON_SWAR_HIGH;
+}
+
+/* index of the first byte with the high bit set, or 8 */
+static guint
+msx_common_swar_first (guint64 mask)
+{
+	if (mask == 0)
+		return 8;
+#ifdef __GNUC__
+	return (guint) __builtin_ctzll (mask) / 8;
+#else
+	for (guint i = 0; i < 8; i++) {
+		if ((mask >> (i * 8)) & 0x80)
+			return i;
+	}
+	return 8;
+#endif
+}
+
+/* converts the first @n bytes of @w, which are all digits, in one go */
+static guint
+msx_common_swar_digits (guint64 w, guint n)
+{
+	if (n == 0)
+		return 0;
+
+	/* right align so the missing leading digits are zero */
+	w &= G_MAXUINT64 >> (64 - 8 * n);
+	w -= (MSX_COMMON_SWAR_ONES * '0') >> (64 - 8 * n);
+	w <<= 64 - 8 * n;
+
+	/* combine pairs, then quads, then the two halves */
+	w = (w * 10) + (w >> 8);
+	w = (((w & G_GUINT64_CONSTANT(0x000000ff000000ff)) *
+	      (100 + (G_GUINT64_CONSTANT(1000000) << 32))) +
+	     (((w >> 16) & G_GUINT64_CONSTANT(0x000000ff000000ff)) *
+	      (1 + (G_GUINT64_CONSTANT(10000) << 32)))) >> 32;
+	return (guint) w;
+}
+
+/* handles the common field shapes, returning FALSE for anything that needs
+ * the full rules of msx_common_parse_int() */
+static gboolean
+msx_common_parse_field_fast (const gchar *buf, gsize buflen, gsize off, gint *value)
+{
+	gsize avail = off < buflen ? buflen - off : 0;
+	guint64 nondigits;
+	guint64 w;
+	guint8 c;
+	guint8 tmp[8];
+	guint minor;
+	guint p;
+	guint q;
+
+	/* past the end of the buffer looks like a field separator */
+	memset (tmp, ' ', sizeof(tmp));
+	memcpy (tmp, buf + off, MIN (avail, sizeof(tmp)));
+	memcpy (&w, tmp, sizeof(w));
+	w = GUINT64_FROM_LE (w);
+
+	/* integer part, up to five digits */
+	nondigits = msx_common_swar_nondigits (w);
+	p = msx_common_swar_first (nondigits);
+	if (p == 8)
+		return FALSE;
+	c = (w >> (p * 8)) & 0xff;
+	if (c == ' ' || c == '-') {
+		if (p > 5)
+			return FALSE;
+		*value = (gint) msx_common_swar_digits (w, p) * 1000;
+		return TRUE;
+	}
+	if (c != '.' || p > 3)
+		return FALSE;
+
+	/* fractional part, where three digits are only allowed at the end */
+	nondigits &= ~(G_MAXUINT64 >> (56 - 8 * p));
+	q = msx_common_swar_first (nondigits);
+	if (q == 8 || ((w >> (q * 8)) & 0xff) != ' ')
+		return FALSE;
+	if (q - p - 1 > 3 || (q - p - 1 == 3 && q < avail))
+		return FALSE;
+	minor = msx_common_swar_digits (w >> ((p + 1) * 8), q - p - 1);
+	for (guint i = q - p - 1; i < 3; i++)
+		minor *= 10;
+	*value = (gint) (msx_common_swar_digits (w, p) * 1000 + minor);
+	return TRUE;
+}
+
+/**
+ * msx_common_parse_fields:
+ * @buf: response data, without the leading '(' or the CRC
+ * @buflen: size of @buf
+ * @offsets: fixed field offsets, terminated by MSX_DEVICE_KEY_UNKNOWN at
+ *	     the expected response length
+ * @values: array of MSX_DEVICE_KEY_LAST values, indexed by key
+ * @error: a #GError, or %NULL
+ *
+ * Parses a fixed-field response in one sweep, converting each field eight
+ * bytes at a time. The results are identical to msx_common_parse_offsets().
+ *
+ * Return value: %TRUE if every field was valid
+ **/
+gboolean
+msx_common_parse_fields (const gchar *buf,
+			 gsize buflen,
+			 const MsxCommonOffset *offsets,
+			 gint *values,
+			 GError **error)
+{
+	/* check the size once */
+	if (!msx_common_check_size (buflen, offsets, error))
+		return FALSE;
+
+	/* msx_common_parse_int() treats this specially */
+	if (buflen == 0 || buf[0] == '\0')
+		return msx_common_parse_offsets (buf, buflen, offsets, values, error);
+
+	for (guint i = 0; offsets[i].key != MSX_DEVICE_KEY_UNKNOWN; i++) {
+		gint val;
+		if (msx_common_parse_field_fast (buf, buflen, offsets[i].off, &val)) {
+			values[offsets[i].key] = val;
+			continue;
+		}
+		val = msx_common_parse_int (buf, offsets[i].off, buflen, error);
+		if (val == G_MAXINT) {
+			g_prefix_error (error,
+					"failed to parse %s @%02x: ",
+					sbu_device_key_to_string (offsets[i].key),
+					(guint) offsets[i].off);
+			return FALSE;
+		}
+		values[offsets[i].key] = val;
+	}
+	return TRUE;
+}
+
 const gchar *
 sbu_device_key_to_string (MsxDeviceKey key)
 {
@@ -101,11 +101,31 @@ typedef enum {
 	MSX_DEVICE_OUTPUT_SOURCE_PRIORITY_LAST
 } MsxDeviceOutputSourcePriority;
 
+typedef struct {
+	gsize		 off;
+	MsxDeviceKey	 key;
+} MsxCommonOffset;
+
 gint		 msx_common_parse_int			(const gchar	*buf,
 							 gsize		 off,
 							 gssize		 buflen,
 							 GError		**error);
 
+gboolean	 msx_common_parse_offsets		(const gchar	*buf,
+							 gsize		 buflen,
+							 const MsxCommonOffset *offsets,
+							 gint		*values,
+							 GError		**error);
+gboolean	 msx_common_parse_fields		(const gchar	*buf,
+							 gsize		 buflen,
+							 const MsxCommonOffset *offsets,
+							 gint		*values,
+							 GError		**error);
+const MsxCommonOffset *msx_common_get_qpiri_offsets	(void);
+const MsxCommonOffset *msx_common_get_qpigs_offsets	(void);
+guint16		 msx_common_crc				(const guint8	*pin,
+							 gsize		 len);
+
 const gchar	*sbu_device_key_to_string		(MsxDeviceKey	 key);
 
 G_END_DECLS
@@ -86,8 +86,20 @@ msx_context_coldplug (MsxContext *self, GError **error)
 {
 	g_autoptr(GPtrArray) devices = NULL;
 
-	if (self->usb_context != NULL)
+	if (self->usb_context != NULL || self->devices->len > 0)
+		return TRUE;
+
+	/* use a software inverter rather than real hardware */
+	if (g_getenv ("MSX_EMULATOR") != NULL) {
+		g_autoptr(MsxEmulator) emulator = msx_emulator_new ();
+		MsxDevice *device;
+		if (!msx_emulator_set_options (emulator, g_getenv ("MSX_EMULATOR"), error))
+			return FALSE;
+		device = msx_device_new_emulated (emulator);
+		g_ptr_array_add (self->devices, device);
+		g_signal_emit (self, signals[SIGNAL_ADDED], 0, device);
 		return TRUE;
+	}
 
 	self->usb_context = g_usb_context_new (error);
 	if (self->usb_context == NULL)
@@ -25,21 +25,52 @@
 
 #include "msx-common.h"
 #include "msx-device.h"
+#include "msx-emulator.h"
 
 #define MSX_DEVICE_TIMEOUT	5000
+#define MSX_DEVICE_RETRIES	3	/* after the first attempt */
+#define MSX_DEVICE_KEY_MASK_SIZE	((MSX_DEVICE_KEY_LAST + 31) / 32)
+
+typedef enum {
+	MSX_DEVICE_CMD_QPIRI,
+	MSX_DEVICE_CMD_QPIGS,
+	MSX_DEVICE_CMD_QFLAG,
+	MSX_DEVICE_CMD_QPIWS,
+	MSX_DEVICE_CMD_LAST
+} MsxDeviceCmd;
+
+typedef gboolean (*MsxDeviceRescanFunc)	(MsxDevice	*self,
+					 GError		**error);
+
+typedef struct {
+	const gchar		*cmd;
+	MsxDeviceRescanFunc	 func;
+	guint			 interval;	/* s, or 0 for every refresh */
+	gint64			 last_sent;	/* monotonic, us */
+	gint64			 duration;	/* us */
+	gboolean		 invalid;
+	guint			 cnt_sent;
+	guint			 cnt_skipped;
+} MsxDeviceSchedule;
 
 struct _MsxDevice
 {
 	GObject			 parent_instance;
 	GUsbDevice		*usb_device;
+	MsxEmulator		*emulator;
 	gchar			*serial_number;
 	gchar			*firmware_version1;
 	gchar			*firmware_version2;
-	GHashTable		*hash;	/* MsxDeviceKey : int */
+	gint			 values[MSX_DEVICE_KEY_LAST];
+	guint32			 valid[MSX_DEVICE_KEY_MASK_SIZE];
+	guint32			 changed[MSX_DEVICE_KEY_MASK_SIZE];
+	MsxDeviceSchedule	 schedule[MSX_DEVICE_CMD_LAST];
 };
 
 enum {
 	SIGNAL_CHANGED,
+	SIGNAL_COMMAND,
+	SIGNAL_SKIPPED,
 	SIGNAL_LAST
 };
 
@@ -47,44 +78,6 @@ static guint signals [SIGNAL_LAST] = { 0 };
 
 G_DEFINE_TYPE (MsxDevice, msx_device, G_TYPE_OBJECT)
 
-static guint16
-msx_crc_half (const guint8 *pin, guint8 len)
-{
-	const guint8 *ptr;
-	guint16 crc;
-	guint8 da;
-	guint8 crc_hi;
-	guint8 crc_lo;
-	guint16 crc_ta[16] = {
-		0x0000, 0x1021, 0x2042, 0x3063,
-		0x4084, 0x50a5, 0x60c6, 0x70e7,
-		0x8108, 0x9129, 0xa14a, 0xb16b,
-		0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
-	};
-	ptr = pin;
-	crc = 0;
-
-	while (len-- != 0)  {
-		da = ((guint8)(crc>>8))>>4;
-		crc <<= 4;
-		crc ^= crc_ta[da^(*ptr>>4)];
-		da = ((guint8) (crc>>8))>>4;
-		crc <<= 4;
-		crc ^= crc_ta[da^(*ptr&0x0f)];
-		ptr++;
-	}
-	crc_lo = crc;
-	crc_hi = (guint8) (crc >> 8);
-
-	if (crc_lo == 0x28 || crc_lo == 0x0d || crc_lo == 0x0a)
-		crc_lo++;
-	if (crc_hi == 0x28 || crc_hi == 0x0d || crc_hi == 0x0a)
-		crc_hi++;
-	crc = ((guint16) crc_hi) << 8;
-	crc += crc_lo;
-	return crc;
-}
-
 static void
 msx_dump_raw (const gchar *title, const guint8 *data, gsize len)
 {
@@ -112,9 +105,46 @@ msx_device_packet_count_data (const guint8 *buf, gsize len)
 	return 8;
 }
 
-GBytes *
-msx_device_send_command (MsxDevice *self, const gchar *cmd, GError **error)
+/* the device is a HID report pipe, unless emulated */
+static gboolean
+msx_device_write_chunk (MsxDevice *self, guint8 *buf, gsize len,
+			gsize *actual_len, GError **error)
+{
+	if (self->emulator != NULL) {
+		*actual_len = len;
+		return msx_emulator_write (self->emulator, buf, len, error);
+	}
+	return g_usb_device_control_transfer (self->usb_device,
+					      G_USB_DEVICE_DIRECTION_HOST_TO_DEVICE,
+					      G_USB_DEVICE_REQUEST_TYPE_CLASS,
+					      G_USB_DEVICE_RECIPIENT_INTERFACE,
+					      0x9, 0x200, 0,
+					      buf, len, actual_len,
+					      MSX_DEVICE_TIMEOUT,
+					      NULL,
+					      error);
+}
+
+static gboolean
+msx_device_read_chunk (MsxDevice *self, guint8 *buf, gsize len,
+		       gsize *actual_len, GError **error)
+{
+	if (self->emulator != NULL)
+		return msx_emulator_read (self->emulator, buf, len, actual_len, error);
+	return g_usb_device_interrupt_transfer (self->usb_device,
+						0x81,
+						buf,
+						len,
+						actual_len,
+						MSX_DEVICE_TIMEOUT,
+						NULL,
+						error);
+}
+
+static GBytes *
+msx_device_send_command_once (MsxDevice *self, const gchar *cmd, GError **error)
 {
+	gboolean complete = FALSE;
 	gsize actual_len = 0;
 	gsize idx = 0;
 	gsize len;
@@ -128,21 +158,13 @@ msx_device_send_command (MsxDevice *self, const gchar *cmd, GError **error)
 	memcpy (buf, cmd, len);
 
 	/* copy in the footer: CRC then newline */
-	crc = GUINT16_TO_BE (msx_crc_half (buf, len));
+	crc = GUINT16_TO_BE (msx_common_crc (buf, len));
 	memcpy (buf + len, &crc, 2);
 	buf[len + 2] = '\r';
 
 	/* send */
 	msx_dump_raw ("host->self", buf, 8);
-	if (!g_usb_device_control_transfer (self->usb_device,
-					    G_USB_DEVICE_DIRECTION_HOST_TO_DEVICE,
-					    G_USB_DEVICE_REQUEST_TYPE_CLASS,
-					    G_USB_DEVICE_RECIPIENT_INTERFACE,
-					    0x9, 0x200, 0,
-					    buf, 8, &actual_len,
-					    MSX_DEVICE_TIMEOUT,
-					    NULL,
-					    error)) {
+	if (!msx_device_write_chunk (self, buf, sizeof (buf), &actual_len, error)) {
 		g_prefix_error (error, "failed to send data: ");
 		return FALSE;
 	}
@@ -160,14 +182,7 @@ msx_device_send_command (MsxDevice *self, const gchar *cmd, GError **error)
 		gsize data_valid;
 
 		memset (buf, 0x00, sizeof (buf));
-		if (!g_usb_device_interrupt_transfer (self->usb_device,
-						      0x81,
-						      buf,
-						      sizeof (buf),
-						      &actual_len,
-						      MSX_DEVICE_TIMEOUT,
-						      NULL,
-						      error)) {
+		if (!msx_device_read_chunk (self, buf, sizeof (buf), &actual_len, error)) {
 			g_prefix_error (error, "failed to get data: ");
 			return FALSE;
 		}
@@ -186,16 +201,38 @@ msx_device_send_command (MsxDevice *self, const gchar *cmd, GError **error)
 		data_valid = msx_device_packet_count_data (buf, actual_len);
 		memcpy (buf2 + idx, buf, data_valid);
 		idx += data_valid;
-		if (data_valid <= 7)
+		if (data_valid <= 7) {
+			complete = TRUE;
 			break;
+		}
+	}
+
+	/* the device never sent the '\r' */
+	if (!complete) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_PARTIAL_INPUT,
+			     "no response terminator after %" G_GSIZE_FORMAT " bytes",
+			     idx);
+		return NULL;
+	}
+
+	/* need at least the '(' and the CRC */
+	if (idx < 3) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_PARTIAL_INPUT,
+			     "response too short, got %" G_GSIZE_FORMAT " bytes",
+			     idx);
+		return NULL;
 	}
 
 	/* check checksum of recieved message */
-	crc = GUINT16_TO_BE (msx_crc_half (buf2, idx - 2));
+	crc = GUINT16_TO_BE (msx_common_crc (buf2, idx - 2));
 	if (memcmp (&crc, buf2 + idx - 2, 2) != 0) {
 		g_set_error (error,
 			     G_IO_ERROR,
-			     G_IO_ERROR_FAILED,
+			     G_IO_ERROR_INVALID_DATA,
 			     "failed checksum, expected %04x",
 			     crc);
 		return FALSE;
@@ -213,6 +250,40 @@ msx_device_send_command (MsxDevice *self, const gchar *cmd, GError **error)
 	return g_bytes_new (buf2 + 1, idx - 3);
 }
 
+GBytes *
+msx_device_send_command (MsxDevice *self, const gchar *cmd, GError **error)
+{
+	GBytes *response = NULL;
+	gint64 ts = g_get_monotonic_time ();
+	guint cnt_crc = 0;
+	guint cnt_retries = 0;
+	g_autoptr(GError) error_local = NULL;
+
+	/* a corrupted response is usually a one-off, so just ask again; a
+	 * badly framed one is G_IO_ERROR_PARTIAL_INPUT and is not retried */
+	while (TRUE) {
+		response = msx_device_send_command_once (self, cmd, &error_local);
+		if (response != NULL)
+			break;
+		if (!g_error_matches (error_local, G_IO_ERROR, G_IO_ERROR_INVALID_DATA))
+			break;
+		cnt_crc++;
+		if (cnt_retries >= MSX_DEVICE_RETRIES)
+			break;
+		g_debug ("retrying %s: %s", cmd, error_local->message);
+		g_clear_error (&error_local);
+		cnt_retries++;
+	}
+	g_signal_emit (self, signals[SIGNAL_COMMAND], 0,
+		       cmd, g_get_monotonic_time () - ts,
+		       cnt_retries, cnt_crc, response != NULL);
+	if (response == NULL) {
+		g_propagate_error (error, g_steal_pointer (&error_local));
+		return NULL;
+	}
+	return response;
+}
+
 static gboolean
 msx_device_rescan_protocol (MsxDevice *self, GError **error)
 {
@@ -238,8 +309,8 @@ msx_device_rescan_protocol (MsxDevice *self, GError **error)
 		g_set_error (error,
 			     G_IO_ERROR,
 			     G_IO_ERROR_FAILED,
-			     "QPI data invalid, got '%s'",
-			     (const gchar *) data);
+			     "QPI data invalid, got '%.*s'",
+			     (gint) len, (const gchar *) data);
 		return FALSE;
 	}
 	return TRUE;
@@ -266,91 +337,109 @@ msx_device_rescan_serial_number (MsxDevice *self, GError **error)
 			     len);
 		return FALSE;
 	}
-	self->serial_number = g_strdup (data);
+	self->serial_number = g_strndup (data, len);
 	return TRUE;
 }
 
-typedef struct {
-	gsize		 off;
-	MsxDeviceKey	 key;
-} MsxDeviceBufferOffsets;
+static gboolean
+msx_device_mask_test (const guint32 *mask, MsxDeviceKey key)
+{
+	return (mask[key / 32] & (1u << (key % 32))) > 0;
+}
+
+static void
+msx_device_mask_set (guint32 *mask, MsxDeviceKey key)
+{
+	mask[key / 32] |= 1u << (key % 32);
+}
 
 static void
-msx_device_emit_changed (MsxDevice *self, MsxDeviceKey key, gint val)
+msx_device_set_value (MsxDevice *self, MsxDeviceKey key, gint val)
 {
-	gpointer hash_key = GUINT_TO_POINTER (key);
-	gint *val_ptr = g_hash_table_lookup (self->hash, hash_key);
-	if (val_ptr == NULL) {
-		val_ptr = g_new0 (gint, 1);
-		g_hash_table_insert (self->hash, hash_key, val_ptr);
+	if (!msx_device_mask_test (self->valid, key)) {
 		g_debug ("cache add new %s=%i",
 			 sbu_device_key_to_string (key), val);
-	}
+		msx_device_mask_set (self->valid, key);
+	} else if (self->values[key] == val) {
+		return;
+	} else if (key == MSX_DEVICE_KEY_CONFIGURATION_STATUS_CHANGE) {
+		/* the ratings and flags are no longer trustworthy */
+		g_debug ("configuration changed, invalidating static data");
+		self->schedule[MSX_DEVICE_CMD_QPIRI].invalid = TRUE;
+		self->schedule[MSX_DEVICE_CMD_QFLAG].invalid = TRUE;
+	}
+	self->values[key] = val;
+	msx_device_mask_set (self->changed, key);
+}
 
-	/* emit and THEN save new value so we can get the old value */
-	g_signal_emit (self, signals[SIGNAL_CHANGED], 0, key, val);
-	*val_ptr = val;
+static void
+msx_device_emit_changed (MsxDevice *self)
+{
+	g_autoptr(GArray) keys = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	/* only the keys that were modified since the last response */
+	for (guint i = 0; i < MSX_DEVICE_KEY_MASK_SIZE; i++) {
+		guint32 mask = self->changed[i];
+		self->changed[i] = 0;
+		for (guint j = 0; mask != 0; j++, mask >>= 1) {
+			guint key = i * 32 + j;
+			if ((mask & 1) > 0)
+				g_array_append_val (keys, key);
+		}
+	}
+	if (keys->len == 0)
+		return;
+	g_signal_emit (self, signals[SIGNAL_CHANGED], 0, keys);
 }
 
 gint
 msx_device_get_value (MsxDevice *self, MsxDeviceKey key)
 {
-	gpointer hash_key = GUINT_TO_POINTER (key);
-	gint *val_ptr = g_hash_table_lookup (self->hash, hash_key);
-	if (val_ptr == NULL)
+	if (key >= MSX_DEVICE_KEY_LAST)
 		return 0;
-	return *val_ptr;
+	return self->values[key];
 }
 
 static gboolean
 msx_device_buffer_parse (MsxDevice *self, GBytes *response,
-			 MsxDeviceBufferOffsets *offsets,
+			 const MsxCommonOffset *offsets,
 			 GError **error)
 {
 	const gchar *data;
+	gint values[MSX_DEVICE_KEY_LAST];
 	gsize len = 0;
-	guint i;
 
-	/* check the size */
-	for (i = 0; offsets[i].key != MSX_DEVICE_KEY_UNKNOWN; i++);
+	/* parse each value, then only set them if they were all valid */
 	data = g_bytes_get_data (response, &len);
-	if (len != offsets[i].off) {
-		g_set_error (error,
-			     G_IO_ERROR,
-			     G_IO_ERROR_FAILED,
-			     "got %" G_GSIZE_FORMAT " bytes, expected %" G_GSIZE_FORMAT,
-			     len, offsets[i].off);
+	if (!msx_common_parse_fields (data, len, offsets, values, error))
 		return FALSE;
-	}
-
-	/* parse each value */
-	for (i = 0; offsets[i].key != MSX_DEVICE_KEY_UNKNOWN; i++) {
-		gint val = msx_common_parse_int (data, offsets[i].off, len, error);
-		if (val == G_MAXINT) {
-			g_prefix_error (error,
-					"failed to parse %s @%02x: ",
-					sbu_device_key_to_string (offsets[i].key),
-					(guint) offsets[i].off);
-			return FALSE;
-		}
-		msx_device_emit_changed (self, offsets[i].key, val);
-	}
+	for (guint i = 0; offsets[i].key != MSX_DEVICE_KEY_UNKNOWN; i++)
+		msx_device_set_value (self, offsets[i].key, values[offsets[i].key]);
 	return TRUE;
 }
 
 static gboolean
 msx_device_buffer_parse_bits (MsxDevice *self, GBytes *response,
-			      MsxDeviceBufferOffsets *offsets,
+			      const MsxCommonOffset *offsets,
 			      GError **error)
 {
-	/* parse each value */
-	const gchar *data = g_bytes_get_data (response, NULL);
-	for (guint i = 0; offsets[i].key != MSX_DEVICE_KEY_UNKNOWN; i++) {
-		if (data[offsets[i].off] == '0') {
-			msx_device_emit_changed (self, offsets[i].key, 0);
-		} else if (data[offsets[i].off] == '1') {
-			msx_device_emit_changed (self, offsets[i].key, 1);
-		} else {
+	const gchar *data;
+	gsize len = 0;
+	guint i;
+
+	/* check each value, then only set them if they were all valid */
+	data = g_bytes_get_data (response, &len);
+	for (i = 0; offsets[i].key != MSX_DEVICE_KEY_UNKNOWN; i++) {
+		if (offsets[i].off >= len) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_FAILED,
+				     "failed to parse %s @%02x: only %" G_GSIZE_FORMAT " bytes",
+				     sbu_device_key_to_string (offsets[i].key),
+				     (guint) offsets[i].off, len);
+			return FALSE;
+		}
+		if (data[offsets[i].off] != '0' && data[offsets[i].off] != '1') {
 			g_set_error (error,
 				     G_IO_ERROR,
 				     G_IO_ERROR_FAILED,
@@ -361,6 +450,10 @@ msx_device_buffer_parse_bits (MsxDevice *self, GBytes *response,
 			return FALSE;
 		}
 	}
+	for (i = 0; offsets[i].key != MSX_DEVICE_KEY_UNKNOWN; i++) {
+		msx_device_set_value (self, offsets[i].key,
+				      data[offsets[i].off] == '1' ? 1 : 0);
+	}
 	return TRUE;
 }
 
@@ -368,34 +461,6 @@ static gboolean
 msx_device_rescan_device_rating (MsxDevice *self, GError **error)
 {
 	g_autoptr(GBytes) response = NULL;
-	MsxDeviceBufferOffsets buffer_offsets[] = {
-		{ 0x00,		MSX_DEVICE_KEY_GRID_RATING_VOLTAGE },
-		{ 0x06,		MSX_DEVICE_KEY_GRID_RATING_CURRENT },
-		{ 0x0b,		MSX_DEVICE_KEY_AC_OUTPUT_RATING_VOLTAGE },
-		{ 0x11,		MSX_DEVICE_KEY_AC_OUTPUT_RATING_FREQUENCY },
-		{ 0x16,		MSX_DEVICE_KEY_AC_OUTPUT_RATING_CURRENT },
-		{ 0x1b,		MSX_DEVICE_KEY_AC_OUTPUT_RATING_APPARENT_POWER },
-		{ 0x20,		MSX_DEVICE_KEY_AC_OUTPUT_RATING_ACTIVE_POWER },
-		{ 0x25,		MSX_DEVICE_KEY_BATTERY_RATING_VOLTAGE },
-		{ 0x2a,		MSX_DEVICE_KEY_BATTERY_RECHARGE_VOLTAGE },
-		{ 0x2f,		MSX_DEVICE_KEY_BATTERY_UNDER_VOLTAGE },
-		{ 0x34,		MSX_DEVICE_KEY_BATTERY_BULK_VOLTAGE },
-		{ 0x39,		MSX_DEVICE_KEY_BATTERY_FLOAT_VOLTAGE },
-		{ 0x3e,		MSX_DEVICE_KEY_BATTERY_TYPE },
-		{ 0x40,		MSX_DEVICE_KEY_PRESENT_MAX_AC_CHARGING_CURRENT },
-		{ 0x43,		MSX_DEVICE_KEY_PRESENT_MAX_CHARGING_CURRENT },
-		{ 0x46,		MSX_DEVICE_KEY_INPUT_VOLTAGE_RANGE },
-		{ 0x48,		MSX_DEVICE_KEY_OUTPUT_SOURCE_PRIORITY },
-		{ 0x4a,		MSX_DEVICE_KEY_CHARGER_SOURCE_PRIORITY },
-		{ 0x4c,		MSX_DEVICE_KEY_PARALLEL_MAX_NUM },
-		{ 0x4e,		MSX_DEVICE_KEY_MACHINE_TYPE },
-		{ 0x51,		MSX_DEVICE_KEY_TOPOLOGY },
-		{ 0x53,		MSX_DEVICE_KEY_OUTPUT_MODE },
-		{ 0x55,		MSX_DEVICE_KEY_BATTERY_REDISCHARGE_VOLTAGE },
-		{ 0x5a,		MSX_DEVICE_KEY_PV_OK_CONDITION_FOR_PARALLEL },
-		{ 0x5c,		MSX_DEVICE_KEY_PV_POWER_BALANCE },
-		{ 0x5d,		MSX_DEVICE_KEY_UNKNOWN }
-	};
 
 	/* parse the data buffer */
 	response = msx_device_send_command (self, "QPIRI", error);
@@ -403,7 +468,9 @@ msx_device_rescan_device_rating (MsxDevice *self, GError **error)
 		g_prefix_error (error, "failed to get device rating: ");
 		return FALSE;
 	}
-	if (!msx_device_buffer_parse (self, response, buffer_offsets, error)) {
+	if (!msx_device_buffer_parse (self, response,
+				      msx_common_get_qpiri_offsets (),
+				      error)) {
 		g_prefix_error (error, "QPIRI data invalid: ");
 		return FALSE;
 	}
@@ -446,31 +513,31 @@ msx_device_rescan_device_flags (MsxDevice *self, GError **error)
 			val = 1;
 			break;
 		case 'a':
-			msx_device_emit_changed (self, MSX_DEVICE_KEY_ENABLE_BUZZER, val);
+			msx_device_set_value (self, MSX_DEVICE_KEY_ENABLE_BUZZER, val);
 			break;
 		case 'b':
-			msx_device_emit_changed (self, MSX_DEVICE_KEY_OVERLOAD_BYPASS_FUNCTION, val);
+			msx_device_set_value (self, MSX_DEVICE_KEY_OVERLOAD_BYPASS_FUNCTION, val);
 			break;
 		case 'j':
-			msx_device_emit_changed (self, MSX_DEVICE_KEY_POWER_SAVE, val);
+			msx_device_set_value (self, MSX_DEVICE_KEY_POWER_SAVE, val);
 			break;
 		case 'k':
-			msx_device_emit_changed (self, MSX_DEVICE_KEY_LCD_DISPLAY_ESCAPE, val);
+			msx_device_set_value (self, MSX_DEVICE_KEY_LCD_DISPLAY_ESCAPE, val);
 			break;
 		case 'u':
-			msx_device_emit_changed (self, MSX_DEVICE_KEY_OVERLOAD_RESTART, val);
+			msx_device_set_value (self, MSX_DEVICE_KEY_OVERLOAD_RESTART, val);
 			break;
 		case 'v':
-			msx_device_emit_changed (self, MSX_DEVICE_KEY_OVER_TEMPERATURE_RESTART, val);
+			msx_device_set_value (self, MSX_DEVICE_KEY_OVER_TEMPERATURE_RESTART, val);
 			break;
 		case 'x':
-			msx_device_emit_changed (self, MSX_DEVICE_KEY_LCD_BACKLIGHT, val);
+			msx_device_set_value (self, MSX_DEVICE_KEY_LCD_BACKLIGHT, val);
 			break;
 		case 'y':
-			msx_device_emit_changed (self, MSX_DEVICE_KEY_ALARM_PRIMARY_SOURCE_INTERRUPT, val);
+			msx_device_set_value (self, MSX_DEVICE_KEY_ALARM_PRIMARY_SOURCE_INTERRUPT, val);
 			break;
 		case 'z':
-			msx_device_emit_changed (self, MSX_DEVICE_KEY_FAULT_CODE_RECORD, val);
+			msx_device_set_value (self, MSX_DEVICE_KEY_FAULT_CODE_RECORD, val);
 			break;
 		default:
 			g_warning ("failed to parse flag '%c'", data[i]);
@@ -564,29 +631,7 @@ static gboolean
 msx_device_rescan_device_general_status (MsxDevice *self, GError **error)
 {
 	g_autoptr(GBytes) response = NULL;
-	MsxDeviceBufferOffsets buffer_offsets[] = {
-		{ 0x00,		MSX_DEVICE_KEY_GRID_VOLTAGE },
-		{ 0x06,		MSX_DEVICE_KEY_GRID_FREQUENCY },
-		{ 0x0b,		MSX_DEVICE_KEY_AC_OUTPUT_VOLTAGE },
-		{ 0x11,		MSX_DEVICE_KEY_AC_OUTPUT_FREQUENCY },
-		{ 0x16,		MSX_DEVICE_KEY_AC_OUTPUT_POWER },
-		{ 0x1b,		MSX_DEVICE_KEY_AC_OUTPUT_ACTIVE_POWER },
-		{ 0x20,		MSX_DEVICE_KEY_MAXIMUM_POWER_PERCENTAGE },
-		{ 0x24,		MSX_DEVICE_KEY_BUS_VOLTAGE },
-		{ 0x28,		MSX_DEVICE_KEY_BATTERY_VOLTAGE },
-		{ 0x2e,		MSX_DEVICE_KEY_BATTERY_CURRENT },
-		{ 0x32,		MSX_DEVICE_KEY_BATTERY_CAPACITY },
-		{ 0x36,		MSX_DEVICE_KEY_INVERTER_HEATSINK_TEMPERATURE },
-		{ 0x3b,		MSX_DEVICE_KEY_PV_INPUT_CURRENT_FOR_BATTERY },
-		{ 0x40,		MSX_DEVICE_KEY_PV_INPUT_VOLTAGE },
-		{ 0x46,		MSX_DEVICE_KEY_BATTERY_VOLTAGE_FROM_SCC },
-		{ 0x4c,		MSX_DEVICE_KEY_BATTERY_DISCHARGE_CURRENT },
-		{ 0x5b,		MSX_DEVICE_KEY_BATTERY_VOLTAGE_OFFSET_FOR_FANS },
-		{ 0x5e,		MSX_DEVICE_KEY_EEPROM_VERSION },
-		{ 0x61,		MSX_DEVICE_KEY_PV_CHARGING_POWER },
-		{ 0x6a,		MSX_DEVICE_KEY_UNKNOWN }
-	};
-	MsxDeviceBufferOffsets buffer_bits[] = {
+	const MsxCommonOffset buffer_bits[] = {
 		{ 0x52,		MSX_DEVICE_KEY_ADD_SBU_PRIORITY_VERSION },
 		{ 0x53,		MSX_DEVICE_KEY_CONFIGURATION_STATUS_CHANGE },
 		{ 0x54,		MSX_DEVICE_KEY_SCC_FIRMWARE_VERSION_UPDATED },
@@ -597,7 +642,7 @@ msx_device_rescan_device_general_status (MsxDevice *self, GError **error)
 		{ 0x59,		MSX_DEVICE_KEY_CHARGING_ON_AC },
 		{ 0x6a,		MSX_DEVICE_KEY_UNKNOWN }
 	};
-	MsxDeviceBufferOffsets device_bits[] = {
+	MsxCommonOffset device_bits[] = {
 		{ 0x67,		MSX_DEVICE_KEY_CHARGING_TO_FLOATING_MODE },
 		{ 0x68,		MSX_DEVICE_KEY_SWITCH_ON },
 		{ 0x6a,		MSX_DEVICE_KEY_UNKNOWN }
@@ -609,7 +654,9 @@ msx_device_rescan_device_general_status (MsxDevice *self, GError **error)
 		g_prefix_error (error, "failed to get device rating: ");
 		return FALSE;
 	}
-	if (!msx_device_buffer_parse (self, response, buffer_offsets, error)) {
+	if (!msx_device_buffer_parse (self, response,
+				      msx_common_get_qpigs_offsets (),
+				      error)) {
 		g_prefix_error (error, "QPIGS data invalid: ");
 		return FALSE;
 	}
@@ -643,7 +690,7 @@ msx_device_rescan_firmware_versions (MsxDevice *self, GError **error)
 			     len);
 		return FALSE;
 	}
-	self->firmware_version1 = g_strdup ((const gchar *) data + 6);
+	self->firmware_version1 = g_strndup ((const gchar *) data + 6, len - 6);
 
 	/* secondary CPU firmware version inquiry */
 	response2 = msx_device_send_command (self, "QVFW2", error);
@@ -660,27 +707,88 @@ msx_device_rescan_firmware_versions (MsxDevice *self, GError **error)
 			     len);
 		return FALSE;
 	}
-	self->firmware_version2 = g_strdup ((const gchar *) data + 7);
+	self->firmware_version2 = g_strndup ((const gchar *) data + 7, len - 7);
+
+	return TRUE;
+}
+
+static gboolean
+msx_device_schedule_is_due (MsxDeviceSchedule *item, gint64 now)
+{
+	if (item->invalid || item->last_sent == 0 || item->interval == 0)
+		return TRUE;
+	return now - item->last_sent >= (gint64) item->interval * G_USEC_PER_SEC;
+}
 
+static gboolean
+msx_device_schedule_run (MsxDevice *self, MsxDeviceSchedule *item,
+			 gint64 now, GError **error)
+{
+	gboolean ret;
+	gint64 ts = g_get_monotonic_time ();
+
+	/* leave the old timestamp on failure so we retry next time */
+	ret = item->func (self, error);
+	msx_device_emit_changed (self);
+	if (!ret)
+		return FALSE;
+	item->duration = g_get_monotonic_time () - ts;
+	item->last_sent = now;
+	item->invalid = FALSE;
+	item->cnt_sent++;
 	return TRUE;
 }
 
 gboolean
 msx_device_refresh (MsxDevice *self, GError **error)
 {
-	if (!msx_device_rescan_device_rating (self, error))
-		return FALSE;
-	if (!msx_device_rescan_device_general_status (self, error))
-		return FALSE;
-	if (!msx_device_rescan_device_flags (self, error))
-		return FALSE;
-	if (!msx_device_rescan_device_warning_status (self, error))
-		return FALSE;
+	gint64 now = g_get_monotonic_time ();
+
+	for (guint i = 0; i < MSX_DEVICE_CMD_LAST; i++) {
+		MsxDeviceSchedule *item = &self->schedule[i];
+		if (!msx_device_schedule_is_due (item, now))
+			continue;
+		if (!msx_device_schedule_run (self, item, now, error))
+			return FALSE;
+	}
+
+	/* the general status may have invalidated commands already skipped */
+	for (guint i = 0; i < MSX_DEVICE_CMD_LAST; i++) {
+		MsxDeviceSchedule *item = &self->schedule[i];
+		if (!item->invalid)
+			continue;
+		if (!msx_device_schedule_run (self, item, now, error))
+			return FALSE;
+	}
+
+	/* the last response was still good enough */
+	for (guint i = 0; i < MSX_DEVICE_CMD_LAST; i++) {
+		MsxDeviceSchedule *item = &self->schedule[i];
+		if (item->last_sent == now)
+			continue;
+		item->cnt_skipped++;
+		g_debug ("skipped %s %u times", item->cmd, item->cnt_skipped);
+		g_signal_emit (self, signals[SIGNAL_SKIPPED], 0,
+			       item->cmd, item->duration);
+	}
 	return TRUE;
 }
 
-gboolean
-msx_device_open (MsxDevice *self, GError **error)
+void
+msx_device_set_command_interval (MsxDevice *self, const gchar *cmd, guint interval)
+{
+	for (guint i = 0; i < MSX_DEVICE_CMD_LAST; i++) {
+		MsxDeviceSchedule *item = &self->schedule[i];
+		if (g_strcmp0 (item->cmd, cmd) == 0) {
+			item->interval = interval;
+			return;
+		}
+	}
+	g_warning ("no scheduled command %s", cmd);
+}
+
+static gboolean
+msx_device_open_usb (MsxDevice *self, GError **error)
 {
 	g_debug ("opening device");
 	if (!g_usb_device_open (self->usb_device, error)) {
@@ -695,6 +803,15 @@ msx_device_open (MsxDevice *self, GError **error)
 		g_prefix_error (error, "failed to claim interface: ");
 		return FALSE;
 	}
+	return TRUE;
+}
+
+gboolean
+msx_device_open (MsxDevice *self, GError **error)
+{
+	/* an emulated device has nothing to claim */
+	if (self->usb_device != NULL && !msx_device_open_usb (self, error))
+		return FALSE;
 
 	/* rescan static things */
 	if (!msx_device_rescan_protocol (self, error))
@@ -714,6 +831,10 @@ msx_device_open (MsxDevice *self, GError **error)
 gboolean
 msx_device_close (MsxDevice *self, GError **error)
 {
+	/* nothing was claimed */
+	if (self->usb_device == NULL)
+		return TRUE;
+
 	g_debug ("releasing interface");
 	if (!g_usb_device_release_interface (self->usb_device, 0x00,
 					     G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
@@ -756,16 +877,37 @@ msx_device_finalize (GObject *object)
 	g_free (self->serial_number);
 	g_free (self->firmware_version1);
 	g_free (self->firmware_version2);
-	g_object_unref (self->usb_device);
-	g_hash_table_unref (self->hash);
+	if (self->usb_device != NULL)
+		g_object_unref (self->usb_device);
+	if (self->emulator != NULL)
+		g_object_unref (self->emulator);
 
 	G_OBJECT_CLASS (msx_device_parent_class)->finalize (object);
 }
 
+static void
+msx_device_schedule_init (MsxDeviceSchedule *item,
+			  const gchar *cmd,
+			  MsxDeviceRescanFunc func,
+			  guint interval)
+{
+	item->cmd = cmd;
+	item->func = func;
+	item->interval = interval;
+}
+
 static void
 msx_device_init (MsxDevice *self)
 {
-	self->hash = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+	/* the ratings and flags only change when reconfigured */
+	msx_device_schedule_init (&self->schedule[MSX_DEVICE_CMD_QPIRI], "QPIRI",
+				  msx_device_rescan_device_rating, 3600);
+	msx_device_schedule_init (&self->schedule[MSX_DEVICE_CMD_QPIGS], "QPIGS",
+				  msx_device_rescan_device_general_status, 0);
+	msx_device_schedule_init (&self->schedule[MSX_DEVICE_CMD_QFLAG], "QFLAG",
+				  msx_device_rescan_device_flags, 3600);
+	msx_device_schedule_init (&self->schedule[MSX_DEVICE_CMD_QPIWS], "QPIWS",
+				  msx_device_rescan_device_warning_status, 0);
 }
 
 static void
@@ -778,7 +920,18 @@ msx_device_class_init (MsxDeviceClass *klass)
 		g_signal_new ("changed",
 			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
 			      0, NULL, NULL, g_cclosure_marshal_generic,
-			      G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_INT);
+			      G_TYPE_NONE, 1, G_TYPE_ARRAY);
+	signals [SIGNAL_COMMAND] =
+		g_signal_new ("command",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, g_cclosure_marshal_generic,
+			      G_TYPE_NONE, 5, G_TYPE_STRING, G_TYPE_INT64,
+			      G_TYPE_UINT, G_TYPE_UINT, G_TYPE_BOOLEAN);
+	signals [SIGNAL_SKIPPED] =
+		g_signal_new ("skipped",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, g_cclosure_marshal_generic,
+			      G_TYPE_NONE, 2, G_TYPE_STRING, G_TYPE_INT64);
 }
 
 /**
@@ -794,3 +947,20 @@ msx_device_new (GUsbDevice *usb_device)
 	self->usb_device = g_object_ref (usb_device);
 	return MSX_DEVICE (self);
 }
+
+/**
+ * msx_device_new_emulated:
+ * @emulator: a #MsxEmulator
+ *
+ * Creates a device that talks to a software inverter rather than USB.
+ *
+ * Return value: a new MsxDevice object.
+ **/
+MsxDevice *
+msx_device_new_emulated (MsxEmulator *emulator)
+{
+	MsxDevice *self;
+	self = g_object_new (MSX_TYPE_DEVICE, NULL);
+	self->emulator = g_object_ref (emulator);
+	return MSX_DEVICE (self);
+}
@@ -26,6 +26,7 @@
 #include <gusb.h>
 
 #include "msx-common.h"
+#include "msx-emulator.h"
 
 G_BEGIN_DECLS
 
@@ -34,6 +35,7 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (MsxDevice, msx_device, MSX, DEVICE, GObject)
 
 MsxDevice	*msx_device_new				(GUsbDevice	*usb_device);
+MsxDevice	*msx_device_new_emulated		(MsxEmulator	*emulator);
 
 gboolean	 msx_device_close			(MsxDevice	*self,
 							 GError		**error);
@@ -49,6 +51,9 @@ const gchar	*msx_device_get_firmware_version1	(MsxDevice	*self);
 const gchar	*msx_device_get_firmware_version2	(MsxDevice	*self);
 gint		 msx_device_get_value			(MsxDevice	*self,
 							 MsxDeviceKey	 key);
+void		 msx_device_set_command_interval	(MsxDevice	*self,
+							 const gchar	*cmd,
+							 guint		 interval);
 
 G_END_DECLS
 
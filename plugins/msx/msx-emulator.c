@@ -0,0 +1,431 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "msx-common.h"
+#include "msx-emulator.h"
+
+#define MSX_EMULATOR_CHUNK_SIZE		8
+
+struct _MsxEmulator
+{
+	GObject			 parent_instance;
+	GByteArray		*request;
+	GByteArray		*response;
+	gsize			 response_idx;
+	GRand			*rand;
+	GHashTable		*responses;		/* cmd : GBytes */
+	GBytes			*raw_response;
+	guint			 latency;		/* ms per chunk */
+	gdouble			 crc_error_rate;	/* 0..1 */
+	gdouble			 timeout_rate;		/* 0..1 */
+	guint			 cnt_commands;
+	gint			 battery_voltage;	/* mV */
+	gint			 load_power;		/* W */
+	gint			 pv_voltage;		/* 0.1V */
+};
+
+G_DEFINE_TYPE (MsxEmulator, msx_emulator, G_TYPE_OBJECT)
+
+/* firmware replies to things it does not understand with this */
+#define MSX_EMULATOR_NAK		"NAKss"
+
+static gint
+msx_emulator_walk (MsxEmulator *self, gint val, gint step, gint min, gint max)
+{
+	val += g_rand_int_range (self->rand, -step, step + 1);
+	return CLAMP (val, min, max);
+}
+
+static gchar *
+msx_emulator_build_qpigs (MsxEmulator *self)
+{
+	gint pv_power;
+	gint pv_current;
+	gint load_va;
+
+	/* drift a little on every request so clients see changes */
+	self->battery_voltage = msx_emulator_walk (self, self->battery_voltage, 50, 23000, 28800);
+	self->load_power = msx_emulator_walk (self, self->load_power, 20, 0, 2400);
+	self->pv_voltage = msx_emulator_walk (self, self->pv_voltage, 5, 0, 1450);
+	pv_current = self->pv_voltage > 300 ? (self->pv_voltage - 300) / 50 : 0;
+	pv_power = pv_current * self->pv_voltage / 10;
+	load_va = self->load_power * 11 / 10;
+
+	/* the field widths are fixed, see msx_common_get_qpigs_offsets() */
+	return g_strdup_printf ("000.0 00.0 230.0 50.0 %04i %04i %03i 376 "
+				"%02i.%02i %03i 100 0035 %04i %03i.%01i "
+				"%02i.%02i 00000 00010110 00 00 %05i 010",
+				load_va, self->load_power,
+				self->load_power * 100 / 2400,
+				self->battery_voltage / 1000,
+				(self->battery_voltage % 1000) / 10,
+				pv_power / (self->battery_voltage / 1000),
+				pv_current,
+				self->pv_voltage / 10, self->pv_voltage % 10,
+				self->battery_voltage / 1000,
+				(self->battery_voltage % 1000) / 10,
+				pv_power);
+}
+
+static gchar *
+msx_emulator_build_response (MsxEmulator *self, const gchar *cmd)
+{
+	if (g_strcmp0 (cmd, "QPI") == 0)
+		return g_strdup ("PI30");
+	if (g_strcmp0 (cmd, "QID") == 0)
+		return g_strdup ("92931701100000");
+	if (g_strcmp0 (cmd, "QVFW") == 0)
+		return g_strdup ("VERFW:00072.70");
+	if (g_strcmp0 (cmd, "QVFW2") == 0)
+		return g_strdup ("VERFW2:00072.70");
+	if (g_strcmp0 (cmd, "QPIRI") == 0) {
+		return g_strdup ("230.0 13.0 230.0 50.0 13.0 3000 2400 24.0 "
+				 "23.0 21.0 28.2 27.0 0 30 60 0 1 2 1 01 0 0 "
+				 "27.0 0 1");
+	}
+	if (g_strcmp0 (cmd, "QPIGS") == 0)
+		return msx_emulator_build_qpigs (self);
+	if (g_strcmp0 (cmd, "QPIWS") == 0)
+		return g_strdup ("00000000000000000000000000000000");
+	if (g_strcmp0 (cmd, "QFLAG") == 0)
+		return g_strdup ("EkxyzDabjuv");
+	return NULL;
+}
+
+static GBytes *
+msx_emulator_get_payload (MsxEmulator *self, const gchar *cmd)
+{
+	GBytes *blob;
+	gchar *payload;
+
+	/* set by the test harness */
+	blob = g_hash_table_lookup (self->responses, cmd);
+	if (blob != NULL)
+		return g_bytes_ref (blob);
+
+	payload = msx_emulator_build_response (self, cmd);
+	if (payload == NULL) {
+		g_debug ("unknown command %s", cmd);
+		payload = g_strdup (MSX_EMULATOR_NAK);
+	}
+	return g_bytes_new_take (payload, strlen (payload));
+}
+
+static void
+msx_emulator_handle_request (MsxEmulator *self)
+{
+	const guint8 *data;
+	gsize len = self->request->len - 3;
+	gsize payload_len = 0;
+	guint16 crc;
+	g_autofree gchar *cmd = NULL;
+	g_autoptr(GBytes) payload = NULL;
+
+	/* firmware ignores requests with a bad checksum */
+	crc = GUINT16_TO_BE (msx_common_crc (self->request->data, len));
+	if (memcmp (&crc, self->request->data + len, 2) != 0) {
+		g_debug ("ignoring request with invalid checksum");
+		return;
+	}
+	cmd = g_strndup ((const gchar *) self->request->data, len);
+	self->cnt_commands++;
+
+	/* send exactly what we were told to, framing and all */
+	g_byte_array_set_size (self->response, 0);
+	self->response_idx = 0;
+	if (self->raw_response != NULL) {
+		data = g_bytes_get_data (self->raw_response, &payload_len);
+		g_byte_array_append (self->response, data, payload_len);
+		return;
+	}
+
+	/* '(' payload CRC '\r', sent in chunks of 8 bytes */
+	payload = msx_emulator_get_payload (self, cmd);
+	data = g_bytes_get_data (payload, &payload_len);
+	g_byte_array_append (self->response, (const guint8 *) "(", 1);
+	g_byte_array_append (self->response, data, payload_len);
+	crc = GUINT16_TO_BE (msx_common_crc (self->response->data, self->response->len));
+	g_byte_array_append (self->response, (const guint8 *) &crc, 2);
+	g_byte_array_append (self->response, (const guint8 *) "\r", 1);
+
+	/* corrupt the payload, leaving the framing intact */
+	if (payload_len > 0 && g_rand_double (self->rand) < self->crc_error_rate)
+		self->response->data[1 + g_rand_int_range (self->rand, 0, (gint32) payload_len)] ^= 0x01;
+}
+
+/**
+ * msx_emulator_write:
+ * @self: a #MsxEmulator
+ * @buf: a chunk of request data
+ * @len: size of @buf, normally 8
+ * @error: a #GError, or %NULL
+ *
+ * Receives a chunk of a request as if it were sent as a HID report.
+ *
+ * Return value: %TRUE for success
+ **/
+gboolean
+msx_emulator_write (MsxEmulator *self, const guint8 *buf, gsize len, GError **error)
+{
+	g_return_val_if_fail (MSX_IS_EMULATOR (self), FALSE);
+
+	if (len != MSX_EMULATOR_CHUNK_SIZE) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_ARGUMENT,
+			     "expected %u bytes, got %" G_GSIZE_FORMAT,
+			     (guint) MSX_EMULATOR_CHUNK_SIZE, len);
+		return FALSE;
+	}
+
+	/* a new request always drops the old response */
+	g_byte_array_set_size (self->response, 0);
+	self->response_idx = 0;
+	for (gsize i = 0; i < len; i++) {
+		g_byte_array_append (self->request, buf + i, 1);
+		if (buf[i] != '\r')
+			continue;
+		if (self->request->len > 3)
+			msx_emulator_handle_request (self);
+		g_byte_array_set_size (self->request, 0);
+		break;
+	}
+	return TRUE;
+}
+
+/**
+ * msx_emulator_read:
+ * @self: a #MsxEmulator
+ * @buf: a buffer
+ * @len: size of @buf, normally 8
+ * @actual_len: (out): the number of bytes written to @buf
+ * @error: a #GError, or %NULL
+ *
+ * Returns the next chunk of the response, waiting for the configured
+ * latency first. Any unused bytes in the last chunk are zero.
+ *
+ * Return value: %TRUE for success
+ **/
+gboolean
+msx_emulator_read (MsxEmulator *self, guint8 *buf, gsize len,
+		   gsize *actual_len, GError **error)
+{
+	gsize chunk;
+
+	g_return_val_if_fail (MSX_IS_EMULATOR (self), FALSE);
+
+	if (self->latency > 0)
+		g_usleep (self->latency * 1000);
+	if (self->response_idx >= self->response->len ||
+	    g_rand_double (self->rand) < self->timeout_rate) {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_TIMED_OUT,
+				     "no response from emulated device");
+		return FALSE;
+	}
+	memset (buf, 0x00, len);
+	chunk = MIN (self->response->len - self->response_idx, len);
+	memcpy (buf, self->response->data + self->response_idx, chunk);
+	self->response_idx += chunk;
+	if (actual_len != NULL)
+		*actual_len = MIN (len, MSX_EMULATOR_CHUNK_SIZE);
+	return TRUE;
+}
+
+void
+msx_emulator_set_latency (MsxEmulator *self, guint latency)
+{
+	g_return_if_fail (MSX_IS_EMULATOR (self));
+	self->latency = latency;
+}
+
+void
+msx_emulator_set_crc_error_rate (MsxEmulator *self, gdouble rate)
+{
+	g_return_if_fail (MSX_IS_EMULATOR (self));
+	self->crc_error_rate = CLAMP (rate, 0.f, 1.f);
+}
+
+void
+msx_emulator_set_timeout_rate (MsxEmulator *self, gdouble rate)
+{
+	g_return_if_fail (MSX_IS_EMULATOR (self));
+	self->timeout_rate = CLAMP (rate, 0.f, 1.f);
+}
+
+void
+msx_emulator_set_seed (MsxEmulator *self, guint32 seed)
+{
+	g_return_if_fail (MSX_IS_EMULATOR (self));
+	g_rand_set_seed (self->rand, seed);
+}
+
+/**
+ * msx_emulator_set_response:
+ * @self: a #MsxEmulator
+ * @cmd: a command, e.g. "QPIGS"
+ * @payload: (nullable): response data, without the framing
+ *
+ * Overrides the response to a command, which is useful for feeding the
+ * parsers with captured or fuzzed data. The '(', CRC and '\r' framing is
+ * still added by the emulator. Use %NULL to restore the default.
+ **/
+void
+msx_emulator_set_response (MsxEmulator *self, const gchar *cmd, GBytes *payload)
+{
+	g_return_if_fail (MSX_IS_EMULATOR (self));
+	g_return_if_fail (cmd != NULL);
+	if (payload == NULL) {
+		g_hash_table_remove (self->responses, cmd);
+		return;
+	}
+	g_hash_table_insert (self->responses, g_strdup (cmd), g_bytes_ref (payload));
+}
+
+/**
+ * msx_emulator_set_raw_response:
+ * @self: a #MsxEmulator
+ * @raw: (nullable): response data, including any framing
+ *
+ * Replies to every valid request with exactly @raw, split into chunks of
+ * 8 bytes. No '(', CRC or '\r' is added, and no corruption is applied.
+ * Use %NULL to restore the normal responses.
+ **/
+void
+msx_emulator_set_raw_response (MsxEmulator *self, GBytes *raw)
+{
+	g_return_if_fail (MSX_IS_EMULATOR (self));
+	g_clear_pointer (&self->raw_response, g_bytes_unref);
+	if (raw != NULL)
+		self->raw_response = g_bytes_ref (raw);
+}
+
+guint
+msx_emulator_get_command_count (MsxEmulator *self)
+{
+	g_return_val_if_fail (MSX_IS_EMULATOR (self), 0);
+	return self->cnt_commands;
+}
+
+/**
+ * msx_emulator_set_options:
+ * @self: a #MsxEmulator
+ * @options: comma separated options, e.g. "latency=5,crc=0.01,timeout=0"
+ * @error: a #GError, or %NULL
+ *
+ * Sets the latency in ms per chunk, the probability of a corrupted
+ * response, the probability of a timeout and the random seed.
+ *
+ * Return value: %TRUE if all the options were valid
+ **/
+gboolean
+msx_emulator_set_options (MsxEmulator *self, const gchar *options, GError **error)
+{
+	g_auto(GStrv) split = NULL;
+
+	g_return_val_if_fail (MSX_IS_EMULATOR (self), FALSE);
+
+	if (options == NULL || options[0] == '\0')
+		return TRUE;
+	split = g_strsplit (options, ",", -1);
+	for (guint i = 0; split[i] != NULL; i++) {
+		g_auto(GStrv) kv = g_strsplit (split[i], "=", 2);
+		if (g_strv_length (kv) != 2) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_ARGUMENT,
+				     "invalid option '%s'", split[i]);
+			return FALSE;
+		}
+		if (g_strcmp0 (kv[0], "latency") == 0) {
+			msx_emulator_set_latency (self, g_ascii_strtoull (kv[1], NULL, 10));
+		} else if (g_strcmp0 (kv[0], "crc") == 0) {
+			msx_emulator_set_crc_error_rate (self, g_ascii_strtod (kv[1], NULL));
+		} else if (g_strcmp0 (kv[0], "timeout") == 0) {
+			msx_emulator_set_timeout_rate (self, g_ascii_strtod (kv[1], NULL));
+		} else if (g_strcmp0 (kv[0], "seed") == 0) {
+			msx_emulator_set_seed (self, g_ascii_strtoull (kv[1], NULL, 10));
+		} else {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_ARGUMENT,
+				     "unknown option '%s'", kv[0]);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static void
+msx_emulator_finalize (GObject *object)
+{
+	MsxEmulator *self = MSX_EMULATOR (object);
+
+	g_byte_array_unref (self->request);
+	g_byte_array_unref (self->response);
+	g_rand_free (self->rand);
+	g_hash_table_unref (self->responses);
+	if (self->raw_response != NULL)
+		g_bytes_unref (self->raw_response);
+
+	G_OBJECT_CLASS (msx_emulator_parent_class)->finalize (object);
+}
+
+static void
+msx_emulator_init (MsxEmulator *self)
+{
+	self->request = g_byte_array_new ();
+	self->response = g_byte_array_new ();
+	self->rand = g_rand_new_with_seed (0);
+	self->responses = g_hash_table_new_full (g_str_hash, g_str_equal,
+						 g_free, (GDestroyNotify) g_bytes_unref);
+	self->battery_voltage = 26600;
+	self->load_power = 183;
+	self->pv_voltage = 0;
+}
+
+static void
+msx_emulator_class_init (MsxEmulatorClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = msx_emulator_finalize;
+}
+
+/**
+ * msx_emulator_new:
+ *
+ * Creates a software PI30 inverter that responds to requests in the same
+ * way as the USB HID device, for use in tests and benchmarks.
+ *
+ * Return value: a new MsxEmulator object.
+ **/
+MsxEmulator *
+msx_emulator_new (void)
+{
+	MsxEmulator *self;
+	self = g_object_new (MSX_TYPE_EMULATOR, NULL);
+	return MSX_EMULATOR (self);
+}
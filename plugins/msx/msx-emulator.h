@@ -0,0 +1,63 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __MSX_EMULATOR_H
+#define __MSX_EMULATOR_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define MSX_TYPE_EMULATOR (msx_emulator_get_type ())
+
+G_DECLARE_FINAL_TYPE (MsxEmulator, msx_emulator, MSX, EMULATOR, GObject)
+
+MsxEmulator	*msx_emulator_new			(void);
+gboolean	 msx_emulator_set_options		(MsxEmulator	*self,
+							 const gchar	*options,
+							 GError		**error);
+void		 msx_emulator_set_latency		(MsxEmulator	*self,
+							 guint		 latency);
+void		 msx_emulator_set_crc_error_rate	(MsxEmulator	*self,
+							 gdouble	 rate);
+void		 msx_emulator_set_timeout_rate		(MsxEmulator	*self,
+							 gdouble	 rate);
+void		 msx_emulator_set_seed			(MsxEmulator	*self,
+							 guint32	 seed);
+gboolean	 msx_emulator_write			(MsxEmulator	*self,
+							 const guint8	*buf,
+							 gsize		 len,
+							 GError		**error);
+gboolean	 msx_emulator_read			(MsxEmulator	*self,
+							 guint8		*buf,
+							 gsize		 len,
+							 gsize		*actual_len,
+							 GError		**error);
+void		 msx_emulator_set_response		(MsxEmulator	*self,
+							 const gchar	*cmd,
+							 GBytes		*payload);
+void		 msx_emulator_set_raw_response		(MsxEmulator	*self,
+							 GBytes		*raw);
+guint		 msx_emulator_get_command_count		(MsxEmulator	*self);
+
+G_END_DECLS
+
+#endif /* __MSX_EMULATOR_H */
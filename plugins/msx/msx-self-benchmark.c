@@ -0,0 +1,156 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "msx-common.h"
+#include "msx-device.h"
+#include "msx-emulator.h"
+#include "sbu-benchmark.h"
+
+#define MSX_BENCHMARK_LOOPS		1000000
+#define MSX_BENCHMARK_POLLS		2000
+
+/* a typical QPIGS response, without the '(' and CRC */
+static const gchar *msx_benchmark_qpigs =
+	"000.0 00.0 229.9 49.9 0229 0183 004 376 26.60 000 "
+	"100 0035 0000 000.0 26.63 00000 00010110 00 00 00000 010";
+
+static gboolean
+msx_benchmark_parse_int (SbuBenchmark *bench, GError **error)
+{
+	gint64 sum = 0;
+
+	sbu_benchmark_start (bench);
+	for (guint i = 0; i < MSX_BENCHMARK_LOOPS; i++) {
+		gint val = msx_common_parse_int (msx_benchmark_qpigs, 0x28, -1, error);
+		if (val == G_MAXINT)
+			return FALSE;
+		sum += val;
+	}
+	sbu_benchmark_stop (bench, "parse-int", MSX_BENCHMARK_LOOPS);
+	g_assert_cmpint (sum, ==, (gint64) 26600 * MSX_BENCHMARK_LOOPS);
+	return TRUE;
+}
+
+static gboolean
+msx_benchmark_parse_qpigs (SbuBenchmark *bench, GError **error)
+{
+	const MsxCommonOffset *offsets = msx_common_get_qpigs_offsets ();
+	gsize len = strlen (msx_benchmark_qpigs);
+	gint values[MSX_DEVICE_KEY_LAST] = { 0 };
+
+	sbu_benchmark_start (bench);
+	for (guint i = 0; i < MSX_BENCHMARK_LOOPS / 10; i++) {
+		if (!msx_common_parse_offsets (msx_benchmark_qpigs, len,
+					       offsets, values, error))
+			return FALSE;
+	}
+	sbu_benchmark_stop (bench, "parse-qpigs", MSX_BENCHMARK_LOOPS / 10);
+
+	sbu_benchmark_start (bench);
+	for (guint i = 0; i < MSX_BENCHMARK_LOOPS / 10; i++) {
+		if (!msx_common_parse_fields (msx_benchmark_qpigs, len,
+					      offsets, values, error))
+			return FALSE;
+	}
+	sbu_benchmark_stop (bench, "parse-qpigs-fields", MSX_BENCHMARK_LOOPS / 10);
+	return TRUE;
+}
+
+static void
+msx_benchmark_crc (SbuBenchmark *bench)
+{
+	const guint8 *buf = (const guint8 *) msx_benchmark_qpigs;
+	gsize len = strlen (msx_benchmark_qpigs);
+	guint16 crc = 0;
+
+	sbu_benchmark_start (bench);
+	for (guint i = 0; i < MSX_BENCHMARK_LOOPS / 10; i++)
+		crc ^= msx_common_crc (buf, len);
+	sbu_benchmark_stop (bench, "crc-bytes", (guint64) len * MSX_BENCHMARK_LOOPS / 10);
+
+	/* stop the loop being optimized away */
+	g_debug ("crc: 0x%04x", crc);
+}
+
+static gboolean
+msx_benchmark_poll (SbuBenchmark *bench, const gchar *name,
+		    gdouble crc_error_rate, GError **error)
+{
+	g_autoptr(MsxDevice) device = NULL;
+	g_autoptr(MsxEmulator) emulator = msx_emulator_new ();
+
+	device = msx_device_new_emulated (emulator);
+	if (!msx_device_open (device, error))
+		return FALSE;
+
+	/* every command on every refresh, as the worst case */
+	msx_device_set_command_interval (device, "QPIRI", 0);
+	msx_device_set_command_interval (device, "QFLAG", 0);
+	msx_emulator_set_crc_error_rate (emulator, crc_error_rate);
+	sbu_benchmark_start (bench);
+	for (guint i = 0; i < MSX_BENCHMARK_POLLS; i++) {
+		if (!msx_device_refresh (device, error))
+			return FALSE;
+	}
+	sbu_benchmark_stop (bench, name, MSX_BENCHMARK_POLLS);
+	return TRUE;
+}
+
+int
+main (int argc, char **argv)
+{
+	g_autofree gchar *output = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GOptionContext) context = g_option_context_new (NULL);
+	g_autoptr(SbuBenchmark) bench = sbu_benchmark_new ("msx");
+	const GOptionEntry options[] = {
+		{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+			"Write the results as JSON to a file", NULL },
+		{ NULL}
+	};
+
+	g_option_context_add_main_entries (context, options, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse arguments: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+
+	/* benchmarks go here */
+	if (!msx_benchmark_parse_int (bench, &error) ||
+	    !msx_benchmark_parse_qpigs (bench, &error) ||
+	    !msx_benchmark_poll (bench, "emulated-refresh", 0.f, &error) ||
+	    !msx_benchmark_poll (bench, "emulated-refresh-crc-errors", 0.01f, &error)) {
+		g_printerr ("Failed to run benchmark: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	msx_benchmark_crc (bench);
+
+	/* save for comparing with the last release */
+	if (!sbu_benchmark_write (bench, output, &error)) {
+		g_printerr ("Failed to write results: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -24,6 +24,7 @@
 #include <glib/gstdio.h>
 #include <glib-object.h>
 #include <math.h>
+#include <string.h>
 
 #include "msx-common.h"
 #include "msx-device.h"
@@ -33,7 +34,12 @@ msx_test_common_func (void)
 {
 	const gchar *buf = "12.34 - 45.67 89.12 0";
 	const gchar *raw = "230.0 13.0 230.0 50.0 13.0 3000 2400";
+	const gchar *qpigs = "000.0 00.0 229.9 49.9 0229 0183 004 376 26.60 000 "
+			     "100 0035 0000 000.0 26.63 00000 00010110 00 00 00000 010";
+	gboolean ret;
 	gchar buf2[5];
+	gint values[MSX_DEVICE_KEY_LAST] = { 0 };
+	g_autoptr(GError) error = NULL;
 
 	g_assert_cmpint (msx_common_parse_int ("123.456", 0, -1, NULL), ==, 123456);
 	g_assert_cmpint (msx_common_parse_int ("123.4", 0, -1, NULL), ==, 123400);
@@ -66,11 +72,216 @@ msx_test_common_func (void)
 	/* real world example */
 	g_assert_cmpint (msx_common_parse_int (raw, 0x1b, -1, NULL), ==, 3000000);
 
+	/* fixed-field response */
+	ret = msx_common_parse_offsets (qpigs, strlen (qpigs),
+					msx_common_get_qpigs_offsets (),
+					values, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (values[MSX_DEVICE_KEY_AC_OUTPUT_VOLTAGE], ==, 229900);
+	g_assert_cmpint (values[MSX_DEVICE_KEY_BATTERY_VOLTAGE], ==, 26600);
+	g_assert_cmpint (values[MSX_DEVICE_KEY_PV_CHARGING_POWER], ==, 0);
+	ret = msx_common_parse_offsets (qpigs, 0x20,
+					msx_common_get_qpigs_offsets (),
+					values, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_FAILED);
+	g_assert (!ret);
+
+	/* checksum */
+	g_assert_cmpint (msx_common_crc ((const guint8 *) "QPIGS", 5), ==, 0xb7a9);
+	g_assert_cmpint (msx_common_crc ((const guint8 *) "QPIRI", 5), ==, 0xf854);
+
 	/* test enum to string */
 	for (guint i = 1; i < MSX_DEVICE_KEY_LAST; i++)
 		g_assert_cmpstr (sbu_device_key_to_string (i), !=, NULL);
 }
 
+static void
+msx_test_parse_fields_compare (const gchar *buf, gsize len, const MsxCommonOffset *offsets)
+{
+	gboolean ret1;
+	gboolean ret2;
+	gint values1[MSX_DEVICE_KEY_LAST] = { 0 };
+	gint values2[MSX_DEVICE_KEY_LAST] = { 0 };
+	g_autoptr(GError) error1 = NULL;
+	g_autoptr(GError) error2 = NULL;
+
+	ret1 = msx_common_parse_offsets (buf, len, offsets, values1, &error1);
+	ret2 = msx_common_parse_fields (buf, len, offsets, values2, &error2);
+	if (ret1 != ret2 || (ret1 && memcmp (values1, values2, sizeof(values1)) != 0))
+		g_error ("parsers disagree on '%.*s'", (gint) len, buf);
+}
+
+static void
+msx_test_parse_fields_func (void)
+{
+	const gchar *alphabet = "0123456789 .-0123456789 .-x";
+	const gchar *qpigs = "000.0 00.0 229.9 49.9 0229 0183 004 376 26.60 000 "
+			     "100 0035 0000 000.0 26.63 00000 00010110 00 00 00000 010";
+	const gchar *qpiri = "230.0 13.0 230.0 50.0 13.0 3000 2400 24.0 23.0 21.0 "
+			     "28.2 27.0 0 30 60 0 1 2 1 01 0 0 27.0 0 1";
+	gboolean ret;
+	gint values[MSX_DEVICE_KEY_LAST] = { 0 };
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GRand) rand = g_rand_new_with_seed (0);
+
+	/* real world examples */
+	ret = msx_common_parse_fields (qpigs, strlen (qpigs),
+				       msx_common_get_qpigs_offsets (),
+				       values, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (values[MSX_DEVICE_KEY_BATTERY_VOLTAGE], ==, 26600);
+	g_assert_cmpint (values[MSX_DEVICE_KEY_AC_OUTPUT_ACTIVE_POWER], ==, 183000);
+	ret = msx_common_parse_fields (qpiri, strlen (qpiri),
+				       msx_common_get_qpiri_offsets (),
+				       values, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (values[MSX_DEVICE_KEY_GRID_RATING_VOLTAGE], ==, 230000);
+	g_assert_cmpint (values[MSX_DEVICE_KEY_BATTERY_REDISCHARGE_VOLTAGE], ==, 27000);
+
+	/* mutate real responses and check against the reference parser */
+	for (guint i = 0; i < 100000; i++) {
+		const gchar *tmpl = i % 2 == 0 ? qpigs : qpiri;
+		const MsxCommonOffset *offsets = i % 2 == 0 ?
+			msx_common_get_qpigs_offsets () :
+			msx_common_get_qpiri_offsets ();
+		gsize len = strlen (tmpl);
+		g_autofree gchar *buf = g_strdup (tmpl);
+		guint mutations = g_rand_int_range (rand, 0, 8);
+		for (guint j = 0; j < mutations; j++) {
+			guint idx = g_rand_int_range (rand, 0, len);
+			buf[idx] = alphabet[g_rand_int_range (rand, 0, strlen (alphabet))];
+		}
+		msx_test_parse_fields_compare (buf, len, offsets);
+	}
+
+	/* random short fields, including ones that run off the end */
+	for (guint i = 0; i < 100000; i++) {
+		gchar buf[16];
+		gsize len = g_rand_int_range (rand, 1, 13);
+		MsxCommonOffset offsets[] = {
+			{ g_rand_int_range (rand, 0, 3),	MSX_DEVICE_KEY_GRID_VOLTAGE },
+			{ len,					MSX_DEVICE_KEY_UNKNOWN }
+		};
+		for (gsize j = 0; j < len; j++)
+			buf[j] = alphabet[g_rand_int_range (rand, 0, strlen (alphabet))];
+		msx_test_parse_fields_compare (buf, len, offsets);
+	}
+}
+
+static void
+msx_test_emulator_func (void)
+{
+	gboolean ret;
+	guint cnt;
+	g_autoptr(GBytes) response1 = NULL;
+	g_autoptr(GBytes) response2 = NULL;
+	g_autoptr(GBytes) response3 = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(MsxDevice) device = NULL;
+	g_autoptr(MsxEmulator) emulator = msx_emulator_new ();
+
+	/* the whole open and refresh path */
+	device = msx_device_new_emulated (emulator);
+	ret = msx_device_open (device, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpstr (msx_device_get_serial_number (device), ==, "92931701100000");
+	g_assert_cmpstr (msx_device_get_firmware_version1 (device), ==, "00072.70");
+	g_assert_cmpstr (msx_device_get_firmware_version2 (device), ==, "00072.70");
+	g_assert_cmpint (msx_device_get_value (device, MSX_DEVICE_KEY_GRID_RATING_VOLTAGE), ==, 230000);
+	g_assert_cmpint (msx_device_get_value (device, MSX_DEVICE_KEY_BATTERY_VOLTAGE), >=, 23000);
+	g_assert_cmpint (msx_device_get_value (device, MSX_DEVICE_KEY_BATTERY_VOLTAGE), <=, 28800);
+	ret = msx_device_refresh (device, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* unknown command */
+	response1 = msx_device_send_command (device, "QXYZ", &error);
+	g_assert_no_error (error);
+	g_assert (response1 != NULL);
+	g_assert_cmpint (g_bytes_get_size (response1), ==, 5);
+	g_assert (memcmp (g_bytes_get_data (response1, NULL), "NAKss", 5) == 0);
+
+	/* corrupted responses are retried three times, then fail */
+	msx_emulator_set_crc_error_rate (emulator, 1.f);
+	cnt = msx_emulator_get_command_count (emulator);
+	response2 = msx_device_send_command (device, "QPI", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert (response2 == NULL);
+	g_assert_cmpint (msx_emulator_get_command_count (emulator), ==, cnt + 4);
+	g_clear_error (&error);
+
+	/* device stops responding */
+	msx_emulator_set_crc_error_rate (emulator, 0.f);
+	msx_emulator_set_timeout_rate (emulator, 1.f);
+	response3 = msx_device_send_command (device, "QPI", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT);
+	g_assert (response3 == NULL);
+	g_clear_error (&error);
+
+	/* options string */
+	ret = msx_emulator_set_options (emulator, "latency=0,crc=0.5,timeout=0,seed=42", &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = msx_emulator_set_options (emulator, "speed=11", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT);
+	g_assert (!ret);
+}
+
+static void
+msx_test_malformed_func (void)
+{
+	gboolean ret;
+	guint cnt;
+	g_autofree gchar *unterminated = g_strnfill (200, 'A');
+	g_autoptr(GBytes) payload1 = g_bytes_new_static ("PI3X", 4);
+	g_autoptr(GBytes) payload2 = g_bytes_new_static ("000.0 00.0", 10);
+	g_autoptr(GBytes) raw1 = g_bytes_new_static ("(\r", 2);
+	g_autoptr(GBytes) raw2 = NULL;
+	g_autoptr(GBytes) response1 = NULL;
+	g_autoptr(GBytes) response2 = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(MsxDevice) device = NULL;
+	g_autoptr(MsxEmulator) emulator = msx_emulator_new ();
+
+	/* too short to have a CRC, which is not a checksum failure to retry */
+	device = msx_device_new_emulated (emulator);
+	msx_emulator_set_raw_response (emulator, raw1);
+	cnt = msx_emulator_get_command_count (emulator);
+	response1 = msx_device_send_command (device, "QPI", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT);
+	g_assert (response1 == NULL);
+	g_assert_cmpint (msx_emulator_get_command_count (emulator), ==, cnt + 1);
+	g_clear_error (&error);
+
+	/* no '\r' */
+	raw2 = g_bytes_new_static (unterminated, 200);
+	msx_emulator_set_raw_response (emulator, raw2);
+	response2 = msx_device_send_command (device, "QPI", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT);
+	g_assert (response2 == NULL);
+	g_clear_error (&error);
+	msx_emulator_set_raw_response (emulator, NULL);
+
+	/* valid framing, wrong protocol */
+	msx_emulator_set_response (emulator, "QPI", payload1);
+	ret = msx_device_open (device, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_FAILED);
+	g_assert (strstr (error->message, "PI3X") != NULL);
+	g_assert (!ret);
+	g_clear_error (&error);
+	msx_emulator_set_response (emulator, "QPI", NULL);
+
+	/* truncated status */
+	msx_emulator_set_response (emulator, "QPIGS", payload2);
+	ret = msx_device_refresh (device, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_FAILED);
+	g_assert (!ret);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -80,6 +291,9 @@ main (int argc, char **argv)
 
 	/* tests go here */
 	g_test_add_func ("/common", msx_test_common_func);
+	g_test_add_func ("/parse-fields", msx_test_parse_fields_func);
+	g_test_add_func ("/emulator", msx_test_emulator_func);
+	g_test_add_func ("/malformed", msx_test_malformed_func);
 
 	return g_test_run ();
 }
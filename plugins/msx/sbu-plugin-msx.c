@@ -32,6 +32,14 @@ struct SbuPluginData {
 	GHashTable		*devices; /* MsxDevice : SbuDeviceImpl */
 };
 
+typedef enum {
+	MSX_DERIVED_NONE		= 0,
+	MSX_DERIVED_NODE_BATTERY_POWER	= 1 << 0,
+	MSX_DERIVED_NODE_SOLAR_VOLTAGE	= 1 << 1,
+	MSX_DERIVED_LINK_SOLAR_LOAD	= 1 << 2,
+	MSX_DERIVED_LINK_UTILITY_LOAD	= 1 << 3
+} MsxDerived;
+
 static gdouble
 msx_val_to_double (gint value)
 {
@@ -51,6 +59,10 @@ msx_device_update_node_battery_power (SbuDeviceImpl *device, MsxDevice *msx_devi
 	gint a = msx_device_get_value (msx_device, MSX_DEVICE_KEY_BATTERY_DISCHARGE_CURRENT);
 	if (a == 0)
 		a = -msx_device_get_value (msx_device, MSX_DEVICE_KEY_BATTERY_CURRENT);
+	sbu_device_impl_set_node_value (device,
+					SBU_NODE_KIND_BATTERY,
+					SBU_DEVICE_PROPERTY_CURRENT,
+					msx_val_to_double (a));
 	sbu_device_impl_set_node_value (device,
 					SBU_NODE_KIND_BATTERY,
 					SBU_DEVICE_PROPERTY_POWER,
@@ -161,17 +173,14 @@ msx_device_update_link_utility_load (SbuDeviceImpl *device, MsxDevice *msx_devic
 	msx_device_update_node_utility_power (device, msx_device);
 }
 
-static void
-msx_device_changed_cb (MsxDevice *msx_device,
-		       MsxDeviceKey key,
-		       gint value,
-		       SbuPlugin *plugin)
+static MsxDerived
+msx_device_changed_key (SbuPlugin *plugin,
+			SbuDeviceImpl *device,
+			MsxDevice *msx_device,
+			MsxDeviceKey key)
 {
-	SbuPluginData *self = sbu_plugin_get_data (plugin);
-	SbuDeviceImpl *device = NULL;
-
-	device = g_hash_table_lookup (self->devices, msx_device);
-	g_assert (device != NULL);
+	MsxDerived derived = MSX_DERIVED_NONE;
+	gint value = msx_device_get_value (msx_device, key);
 
 	switch (key) {
 	case MSX_DEVICE_KEY_GRID_RATING_VOLTAGE:
@@ -227,7 +236,7 @@ msx_device_changed_cb (MsxDevice *msx_device,
 						SBU_NODE_KIND_UTILITY,
 						SBU_DEVICE_PROPERTY_VOLTAGE,
 						msx_val_to_double (value));
-		msx_device_update_link_utility_load (device, msx_device);
+		derived |= MSX_DERIVED_LINK_UTILITY_LOAD;
 		break;
 	case MSX_DEVICE_KEY_GRID_FREQUENCY:
 		sbu_device_impl_set_node_value (device,
@@ -253,22 +262,18 @@ msx_device_changed_cb (MsxDevice *msx_device,
 						SBU_NODE_KIND_LOAD,
 						SBU_DEVICE_PROPERTY_POWER,
 						MAX (msx_val_to_double (value), 20.f));
-		msx_device_update_link_solar_load (device, msx_device);
-		msx_device_update_link_utility_load (device, msx_device);
+		derived |= MSX_DERIVED_LINK_SOLAR_LOAD;
+		derived |= MSX_DERIVED_LINK_UTILITY_LOAD;
 		break;
 	case MSX_DEVICE_KEY_BATTERY_VOLTAGE:
 		sbu_device_impl_set_node_value (device,
 						SBU_NODE_KIND_BATTERY,
 						SBU_DEVICE_PROPERTY_VOLTAGE,
 						msx_val_to_double (value));
-		msx_device_update_node_battery_power (device, msx_device);
+		derived |= MSX_DERIVED_NODE_BATTERY_POWER;
 		break;
 	case MSX_DEVICE_KEY_BATTERY_CURRENT:
-		sbu_device_impl_set_node_value (device,
-						SBU_NODE_KIND_BATTERY,
-						SBU_DEVICE_PROPERTY_CURRENT,
-						-msx_val_to_double (value));
-		msx_device_update_node_battery_power (device, msx_device);
+		derived |= MSX_DERIVED_NODE_BATTERY_POWER;
 		break;
 	case MSX_DEVICE_KEY_PV_INPUT_CURRENT_FOR_BATTERY:
 		sbu_device_impl_set_node_value (device,
@@ -277,29 +282,28 @@ msx_device_changed_cb (MsxDevice *msx_device,
 						msx_val_to_double (value));
 		break;
 	case MSX_DEVICE_KEY_BATTERY_VOLTAGE_FROM_SCC:
-		msx_device_update_node_solar_voltage (device, msx_device);
-		msx_device_update_link_solar_load (device, msx_device);
+	case MSX_DEVICE_KEY_PV_INPUT_VOLTAGE:
+		derived |= MSX_DERIVED_NODE_SOLAR_VOLTAGE;
+		derived |= MSX_DERIVED_LINK_SOLAR_LOAD;
 		break;
 	case MSX_DEVICE_KEY_PV_CHARGING_POWER:
 		sbu_device_impl_set_node_value (device,
 						SBU_NODE_KIND_SOLAR,
 						SBU_DEVICE_PROPERTY_POWER,
 						msx_val_to_double (value));
+		derived |= MSX_DERIVED_LINK_SOLAR_LOAD;
 		break;
 	case MSX_DEVICE_KEY_BATTERY_DISCHARGE_CURRENT:
-		sbu_device_impl_set_node_value (device,
-						SBU_NODE_KIND_BATTERY,
-						SBU_DEVICE_PROPERTY_CURRENT,
-						msx_val_to_double (value));
 		sbu_device_impl_set_link_active (device,
 						 SBU_NODE_KIND_BATTERY,
 						 SBU_NODE_KIND_LOAD,
 						 value >= 1);
-		msx_device_update_node_battery_power (device, msx_device);
-		msx_device_update_link_utility_load (device, msx_device);
+		derived |= MSX_DERIVED_NODE_BATTERY_POWER;
+		derived |= MSX_DERIVED_LINK_UTILITY_LOAD;
 		break;
 	case MSX_DEVICE_KEY_CHARGING_ON:
-		msx_device_update_link_solar_load (device, msx_device);
+	case MSX_DEVICE_KEY_OUTPUT_SOURCE_PRIORITY:
+		derived |= MSX_DERIVED_LINK_SOLAR_LOAD;
 		break;
 	case MSX_DEVICE_KEY_CHARGING_ON_SOLAR:
 		sbu_device_impl_set_link_active (device,
@@ -313,6 +317,15 @@ msx_device_changed_cb (MsxDevice *msx_device,
 						 SBU_NODE_KIND_BATTERY,
 						 value >= 1);
 		break;
+	case MSX_DEVICE_KEY_CHARGING_TO_FLOATING_MODE:
+		/* the only time the state of charge is really known */
+		if (value >= 1)
+			sbu_device_impl_set_battery_full (device);
+		break;
+	case MSX_DEVICE_KEY_BATTERY_CAPACITY:
+		/* derived from the voltage, so only good enough to start from */
+		sbu_device_impl_set_battery_estimate (device, msx_val_to_double (value));
+		break;
 	case MSX_DEVICE_KEY_AC_OUTPUT_ACTIVE_POWER:
 	case MSX_DEVICE_KEY_AC_OUTPUT_RATING_APPARENT_POWER:
 	case MSX_DEVICE_KEY_BATTERY_RATING_VOLTAGE:
@@ -322,7 +335,6 @@ msx_device_changed_cb (MsxDevice *msx_device,
 	case MSX_DEVICE_KEY_BATTERY_TYPE:
 	case MSX_DEVICE_KEY_PRESENT_MAX_AC_CHARGING_CURRENT:
 	case MSX_DEVICE_KEY_INPUT_VOLTAGE_RANGE:
-	case MSX_DEVICE_KEY_OUTPUT_SOURCE_PRIORITY:
 	case MSX_DEVICE_KEY_CHARGER_SOURCE_PRIORITY:
 	case MSX_DEVICE_KEY_PARALLEL_MAX_NUM:
 	case MSX_DEVICE_KEY_MACHINE_TYPE:
@@ -333,9 +345,7 @@ msx_device_changed_cb (MsxDevice *msx_device,
 	case MSX_DEVICE_KEY_PV_POWER_BALANCE:
 	case MSX_DEVICE_KEY_MAXIMUM_POWER_PERCENTAGE:
 	case MSX_DEVICE_KEY_BUS_VOLTAGE:
-	case MSX_DEVICE_KEY_BATTERY_CAPACITY:
 	case MSX_DEVICE_KEY_INVERTER_HEATSINK_TEMPERATURE:
-	case MSX_DEVICE_KEY_PV_INPUT_VOLTAGE:
 	case MSX_DEVICE_KEY_ADD_SBU_PRIORITY_VERSION:
 	case MSX_DEVICE_KEY_CONFIGURATION_STATUS_CHANGE:
 	case MSX_DEVICE_KEY_SCC_FIRMWARE_VERSION_UPDATED:
@@ -352,7 +362,6 @@ msx_device_changed_cb (MsxDevice *msx_device,
 	case MSX_DEVICE_KEY_FAULT_CODE_RECORD:
 	case MSX_DEVICE_KEY_BATTERY_VOLTAGE_OFFSET_FOR_FANS:
 	case MSX_DEVICE_KEY_EEPROM_VERSION:
-	case MSX_DEVICE_KEY_CHARGING_TO_FLOATING_MODE:
 	case MSX_DEVICE_KEY_SWITCH_ON:
 		g_debug ("key %s=%i not handled",
 			 sbu_device_key_to_string (key), value);
@@ -376,12 +385,77 @@ msx_device_changed_cb (MsxDevice *msx_device,
 	case MSX_DEVICE_KEY_PV_INPUT_CURRENT_FOR_BATTERY:
 		break;
 	default:
-		if (msx_device_get_value (msx_device, key) != value) {
-			sbu_plugin_update_metadata (plugin, device,
-						    sbu_device_key_to_string (key), value);
-		}
+		sbu_plugin_update_metadata (plugin, device,
+					    sbu_device_key_to_string (key), value);
 		break;
 	}
+	return derived;
+}
+
+static void
+msx_device_changed_cb (MsxDevice *msx_device,
+		       GArray *keys,
+		       SbuPlugin *plugin)
+{
+	SbuPluginData *self = sbu_plugin_get_data (plugin);
+	SbuDeviceImpl *device = NULL;
+	MsxDerived derived = MSX_DERIVED_NONE;
+
+	device = g_hash_table_lookup (self->devices, msx_device);
+	g_assert (device != NULL);
+
+	/* only the keys that changed in this response */
+	sbu_device_impl_begin_update (device);
+	for (guint i = 0; i < keys->len; i++) {
+		MsxDeviceKey key = g_array_index (keys, guint, i);
+		derived |= msx_device_changed_key (plugin, device, msx_device, key);
+	}
+
+	/* recompute each derived value just once, in dependency order */
+	if (derived & MSX_DERIVED_NODE_SOLAR_VOLTAGE)
+		msx_device_update_node_solar_voltage (device, msx_device);
+	if (derived & MSX_DERIVED_NODE_BATTERY_POWER)
+		msx_device_update_node_battery_power (device, msx_device);
+	if (derived & MSX_DERIVED_LINK_SOLAR_LOAD) {
+		msx_device_update_link_solar_load (device, msx_device);
+		/* the utility link is only active if the solar one is not */
+		derived |= MSX_DERIVED_LINK_UTILITY_LOAD;
+	}
+	if (derived & MSX_DERIVED_LINK_UTILITY_LOAD)
+		msx_device_update_link_utility_load (device, msx_device);
+	sbu_device_impl_commit_update (device);
+}
+
+static void
+msx_device_command_cb (MsxDevice *msx_device,
+		       const gchar *cmd,
+		       gint64 duration,
+		       guint cnt_retries,
+		       guint cnt_crc,
+		       gboolean success,
+		       SbuPlugin *plugin)
+{
+	SbuMetrics *metrics = sbu_plugin_get_metrics (plugin);
+	g_autofree gchar *labels = g_strdup_printf ("cmd=\"%s\"", cmd);
+
+	sbu_metrics_observe (metrics, "sbud_msx_command_seconds", labels, duration);
+	sbu_metrics_increment (metrics, "sbud_msx_command_retries_total", labels, cnt_retries);
+	sbu_metrics_increment (metrics, "sbud_msx_command_crc_failures_total", labels, cnt_crc);
+	if (!success)
+		sbu_metrics_increment (metrics, "sbud_msx_command_errors_total", labels, 1);
+}
+
+/* the count is how often the last response was reused, and the sum is the
+ * time that would have been spent on the wire asking for it again */
+static void
+msx_device_skipped_cb (MsxDevice *msx_device,
+		       const gchar *cmd,
+		       gint64 duration,
+		       SbuPlugin *plugin)
+{
+	SbuMetrics *metrics = sbu_plugin_get_metrics (plugin);
+	g_autofree gchar *labels = g_strdup_printf ("cmd=\"%s\"", cmd);
+	sbu_metrics_observe (metrics, "sbud_msx_command_skipped_seconds", labels, duration);
 }
 
 static const gchar *
@@ -445,6 +519,10 @@ msx_device_added_cb (MsxContext *context,
 	/* open */
 	g_signal_connect (msx_device, "changed",
 			  G_CALLBACK (msx_device_changed_cb), plugin);
+	g_signal_connect (msx_device, "command",
+			  G_CALLBACK (msx_device_command_cb), plugin);
+	g_signal_connect (msx_device, "skipped",
+			  G_CALLBACK (msx_device_skipped_cb), plugin);
 	if (!msx_device_open (msx_device, &error)) {
 		g_warning ("failed to open: %s", error->message);
 		return;
@@ -478,6 +556,12 @@ msx_device_removed_cb (MsxContext *context, MsxDevice *msx_device, SbuPlugin *pl
 	}
 }
 
+guint
+sbu_plugin_get_abi_version (void)
+{
+	return SBU_PLUGIN_ABI_VERSION;
+}
+
 void
 sbu_plugin_initialize (SbuPlugin *plugin)
 {
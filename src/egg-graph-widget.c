@@ -58,11 +58,59 @@ typedef struct {
 
 	PangoLayout 		*layout;
 
-	GPtrArray		*data_list;
-	GPtrArray		*plot_list;
+	GPtrArray		*series_list;	/* of EggGraphWidgetSeries */
 	GPtrArray		*legend_list;
+
+	/* what the decimated points were built for */
+	gint			 decimated_width;
+	gdouble			 decimated_start_x;
+	gdouble			 decimated_stop_x;
+
+	/* live mode scrolls what was drawn last time */
+	gdouble			 live_span;
+	cairo_surface_t		*live_surface;
+	gboolean		 live_dirty;
+	gdouble			 live_stop_x;
+	gdouble			 live_start_y;
+	gdouble			 live_stop_y;
+
+	/* zoom and pan */
+	gboolean		 use_zoom;
+	gboolean		 pan_active;
+	gdouble			 pan_x;
+	gdouble			 pan_start_x;
+	gdouble			 pan_stop_x;
+
+	/* static layers, redrawn only when the layout changes */
+	cairo_surface_t		*frame_surface;
+	cairo_surface_t		*labels_x_surface;
+	gboolean		 frame_dirty;
+	gint			 frame_width;
+	gint			 frame_height;
+	gdouble			 frame_start_y;
+	gdouble			 frame_stop_y;
+	gdouble			 labels_start_x;
+	gdouble			 labels_stop_x;
+	guint			 legend_width;
+	guint			 legend_height;
 } EggGraphWidgetPrivate;
 
+typedef struct {
+	GArray			*x;		/* of gdouble */
+	GArray			*y;		/* of gdouble */
+	GArray			*colors;	/* of guint32, or NULL for @color */
+	guint32			 color;
+	EggGraphWidgetPlot	 plot;
+	guint			 head;		/* oldest point when full */
+	guint			 limit;		/* or 0 for unbounded */
+	gboolean		 extents_valid;
+	gdouble			 min_x;
+	gdouble			 max_x;
+	gdouble			 min_y;
+	gdouble			 max_y;
+	GArray			*decimated;	/* of EggGraphPoint, or NULL if invalid */
+} EggGraphWidgetSeries;
+
 G_DEFINE_TYPE_WITH_PRIVATE (EggGraphWidget, egg_graph_widget, GTK_TYPE_DRAWING_AREA);
 #define GET_PRIVATE(o) (egg_graph_widget_get_instance_private (o))
 
@@ -84,14 +132,104 @@ enum
 	PROP_START_Y,
 	PROP_STOP_X,
 	PROP_STOP_Y,
+	PROP_LIVE_SPAN,
+	PROP_USE_ZOOM,
 	PROP_LAST
 };
 
+enum {
+	SIGNAL_RANGE_CHANGED,
+	SIGNAL_LAST
+};
+
+static guint signals[SIGNAL_LAST] = { 0 };
+
 typedef struct {
 	gchar		*desc;
 	guint32		 color;
 } EggGraphWidgetLegendData;
 
+static void
+egg_graph_widget_series_free (EggGraphWidgetSeries *series)
+{
+	g_array_unref (series->x);
+	g_array_unref (series->y);
+	if (series->colors != NULL)
+		g_array_unref (series->colors);
+	if (series->decimated != NULL)
+		g_array_unref (series->decimated);
+	g_free (series);
+}
+
+/* the array index of the @idx'th oldest point */
+static inline guint
+egg_graph_widget_series_index (EggGraphWidgetSeries *series, guint idx)
+{
+	idx += series->head;
+	if (idx >= series->x->len)
+		idx -= series->x->len;
+	return idx;
+}
+
+static inline gdouble
+egg_graph_widget_series_get_x (EggGraphWidgetSeries *series, guint idx)
+{
+	return g_array_index (series->x, gdouble,
+			      egg_graph_widget_series_index (series, idx));
+}
+
+static inline gdouble
+egg_graph_widget_series_get_y (EggGraphWidgetSeries *series, guint idx)
+{
+	return g_array_index (series->y, gdouble,
+			      egg_graph_widget_series_index (series, idx));
+}
+
+static guint32
+egg_graph_widget_series_get_color (EggGraphWidgetSeries *series, guint idx)
+{
+	if (series->colors == NULL)
+		return series->color;
+	return g_array_index (series->colors, guint32,
+			      egg_graph_widget_series_index (series, idx));
+}
+
+/* update the cached data range from array index @idx onwards */
+static void
+egg_graph_widget_series_update_extents (EggGraphWidgetSeries *series, guint idx)
+{
+	const gdouble *x = (const gdouble *) series->x->data;
+	const gdouble *y = (const gdouble *) series->y->data;
+	gdouble min_x = series->min_x;
+	gdouble max_x = series->max_x;
+	gdouble min_y = series->min_y;
+	gdouble max_y = series->max_y;
+	for (guint i = idx; i < series->x->len; i++) {
+		min_x = MIN (min_x, x[i]);
+		max_x = MAX (max_x, x[i]);
+		min_y = MIN (min_y, y[i]);
+		max_y = MAX (max_y, y[i]);
+	}
+	series->min_x = min_x;
+	series->max_x = max_x;
+	series->min_y = min_y;
+	series->max_y = max_y;
+}
+
+/* the range is only rebuilt when a minimum or maximum was overwritten */
+static void
+egg_graph_widget_series_ensure_extents (EggGraphWidgetSeries *series)
+{
+	if (series->extents_valid)
+		return;
+	series->min_x = G_MAXDOUBLE;
+	series->max_x = -G_MAXDOUBLE;
+	series->min_y = G_MAXDOUBLE;
+	series->max_y = -G_MAXDOUBLE;
+	egg_graph_widget_series_update_extents (series, 0);
+	series->extents_valid = TRUE;
+}
+
 static void
 egg_graph_widget_key_legend_data_free (EggGraphWidgetLegendData *legend_data)
 {
@@ -112,6 +250,7 @@ egg_graph_widget_key_legend_add (EggGraphWidget *graph, guint32 color, const gch
 	legend_data->color = color;
 	legend_data->desc = g_strdup (desc);
 	g_ptr_array_add (priv->legend_list, legend_data);
+	priv->frame_dirty = TRUE;
 }
 
 void
@@ -120,6 +259,7 @@ egg_graph_widget_key_legend_clear (EggGraphWidget *graph)
 	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
 	g_return_if_fail (EGG_IS_GRAPH_WIDGET (graph));
 	g_ptr_array_set_size (priv->legend_list, 0);
+	priv->frame_dirty = TRUE;
 }
 
 void
@@ -127,6 +267,7 @@ egg_graph_widget_set_use_legend (EggGraphWidget *graph, gboolean use_legend)
 {
 	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
 	priv->use_legend = use_legend;
+	priv->frame_dirty = TRUE;
 }
 
 gboolean
@@ -178,6 +319,12 @@ up_graph_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec
 	case PROP_STOP_Y:
 		g_value_set_double (value, priv->stop_y);
 		break;
+	case PROP_LIVE_SPAN:
+		g_value_set_double (value, priv->live_span);
+		break;
+	case PROP_USE_ZOOM:
+		g_value_set_boolean (value, priv->use_zoom);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -227,16 +374,115 @@ up_graph_set_property (GObject *object, guint prop_id, const GValue *value, GPar
 	case PROP_STOP_Y:
 		priv->stop_y = g_value_get_double (value);
 		break;
+	case PROP_LIVE_SPAN:
+		priv->live_span = g_value_get_double (value);
+		break;
+	case PROP_USE_ZOOM:
+		priv->use_zoom = g_value_get_boolean (value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
 	}
+	priv->live_dirty = TRUE;
+	priv->frame_dirty = TRUE;
 
 	/* refresh widget */
 	gtk_widget_hide (GTK_WIDGET (graph));
 	gtk_widget_show (GTK_WIDGET (graph));
 }
 
+/* the user has chosen a new X range */
+static void
+egg_graph_widget_set_range_x (EggGraphWidget *graph, gdouble start_x, gdouble stop_x)
+{
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+	if (stop_x - start_x < 1.f)
+		return;
+	priv->start_x = start_x;
+	priv->stop_x = stop_x;
+	priv->autorange_x = FALSE;
+	priv->live_span = 0.f;
+	priv->live_dirty = TRUE;
+	g_signal_emit (graph, signals[SIGNAL_RANGE_CHANGED], 0);
+	gtk_widget_queue_draw (GTK_WIDGET (graph));
+}
+
+static gboolean
+egg_graph_widget_scroll_event (GtkWidget *widget, GdkEventScroll *event)
+{
+	EggGraphWidget *graph = EGG_GRAPH_WIDGET (widget);
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+	gdouble factor;
+	gdouble data_x;
+
+	if (!priv->use_zoom || priv->unit_x <= 0.f)
+		return FALSE;
+	switch (event->direction) {
+	case GDK_SCROLL_UP:
+		factor = 0.8f;
+		break;
+	case GDK_SCROLL_DOWN:
+		factor = 1.25f;
+		break;
+	case GDK_SCROLL_SMOOTH:
+		factor = pow (1.25f, event->delta_y);
+		break;
+	default:
+		return FALSE;
+	}
+
+	/* keep the value under the pointer in the same place */
+	data_x = priv->start_x + (event->x - priv->box_x - 1) / priv->unit_x;
+	data_x = CLAMP (data_x, priv->start_x, priv->stop_x);
+	egg_graph_widget_set_range_x (graph,
+				      data_x - (data_x - priv->start_x) * factor,
+				      data_x + (priv->stop_x - data_x) * factor);
+	return TRUE;
+}
+
+static gboolean
+egg_graph_widget_button_press_event (GtkWidget *widget, GdkEventButton *event)
+{
+	EggGraphWidget *graph = EGG_GRAPH_WIDGET (widget);
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+
+	if (!priv->use_zoom || event->button != 1)
+		return FALSE;
+	priv->pan_active = TRUE;
+	priv->pan_x = event->x;
+	priv->pan_start_x = priv->start_x;
+	priv->pan_stop_x = priv->stop_x;
+	return TRUE;
+}
+
+static gboolean
+egg_graph_widget_button_release_event (GtkWidget *widget, GdkEventButton *event)
+{
+	EggGraphWidget *graph = EGG_GRAPH_WIDGET (widget);
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+	if (event->button != 1)
+		return FALSE;
+	priv->pan_active = FALSE;
+	return FALSE;
+}
+
+static gboolean
+egg_graph_widget_motion_notify_event (GtkWidget *widget, GdkEventMotion *event)
+{
+	EggGraphWidget *graph = EGG_GRAPH_WIDGET (widget);
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+	gdouble dx;
+
+	if (!priv->pan_active || priv->unit_x <= 0.f)
+		return FALSE;
+	dx = (event->x - priv->pan_x) / priv->unit_x;
+	egg_graph_widget_set_range_x (graph,
+				      priv->pan_start_x - dx,
+				      priv->pan_stop_x - dx);
+	return TRUE;
+}
+
 static void
 egg_graph_widget_class_init (EggGraphWidgetClass *class)
 {
@@ -244,6 +490,10 @@ egg_graph_widget_class_init (EggGraphWidgetClass *class)
 	GObjectClass *object_class = G_OBJECT_CLASS (class);
 
 	widget_class->draw = egg_graph_widget_draw;
+	widget_class->scroll_event = egg_graph_widget_scroll_event;
+	widget_class->button_press_event = egg_graph_widget_button_press_event;
+	widget_class->button_release_event = egg_graph_widget_button_release_event;
+	widget_class->motion_notify_event = egg_graph_widget_motion_notify_event;
 	object_class->get_property = up_graph_get_property;
 	object_class->set_property = up_graph_set_property;
 	object_class->finalize = egg_graph_widget_finalize;
@@ -313,6 +563,41 @@ egg_graph_widget_class_init (EggGraphWidgetClass *class)
 					 g_param_spec_double ("stop-y", NULL, NULL,
 							   -G_MAXDOUBLE, G_MAXDOUBLE, 100.f,
 							   G_PARAM_READWRITE));
+
+	/**
+	 * EggGraphWidget:live-span:
+	 *
+	 * If non-zero, the X axis always shows this much of the newest data and
+	 * new points scroll the existing plot rather than redrawing it.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_LIVE_SPAN,
+					 g_param_spec_double ("live-span", NULL, NULL,
+							   0.f, G_MAXDOUBLE, 0.f,
+							   G_PARAM_READWRITE));
+
+	/**
+	 * EggGraphWidget:use-zoom:
+	 *
+	 * If the X axis can be zoomed with the scroll wheel and panned by
+	 * dragging. This turns off autorange-x and live-span.
+	 */
+	g_object_class_install_property (object_class,
+					 PROP_USE_ZOOM,
+					 g_param_spec_boolean ("use-zoom", NULL, NULL,
+							       FALSE,
+							       G_PARAM_READWRITE));
+
+	/**
+	 * EggGraphWidget::range-changed:
+	 *
+	 * Emitted when the user zooms or pans the X axis.
+	 */
+	signals[SIGNAL_RANGE_CHANGED] =
+		g_signal_new ("range-changed",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, g_cclosure_marshal_VOID__VOID,
+			      G_TYPE_NONE, 0);
 }
 
 static void
@@ -329,10 +614,15 @@ egg_graph_widget_init (EggGraphWidget *graph)
 	priv->use_grid = TRUE;
 	priv->use_legend = FALSE;
 	priv->legend_list = g_ptr_array_new_with_free_func ((GDestroyNotify) egg_graph_widget_key_legend_data_free);
-	priv->data_list = g_ptr_array_new_with_free_func ((GDestroyNotify) g_ptr_array_unref);
-	priv->plot_list = g_ptr_array_new ();
+	priv->series_list = g_ptr_array_new_with_free_func ((GDestroyNotify) egg_graph_widget_series_free);
 	priv->type_x = EGG_GRAPH_WIDGET_KIND_TIME;
 	priv->type_y = EGG_GRAPH_WIDGET_KIND_PERCENTAGE;
+	gtk_widget_add_events (GTK_WIDGET (graph),
+			       GDK_SCROLL_MASK |
+			       GDK_SMOOTH_SCROLL_MASK |
+			       GDK_BUTTON_PRESS_MASK |
+			       GDK_BUTTON_RELEASE_MASK |
+			       GDK_BUTTON1_MOTION_MASK);
 
 	/* do pango stuff */
 	context = gtk_widget_get_pango_context (GTK_WIDGET (graph));
@@ -349,8 +639,8 @@ egg_graph_widget_data_clear (EggGraphWidget *graph)
 {
 	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
 	g_return_if_fail (EGG_IS_GRAPH_WIDGET (graph));
-	g_ptr_array_set_size (priv->data_list, 0);
-	g_ptr_array_set_size (priv->plot_list, 0);
+	g_ptr_array_set_size (priv->series_list, 0);
+	priv->live_dirty = TRUE;
 }
 
 static void
@@ -360,14 +650,171 @@ egg_graph_widget_finalize (GObject *object)
 	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
 
 	g_ptr_array_unref (priv->legend_list);
-	g_ptr_array_unref (priv->data_list);
-	g_ptr_array_unref (priv->plot_list);
+	g_ptr_array_unref (priv->series_list);
+	if (priv->live_surface != NULL)
+		cairo_surface_destroy (priv->live_surface);
+	if (priv->frame_surface != NULL)
+		cairo_surface_destroy (priv->frame_surface);
+	if (priv->labels_x_surface != NULL)
+		cairo_surface_destroy (priv->labels_x_surface);
 
 	g_object_unref (priv->layout);
 
 	G_OBJECT_CLASS (egg_graph_widget_parent_class)->finalize (object);
 }
 
+/**
+ * egg_graph_widget_data_add_values:
+ * @graph: This class instance
+ * @plot: the plot kind, e.g. %EGG_GRAPH_WIDGET_PLOT_LINE
+ * @x: an array of X values
+ * @y: an array of Y values
+ * @len: the number of values in @x and @y
+ * @color: the series color
+ *
+ * Adds a data series to the graph, copying the values.
+ *
+ * Returns: the series index, for use with egg_graph_widget_data_append()
+ **/
+guint
+egg_graph_widget_data_add_values (EggGraphWidget *graph,
+				  EggGraphWidgetPlot plot,
+				  const gdouble *x,
+				  const gdouble *y,
+				  guint len,
+				  guint32 color)
+{
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+	EggGraphWidgetSeries *series;
+
+	g_return_val_if_fail (EGG_IS_GRAPH_WIDGET (graph), G_MAXUINT);
+	g_return_val_if_fail (len == 0 || (x != NULL && y != NULL), G_MAXUINT);
+
+	series = g_new0 (EggGraphWidgetSeries, 1);
+	series->x = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), len);
+	series->y = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), len);
+	g_array_append_vals (series->x, x, len);
+	g_array_append_vals (series->y, y, len);
+	series->color = color;
+	series->plot = plot;
+	egg_graph_widget_series_ensure_extents (series);
+	g_ptr_array_add (priv->series_list, series);
+	priv->live_dirty = TRUE;
+
+	/* refresh */
+	gtk_widget_queue_draw (GTK_WIDGET (graph));
+	return priv->series_list->len - 1;
+}
+
+/* copy the newest @keep points into new arrays, oldest first */
+static void
+egg_graph_widget_series_linearize (EggGraphWidgetSeries *series, guint keep)
+{
+	GArray *x = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), keep);
+	GArray *y = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), keep);
+	GArray *colors = NULL;
+	guint len = series->x->len;
+
+	if (series->colors != NULL)
+		colors = g_array_sized_new (FALSE, FALSE, sizeof (guint32), keep);
+	for (guint i = len - MIN (keep, len); i < len; i++) {
+		gdouble tmp = egg_graph_widget_series_get_x (series, i);
+		g_array_append_val (x, tmp);
+		tmp = egg_graph_widget_series_get_y (series, i);
+		g_array_append_val (y, tmp);
+		if (colors != NULL) {
+			guint32 color = egg_graph_widget_series_get_color (series, i);
+			g_array_append_val (colors, color);
+		}
+	}
+	g_array_unref (series->x);
+	g_array_unref (series->y);
+	if (series->colors != NULL)
+		g_array_unref (series->colors);
+	series->x = x;
+	series->y = y;
+	series->colors = colors;
+	series->head = 0;
+	series->extents_valid = FALSE;
+}
+
+/**
+ * egg_graph_widget_data_set_limit:
+ * @graph: This class instance
+ * @idx: the series index
+ * @limit: the maximum number of points, or 0 for no limit
+ *
+ * Sets the maximum number of points kept for a series. When the limit is
+ * reached each appended point replaces the oldest one. Any points over the
+ * new limit are dropped, oldest first.
+ **/
+void
+egg_graph_widget_data_set_limit (EggGraphWidget *graph, guint idx, guint limit)
+{
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+	EggGraphWidgetSeries *series;
+
+	g_return_if_fail (EGG_IS_GRAPH_WIDGET (graph));
+	g_return_if_fail (idx < priv->series_list->len);
+
+	series = g_ptr_array_index (priv->series_list, idx);
+	egg_graph_widget_series_linearize (series,
+					   limit > 0 ? limit : series->x->len);
+	series->limit = limit;
+	g_clear_pointer (&series->decimated, g_array_unref);
+	priv->live_dirty = TRUE;
+	gtk_widget_queue_draw (GTK_WIDGET (graph));
+}
+
+/**
+ * egg_graph_widget_data_append:
+ * @graph: This class instance
+ * @idx: the series index
+ * @x: the X value, normally newer than any existing point
+ * @y: the Y value
+ *
+ * Adds one point to the end of an existing series.
+ **/
+void
+egg_graph_widget_data_append (EggGraphWidget *graph, guint idx, gdouble x, gdouble y)
+{
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+	EggGraphWidgetSeries *series;
+
+	g_return_if_fail (EGG_IS_GRAPH_WIDGET (graph));
+	g_return_if_fail (idx < priv->series_list->len);
+
+	series = g_ptr_array_index (priv->series_list, idx);
+	if (series->limit == 0 || series->x->len < series->limit) {
+		g_array_append_val (series->x, x);
+		g_array_append_val (series->y, y);
+		if (series->colors != NULL)
+			g_array_append_val (series->colors, series->color);
+	} else {
+		gdouble *old_x = &g_array_index (series->x, gdouble, series->head);
+		gdouble *old_y = &g_array_index (series->y, gdouble, series->head);
+
+		/* overwriting the edge of the range needs a rescan */
+		if (*old_x <= series->min_x || *old_x >= series->max_x ||
+		    *old_y <= series->min_y || *old_y >= series->max_y)
+			series->extents_valid = FALSE;
+		*old_x = x;
+		*old_y = y;
+		if (series->colors != NULL)
+			g_array_index (series->colors, guint32, series->head) = series->color;
+		series->head = (series->head + 1) % series->limit;
+	}
+
+	/* running range */
+	series->min_x = MIN (series->min_x, x);
+	series->max_x = MAX (series->max_x, x);
+	series->min_y = MIN (series->min_y, y);
+	series->max_y = MAX (series->max_y, y);
+
+	g_clear_pointer (&series->decimated, g_array_unref);
+	gtk_widget_queue_draw (GTK_WIDGET (graph));
+}
+
 /**
  * egg_graph_widget_data_add:
  * @graph: This class instance
@@ -379,26 +826,45 @@ void
 egg_graph_widget_data_add (EggGraphWidget *graph, EggGraphWidgetPlot plot, GPtrArray *data)
 {
 	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
-	GPtrArray *copy;
+	EggGraphWidgetSeries *series;
 	EggGraphPoint *obj;
+	guint32 color = 0x0;
 	guint i;
+	g_autoptr(GArray) x = NULL;
+	g_autoptr(GArray) y = NULL;
+	g_autoptr(GArray) colors = NULL;
 
 	g_return_if_fail (data != NULL);
 	g_return_if_fail (EGG_IS_GRAPH_WIDGET (graph));
 
-	/* make a deep copy */
-	copy = g_ptr_array_new_with_free_func ((GDestroyNotify) egg_graph_point_free);
+	/* split into arrays */
+	x = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), data->len);
+	y = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), data->len);
+	colors = g_array_sized_new (FALSE, FALSE, sizeof (guint32), data->len);
 	for (i = 0; i < data->len; i++) {
-		obj = egg_graph_point_copy (g_ptr_array_index (data, i));
-		g_ptr_array_add (copy, obj);
+		obj = g_ptr_array_index (data, i);
+		g_array_append_val (x, obj->x);
+		g_array_append_val (y, obj->y);
+		g_array_append_val (colors, obj->color);
+	}
+	if (data->len > 0) {
+		obj = g_ptr_array_index (data, 0);
+		color = obj->color;
+	}
+	egg_graph_widget_data_add_values (graph, plot,
+					  (const gdouble *) x->data,
+					  (const gdouble *) y->data,
+					  x->len, color);
+
+	/* only keep per-point colors if they are actually different */
+	for (i = 0; i < colors->len; i++) {
+		if (g_array_index (colors, guint32, i) != color) {
+			series = g_ptr_array_index (priv->series_list,
+						    priv->series_list->len - 1);
+			series->colors = g_steal_pointer (&colors);
+			break;
+		}
 	}
-
-	/* get the new data */
-	g_ptr_array_add (priv->data_list, copy);
-	g_ptr_array_add (priv->plot_list, GUINT_TO_POINTER(plot));
-
-	/* refresh */
-	gtk_widget_queue_draw (GTK_WIDGET (graph));
 }
 
 static gchar *
@@ -506,19 +972,16 @@ egg_graph_widget_draw_grid (EggGraphWidget *graph, cairo_t *cr)
 }
 
 static void
-egg_graph_widget_draw_labels (EggGraphWidget *graph, cairo_t *cr)
+egg_graph_widget_draw_labels_x (EggGraphWidget *graph, cairo_t *cr)
 {
 	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
 	guint i;
 	gdouble b;
 	gdouble value;
 	gdouble divwidth  = (gdouble)priv->box_width / 10.0f;
-	gdouble divheight = (gdouble)priv->box_height / 10.0f;
 	gdouble length_x = priv->stop_x - priv->start_x;
-	gdouble length_y = priv->stop_y - priv->start_y;
 	PangoRectangle ink_rect, logical_rect;
 	gdouble offsetx = 0;
-	gdouble offsety = 0;
 
 	cairo_save (cr);
 
@@ -546,7 +1009,26 @@ egg_graph_widget_draw_labels (EggGraphWidget *graph, cairo_t *cr)
 		pango_cairo_show_layout (cr, priv->layout);
 	}
 
+	cairo_restore (cr);
+}
+
+static void
+egg_graph_widget_draw_labels_y (EggGraphWidget *graph, cairo_t *cr)
+{
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+	guint i;
+	gdouble b;
+	gdouble value;
+	gdouble divheight = (gdouble)priv->box_height / 10.0f;
+	gdouble length_y = priv->stop_y - priv->start_y;
+	PangoRectangle ink_rect, logical_rect;
+	gdouble offsetx = 0;
+	gdouble offsety = 0;
+
+	cairo_save (cr);
+
 	/* do y text */
+	cairo_set_source_rgb (cr, 0.2f, 0.2f, 0.2f);
 	for (i = 0; i < 11; i++) {
 		g_autofree gchar *text = NULL;
 		b = priv->box_y + ((gdouble) i * divheight);
@@ -669,21 +1151,20 @@ static void
 egg_graph_widget_autorange_x (EggGraphWidget *graph)
 {
 	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
-	EggGraphPoint *point;
+	EggGraphWidgetSeries *series;
 	GPtrArray *array;
-	GPtrArray *data;
-	gdouble biggest_x = G_MINFLOAT;
-	gdouble smallest_x = G_MAXFLOAT;
+	gdouble biggest_x = -G_MAXDOUBLE;
+	gdouble smallest_x = G_MAXDOUBLE;
 	guint rounding_x = 1;
-	guint i, j;
+	guint j;
 	guint len = 0;
 
-	array = priv->data_list;
+	array = priv->series_list;
 
 	/* find out if we have no data */
 	for (j = 0; j < array->len; j++) {
-		data = g_ptr_array_index (array, j);
-		len = data->len;
+		series = g_ptr_array_index (array, j);
+		len = series->x->len;
 		if (len > 0)
 			break;
 	}
@@ -698,14 +1179,14 @@ egg_graph_widget_autorange_x (EggGraphWidget *graph)
 
 	/* get the range for the graph */
 	for (j = 0; j < array->len; j++) {
-		data = g_ptr_array_index (array, j);
-		for (i = 0; i < data->len; i++) {
-			point = (EggGraphPoint *) g_ptr_array_index (data, i);
-			if (point->x > biggest_x)
-				biggest_x = point->x;
-			if (point->x < smallest_x)
-				smallest_x = point->x;
-		}
+		series = g_ptr_array_index (array, j);
+		if (series->x->len == 0)
+			continue;
+		egg_graph_widget_series_ensure_extents (series);
+		if (series->max_x > biggest_x)
+			biggest_x = series->max_x;
+		if (series->min_x < smallest_x)
+			smallest_x = series->min_x;
 	}
 	g_debug ("Data range is %f<x<%f", smallest_x, biggest_x);
 	/* don't allow no difference */
@@ -768,21 +1249,20 @@ static void
 egg_graph_widget_autorange_y (EggGraphWidget *graph)
 {
 	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
-	gdouble biggest_y = G_MINFLOAT;
-	gdouble smallest_y = G_MAXFLOAT;
+	gdouble biggest_y = -G_MAXDOUBLE;
+	gdouble smallest_y = G_MAXDOUBLE;
 	guint rounding_y = 1;
-	GPtrArray *data;
-	EggGraphPoint *point;
-	guint i, j;
+	EggGraphWidgetSeries *series;
+	guint j;
 	guint len = 0;
 	GPtrArray *array;
 
-	array = priv->data_list;
+	array = priv->series_list;
 
 	/* find out if we have no data */
 	for (j = 0; j < array->len; j++) {
-		data = g_ptr_array_index (array, j);
-		len = data->len;
+		series = g_ptr_array_index (array, j);
+		len = series->x->len;
 		if (len > 0)
 			break;
 	}
@@ -797,14 +1277,14 @@ egg_graph_widget_autorange_y (EggGraphWidget *graph)
 
 	/* get the range for the graph */
 	for (j = 0; j < array->len; j++) {
-		data = g_ptr_array_index (array, j);
-		for (i=0; i < data->len; i++) {
-			point = (EggGraphPoint *) g_ptr_array_index (data, i);
-			if (point->y > biggest_y)
-				biggest_y = point->y;
-			if (point->y < smallest_y)
-				smallest_y = point->y;
-		}
+		series = g_ptr_array_index (array, j);
+		if (series->y->len == 0)
+			continue;
+		egg_graph_widget_series_ensure_extents (series);
+		if (series->max_y > biggest_y)
+			biggest_y = series->max_y;
+		if (series->min_y < smallest_y)
+			smallest_y = series->min_y;
 	}
 	g_debug ("Data range is %f<y<%f", smallest_y, biggest_y);
 	/* don't allow no difference */
@@ -921,94 +1401,320 @@ egg_graph_widget_draw_dot (cairo_t *cr, gdouble x, gdouble y, guint32 color)
 }
 
 static void
-egg_graph_widget_draw_line (EggGraphWidget *graph, cairo_t *cr)
+egg_graph_widget_decimate_append (GArray *out, EggGraphWidgetSeries *series, guint idx)
+{
+	EggGraphPoint point;
+	point.x = egg_graph_widget_series_get_x (series, idx);
+	point.y = egg_graph_widget_series_get_y (series, idx);
+	point.color = egg_graph_widget_series_get_color (series, idx);
+	g_array_append_val (out, point);
+}
+
+/* keep the first, last, lowest and highest point, in order */
+static void
+egg_graph_widget_decimate_flush (GArray *out,
+				 EggGraphWidgetSeries *series,
+				 guint first,
+				 guint min,
+				 guint max,
+				 guint last)
+{
+	guint tmp;
+	if (min > max) {
+		tmp = min;
+		min = max;
+		max = tmp;
+	}
+	egg_graph_widget_decimate_append (out, series, first);
+	if (min != first && min != last)
+		egg_graph_widget_decimate_append (out, series, min);
+	if (max != first && max != last && max != min)
+		egg_graph_widget_decimate_append (out, series, max);
+	if (last != first)
+		egg_graph_widget_decimate_append (out, series, last);
+}
+
+/**
+ * egg_graph_widget_decimate:
+ * @graph: This class instance
+ * @series: a data series
+ *
+ * Reduces the data to at most four points per pixel column, which draws the
+ * same line as using every point. Points outside the x range are dropped.
+ **/
+static GArray *
+egg_graph_widget_decimate (EggGraphWidget *graph, EggGraphWidgetSeries *series)
 {
 	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
-	GPtrArray *data;
-	GPtrArray *array;
-	EggGraphWidgetPlot plot;
-	EggGraphPoint *point;
-	gdouble x, y;
-	guint i, j;
+	GArray *out;
+	gboolean have_first = FALSE;
+	gint column_last = -1;
+	guint32 color_last = 0;
+	guint first = 0;
+	guint min = 0;
+	guint max = 0;
+	guint last = 0;
+	guint reserve = MAX (priv->box_width, 1) * 4;
+
+	out = g_array_sized_new (FALSE, FALSE, sizeof (EggGraphPoint),
+				 MIN (series->x->len, reserve));
+	for (guint i = 0; i < series->x->len; i++) {
+		gdouble x = egg_graph_widget_series_get_x (series, i);
+		gdouble y = egg_graph_widget_series_get_y (series, i);
+		guint32 color;
+		gint column;
+
+		/* ignore anything out of range */
+		if (x < priv->start_x || x > priv->stop_x)
+			continue;
 
-	if (priv->data_list->len == 0) {
-		g_debug ("no data");
-		return;
+		/* new pixel column, or the color changed */
+		column = (gint) ((x - priv->start_x) * priv->unit_x);
+		color = egg_graph_widget_series_get_color (series, i);
+		if (!have_first || column != column_last || color != color_last) {
+			if (have_first)
+				egg_graph_widget_decimate_flush (out, series, first, min, max, last);
+			first = min = max = last = i;
+			column_last = column;
+			color_last = color;
+			have_first = TRUE;
+			continue;
+		}
+		if (y < egg_graph_widget_series_get_y (series, min))
+			min = i;
+		if (y > egg_graph_widget_series_get_y (series, max))
+			max = i;
+		last = i;
 	}
-	cairo_save (cr);
+	if (have_first)
+		egg_graph_widget_decimate_flush (out, series, first, min, max, last);
+	return out;
+}
 
-	array = priv->data_list;
+static void
+egg_graph_widget_decimate_ensure (EggGraphWidget *graph)
+{
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
 
-	/* do each line */
-	for (j = 0; j < array->len; j++) {
-		data = g_ptr_array_index (array, j);
-		if (data->len == 0)
+	/* allocation or range changed, so invalidate everything */
+	if (priv->decimated_width != priv->box_width ||
+	    priv->decimated_start_x != priv->start_x ||
+	    priv->decimated_stop_x != priv->stop_x) {
+		for (guint i = 0; i < priv->series_list->len; i++) {
+			EggGraphWidgetSeries *series = g_ptr_array_index (priv->series_list, i);
+			g_clear_pointer (&series->decimated, g_array_unref);
+		}
+		priv->decimated_width = priv->box_width;
+		priv->decimated_start_x = priv->start_x;
+		priv->decimated_stop_x = priv->stop_x;
+	}
+
+	/* only rebuild series that are new */
+	for (guint i = 0; i < priv->series_list->len; i++) {
+		EggGraphWidgetSeries *series = g_ptr_array_index (priv->series_list, i);
+		if (series->decimated != NULL)
 			continue;
-		plot = GPOINTER_TO_UINT (g_ptr_array_index (priv->plot_list, j));
+		series->decimated = egg_graph_widget_decimate (graph, series);
+		g_debug ("decimated %u points to %u",
+			 series->x->len, series->decimated->len);
+	}
+}
+
+static void
+egg_graph_widget_draw_points (EggGraphWidget *graph,
+			      cairo_t *cr,
+			      EggGraphWidgetPlot plot,
+			      GArray *data)
+{
+	EggGraphPoint *point;
+	gdouble x, y;
+	guint i;
 
-		/* get the very first point so we can work out the old */
-		point = (EggGraphPoint *) g_ptr_array_index (data, 0);
-		x = 0;
-		y = 0;
-		egg_graph_widget_get_pos_on_graph (graph, point->x, point->y, &x, &y);
+	if (data->len == 0)
+		return;
 
-		/* plot points */
-		if (plot == EGG_GRAPH_WIDGET_PLOT_POINTS || plot == EGG_GRAPH_WIDGET_PLOT_BOTH) {
+	/* plot points */
+	if (plot == EGG_GRAPH_WIDGET_PLOT_POINTS || plot == EGG_GRAPH_WIDGET_PLOT_BOTH) {
+		for (i = 0; i < data->len; i++) {
+			point = &g_array_index (data, EggGraphPoint, i);
+			egg_graph_widget_get_pos_on_graph (graph, point->x, point->y, &x, &y);
 			egg_graph_widget_draw_dot (cr, x, y, point->color);
-			for (i = 1; i < data->len; i++) {
-				point = (EggGraphPoint *) g_ptr_array_index (data, i);
-				egg_graph_widget_get_pos_on_graph (graph, point->x, point->y, &x, &y);
-				egg_graph_widget_draw_dot (cr, x, y, point->color);
-			}
 		}
+	}
+
+	/* plot lines */
+	if (plot == EGG_GRAPH_WIDGET_PLOT_LINE || plot == EGG_GRAPH_WIDGET_PLOT_BOTH) {
 
-		/* plot lines */
-		if (plot == EGG_GRAPH_WIDGET_PLOT_LINE || plot == EGG_GRAPH_WIDGET_PLOT_BOTH) {
-
-			guint32 old_color = 0xffffff;
-			cairo_set_line_width (cr, 1.5);
-
-			for (i = 1; i < data->len; i++) {
-				point = (EggGraphPoint *) g_ptr_array_index (data, i);
-
-				/* ignore anything out of range */
-				if (point->x < priv->start_x ||
-				    point->x > priv->stop_x) {
-					continue;
-				}
-
-				/* ignore white lines */
-				if (point->color == 0xffffff)
-					continue;
-
-				/* is graph color the same */
-				egg_graph_widget_get_pos_on_graph (graph,
-								  point->x,
-								  point->y,
-								  &x, &y);
-				if (point->color == old_color) {
-					cairo_line_to (cr, x, y);
-					continue;
-				}
-
-				/* finish previous line */
-				if (i != 1)
-					cairo_stroke (cr);
-
-				/* start new color line */
-				old_color = point->color;
-				cairo_move_to (cr, x, y);
-				egg_graph_widget_set_color (cr, point->color);
+		guint32 old_color = 0xffffff;
+		cairo_set_line_width (cr, 1.5);
+
+		for (i = 1; i < data->len; i++) {
+			point = &g_array_index (data, EggGraphPoint, i);
+
+			/* ignore white lines */
+			if (point->color == 0xffffff)
+				continue;
+
+			/* is graph color the same */
+			egg_graph_widget_get_pos_on_graph (graph,
+							  point->x,
+							  point->y,
+							  &x, &y);
+			if (point->color == old_color) {
+				cairo_line_to (cr, x, y);
+				continue;
 			}
 
-			/* finish current line */
-			cairo_stroke (cr);
+			/* finish previous line */
+			if (i != 1)
+				cairo_stroke (cr);
+
+			/* start new color line */
+			old_color = point->color;
+			cairo_move_to (cr, x, y);
+			egg_graph_widget_set_color (cr, point->color);
 		}
+
+		/* finish current line */
+		cairo_stroke (cr);
+	}
+}
+
+static void
+egg_graph_widget_draw_line (EggGraphWidget *graph, cairo_t *cr)
+{
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+
+	if (priv->series_list->len == 0) {
+		g_debug ("no data");
+		return;
+	}
+	egg_graph_widget_decimate_ensure (graph);
+	cairo_save (cr);
+
+	/* do each line */
+	for (guint j = 0; j < priv->series_list->len; j++) {
+		EggGraphWidgetSeries *series = g_ptr_array_index (priv->series_list, j);
+		egg_graph_widget_draw_points (graph, cr, series->plot, series->decimated);
 	}
 
 	cairo_restore (cr);
 }
 
+/* just the points newer than @start_x, and the one before for the join */
+static void
+egg_graph_widget_draw_line_strip (EggGraphWidget *graph, cairo_t *cr, gdouble start_x)
+{
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+
+	cairo_save (cr);
+	for (guint j = 0; j < priv->series_list->len; j++) {
+		EggGraphWidgetSeries *series = g_ptr_array_index (priv->series_list, j);
+		g_autoptr(GArray) data = g_array_new (FALSE, FALSE, sizeof (EggGraphPoint));
+		guint i = series->x->len;
+
+		while (i > 0) {
+			i--;
+			if (egg_graph_widget_series_get_x (series, i) < start_x)
+				break;
+		}
+		for (; i < series->x->len; i++)
+			egg_graph_widget_decimate_append (data, series, i);
+		egg_graph_widget_draw_points (graph, cr, series->plot, data);
+	}
+	cairo_restore (cr);
+}
+
+/**
+ * egg_graph_widget_draw_live:
+ * @graph: This class instance
+ * @cr: Cairo drawing context
+ *
+ * Draws the data from a cached surface, scrolled left by however much the
+ * newest data has moved since the last draw. Only the newly exposed strip
+ * is drawn, unless the size or Y range has changed.
+ **/
+static void
+egg_graph_widget_draw_live (EggGraphWidget *graph, cairo_t *cr)
+{
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+	cairo_surface_t *surface;
+	cairo_t *cr_surface;
+	gint shift = priv->box_width;
+
+	/* can we reuse the previous plot */
+	if (priv->live_surface != NULL &&
+	    !priv->live_dirty &&
+	    cairo_image_surface_get_width (priv->live_surface) == priv->box_width &&
+	    cairo_image_surface_get_height (priv->live_surface) == priv->box_height &&
+	    priv->live_start_y == priv->start_y &&
+	    priv->live_stop_y == priv->stop_y &&
+	    priv->stop_x >= priv->live_stop_x) {
+		shift = (gint) ((priv->stop_x - priv->live_stop_x) * priv->unit_x);
+	}
+
+	surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+					      priv->box_width,
+					      priv->box_height);
+	cr_surface = cairo_create (surface);
+	cairo_translate (cr_surface, -priv->box_x, -priv->box_y);
+	if (shift < priv->box_width) {
+		gdouble strip_x = priv->box_x + priv->box_width - shift - 3;
+
+		/* move the old plot left */
+		cairo_set_source_surface (cr_surface, priv->live_surface,
+					  priv->box_x - shift, priv->box_y);
+		cairo_paint (cr_surface);
+		priv->live_stop_x += (gdouble) shift / priv->unit_x;
+
+		/* clear and draw the exposed strip */
+		cairo_rectangle (cr_surface, strip_x, priv->box_y,
+				 priv->box_x + priv->box_width - strip_x,
+				 priv->box_height);
+		cairo_clip (cr_surface);
+		cairo_set_operator (cr_surface, CAIRO_OPERATOR_CLEAR);
+		cairo_paint (cr_surface);
+		cairo_set_operator (cr_surface, CAIRO_OPERATOR_OVER);
+		egg_graph_widget_draw_line_strip (graph, cr_surface,
+						  priv->start_x + (strip_x - priv->box_x - 1) / priv->unit_x);
+	} else {
+		egg_graph_widget_draw_line (graph, cr_surface);
+		priv->live_stop_x = priv->stop_x;
+	}
+	cairo_destroy (cr_surface);
+
+	/* save for next time */
+	if (priv->live_surface != NULL)
+		cairo_surface_destroy (priv->live_surface);
+	priv->live_surface = surface;
+	priv->live_start_y = priv->start_y;
+	priv->live_stop_y = priv->stop_y;
+	priv->live_dirty = FALSE;
+
+	cairo_set_source_surface (cr, surface, priv->box_x, priv->box_y);
+	cairo_paint (cr);
+}
+
+/* show the newest data only */
+static void
+egg_graph_widget_live_range (EggGraphWidget *graph)
+{
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+	gdouble biggest_x = -G_MAXDOUBLE;
+
+	for (guint j = 0; j < priv->series_list->len; j++) {
+		EggGraphWidgetSeries *series = g_ptr_array_index (priv->series_list, j);
+		if (series->x->len == 0)
+			continue;
+		egg_graph_widget_series_ensure_extents (series);
+		biggest_x = MAX (biggest_x, series->max_x);
+	}
+	if (biggest_x == -G_MAXDOUBLE)
+		biggest_x = priv->live_span;
+	priv->stop_x = biggest_x;
+	priv->start_x = biggest_x - priv->live_span;
+}
+
 /**
  * egg_graph_widget_draw_bounding_box:
  * @cr: Cairo drawing context
@@ -1104,14 +1810,50 @@ egg_graph_widget_legend_calculate_size (EggGraphWidget *graph, cairo_t *cr,
 	return TRUE;
 }
 
+/* everything that only changes with the size, Y range or legend */
+static void
+egg_graph_widget_draw_frame (EggGraphWidget *graph, cairo_t *cr)
+{
+	EggGraphWidgetPrivate *priv = GET_PRIVATE (graph);
+
+	/* graph background */
+	egg_graph_widget_draw_bounding_box (cr, priv->box_x, priv->box_y,
+				     priv->box_width, priv->box_height);
+	if (priv->use_grid)
+		egg_graph_widget_draw_grid (graph, cr);
+
+	/* solid outline box */
+	cairo_rectangle (cr, priv->box_x + 0.5f, priv->box_y + 0.5f,
+			 priv->box_width - 1, priv->box_height - 1);
+	cairo_set_source_rgb (cr, 0.6f, 0.6f, 0.6f);
+	cairo_set_line_width (cr, 1);
+	cairo_stroke (cr);
+
+	egg_graph_widget_draw_labels_y (graph, cr);
+
+	if (priv->use_legend && priv->legend_height > 0) {
+		egg_graph_widget_draw_legend (graph, cr,
+					      priv->box_x + priv->box_width + 6,
+					      priv->box_y,
+					      priv->legend_width,
+					      priv->legend_height);
+	}
+}
+
+static cairo_surface_t *
+egg_graph_widget_layer_new (cairo_t *cr, GtkAllocation *allocation)
+{
+	return cairo_surface_create_similar (cairo_get_target (cr),
+					     CAIRO_CONTENT_COLOR_ALPHA,
+					     allocation->width,
+					     allocation->height);
+}
+
 static gboolean
 egg_graph_widget_draw (GtkWidget *widget, cairo_t *cr)
 {
 	GtkAllocation allocation;
-	gint legend_x = 0;
-	gint legend_y = 0;
-	guint legend_height = 0;
-	guint legend_width = 0;
+	gboolean use_cache;
 	gdouble data_x;
 	gdouble data_y;
 
@@ -1120,11 +1862,12 @@ egg_graph_widget_draw (GtkWidget *widget, cairo_t *cr)
 	g_return_val_if_fail (graph != NULL, FALSE);
 	g_return_val_if_fail (EGG_IS_GRAPH_WIDGET (graph), FALSE);
 
-	egg_graph_widget_legend_calculate_size (graph, cr, &legend_width, &legend_height);
 	cairo_save (cr);
 
 	/* we need this so we know the y text */
-	if (priv->autorange_x)
+	if (priv->live_span > 0)
+		egg_graph_widget_live_range (graph);
+	else if (priv->autorange_x)
 		egg_graph_widget_autorange_x (graph);
 	if (priv->autorange_y)
 		egg_graph_widget_autorange_y (graph);
@@ -1137,35 +1880,44 @@ egg_graph_widget_draw (GtkWidget *widget, cairo_t *cr)
 			priv->stop_y = -priv->start_y;
 	}
 
-	priv->box_x = egg_graph_widget_get_y_label_max_width (graph, cr) + 10;
-	priv->box_y = 5;
-
+	/* vector output has to be drawn every time */
+	use_cache = cairo_surface_get_type (cairo_get_target (cr)) != CAIRO_SURFACE_TYPE_SVG;
 	gtk_widget_get_allocation (widget, &allocation);
-	priv->box_height = allocation.height - (20 + priv->box_y);
-
-	/* make size adjustment for legend */
-	if (priv->use_legend && legend_height > 0) {
-		priv->box_width = allocation.width -
-					 (3 + legend_width + 5 + priv->box_x);
-		legend_x = priv->box_x + priv->box_width + 6;
-		legend_y = priv->box_y;
-	} else {
-		priv->box_width = allocation.width -
-					 (3 + priv->box_x);
+	if (priv->frame_surface == NULL ||
+	    priv->frame_dirty ||
+	    priv->frame_width != allocation.width ||
+	    priv->frame_height != allocation.height ||
+	    priv->frame_start_y != priv->start_y ||
+	    priv->frame_stop_y != priv->stop_y) {
+		if (priv->frame_surface != NULL) {
+			cairo_surface_destroy (priv->frame_surface);
+			priv->frame_surface = NULL;
+		}
+		if (priv->labels_x_surface != NULL) {
+			cairo_surface_destroy (priv->labels_x_surface);
+			priv->labels_x_surface = NULL;
+		}
+		use_cache = FALSE;
 	}
 
-	/* graph background */
-	egg_graph_widget_draw_bounding_box (cr, priv->box_x, priv->box_y,
-				     priv->box_width, priv->box_height);
-	if (priv->use_grid)
-		egg_graph_widget_draw_grid (graph, cr);
-
-	/* solid outline box */
-	cairo_rectangle (cr, priv->box_x + 0.5f, priv->box_y + 0.5f,
-			 priv->box_width - 1, priv->box_height - 1);
-	cairo_set_source_rgb (cr, 0.6f, 0.6f, 0.6f);
-	cairo_set_line_width (cr, 1);
-	cairo_stroke (cr);
+	/* the text sizes need Pango, so only work out the layout when needed */
+	if (!use_cache) {
+		egg_graph_widget_legend_calculate_size (graph, cr,
+							&priv->legend_width,
+							&priv->legend_height);
+		priv->box_x = egg_graph_widget_get_y_label_max_width (graph, cr) + 10;
+		priv->box_y = 5;
+		priv->box_height = allocation.height - (20 + priv->box_y);
+
+		/* make size adjustment for legend */
+		if (priv->use_legend && priv->legend_height > 0) {
+			priv->box_width = allocation.width -
+						 (3 + priv->legend_width + 5 + priv->box_x);
+		} else {
+			priv->box_width = allocation.width -
+						 (3 + priv->box_x);
+		}
+	}
 
 	/* -3 is so we can keep the lines inside the box at both extremes */
 	data_x = priv->stop_x - priv->start_x;
@@ -1173,11 +1925,49 @@ egg_graph_widget_draw (GtkWidget *widget, cairo_t *cr)
 	priv->unit_x = (gdouble)(priv->box_width - 3) / (gdouble) data_x;
 	priv->unit_y = (gdouble)(priv->box_height - 3) / (gdouble) data_y;
 
-	egg_graph_widget_draw_labels (graph, cr);
-	egg_graph_widget_draw_line (graph, cr);
+	if (cairo_surface_get_type (cairo_get_target (cr)) == CAIRO_SURFACE_TYPE_SVG) {
+		egg_graph_widget_draw_frame (graph, cr);
+		egg_graph_widget_draw_labels_x (graph, cr);
+	} else {
+		/* static layer */
+		if (priv->frame_surface == NULL) {
+			cairo_t *cr_layer;
+			priv->frame_surface = egg_graph_widget_layer_new (cr, &allocation);
+			cr_layer = cairo_create (priv->frame_surface);
+			egg_graph_widget_draw_frame (graph, cr_layer);
+			cairo_destroy (cr_layer);
+			priv->frame_width = allocation.width;
+			priv->frame_height = allocation.height;
+			priv->frame_start_y = priv->start_y;
+			priv->frame_stop_y = priv->stop_y;
+			priv->frame_dirty = FALSE;
+		}
+
+		/* the X labels also change when scrolling */
+		if (priv->labels_x_surface == NULL ||
+		    priv->labels_start_x != priv->start_x ||
+		    priv->labels_stop_x != priv->stop_x) {
+			cairo_t *cr_layer;
+			if (priv->labels_x_surface != NULL)
+				cairo_surface_destroy (priv->labels_x_surface);
+			priv->labels_x_surface = egg_graph_widget_layer_new (cr, &allocation);
+			cr_layer = cairo_create (priv->labels_x_surface);
+			egg_graph_widget_draw_labels_x (graph, cr_layer);
+			cairo_destroy (cr_layer);
+			priv->labels_start_x = priv->start_x;
+			priv->labels_stop_x = priv->stop_x;
+		}
+		cairo_set_source_surface (cr, priv->frame_surface, 0, 0);
+		cairo_paint (cr);
+		cairo_set_source_surface (cr, priv->labels_x_surface, 0, 0);
+		cairo_paint (cr);
+	}
 
-	if (priv->use_legend && legend_height > 0)
-		egg_graph_widget_draw_legend (graph, cr, legend_x, legend_y, legend_width, legend_height);
+	/* data layer */
+	if (priv->live_span > 0)
+		egg_graph_widget_draw_live (graph, cr);
+	else
+		egg_graph_widget_draw_line (graph, cr);
 
 	cairo_restore (cr);
 	return FALSE;
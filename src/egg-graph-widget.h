@@ -70,6 +70,19 @@ void		 egg_graph_widget_data_clear		(EggGraphWidget		*graph);
 void		 egg_graph_widget_data_add		(EggGraphWidget		*graph,
 							 EggGraphWidgetPlot	 plot,
 							 GPtrArray		*array);
+guint		 egg_graph_widget_data_add_values	(EggGraphWidget		*graph,
+							 EggGraphWidgetPlot	 plot,
+							 const gdouble		*x,
+							 const gdouble		*y,
+							 guint			 len,
+							 guint32		 color);
+void		 egg_graph_widget_data_set_limit	(EggGraphWidget		*graph,
+							 guint			 idx,
+							 guint			 limit);
+void		 egg_graph_widget_data_append		(EggGraphWidget		*graph,
+							 guint			 idx,
+							 gdouble		 x,
+							 gdouble		 y);
 void		 egg_graph_widget_key_legend_clear	(EggGraphWidget		*graph);
 void		 egg_graph_widget_key_legend_add	(EggGraphWidget		*graph,
 							 guint32		 color,
@@ -0,0 +1,341 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+#include <glib-unix.h>
+#include <locale.h>
+#include <stdlib.h>
+
+#include "generated-gdbus.h"
+
+#include "sbu-common.h"
+#include "sbu-config.h"
+#include "sbu-site.h"
+
+typedef struct {
+	GMainLoop			*loop;
+	GOptionContext			*context;
+	GDBusConnection			*connection;
+	guint				 name_owner_id;
+	GPtrArray			*sites;		/* of SbuSite */
+	SbuManager			*manager;
+	SbuSites			*sites_iface;
+	GDBusObjectManagerServer	*object_manager;
+} SbuAggregator;
+
+static gboolean
+sbu_aggregator_sigint_cb (gpointer user_data)
+{
+	SbuAggregator *self = (SbuAggregator *) user_data;
+	g_debug ("handling SIGINT");
+	g_main_loop_quit (self->loop);
+	return FALSE;
+}
+
+static gboolean
+sbu_aggregator_handle_get_devices_cb (SbuManager *manager,
+				      GDBusMethodInvocation *invocation,
+				      SbuAggregator *self)
+{
+	GVariantBuilder builder;
+
+	g_debug ("handling GetDevices");
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("(ao)"));
+	g_variant_builder_open (&builder, G_VARIANT_TYPE ("ao"));
+	for (guint i = 0; i < self->sites->len; i++) {
+		SbuSite *site = g_ptr_array_index (self->sites, i);
+		g_autoptr(GPtrArray) devices = sbu_site_get_devices (site);
+		for (guint j = 0; j < devices->len; j++) {
+			GDBusProxy *device = g_ptr_array_index (devices, j);
+			g_autofree gchar *object_path = NULL;
+			object_path = sbu_site_get_object_path (site, g_dbus_proxy_get_object_path (device));
+			g_variant_builder_add (&builder, "o", object_path);
+		}
+	}
+	g_variant_builder_close (&builder);
+	g_dbus_method_invocation_return_value (invocation,
+					       g_variant_builder_end (&builder));
+	return TRUE;
+}
+
+/* the sites keep their own counters */
+static gboolean
+sbu_aggregator_handle_get_metrics_cb (SbuManager *manager,
+				      GDBusMethodInvocation *invocation,
+				      SbuAggregator *self)
+{
+	g_debug ("handling GetMetrics");
+	g_dbus_method_invocation_return_value (invocation,
+					       g_variant_new_parsed ("(@a{s(sttt)} {},)"));
+	return TRUE;
+}
+
+static gboolean
+sbu_aggregator_handle_get_sites_cb (SbuSites *sites_iface,
+				    GDBusMethodInvocation *invocation,
+				    SbuAggregator *self)
+{
+	GVariantBuilder builder;
+
+	g_debug ("handling GetSites");
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a(ssb))"));
+	g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ssb)"));
+	for (guint i = 0; i < self->sites->len; i++) {
+		SbuSite *site = g_ptr_array_index (self->sites, i);
+		g_variant_builder_add (&builder, "(ssb)",
+				       sbu_site_get_name (site),
+				       sbu_site_get_address (site),
+				       sbu_site_is_connected (site));
+	}
+	g_variant_builder_close (&builder);
+	g_dbus_method_invocation_return_value (invocation,
+					       g_variant_builder_end (&builder));
+	return TRUE;
+}
+
+static gboolean
+sbu_aggregator_handle_get_history_cb (SbuSites *sites_iface,
+				      GDBusMethodInvocation *invocation,
+				      const gchar *key,
+				      guint64 start,
+				      guint64 end,
+				      guint limit,
+				      SbuAggregator *self)
+{
+	g_debug ("handling GetHistory for %s", key);
+	sbu_site_return_history (self->sites, invocation, key, start, end, limit);
+	return TRUE;
+}
+
+static void
+sbu_aggregator_name_lost_cb (GDBusConnection *connection,
+			     const gchar *name,
+			     gpointer user_data)
+{
+	SbuAggregator *self = (SbuAggregator *) user_data;
+	g_debug ("lost (or failed to acquire) the name %s on the bus", name);
+	g_main_loop_quit (self->loop);
+}
+
+static void
+sbu_aggregator_name_acquired_cb (GDBusConnection *connection,
+				 const gchar *name,
+				 gpointer user_data)
+{
+	SbuAggregator *self = (SbuAggregator *) user_data;
+	g_debug ("acquired the name %s on the bus", name);
+	for (guint i = 0; i < self->sites->len; i++) {
+		SbuSite *site = g_ptr_array_index (self->sites, i);
+		sbu_site_connect (site);
+	}
+}
+
+/* each is either name=address or name=system for this machine */
+static gboolean
+sbu_aggregator_add_site (SbuAggregator *self, const gchar *str, GError **error)
+{
+	SbuSite *site;
+	g_auto(GStrv) split = g_strsplit (str, "=", 2);
+
+	if (g_strv_length (split) != 2) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_ARGUMENT,
+			     "site '%s' is not in the form name=address", str);
+		return FALSE;
+	}
+	for (guint i = 0; i < self->sites->len; i++) {
+		SbuSite *site_tmp = g_ptr_array_index (self->sites, i);
+		if (g_strcmp0 (sbu_site_get_name (site_tmp), split[0]) == 0) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_EXISTS,
+				     "site %s already added", split[0]);
+			return FALSE;
+		}
+	}
+	site = sbu_site_new (self->object_manager, split[0], split[1], error);
+	if (site == NULL)
+		return FALSE;
+	g_ptr_array_add (self->sites, site);
+	return TRUE;
+}
+
+static GDBusConnection *
+sbu_aggregator_get_connection (const gchar *bus, GError **error)
+{
+	if (bus == NULL || g_strcmp0 (bus, "session") == 0)
+		return g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, error);
+	if (g_strcmp0 (bus, "system") == 0)
+		return g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, error);
+	return g_dbus_connection_new_for_address_sync (bus,
+						       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+						       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+						       NULL, NULL, error);
+}
+
+static void
+sbu_aggregator_self_free (SbuAggregator *self)
+{
+	if (self->name_owner_id != 0)
+		g_bus_unown_name (self->name_owner_id);
+	g_ptr_array_unref (self->sites);
+	g_main_loop_unref (self->loop);
+	g_option_context_free (self->context);
+	g_object_unref (self->manager);
+	g_object_unref (self->sites_iface);
+	g_object_unref (self->object_manager);
+	if (self->connection != NULL)
+		g_object_unref (self->connection);
+	g_free (self);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuAggregator, sbu_aggregator_self_free)
+
+static SbuAggregator *
+sbu_aggregator_self_new (void)
+{
+	SbuAggregator *self = g_new0 (SbuAggregator, 1);
+	self->loop = g_main_loop_new (NULL, FALSE);
+	self->context = g_option_context_new (_("[NAME=ADDRESS…]"));
+	self->sites = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	self->object_manager = g_dbus_object_manager_server_new ("/com/hughski/PowerSBU");
+	self->manager = sbu_manager_skeleton_new ();
+	self->sites_iface = sbu_sites_skeleton_new ();
+	return self;
+}
+
+int
+main (int argc, char *argv[])
+{
+	g_autoptr(SbuAggregator) self = sbu_aggregator_self_new ();
+	gboolean verbose = FALSE;
+	g_autofree gchar *bus = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(SbuObjectSkeleton) manager_object = NULL;
+
+	const GOptionEntry options[] = {
+		{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+			/* TRANSLATORS: command line option */
+			_("Show extra debugging information"), NULL },
+		{ "bus", 'b', 0, G_OPTION_ARG_STRING, &bus,
+			/* TRANSLATORS: command line option */
+			_("Bus to export the devices on, e.g. session, system or an address"), NULL },
+		{ NULL}
+	};
+
+	setlocale (LC_ALL, "");
+
+	bindtextdomain (GETTEXT_PACKAGE, LOCALEDIR);
+	bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
+	textdomain (GETTEXT_PACKAGE);
+
+	/* do stuff on ctrl+c */
+	g_unix_signal_add_full (G_PRIORITY_DEFAULT,
+				SIGINT, sbu_aggregator_sigint_cb,
+				self, NULL);
+
+	/* TRANSLATORS: program name */
+	g_set_application_name (_("SBU Aggregator"));
+	g_option_context_add_main_entries (self->context, options, NULL);
+	if (!g_option_context_parse (self->context, &argc, &argv, &error)) {
+		/* TRANSLATORS: the user didn't read the man page */
+		g_printerr ("%s: %s\n", _("Failed to parse arguments"),
+			    error->message);
+		return EXIT_FAILURE;
+	}
+
+	/* set verbose? */
+	if (verbose)
+		g_setenv ("G_MESSAGES_DEBUG", "all", TRUE);
+
+	/* sites from the command line, otherwise from the config file */
+	if (argc > 1) {
+		for (gint i = 1; i < argc; i++) {
+			if (!sbu_aggregator_add_site (self, argv[i], &error)) {
+				g_printerr ("%s: %s\n", _("Failed to add site"),
+					    error->message);
+				return EXIT_FAILURE;
+			}
+		}
+	} else {
+		g_autoptr(SbuConfig) config = sbu_config_new ();
+		g_autofree gchar *sites = NULL;
+		g_auto(GStrv) split = NULL;
+
+		sites = sbu_config_get_string (config, "AggregatorSites", NULL);
+		if (sites != NULL)
+			split = g_strsplit_set (sites, " \t", -1);
+		for (guint i = 0; split != NULL && split[i] != NULL; i++) {
+			if (split[i][0] == '\0')
+				continue;
+			if (!sbu_aggregator_add_site (self, split[i], &error)) {
+				g_printerr ("%s: %s\n", _("Failed to add site"),
+					    error->message);
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	if (self->sites->len == 0) {
+		/* TRANSLATORS: neither arguments nor AggregatorSites were set */
+		g_printerr ("%s\n", _("No sites to aggregate"));
+		return EXIT_FAILURE;
+	}
+
+	/* the same names as sbud so that the existing clients work */
+	self->connection = sbu_aggregator_get_connection (bus, &error);
+	if (self->connection == NULL) {
+		g_printerr ("%s: %s\n", _("Failed to connect to bus"),
+			    error->message);
+		return EXIT_FAILURE;
+	}
+	sbu_manager_set_version (self->manager, PACKAGE_VERSION);
+	g_signal_connect (self->manager, "handle-get-devices",
+			  G_CALLBACK (sbu_aggregator_handle_get_devices_cb), self);
+	g_signal_connect (self->manager, "handle-get-metrics",
+			  G_CALLBACK (sbu_aggregator_handle_get_metrics_cb), self);
+	g_signal_connect (self->sites_iface, "handle-get-sites",
+			  G_CALLBACK (sbu_aggregator_handle_get_sites_cb), self);
+	g_signal_connect (self->sites_iface, "handle-get-history",
+			  G_CALLBACK (sbu_aggregator_handle_get_history_cb), self);
+	manager_object = sbu_object_skeleton_new (SBU_DBUS_PATH_MANAGER);
+	sbu_object_skeleton_set_manager (manager_object, self->manager);
+	sbu_object_skeleton_set_sites (manager_object, self->sites_iface);
+	g_dbus_object_manager_server_export (self->object_manager,
+					     G_DBUS_OBJECT_SKELETON (manager_object));
+	g_dbus_object_manager_server_set_connection (self->object_manager,
+						     self->connection);
+
+	/* try to own name */
+	self->name_owner_id = g_bus_own_name_on_connection (self->connection,
+							    SBU_DBUS_NAME,
+							    G_BUS_NAME_OWNER_FLAGS_NONE,
+							    sbu_aggregator_name_acquired_cb,
+							    sbu_aggregator_name_lost_cb,
+							    self,
+							    NULL);
+	g_main_loop_run (self->loop);
+
+	/* success */
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include "sbu-benchmark.h"
+
+typedef struct {
+	gchar			*name;
+	gchar			*skip_reason;
+	guint64			 iterations;
+	gint64			 elapsed;	/* us */
+} SbuBenchmarkResult;
+
+struct _SbuBenchmark
+{
+	GObject			 parent_instance;
+	gchar			*suite;
+	gint64			 ts_start;
+	GPtrArray		*results;	/* of SbuBenchmarkResult */
+};
+
+G_DEFINE_TYPE (SbuBenchmark, sbu_benchmark, G_TYPE_OBJECT)
+
+static void
+sbu_benchmark_result_free (SbuBenchmarkResult *result)
+{
+	g_free (result->name);
+	g_free (result->skip_reason);
+	g_free (result);
+}
+
+void
+sbu_benchmark_start (SbuBenchmark *self)
+{
+	g_return_if_fail (SBU_IS_BENCHMARK (self));
+	self->ts_start = g_get_monotonic_time ();
+}
+
+/**
+ * sbu_benchmark_stop:
+ * @self: a #SbuBenchmark
+ * @name: the benchmark name, e.g. "database-insert"
+ * @iterations: number of operations done since sbu_benchmark_start()
+ *
+ * Records the time taken and prints a one-line summary.
+ **/
+void
+sbu_benchmark_stop (SbuBenchmark *self, const gchar *name, guint64 iterations)
+{
+	SbuBenchmarkResult *result;
+
+	g_return_if_fail (SBU_IS_BENCHMARK (self));
+	g_return_if_fail (self->ts_start != 0);
+
+	result = g_new0 (SbuBenchmarkResult, 1);
+	result->name = g_strdup (name);
+	result->iterations = iterations;
+	result->elapsed = MAX (g_get_monotonic_time () - self->ts_start, 1);
+	g_ptr_array_add (self->results, result);
+	self->ts_start = 0;
+
+	g_print ("%-32s %10" G_GUINT64_FORMAT " ops in %8.3fs, %12.1f ops/s\n",
+		 name, iterations,
+		 (gdouble) result->elapsed / G_USEC_PER_SEC,
+		 (gdouble) iterations * G_USEC_PER_SEC / result->elapsed);
+}
+
+void
+sbu_benchmark_skip (SbuBenchmark *self, const gchar *name, const gchar *reason)
+{
+	SbuBenchmarkResult *result;
+
+	g_return_if_fail (SBU_IS_BENCHMARK (self));
+
+	result = g_new0 (SbuBenchmarkResult, 1);
+	result->name = g_strdup (name);
+	result->skip_reason = g_strdup (reason);
+	g_ptr_array_add (self->results, result);
+	self->ts_start = 0;
+
+	g_print ("%-32s skipped: %s\n", name, reason);
+}
+
+static void
+sbu_benchmark_append_string (GString *str, const gchar *value)
+{
+	g_autofree gchar *tmp = g_strescape (value, NULL);
+	g_string_append_printf (str, "\"%s\"", tmp);
+}
+
+/**
+ * sbu_benchmark_to_json:
+ * @self: a #SbuBenchmark
+ *
+ * Exports all the results so they can be compared between releases.
+ *
+ * Return value: a JSON document
+ **/
+gchar *
+sbu_benchmark_to_json (SbuBenchmark *self)
+{
+	GString *str = g_string_new ("{\n  \"suite\" : ");
+	g_autoptr(GDateTime) dt = g_date_time_new_now_utc ();
+	g_autofree gchar *timestamp = g_date_time_format (dt, "%FT%TZ");
+
+	g_return_val_if_fail (SBU_IS_BENCHMARK (self), NULL);
+
+	sbu_benchmark_append_string (str, self->suite);
+	g_string_append (str, ",\n  \"version\" : ");
+	sbu_benchmark_append_string (str, PACKAGE_VERSION);
+	g_string_append (str, ",\n  \"timestamp\" : ");
+	sbu_benchmark_append_string (str, timestamp);
+	g_string_append (str, ",\n  \"results\" : [");
+	for (guint i = 0; i < self->results->len; i++) {
+		SbuBenchmarkResult *result = g_ptr_array_index (self->results, i);
+		gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+		g_string_append (str, i == 0 ? "\n    {\n" : ",\n    {\n");
+		g_string_append (str, "      \"name\" : ");
+		sbu_benchmark_append_string (str, result->name);
+		if (result->skip_reason != NULL) {
+			g_string_append (str, ",\n      \"skipped\" : ");
+			sbu_benchmark_append_string (str, result->skip_reason);
+			g_string_append (str, "\n    }");
+			continue;
+		}
+		g_string_append_printf (str, ",\n      \"iterations\" : %" G_GUINT64_FORMAT,
+					result->iterations);
+
+		/* locale independent, as JSON needs a '.' */
+		g_ascii_formatd (buf, sizeof(buf), "%.6f",
+				 (gdouble) result->elapsed / G_USEC_PER_SEC);
+		g_string_append_printf (str, ",\n      \"seconds\" : %s", buf);
+		g_ascii_formatd (buf, sizeof(buf), "%.1f",
+				 (gdouble) result->iterations * G_USEC_PER_SEC / result->elapsed);
+		g_string_append_printf (str, ",\n      \"per_second\" : %s", buf);
+		g_ascii_formatd (buf, sizeof(buf), "%.1f",
+				 result->iterations > 0 ?
+				 (gdouble) result->elapsed * 1000.f / result->iterations : 0.f);
+		g_string_append_printf (str, ",\n      \"ns_per_op\" : %s", buf);
+		g_string_append (str, "\n    }");
+	}
+	g_string_append (str, "\n  ]\n}\n");
+	return g_string_free (str, FALSE);
+}
+
+/**
+ * sbu_benchmark_write:
+ * @self: a #SbuBenchmark
+ * @filename: a filename, or %NULL for stdout
+ * @error: a #GError, or %NULL
+ *
+ * Writes the results as JSON.
+ *
+ * Return value: %TRUE for success
+ **/
+gboolean
+sbu_benchmark_write (SbuBenchmark *self, const gchar *filename, GError **error)
+{
+	g_autofree gchar *json = sbu_benchmark_to_json (self);
+	if (filename == NULL) {
+		g_print ("%s", json);
+		return TRUE;
+	}
+	return g_file_set_contents (filename, json, -1, error);
+}
+
+static void
+sbu_benchmark_finalize (GObject *object)
+{
+	SbuBenchmark *self = SBU_BENCHMARK (object);
+
+	g_free (self->suite);
+	g_ptr_array_unref (self->results);
+
+	G_OBJECT_CLASS (sbu_benchmark_parent_class)->finalize (object);
+}
+
+static void
+sbu_benchmark_init (SbuBenchmark *self)
+{
+	self->results = g_ptr_array_new_with_free_func ((GDestroyNotify) sbu_benchmark_result_free);
+}
+
+static void
+sbu_benchmark_class_init (SbuBenchmarkClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = sbu_benchmark_finalize;
+}
+
+/**
+ * sbu_benchmark_new:
+ * @suite: the suite name, e.g. "sbu"
+ *
+ * Creates a new benchmark result collector.
+ *
+ * Return value: a #SbuBenchmark
+ **/
+SbuBenchmark *
+sbu_benchmark_new (const gchar *suite)
+{
+	SbuBenchmark *self = g_object_new (SBU_TYPE_BENCHMARK, NULL);
+	self->suite = g_strdup (suite);
+	return self;
+}
@@ -0,0 +1,48 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __SBU_BENCHMARK_H
+#define __SBU_BENCHMARK_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define SBU_TYPE_BENCHMARK (sbu_benchmark_get_type ())
+
+G_DECLARE_FINAL_TYPE (SbuBenchmark, sbu_benchmark, SBU, BENCHMARK, GObject)
+
+SbuBenchmark	*sbu_benchmark_new		(const gchar	*suite);
+void		 sbu_benchmark_start		(SbuBenchmark	*self);
+void		 sbu_benchmark_stop		(SbuBenchmark	*self,
+						 const gchar	*name,
+						 guint64	 iterations);
+void		 sbu_benchmark_skip		(SbuBenchmark	*self,
+						 const gchar	*name,
+						 const gchar	*reason);
+gchar		*sbu_benchmark_to_json		(SbuBenchmark	*self);
+gboolean	 sbu_benchmark_write		(SbuBenchmark	*self,
+						 const gchar	*filename,
+						 GError		**error);
+
+G_END_DECLS
+
+#endif /* __SBU_BENCHMARK_H */
@@ -20,8 +20,9 @@
 
 #include "config.h"
 
-#include <glib.h>
+#include <gio/gio.h>
 #include <math.h>
+#include <string.h>
 
 #include "sbu-common.h"
 
@@ -60,6 +61,8 @@ sbu_device_property_to_string (SbuDeviceProperty key)
 		return "current-max";
 	if (key == SBU_DEVICE_PROPERTY_FREQUENCY)
 		return "frequency";
+	if (key == SBU_DEVICE_PROPERTY_STATE_OF_CHARGE)
+		return "state-of-charge";
 	return NULL;
 }
 
@@ -77,6 +80,8 @@ sbu_device_property_to_unit (SbuDeviceProperty key)
 		return "A";
 	if (key == SBU_DEVICE_PROPERTY_FREQUENCY)
 		return "Hz";
+	if (key == SBU_DEVICE_PROPERTY_STATE_OF_CHARGE)
+		return "%";
 	return NULL;
 }
 
@@ -115,3 +120,34 @@ sbu_format_for_display (gdouble val, const gchar *suffix)
 	}
 	return g_string_free (str, FALSE);
 }
+
+/**
+ * sbu_key_normalize:
+ * @key: a short key, e.g. "battery:voltage" or "solar_load:active"
+ * @error: a #GError, or %NULL
+ *
+ * Converts a key as written in the config file to the object name used in
+ * the history, e.g. "node_battery:voltage" or "link_solar_load:active".
+ *
+ * Return value: a new string, or %NULL if @key is invalid
+ **/
+gchar *
+sbu_key_normalize (const gchar *key, GError **error)
+{
+	const gchar *tmp = strchr (key, ':');
+
+	if (tmp == NULL || tmp == key || tmp[1] == '\0' ||
+	    strchr (tmp + 1, ':') != NULL) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "invalid key '%s', expected object:property",
+			     key);
+		return NULL;
+	}
+	if (g_str_has_prefix (key, "node_") || g_str_has_prefix (key, "link_"))
+		return g_strdup (key);
+	if (memchr (key, '_', (gsize) (tmp - key)) != NULL)
+		return g_strdup_printf ("link_%s", key);
+	return g_strdup_printf ("node_%s", key);
+}
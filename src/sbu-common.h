@@ -48,6 +48,7 @@ typedef enum {
 	SBU_DEVICE_PROPERTY_CURRENT,
 	SBU_DEVICE_PROPERTY_CURRENT_MAX,
 	SBU_DEVICE_PROPERTY_FREQUENCY,
+	SBU_DEVICE_PROPERTY_STATE_OF_CHARGE,
 	SBU_DEVICE_PROPERTY_LAST
 } SbuDeviceProperty;
 
@@ -57,6 +58,8 @@ const gchar	*sbu_device_property_to_unit	(SbuDeviceProperty value);
 
 gchar		*sbu_format_for_display		(gdouble	 val,
 						 const gchar	*suffix);
+gchar		*sbu_key_normalize		(const gchar	*key,
+						 GError		**error);
 
 G_END_DECLS
 
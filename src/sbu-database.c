@@ -27,6 +27,7 @@
 #include <math.h>
 
 #include "sbu-database.h"
+#include "sbu-metrics.h"
 
 struct _SbuDatabase
 {
@@ -35,6 +36,7 @@ struct _SbuDatabase
 	GHashTable		*hash;
 	gchar			*location;
 	sqlite3			*db;
+	SbuMetrics		*metrics;
 };
 
 #define SBU_DATABASE_VALUE_DELTA	0.5f
@@ -49,6 +51,12 @@ sbu_database_set_location (SbuDatabase *self, const gchar *location)
 	self->location = g_strdup (location);
 }
 
+void
+sbu_database_set_metrics (SbuDatabase *self, SbuMetrics *metrics)
+{
+	g_set_object (&self->metrics, metrics);
+}
+
 static gboolean
 sbu_database_ensure_file_directory (const gchar *path, GError **error)
 {
@@ -234,6 +242,18 @@ sbu_database_open (SbuDatabase *self, GError **error)
 			return FALSE;
 	}
 
+	/* energy counters, one row per key and bucket */
+	statement = "CREATE TABLE IF NOT EXISTS energy ("
+		    "dev INTEGER DEFAULT 0,"
+		    "key STRING NOT NULL,"
+		    "width INTEGER NOT NULL,"
+		    "ts INTEGER NOT NULL,"
+		    "pos INTEGER DEFAULT 0,"
+		    "neg INTEGER DEFAULT 0,"
+		    "PRIMARY KEY (dev, key, width, ts));";
+	if (!sbu_database_execute (self, statement, error))
+		return FALSE;
+
 	/* load existing values */
 	results = sbu_database_get_latest (self, SBU_DEVICE_ID_DEFAULT, error);
 	if (results == NULL)
@@ -297,6 +317,7 @@ gboolean
 sbu_database_save_value (SbuDatabase *self, const gchar *key, gint val, GError **error)
 {
 	SbuDatabaseItem *item;
+	gint64 ts;
 	g_autofree gchar *statement = NULL;
 
 	/* sanity check */
@@ -337,13 +358,231 @@ sbu_database_save_value (SbuDatabase *self, const gchar *key, gint val, GError *
 	statement = g_strdup_printf ("INSERT INTO log (ts, key, val) "
 				     "VALUES ('%" G_GINT64_FORMAT "', '%s', '%i')",
 				     item->ts, key, item->val);
-	if (!sbu_database_execute (self, statement, error))
+	ts = g_get_monotonic_time ();
+	if (!sbu_database_execute (self, statement, error)) {
+		sbu_metrics_increment (self->metrics, "sbud_database_errors_total", NULL, 1);
 		return FALSE;
+	}
+	sbu_metrics_observe (self->metrics, "sbud_database_insert_seconds", NULL,
+			     g_get_monotonic_time () - ts);
 
 	/* success */
 	return TRUE;
 }
 
+/**
+ * sbu_database_save_items:
+ * @self: a #SbuDatabase
+ * @key: the key, e.g. "/0/node_battery:voltage"
+ * @items: an array of #SbuDatabaseItem
+ * @error: a #GError, or %NULL
+ *
+ * Saves historical values with their own timestamps in one transaction.
+ * Unlike sbu_database_save_value() no values are filtered and the cache
+ * of latest values is not changed.
+ *
+ * Return value: %TRUE if all the items were saved
+ **/
+gboolean
+sbu_database_save_items (SbuDatabase *self, const gchar *key,
+			 GPtrArray *items, GError **error)
+{
+	gint rc;
+	gint64 ts = g_get_monotonic_time ();
+	sqlite3_stmt *stmt = NULL;
+
+	/* sanity check */
+	if (self->db == NULL) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "database is not open");
+		return FALSE;
+	}
+
+	if (!sbu_database_execute (self, "BEGIN TRANSACTION;", error))
+		return FALSE;
+	rc = sqlite3_prepare_v2 (self->db,
+				 "INSERT INTO log (ts, key, val) "
+				 "VALUES (?1, ?2, ?3);",
+				 -1, &stmt, NULL);
+	if (rc != SQLITE_OK)
+		goto out;
+	sqlite3_bind_text (stmt, 2, key, -1, SQLITE_STATIC);
+	for (guint i = 0; i < items->len; i++) {
+		SbuDatabaseItem *item = g_ptr_array_index (items, i);
+		sqlite3_bind_int64 (stmt, 1, item->ts);
+		sqlite3_bind_int (stmt, 3, item->val);
+		rc = sqlite3_step (stmt);
+		if (rc != SQLITE_DONE)
+			goto out;
+		sqlite3_reset (stmt);
+	}
+	rc = sqlite3_exec (self->db, "COMMIT;", NULL, NULL, NULL);
+out:
+	if (rc != SQLITE_OK && rc != SQLITE_DONE) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "SQL error: %s", sqlite3_errmsg (self->db));
+		sqlite3_finalize (stmt);
+		sqlite3_exec (self->db, "ROLLBACK;", NULL, NULL, NULL);
+		sbu_metrics_increment (self->metrics, "sbud_database_errors_total", NULL, 1);
+		return FALSE;
+	}
+	sqlite3_finalize (stmt);
+	sbu_metrics_observe (self->metrics, "sbud_database_insert_seconds", NULL,
+			     g_get_monotonic_time () - ts);
+	return TRUE;
+}
+
+/**
+ * sbu_database_save_energy:
+ * @self: a #SbuDatabase
+ * @dev: a device ID, normally %SBU_DEVICE_ID_DEFAULT
+ * @items: an array of #SbuDatabaseEnergy
+ * @error: a #GError, or %NULL
+ *
+ * Saves energy counters in one transaction, replacing any existing value
+ * for the same key, width and bucket.
+ *
+ * Return value: %TRUE if all the items were saved
+ **/
+gboolean
+sbu_database_save_energy (SbuDatabase *self, guint dev,
+			  GPtrArray *items, GError **error)
+{
+	gint rc;
+	gint64 ts = g_get_monotonic_time ();
+	sqlite3_stmt *stmt = NULL;
+
+	/* sanity check */
+	if (self->db == NULL) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "database is not open");
+		return FALSE;
+	}
+
+	if (!sbu_database_execute (self, "BEGIN TRANSACTION;", error))
+		return FALSE;
+	rc = sqlite3_prepare_v2 (self->db,
+				 "INSERT OR REPLACE INTO energy "
+				 "(dev, key, width, ts, pos, neg) "
+				 "VALUES (?1, ?2, ?3, ?4, ?5, ?6);",
+				 -1, &stmt, NULL);
+	if (rc != SQLITE_OK)
+		goto out;
+	sqlite3_bind_int (stmt, 1, (gint) dev);
+	for (guint i = 0; i < items->len; i++) {
+		SbuDatabaseEnergy *item = g_ptr_array_index (items, i);
+		sqlite3_bind_text (stmt, 2, item->key, -1, SQLITE_STATIC);
+		sqlite3_bind_int (stmt, 3, (gint) item->width);
+		sqlite3_bind_int64 (stmt, 4, item->ts);
+		sqlite3_bind_int64 (stmt, 5, item->pos);
+		sqlite3_bind_int64 (stmt, 6, item->neg);
+		rc = sqlite3_step (stmt);
+		if (rc != SQLITE_DONE)
+			goto out;
+		sqlite3_reset (stmt);
+	}
+	rc = sqlite3_exec (self->db, "COMMIT;", NULL, NULL, NULL);
+out:
+	if (rc != SQLITE_OK && rc != SQLITE_DONE) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "SQL error: %s", sqlite3_errmsg (self->db));
+		sqlite3_finalize (stmt);
+		sqlite3_exec (self->db, "ROLLBACK;", NULL, NULL, NULL);
+		sbu_metrics_increment (self->metrics, "sbud_database_errors_total", NULL, 1);
+		return FALSE;
+	}
+	sqlite3_finalize (stmt);
+	sbu_metrics_observe (self->metrics, "sbud_database_insert_seconds", NULL,
+			     g_get_monotonic_time () - ts);
+	return TRUE;
+}
+
+/**
+ * sbu_database_query_energy:
+ * @self: a #SbuDatabase
+ * @key: the key, e.g. "/0/node_battery:power"
+ * @dev: a device ID, normally %SBU_DEVICE_ID_DEFAULT
+ * @width: bucket size in seconds, e.g. 3600
+ * @ts_start: start of the range
+ * @ts_end: end of the range, exclusive
+ * @error: a #GError, or %NULL
+ *
+ * Gets the energy counters for buckets starting in the range, using the
+ * primary key so the cost only depends on the number of buckets.
+ *
+ * Return value: (transfer container): an array of #SbuDatabaseEnergy
+ **/
+GPtrArray *
+sbu_database_query_energy (SbuDatabase *self, const gchar *key, guint dev,
+			   guint width, gint64 ts_start, gint64 ts_end,
+			   GError **error)
+{
+	gint rc;
+	gint64 ts = g_get_monotonic_time ();
+	sqlite3_stmt *stmt = NULL;
+	g_autoptr(GPtrArray) results = g_ptr_array_new_with_free_func (g_free);
+
+	/* sanity check */
+	if (self->db == NULL) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "database is not open");
+		return NULL;
+	}
+
+	rc = sqlite3_prepare_v2 (self->db,
+				 "SELECT ts, pos, neg FROM energy "
+				 "WHERE dev = ?1 "
+				 "AND key = ?2 "
+				 "AND width = ?3 "
+				 "AND ts >= ?4 "
+				 "AND ts < ?5 "
+				 "ORDER BY ts ASC;",
+				 -1, &stmt, NULL);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "SQL error: %s", sqlite3_errmsg (self->db));
+		return NULL;
+	}
+	sqlite3_bind_int (stmt, 1, (gint) dev);
+	sqlite3_bind_text (stmt, 2, key, -1, SQLITE_STATIC);
+	sqlite3_bind_int (stmt, 3, (gint) width);
+	sqlite3_bind_int64 (stmt, 4, ts_start);
+	sqlite3_bind_int64 (stmt, 5, ts_end);
+	while ((rc = sqlite3_step (stmt)) == SQLITE_ROW) {
+		SbuDatabaseEnergy *item = g_new0 (SbuDatabaseEnergy, 1);
+		item->width = width;
+		item->ts = sqlite3_column_int64 (stmt, 0);
+		item->pos = sqlite3_column_int64 (stmt, 1);
+		item->neg = sqlite3_column_int64 (stmt, 2);
+		g_ptr_array_add (results, item);
+	}
+	if (rc != SQLITE_DONE) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "SQL error: %s", sqlite3_errmsg (self->db));
+		sqlite3_finalize (stmt);
+		sbu_metrics_increment (self->metrics, "sbud_database_errors_total", NULL, 1);
+		return NULL;
+	}
+	sqlite3_finalize (stmt);
+	sbu_metrics_observe (self->metrics, "sbud_database_query_seconds", NULL,
+			     g_get_monotonic_time () - ts);
+	return g_steal_pointer (&results);
+}
+
 GPtrArray *
 sbu_database_query (SbuDatabase *self, const gchar *key, guint dev,
 		    gint64 ts_start, gint64 ts_end, GError **error)
@@ -351,6 +590,7 @@ sbu_database_query (SbuDatabase *self, const gchar *key, guint dev,
 	g_autoptr(GPtrArray) results = g_ptr_array_new_with_free_func (g_free);
 	gchar *error_msg = NULL;
 	gint rc;
+	gint64 ts = g_get_monotonic_time ();
 	g_autofree gchar *statement = NULL;
 
 	statement = g_strdup_printf ("SELECT ts, val FROM log "
@@ -367,13 +607,151 @@ sbu_database_query (SbuDatabase *self, const gchar *key, guint dev,
 			     G_IO_ERROR_FAILED,
 			     "SQL error: %s", error_msg);
 		sqlite3_free (error_msg);
+		sbu_metrics_increment (self->metrics, "sbud_database_errors_total", NULL, 1);
 		return NULL;
 	}
+	sbu_metrics_observe (self->metrics, "sbud_database_query_seconds", NULL,
+			     g_get_monotonic_time () - ts);
 
 	/* success */
 	return g_steal_pointer (&results);
 }
 
+gboolean
+sbu_database_query_foreach (SbuDatabase *self, const gchar *key, guint dev,
+			    gint64 ts_start, gint64 ts_end,
+			    SbuDatabaseItemFunc func, gpointer user_data,
+			    GError **error)
+{
+	gint rc;
+	gint64 ts = g_get_monotonic_time ();
+	sqlite3_stmt *stmt = NULL;
+
+	/* step through the rows one at a time rather than building an array,
+	 * so that the caller can process arbitrarily long ranges */
+	rc = sqlite3_prepare_v2 (self->db,
+				 "SELECT ts, val FROM log "
+				 "WHERE key = ?1 "
+				 "AND dev = ?2 "
+				 "AND ts >= ?3 "
+				 "AND ts <= ?4 "
+				 "ORDER BY ts ASC;",
+				 -1, &stmt, NULL);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "SQL error: %s", sqlite3_errmsg (self->db));
+		return FALSE;
+	}
+	sqlite3_bind_text (stmt, 1, key, -1, SQLITE_STATIC);
+	sqlite3_bind_int (stmt, 2, (gint) dev);
+	sqlite3_bind_int64 (stmt, 3, ts_start);
+	sqlite3_bind_int64 (stmt, 4, ts_end);
+	while ((rc = sqlite3_step (stmt)) == SQLITE_ROW) {
+		SbuDatabaseItem item;
+		item.ts = sqlite3_column_int64 (stmt, 0);
+		item.val = sqlite3_column_int (stmt, 1);
+		if (!func (&item, user_data))
+			break;
+	}
+	if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "SQL error: %s", sqlite3_errmsg (self->db));
+		sqlite3_finalize (stmt);
+		sbu_metrics_increment (self->metrics, "sbud_database_errors_total", NULL, 1);
+		return FALSE;
+	}
+	sqlite3_finalize (stmt);
+	sbu_metrics_observe (self->metrics, "sbud_database_query_seconds", NULL,
+			     g_get_monotonic_time () - ts);
+	return TRUE;
+}
+
+/**
+ * sbu_database_reduce_items:
+ * @items: an array of #SbuDatabaseItem, sorted by timestamp
+ * @ts_start: start of the range
+ * @ts_end: end of the range
+ * @limit: 0 for all items, 1 for a single average, or the approximate
+ *	   number of averaged bins to return
+ *
+ * Reduces the results of a query to something a client can plot.
+ *
+ * Return value: (transfer container): an array of #SbuDatabaseItem
+ **/
+GPtrArray *
+sbu_database_reduce_items (GPtrArray *items, gint64 ts_start, gint64 ts_end, guint limit)
+{
+	GPtrArray *results;
+
+	/* no filter */
+	if (limit == 0)
+		return g_ptr_array_ref (items);
+
+	/* just one value */
+	results = g_ptr_array_new_with_free_func (g_free);
+	if (items->len == 0)
+		return results;
+	if (limit == 1) {
+		SbuDatabaseItem *item;
+		gdouble ave_acc = 0;
+		gint64 ts = 0;
+		for (guint i = 0; i < items->len; i++) {
+			item = g_ptr_array_index (items, i);
+			ave_acc += item->val;
+			ts = item->ts;
+		}
+		item = g_new0 (SbuDatabaseItem, 1);
+		item->ts = ts;
+		item->val = ave_acc / items->len;
+		g_ptr_array_add (results, item);
+
+	/* bin into averaged groups */
+	} else {
+		gint64 ts_last_added = 0;
+		guint ave_cnt = 0;
+		gdouble ave_acc = 0;
+		gint64 interval = (ts_end - ts_start) / (limit - 1);
+
+		for (guint i = 0; i < items->len; i++) {
+			SbuDatabaseItem *item = g_ptr_array_index (items, i);
+
+			if (ts_last_added == 0)
+				ts_last_added = item->ts;
+
+			/* first and last points */
+			if (i == 0 || i == items->len - 1) {
+				SbuDatabaseItem *item2 = g_new0 (SbuDatabaseItem, 1);
+				item2->ts = item->ts;
+				item2->val = item->val;
+				g_ptr_array_add (results, item2);
+				continue;
+			}
+
+			/* add to moving average */
+			ave_acc += item->val;
+			ave_cnt += 1;
+
+			/* more than the interval */
+			if (item->ts - ts_last_added > interval) {
+				SbuDatabaseItem *item2 = g_new0 (SbuDatabaseItem, 1);
+				item2->ts = item->ts;
+				item2->val = ave_acc / (gdouble) ave_cnt;
+				g_ptr_array_add (results, item2);
+				ts_last_added = item->ts;
+
+				/* reset moving average */
+				ave_cnt = 0;
+				ave_acc = 0.f;
+			}
+		}
+	}
+	return results;
+}
+
 static void
 sbu_database_finalize (GObject *object)
 {
@@ -381,6 +759,8 @@ sbu_database_finalize (GObject *object)
 
 	if (self->db != NULL)
 		sqlite3_close (self->db);
+	if (self->metrics != NULL)
+		g_object_unref (self->metrics);
 	g_free (self->location);
 	g_hash_table_unref (self->hash);
 
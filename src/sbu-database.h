@@ -24,6 +24,8 @@
 
 #include <glib-object.h>
 
+#include "sbu-metrics.h"
+
 G_BEGIN_DECLS
 
 #define SBU_TYPE_DATABASE (sbu_database_get_type ())
@@ -32,11 +34,25 @@ G_DECLARE_FINAL_TYPE (SbuDatabase, sbu_database, SBU, DATABASE, GObject)
 
 #define SBU_DEVICE_ID_DEFAULT		0
 
+/* bump when the tables created by sbu_database_open() change */
+#define SBU_DATABASE_SCHEMA_VERSION	2
+
 typedef struct {
 	gint64		 ts;
 	gint		 val;
 } SbuDatabaseItem;
 
+typedef struct {
+	const gchar	*key;		/* only used when saving */
+	guint		 width;		/* s, e.g. 3600 */
+	gint64		 ts;		/* start of the bucket */
+	gint64		 pos;		/* mWh with positive power */
+	gint64		 neg;		/* mWh with negative power */
+} SbuDatabaseEnergy;
+
+typedef gboolean (*SbuDatabaseItemFunc)		(const SbuDatabaseItem	*item,
+							 gpointer		 user_data);
+
 SbuDatabase	*sbu_database_new			(void);
 gboolean	 sbu_database_open			(SbuDatabase	*self,
 							 GError		**error);
@@ -44,16 +60,45 @@ gboolean	 sbu_database_repair			(SbuDatabase	*self,
 							 GError		**error);
 void		 sbu_database_set_location		(SbuDatabase	*self,
 							 const gchar	*location);
+void		 sbu_database_set_metrics		(SbuDatabase	*self,
+							 SbuMetrics	*metrics);
 gboolean	 sbu_database_save_value		(SbuDatabase	*self,
 							 const gchar	*key,
 							 gint		 val,
 							 GError		**error);
+gboolean	 sbu_database_save_items		(SbuDatabase	*self,
+							 const gchar	*key,
+							 GPtrArray	*items,
+							 GError		**error);
 GPtrArray	*sbu_database_query			(SbuDatabase	*self,
 							 const gchar	*key,
 							 guint		 dev,
 							 gint64		 ts_start,
 							 gint64		 ts_end,
 							 GError		**error);
+gboolean	 sbu_database_query_foreach		(SbuDatabase	*self,
+							 const gchar	*key,
+							 guint		 dev,
+							 gint64		 ts_start,
+							 gint64		 ts_end,
+							 SbuDatabaseItemFunc func,
+							 gpointer	 user_data,
+							 GError		**error);
+GPtrArray	*sbu_database_reduce_items		(GPtrArray	*items,
+							 gint64		 ts_start,
+							 gint64		 ts_end,
+							 guint		 limit);
+gboolean	 sbu_database_save_energy		(SbuDatabase	*self,
+							 guint		 dev,
+							 GPtrArray	*items,
+							 GError		**error);
+GPtrArray	*sbu_database_query_energy		(SbuDatabase	*self,
+							 const gchar	*key,
+							 guint		 dev,
+							 guint		 width,
+							 gint64		 ts_start,
+							 gint64		 ts_end,
+							 GError		**error);
 GHashTable	*sbu_database_get_latest		(SbuDatabase	*self,
 							 guint		 dev,
 							 GError		**error);
@@ -0,0 +1,807 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <math.h>
+#include <string.h>
+
+#include "sbu-common.h"
+#include "sbu-derived.h"
+
+#define SBU_DERIVED_STACK_MAX		32
+#define SBU_DERIVED_NESTING_MAX		64
+
+typedef enum {
+	SBU_DERIVED_OP_CONST,
+	SBU_DERIVED_OP_SLOT,
+	SBU_DERIVED_OP_ADD,
+	SBU_DERIVED_OP_SUB,
+	SBU_DERIVED_OP_MUL,
+	SBU_DERIVED_OP_DIV,
+	SBU_DERIVED_OP_NEG,
+	SBU_DERIVED_OP_MIN,
+	SBU_DERIVED_OP_MAX,
+	SBU_DERIVED_OP_ABS,
+	SBU_DERIVED_OP_LAST
+} SbuDerivedOpKind;
+
+typedef struct {
+	SbuDerivedOpKind	 kind;
+	guint			 slot;
+	gdouble			 value;
+} SbuDerivedOp;
+
+typedef struct {
+	gchar			*key;		/* e.g. node_battery:power_dc */
+	guint			 slot;
+	GArray			*ops;		/* of SbuDerivedOp, in RPN */
+	GArray			*inputs;	/* of guint slot */
+} SbuDerivedKey;
+
+typedef struct {
+	gchar			*prefix;	/* e.g. /0/ */
+	gsize			 prefix_len;
+	gdouble			*values;	/* by slot */
+	gboolean		*known;		/* by slot */
+	gboolean		*dirty;		/* by key index */
+} SbuDerivedState;
+
+struct _SbuDerived
+{
+	GObject			 parent_instance;
+	GPtrArray		*keys;		/* of SbuDerivedKey, in evaluation order */
+	GHashTable		*hash_slots;	/* key:slot+1 */
+	GPtrArray		*dependents;	/* by slot, of GArray of key index */
+	GPtrArray		*states;	/* of SbuDerivedState, by device */
+	gboolean		 compiled;
+	guint64			 cnt_evaluations;
+};
+
+enum {
+	SIGNAL_CHANGED,
+	SIGNAL_LAST
+};
+
+static guint signals [SIGNAL_LAST] = { 0 };
+
+G_DEFINE_TYPE (SbuDerived, sbu_derived, G_TYPE_OBJECT)
+
+typedef struct {
+	SbuDerived		*self;
+	SbuDerivedKey		*item;
+	const gchar		*expression;
+	const gchar		*pos;
+	guint			 depth;
+	guint			 depth_max;
+	guint			 nesting;	/* of the parser, not the stack */
+} SbuDerivedParser;
+
+static void
+sbu_derived_key_free (SbuDerivedKey *item)
+{
+	g_free (item->key);
+	g_array_unref (item->ops);
+	g_array_unref (item->inputs);
+	g_free (item);
+}
+
+static void
+sbu_derived_state_free (SbuDerivedState *state)
+{
+	g_free (state->prefix);
+	g_free (state->values);
+	g_free (state->known);
+	g_free (state->dirty);
+	g_free (state);
+}
+
+static guint
+sbu_derived_ensure_slot (SbuDerived *self, const gchar *key)
+{
+	guint slot = GPOINTER_TO_UINT (g_hash_table_lookup (self->hash_slots, key));
+	if (slot == 0) {
+		slot = g_hash_table_size (self->hash_slots) + 1;
+		g_hash_table_insert (self->hash_slots, g_strdup (key),
+				     GUINT_TO_POINTER (slot));
+	}
+	return slot - 1;
+}
+
+static void
+sbu_derived_parser_emit (SbuDerivedParser *parser, SbuDerivedOpKind kind,
+			 guint slot, gdouble value)
+{
+	SbuDerivedOp op = { kind, slot, value };
+
+	/* track the stack depth needed to evaluate */
+	switch (kind) {
+	case SBU_DERIVED_OP_CONST:
+	case SBU_DERIVED_OP_SLOT:
+		parser->depth++;
+		break;
+	case SBU_DERIVED_OP_NEG:
+	case SBU_DERIVED_OP_ABS:
+		break;
+	default:
+		parser->depth--;
+		break;
+	}
+	parser->depth_max = MAX (parser->depth_max, parser->depth);
+	g_array_append_val (parser->item->ops, op);
+}
+
+static void
+sbu_derived_parser_skip_space (SbuDerivedParser *parser)
+{
+	while (g_ascii_isspace (*parser->pos))
+		parser->pos++;
+}
+
+static gboolean
+sbu_derived_parser_expect (SbuDerivedParser *parser, gchar c, GError **error)
+{
+	sbu_derived_parser_skip_space (parser);
+	if (*parser->pos != c) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "expected '%c' at position %u of '%s'",
+			     c, (guint) (parser->pos - parser->expression),
+			     parser->expression);
+		return FALSE;
+	}
+	parser->pos++;
+	return TRUE;
+}
+
+/* each recursion is a C stack frame, so bound it before the stack is */
+static gboolean
+sbu_derived_parser_enter (SbuDerivedParser *parser, GError **error)
+{
+	if (parser->nesting >= SBU_DERIVED_NESTING_MAX) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "'%s' is nested too deeply",
+			     parser->expression);
+		return FALSE;
+	}
+	parser->nesting++;
+	return TRUE;
+}
+
+static gboolean sbu_derived_parse_expr (SbuDerivedParser *parser, GError **error);
+
+static gboolean
+sbu_derived_parse_function (SbuDerivedParser *parser, const gchar *name, GError **error)
+{
+	SbuDerivedOpKind kind;
+	guint args;
+
+	if (g_strcmp0 (name, "min") == 0) {
+		kind = SBU_DERIVED_OP_MIN;
+		args = 2;
+	} else if (g_strcmp0 (name, "max") == 0) {
+		kind = SBU_DERIVED_OP_MAX;
+		args = 2;
+	} else if (g_strcmp0 (name, "abs") == 0) {
+		kind = SBU_DERIVED_OP_ABS;
+		args = 1;
+	} else {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "unknown function '%s' in '%s'",
+			     name, parser->expression);
+		return FALSE;
+	}
+	if (!sbu_derived_parser_expect (parser, '(', error))
+		return FALSE;
+	for (guint i = 0; i < args; i++) {
+		if (i > 0 && !sbu_derived_parser_expect (parser, ',', error))
+			return FALSE;
+		if (!sbu_derived_parse_expr (parser, error))
+			return FALSE;
+	}
+	if (!sbu_derived_parser_expect (parser, ')', error))
+		return FALSE;
+	sbu_derived_parser_emit (parser, kind, 0, 0.f);
+	return TRUE;
+}
+
+static gboolean
+sbu_derived_parse_primary (SbuDerivedParser *parser, GError **error)
+{
+	const gchar *start;
+	guint slot;
+	g_autofree gchar *key = NULL;
+	g_autofree gchar *name = NULL;
+
+	sbu_derived_parser_skip_space (parser);
+	start = parser->pos;
+
+	/* sub-expression */
+	if (*start == '(') {
+		parser->pos++;
+		if (!sbu_derived_parse_expr (parser, error))
+			return FALSE;
+		return sbu_derived_parser_expect (parser, ')', error);
+	}
+
+	/* number */
+	if (g_ascii_isdigit (*start) || *start == '.') {
+		gchar *end = NULL;
+		gdouble value = g_ascii_strtod (start, &end);
+		if (end == start) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_DATA,
+				     "invalid number at position %u of '%s'",
+				     (guint) (start - parser->expression),
+				     parser->expression);
+			return FALSE;
+		}
+		parser->pos = end;
+		sbu_derived_parser_emit (parser, SBU_DERIVED_OP_CONST, 0, value);
+		return TRUE;
+	}
+
+	/* function or key */
+	if (!g_ascii_isalpha (*start) && *start != '_') {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "unexpected '%c' at position %u of '%s'",
+			     *start == '\0' ? ' ' : *start,
+			     (guint) (start - parser->expression),
+			     parser->expression);
+		return FALSE;
+	}
+	while (g_ascii_isalnum (*parser->pos) ||
+	       *parser->pos == '_' ||
+	       *parser->pos == ':')
+		parser->pos++;
+	name = g_strndup (start, (gsize) (parser->pos - start));
+	if (strchr (name, ':') == NULL)
+		return sbu_derived_parse_function (parser, name, error);
+	key = sbu_key_normalize (name, error);
+	if (key == NULL)
+		return FALSE;
+	slot = sbu_derived_ensure_slot (parser->self, key);
+	for (guint i = 0; i < parser->item->inputs->len; i++) {
+		if (g_array_index (parser->item->inputs, guint, i) == slot) {
+			sbu_derived_parser_emit (parser, SBU_DERIVED_OP_SLOT, slot, 0.f);
+			return TRUE;
+		}
+	}
+	g_array_append_val (parser->item->inputs, slot);
+	sbu_derived_parser_emit (parser, SBU_DERIVED_OP_SLOT, slot, 0.f);
+	return TRUE;
+}
+
+static gboolean
+sbu_derived_parse_unary (SbuDerivedParser *parser, GError **error)
+{
+	sbu_derived_parser_skip_space (parser);
+	if (*parser->pos == '-') {
+		parser->pos++;
+		if (!sbu_derived_parser_enter (parser, error))
+			return FALSE;
+		if (!sbu_derived_parse_unary (parser, error))
+			return FALSE;
+		parser->nesting--;
+		sbu_derived_parser_emit (parser, SBU_DERIVED_OP_NEG, 0, 0.f);
+		return TRUE;
+	}
+	return sbu_derived_parse_primary (parser, error);
+}
+
+static gboolean
+sbu_derived_parse_term (SbuDerivedParser *parser, GError **error)
+{
+	if (!sbu_derived_parse_unary (parser, error))
+		return FALSE;
+	while (TRUE) {
+		gchar c;
+		sbu_derived_parser_skip_space (parser);
+		c = *parser->pos;
+		if (c != '*' && c != '/')
+			break;
+		parser->pos++;
+		if (!sbu_derived_parse_unary (parser, error))
+			return FALSE;
+		sbu_derived_parser_emit (parser,
+					 c == '*' ? SBU_DERIVED_OP_MUL : SBU_DERIVED_OP_DIV,
+					 0, 0.f);
+	}
+	return TRUE;
+}
+
+static gboolean
+sbu_derived_parse_expr (SbuDerivedParser *parser, GError **error)
+{
+	if (!sbu_derived_parser_enter (parser, error))
+		return FALSE;
+	if (!sbu_derived_parse_term (parser, error))
+		return FALSE;
+	while (TRUE) {
+		gchar c;
+		sbu_derived_parser_skip_space (parser);
+		c = *parser->pos;
+		if (c != '+' && c != '-')
+			break;
+		parser->pos++;
+		if (!sbu_derived_parse_term (parser, error))
+			return FALSE;
+		sbu_derived_parser_emit (parser,
+					 c == '+' ? SBU_DERIVED_OP_ADD : SBU_DERIVED_OP_SUB,
+					 0, 0.f);
+	}
+	parser->nesting--;
+	return TRUE;
+}
+
+/* the daemon sets these itself, so a virtual key must not hide them */
+static gboolean
+sbu_derived_key_is_property (const gchar *key)
+{
+	const gchar *propname = strchr (key, ':') + 1;
+
+	if (g_str_has_prefix (key, "link_"))
+		return g_strcmp0 (propname, "active") == 0;
+	for (guint i = SBU_DEVICE_PROPERTY_UNKNOWN + 1; i < SBU_DEVICE_PROPERTY_LAST; i++) {
+		if (g_strcmp0 (sbu_device_property_to_string (i), propname) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * sbu_derived_add:
+ * @self: a #SbuDerived
+ * @key: a virtual key, e.g. "battery:power_dc"
+ * @expression: e.g. "battery:voltage * battery:current"
+ * @error: a #GError, or %NULL
+ *
+ * Adds a virtual key computed from other keys. Keys are written as
+ * "node:property" or "src_dst:property" and refer to the same device.
+ * The operators are + - * / with parentheses, and the functions min(),
+ * max() and abs(). The virtual key cannot use the name of a real node or
+ * link property such as "battery:power" or "solar_load:active".
+ *
+ * Return value: %TRUE if the expression was valid
+ **/
+gboolean
+sbu_derived_add (SbuDerived *self, const gchar *key, const gchar *expression, GError **error)
+{
+	SbuDerivedParser parser = { self, NULL, expression, expression, 0, 0, 0 };
+	g_autofree gchar *key_normalized = NULL;
+
+	g_return_val_if_fail (SBU_IS_DERIVED (self), FALSE);
+
+	key_normalized = sbu_key_normalize (key, error);
+	if (key_normalized == NULL)
+		return FALSE;
+	if (sbu_derived_key_is_property (key_normalized)) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_EXISTS,
+			     "%s is a real property", key);
+		return FALSE;
+	}
+	for (guint i = 0; i < self->keys->len; i++) {
+		SbuDerivedKey *item = g_ptr_array_index (self->keys, i);
+		if (g_strcmp0 (item->key, key_normalized) == 0) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_EXISTS,
+				     "%s is already defined", key);
+			return FALSE;
+		}
+	}
+
+	/* compile to RPN */
+	parser.item = g_new0 (SbuDerivedKey, 1);
+	parser.item->key = g_steal_pointer (&key_normalized);
+	parser.item->slot = sbu_derived_ensure_slot (self, parser.item->key);
+	parser.item->ops = g_array_new (FALSE, FALSE, sizeof (SbuDerivedOp));
+	parser.item->inputs = g_array_new (FALSE, FALSE, sizeof (guint));
+	if (!sbu_derived_parse_expr (&parser, error)) {
+		sbu_derived_key_free (parser.item);
+		return FALSE;
+	}
+	sbu_derived_parser_skip_space (&parser);
+	if (*parser.pos != '\0') {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "unexpected '%c' at position %u of '%s'",
+			     *parser.pos,
+			     (guint) (parser.pos - expression),
+			     expression);
+		sbu_derived_key_free (parser.item);
+		return FALSE;
+	}
+	if (parser.depth_max > SBU_DERIVED_STACK_MAX) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "'%s' is too complex", expression);
+		sbu_derived_key_free (parser.item);
+		return FALSE;
+	}
+	g_ptr_array_add (self->keys, parser.item);
+	self->compiled = FALSE;
+	return TRUE;
+}
+
+/**
+ * sbu_derived_add_from_string:
+ * @self: a #SbuDerived
+ * @definitions: e.g. "battery:power=battery:voltage*battery:current"
+ * @error: a #GError, or %NULL
+ *
+ * Adds virtual keys separated by ';' or newlines, as used in the config file.
+ *
+ * Return value: %TRUE if all the definitions were valid
+ **/
+gboolean
+sbu_derived_add_from_string (SbuDerived *self, const gchar *definitions, GError **error)
+{
+	g_auto(GStrv) split = NULL;
+
+	g_return_val_if_fail (SBU_IS_DERIVED (self), FALSE);
+
+	split = g_strsplit_set (definitions, ";\n", -1);
+	for (guint i = 0; split[i] != NULL; i++) {
+		gchar *tmp;
+		g_strstrip (split[i]);
+		if (split[i][0] == '\0')
+			continue;
+		tmp = strchr (split[i], '=');
+		if (tmp == NULL) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_DATA,
+				     "expected key=expression, got '%s'",
+				     split[i]);
+			return FALSE;
+		}
+		*tmp = '\0';
+		if (!sbu_derived_add (self, g_strstrip (split[i]), tmp + 1, error))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+sbu_derived_compile_visit (SbuDerived *self, gint *key_for_slot, guint8 *marks,
+			   guint idx, GPtrArray *order, GError **error)
+{
+	SbuDerivedKey *item = g_ptr_array_index (self->keys, idx);
+
+	if (marks[idx] == 2)
+		return TRUE;
+	if (marks[idx] == 1) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_DATA,
+			     "%s depends on itself", item->key);
+		return FALSE;
+	}
+	marks[idx] = 1;
+	for (guint i = 0; i < item->inputs->len; i++) {
+		gint dep = key_for_slot[g_array_index (item->inputs, guint, i)];
+		if (dep < 0)
+			continue;
+		if (!sbu_derived_compile_visit (self, key_for_slot, marks,
+						(guint) dep, order, error))
+			return FALSE;
+	}
+	marks[idx] = 2;
+	g_ptr_array_add (order, item);
+	return TRUE;
+}
+
+/**
+ * sbu_derived_compile:
+ * @self: a #SbuDerived
+ * @error: a #GError, or %NULL
+ *
+ * Orders the virtual keys so that each is evaluated after anything it
+ * depends on, and builds the map from each key to the virtual keys that
+ * use it. Any existing device state is discarded.
+ *
+ * Return value: %TRUE if there were no circular dependencies
+ **/
+gboolean
+sbu_derived_compile (SbuDerived *self, GError **error)
+{
+	guint slots;
+	g_autofree gint *key_for_slot = NULL;
+	g_autofree guint8 *marks = NULL;
+	g_autoptr(GPtrArray) order = NULL;
+
+	g_return_val_if_fail (SBU_IS_DERIVED (self), FALSE);
+
+	/* topological sort */
+	slots = g_hash_table_size (self->hash_slots);
+	key_for_slot = g_new (gint, slots);
+	for (guint i = 0; i < slots; i++)
+		key_for_slot[i] = -1;
+	for (guint i = 0; i < self->keys->len; i++) {
+		SbuDerivedKey *item = g_ptr_array_index (self->keys, i);
+		key_for_slot[item->slot] = (gint) i;
+	}
+	marks = g_new0 (guint8, self->keys->len);
+	order = g_ptr_array_new ();
+	for (guint i = 0; i < self->keys->len; i++) {
+		if (!sbu_derived_compile_visit (self, key_for_slot, marks, i, order, error))
+			return FALSE;
+	}
+	for (guint i = 0; i < order->len; i++)
+		self->keys->pdata[i] = order->pdata[i];
+
+	/* dependents are in evaluation order too */
+	g_ptr_array_set_size (self->dependents, 0);
+	for (guint i = 0; i < slots; i++)
+		g_ptr_array_add (self->dependents, g_array_new (FALSE, FALSE, sizeof (guint)));
+	for (guint i = 0; i < self->keys->len; i++) {
+		SbuDerivedKey *item = g_ptr_array_index (self->keys, i);
+		for (guint j = 0; j < item->inputs->len; j++) {
+			guint slot = g_array_index (item->inputs, guint, j);
+			g_array_append_val (g_ptr_array_index (self->dependents, slot), i);
+		}
+	}
+	g_ptr_array_set_size (self->states, 0);
+	self->compiled = TRUE;
+	return TRUE;
+}
+
+static gboolean
+sbu_derived_key_eval (SbuDerivedKey *item, SbuDerivedState *state, gdouble *result)
+{
+	gdouble stack[SBU_DERIVED_STACK_MAX];
+	guint sp = 0;
+
+	/* not all the inputs have been seen yet */
+	for (guint i = 0; i < item->inputs->len; i++) {
+		if (!state->known[g_array_index (item->inputs, guint, i)])
+			return FALSE;
+	}
+
+	for (guint i = 0; i < item->ops->len; i++) {
+		SbuDerivedOp *op = &g_array_index (item->ops, SbuDerivedOp, i);
+		switch (op->kind) {
+		case SBU_DERIVED_OP_CONST:
+			stack[sp++] = op->value;
+			break;
+		case SBU_DERIVED_OP_SLOT:
+			stack[sp++] = state->values[op->slot];
+			break;
+		case SBU_DERIVED_OP_ADD:
+			sp--;
+			stack[sp - 1] += stack[sp];
+			break;
+		case SBU_DERIVED_OP_SUB:
+			sp--;
+			stack[sp - 1] -= stack[sp];
+			break;
+		case SBU_DERIVED_OP_MUL:
+			sp--;
+			stack[sp - 1] *= stack[sp];
+			break;
+		case SBU_DERIVED_OP_DIV:
+			sp--;
+			stack[sp - 1] /= stack[sp];
+			break;
+		case SBU_DERIVED_OP_NEG:
+			stack[sp - 1] = -stack[sp - 1];
+			break;
+		case SBU_DERIVED_OP_MIN:
+			sp--;
+			stack[sp - 1] = MIN (stack[sp - 1], stack[sp]);
+			break;
+		case SBU_DERIVED_OP_MAX:
+			sp--;
+			stack[sp - 1] = MAX (stack[sp - 1], stack[sp]);
+			break;
+		case SBU_DERIVED_OP_ABS:
+			stack[sp - 1] = fabs (stack[sp - 1]);
+			break;
+		default:
+			g_assert_not_reached ();
+		}
+	}
+
+	/* e.g. divide by zero */
+	*result = stack[0];
+	return isfinite (*result);
+}
+
+static void
+sbu_derived_state_mark_dirty (SbuDerived *self, SbuDerivedState *state, guint slot)
+{
+	GArray *deps = g_ptr_array_index (self->dependents, slot);
+	for (guint i = 0; i < deps->len; i++)
+		state->dirty[g_array_index (deps, guint, i)] = TRUE;
+}
+
+static void
+sbu_derived_state_update (SbuDerived *self, SbuDerivedState *state,
+			  guint slot, gdouble value)
+{
+	GArray *deps = g_ptr_array_index (self->dependents, slot);
+
+	/* nothing to do */
+	if (state->known[slot] && state->values[slot] == value)
+		return;
+	state->values[slot] = value;
+	state->known[slot] = TRUE;
+	if (deps->len == 0)
+		return;
+
+	/* anything that uses a virtual key is always later in the order */
+	sbu_derived_state_mark_dirty (self, state, slot);
+	for (guint i = g_array_index (deps, guint, 0); i < self->keys->len; i++) {
+		SbuDerivedKey *item = g_ptr_array_index (self->keys, i);
+		gdouble result;
+		g_autofree gchar *key = NULL;
+
+		if (!state->dirty[i])
+			continue;
+		state->dirty[i] = FALSE;
+		if (!sbu_derived_key_eval (item, state, &result))
+			continue;
+		self->cnt_evaluations++;
+		if (state->known[item->slot] && state->values[item->slot] == result)
+			continue;
+		state->values[item->slot] = result;
+		state->known[item->slot] = TRUE;
+		sbu_derived_state_mark_dirty (self, state, item->slot);
+		key = g_strdup_printf ("%s%s", state->prefix, item->key);
+		g_signal_emit (self, signals[SIGNAL_CHANGED], 0, key, result);
+	}
+}
+
+static SbuDerivedState *
+sbu_derived_ensure_state (SbuDerived *self, const gchar *key, gsize prefix_len)
+{
+	SbuDerivedState *state;
+	guint slots = self->dependents->len;
+
+	for (guint i = 0; i < self->states->len; i++) {
+		state = g_ptr_array_index (self->states, i);
+		if (state->prefix_len == prefix_len &&
+		    strncmp (state->prefix, key, prefix_len) == 0)
+			return state;
+	}
+	state = g_new0 (SbuDerivedState, 1);
+	state->prefix = g_strndup (key, prefix_len);
+	state->prefix_len = prefix_len;
+	state->values = g_new0 (gdouble, slots);
+	state->known = g_new0 (gboolean, slots);
+	state->dirty = g_new0 (gboolean, self->keys->len);
+	g_ptr_array_add (self->states, state);
+	return state;
+}
+
+/**
+ * sbu_derived_set_value:
+ * @self: a #SbuDerived
+ * @key: a history key, e.g. "/0/node_battery:voltage"
+ * @value: the new value
+ *
+ * Updates an input and re-evaluates only the virtual keys that depend on
+ * it, emitting ::changed for each one with a new value. Each device, i.e.
+ * the part of @key before the last '/', has its own set of values.
+ **/
+void
+sbu_derived_set_value (SbuDerived *self, const gchar *key, gdouble value)
+{
+	const gchar *name;
+	gsize prefix_len = 0;
+	guint slot;
+
+	g_return_if_fail (SBU_IS_DERIVED (self));
+
+	if (!self->compiled)
+		return;
+	name = strrchr (key, '/');
+	if (name != NULL) {
+		name++;
+		prefix_len = (gsize) (name - key);
+	} else {
+		name = key;
+	}
+
+	/* not used by anything */
+	slot = GPOINTER_TO_UINT (g_hash_table_lookup (self->hash_slots, name));
+	if (slot == 0)
+		return;
+	sbu_derived_state_update (self,
+				  sbu_derived_ensure_state (self, key, prefix_len),
+				  slot - 1, value);
+}
+
+guint
+sbu_derived_get_size (SbuDerived *self)
+{
+	g_return_val_if_fail (SBU_IS_DERIVED (self), 0);
+	return self->keys->len;
+}
+
+guint64
+sbu_derived_get_evaluation_count (SbuDerived *self)
+{
+	g_return_val_if_fail (SBU_IS_DERIVED (self), 0);
+	return self->cnt_evaluations;
+}
+
+static void
+sbu_derived_finalize (GObject *object)
+{
+	SbuDerived *self = SBU_DERIVED (object);
+
+	g_ptr_array_unref (self->keys);
+	g_ptr_array_unref (self->dependents);
+	g_ptr_array_unref (self->states);
+	g_hash_table_unref (self->hash_slots);
+
+	G_OBJECT_CLASS (sbu_derived_parent_class)->finalize (object);
+}
+
+static void
+sbu_derived_init (SbuDerived *self)
+{
+	self->keys = g_ptr_array_new_with_free_func ((GDestroyNotify) sbu_derived_key_free);
+	self->dependents = g_ptr_array_new_with_free_func ((GDestroyNotify) g_array_unref);
+	self->states = g_ptr_array_new_with_free_func ((GDestroyNotify) sbu_derived_state_free);
+	self->hash_slots = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static void
+sbu_derived_class_init (SbuDerivedClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = sbu_derived_finalize;
+
+	signals [SIGNAL_CHANGED] =
+		g_signal_new ("changed",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, g_cclosure_marshal_generic,
+			      G_TYPE_NONE, 2, G_TYPE_STRING, G_TYPE_DOUBLE);
+}
+
+/**
+ * sbu_derived_new:
+ *
+ * Return value: a new SbuDerived object.
+ **/
+SbuDerived *
+sbu_derived_new (void)
+{
+	SbuDerived *self;
+	self = g_object_new (SBU_TYPE_DERIVED, NULL);
+	return SBU_DERIVED (self);
+}
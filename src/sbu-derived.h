@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __SBU_DERIVED_H
+#define __SBU_DERIVED_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define SBU_TYPE_DERIVED (sbu_derived_get_type ())
+
+G_DECLARE_FINAL_TYPE (SbuDerived, sbu_derived, SBU, DERIVED, GObject)
+
+SbuDerived	*sbu_derived_new		(void);
+gboolean	 sbu_derived_add		(SbuDerived	*self,
+						 const gchar	*key,
+						 const gchar	*expression,
+						 GError		**error);
+gboolean	 sbu_derived_add_from_string	(SbuDerived	*self,
+						 const gchar	*definitions,
+						 GError		**error);
+gboolean	 sbu_derived_compile		(SbuDerived	*self,
+						 GError		**error);
+guint		 sbu_derived_get_size		(SbuDerived	*self);
+void		 sbu_derived_set_value		(SbuDerived	*self,
+						 const gchar	*key,
+						 gdouble	 value);
+guint64		 sbu_derived_get_evaluation_count (SbuDerived	*self);
+
+G_END_DECLS
+
+#endif /* __SBU_DERIVED_H */
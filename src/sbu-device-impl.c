@@ -25,7 +25,9 @@
 #include <string.h>
 
 #include "sbu-device-impl.h"
+#include "sbu-energy.h"
 #include "sbu-node-impl.h"
+#include "sbu-soc.h"
 
 typedef struct _SbuDeviceImplClass	SbuDeviceImplClass;
 
@@ -37,6 +39,19 @@ struct _SbuDeviceImpl
 	GPtrArray			*nodes;
 	GPtrArray			*links;
 	SbuDatabase			*database;
+	SbuMetrics			*metrics;
+	SbuSoc				*soc;
+	guint				 update_depth;
+	guint				 flush_id;
+	guint				 flush_interval;	/* ms */
+	gdouble				 node_values[SBU_NODE_KIND_LAST][SBU_DEVICE_PROPERTY_LAST];
+	guint32				 node_pending[SBU_NODE_KIND_LAST];
+	gboolean			 link_values[SBU_NODE_KIND_LAST][SBU_NODE_KIND_LAST];
+	gboolean			 link_pending[SBU_NODE_KIND_LAST][SBU_NODE_KIND_LAST];
+	guint32				 node_changed[SBU_NODE_KIND_LAST];
+	gboolean			 link_changed[SBU_NODE_KIND_LAST][SBU_NODE_KIND_LAST];
+	guint64				 cnt_updates;
+	guint64				 cnt_messages;
 };
 
 struct _SbuDeviceImplClass
@@ -52,6 +67,13 @@ enum
 	PROP_LAST
 };
 
+enum {
+	SIGNAL_CHANGED,
+	SIGNAL_LAST
+};
+
+static guint signals [SIGNAL_LAST] = { 0 };
+
 static void sbu_device_iface_init (SbuDeviceIface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (SbuDeviceImpl, sbu_device_impl, SBU_TYPE_DEVICE_SKELETON,
@@ -99,6 +121,42 @@ sbu_device_impl_get_link (SbuDeviceImpl *self, SbuNodeKind src, SbuNodeKind dst)
 	return NULL;
 }
 
+static gboolean
+sbu_device_impl_is_staging (SbuDeviceImpl *self)
+{
+	return self->update_depth > 0 || self->flush_id != 0;
+}
+
+static void
+sbu_device_impl_emit_node_changed (SbuDeviceImpl *self,
+				   SbuNodeKind kind,
+				   SbuDeviceProperty key,
+				   gdouble value)
+{
+	SbuNodeImpl *n = sbu_device_impl_get_node (self, kind);
+	if (n == NULL || sbu_node_impl_get_object_path (n) == NULL)
+		return;
+	g_signal_emit (self, signals[SIGNAL_CHANGED], 0,
+		       sbu_node_impl_get_object_path (n),
+		       sbu_device_property_to_string (key),
+		       value);
+}
+
+static void
+sbu_device_impl_emit_link_changed (SbuDeviceImpl *self,
+				   SbuNodeKind src,
+				   SbuNodeKind dst,
+				   gboolean value)
+{
+	SbuLinkImpl *l = sbu_device_impl_get_link (self, src, dst);
+	if (l == NULL || sbu_link_impl_get_object_path (l) == NULL)
+		return;
+	g_signal_emit (self, signals[SIGNAL_CHANGED], 0,
+		       sbu_link_impl_get_object_path (l),
+		       "active",
+		       value ? 1.f : 0.f);
+}
+
 gdouble
 sbu_device_impl_get_node_value (SbuDeviceImpl *self,
 				SbuNodeKind kind,
@@ -106,6 +164,12 @@ sbu_device_impl_get_node_value (SbuDeviceImpl *self,
 {
 	SbuNodeImpl *n;
 	gdouble val;
+
+	/* not yet flushed */
+	if (kind < SBU_NODE_KIND_LAST && key < SBU_DEVICE_PROPERTY_LAST &&
+	    self->node_pending[kind] & (1u << key))
+		return self->node_values[kind][key];
+
 	n = sbu_device_impl_get_node (self, kind);
 	if (n == NULL)
 		return 0.f;
@@ -119,10 +183,31 @@ sbu_device_impl_set_node_value (SbuDeviceImpl *self,
 				SbuDeviceProperty key,
 				gdouble value)
 {
-	SbuNodeImpl *n = sbu_device_impl_get_node (self, kind);
+	SbuNodeImpl *n;
+
+	/* defer until the flush */
+	if (sbu_device_impl_is_staging (self) &&
+	    kind < SBU_NODE_KIND_LAST &&
+	    key > SBU_DEVICE_PROPERTY_UNKNOWN &&
+	    key < SBU_DEVICE_PROPERTY_LAST) {
+		if (sbu_device_impl_get_node_value (self, kind, key) == value)
+			return;
+		self->node_values[kind][key] = value;
+		self->node_pending[kind] |= 1u << key;
+		if (self->update_depth > 0)
+			self->node_changed[kind] |= 1u << key;
+		else
+			sbu_device_impl_emit_node_changed (self, kind, key, value);
+		return;
+	}
+
+	n = sbu_device_impl_get_node (self, kind);
 	if (n == NULL)
 		return;
+	if (sbu_device_impl_get_node_value (self, kind, key) == value)
+		return;
 	g_object_set (n, sbu_device_property_to_string (key), value, NULL);
+	sbu_device_impl_emit_node_changed (self, kind, key, value);
 }
 
 gboolean
@@ -131,7 +216,14 @@ sbu_device_impl_get_link_active (SbuDeviceImpl *self,
 				 SbuNodeKind dst)
 {
 	gboolean value;
-	SbuLinkImpl *l = sbu_device_impl_get_link (self, src, dst);
+	SbuLinkImpl *l;
+
+	/* not yet flushed */
+	if (src < SBU_NODE_KIND_LAST && dst < SBU_NODE_KIND_LAST &&
+	    self->link_pending[src][dst])
+		return self->link_values[src][dst];
+
+	l = sbu_device_impl_get_link (self, src, dst);
 	if (l == NULL)
 		return FALSE;
 	g_object_get (l, "active", &value, NULL);
@@ -144,11 +236,229 @@ sbu_device_impl_set_link_active (SbuDeviceImpl *self,
 				 SbuNodeKind dst,
 				 gboolean value)
 {
-	SbuLinkImpl *l = sbu_device_impl_get_link (self, src, dst);
+	SbuLinkImpl *l;
+
+	/* defer until the flush */
+	if (sbu_device_impl_is_staging (self) &&
+	    src < SBU_NODE_KIND_LAST && dst < SBU_NODE_KIND_LAST) {
+		if (sbu_device_impl_get_link_active (self, src, dst) == value)
+			return;
+		self->link_values[src][dst] = value;
+		self->link_pending[src][dst] = TRUE;
+		if (self->update_depth > 0)
+			self->link_changed[src][dst] = TRUE;
+		else
+			sbu_device_impl_emit_link_changed (self, src, dst, value);
+		return;
+	}
+
+	l = sbu_device_impl_get_link (self, src, dst);
 	if (l == NULL)
 		return;
+	if (sbu_device_impl_get_link_active (self, src, dst) == value)
+		return;
 	g_object_set (l, "active", value, NULL);
+	sbu_device_impl_emit_link_changed (self, src, dst, value);
+}
+
+/* the history, energy, derived keys and rules see every poll, even when the
+ * D-Bus properties are only updated at the end of the flush window */
+static void
+sbu_device_impl_emit_changes (SbuDeviceImpl *self)
+{
+	for (guint i = 0; i < SBU_NODE_KIND_LAST; i++) {
+		if (self->node_changed[i] == 0)
+			continue;
+		for (guint j = 0; j < SBU_DEVICE_PROPERTY_LAST; j++) {
+			if ((self->node_changed[i] & (1u << j)) == 0)
+				continue;
+			sbu_device_impl_emit_node_changed (self, i, j,
+							   self->node_values[i][j]);
+		}
+		self->node_changed[i] = 0;
+		self->cnt_updates++;
+	}
+	for (guint i = 0; i < SBU_NODE_KIND_LAST; i++) {
+		for (guint j = 0; j < SBU_NODE_KIND_LAST; j++) {
+			if (!self->link_changed[i][j])
+				continue;
+			sbu_device_impl_emit_link_changed (self, i, j,
+							   self->link_values[i][j]);
+			self->link_changed[i][j] = FALSE;
+			self->cnt_updates++;
+		}
+	}
+}
+
+static void
+sbu_device_impl_flush (SbuDeviceImpl *self)
+{
+	guint cnt_messages = 0;
+
+	/* one PropertiesChanged per object with any actual change */
+	for (guint i = 0; i < self->nodes->len; i++) {
+		SbuNodeImpl *node = g_ptr_array_index (self->nodes, i);
+		SbuNodeKind kind;
+		gboolean changed = FALSE;
+
+		g_object_get (node, "kind", &kind, NULL);
+		if (kind >= SBU_NODE_KIND_LAST || self->node_pending[kind] == 0)
+			continue;
+		g_object_freeze_notify (G_OBJECT (node));
+		for (guint j = 0; j < SBU_DEVICE_PROPERTY_LAST; j++) {
+			const gchar *propname = sbu_device_property_to_string (j);
+			gdouble val = self->node_values[kind][j];
+			gdouble val_old;
+			if ((self->node_pending[kind] & (1u << j)) == 0)
+				continue;
+			g_object_get (node, propname, &val_old, NULL);
+			if (val == val_old)
+				continue;
+			g_object_set (node, propname, val, NULL);
+			changed = TRUE;
+		}
+		self->node_pending[kind] = 0;
+		g_object_thaw_notify (G_OBJECT (node));
+		if (changed)
+			cnt_messages++;
+	}
+	for (guint i = 0; i < self->links->len; i++) {
+		SbuLinkImpl *link = g_ptr_array_index (self->links, i);
+		SbuNodeKind src, dst;
+		gboolean val_old;
+
+		g_object_get (link, "src", &src, "dst", &dst, "active", &val_old, NULL);
+		if (src >= SBU_NODE_KIND_LAST || dst >= SBU_NODE_KIND_LAST)
+			continue;
+		if (!self->link_pending[src][dst])
+			continue;
+		self->link_pending[src][dst] = FALSE;
+		if (self->link_values[src][dst] == val_old)
+			continue;
+		g_object_set (link, "active", self->link_values[src][dst], NULL);
+		cnt_messages++;
+	}
+
+	/* anything left over had no node or link to apply to */
+	memset (self->node_pending, 0, sizeof (self->node_pending));
+	memset (self->link_pending, 0, sizeof (self->link_pending));
+
+	self->cnt_messages += cnt_messages;
+	g_debug ("flushed %u PropertiesChanged, %" G_GUINT64_FORMAT
+		 " sent in total for %" G_GUINT64_FORMAT " changed objects",
+		 cnt_messages, self->cnt_messages, self->cnt_updates);
+}
+
+static gboolean
+sbu_device_impl_flush_cb (gpointer user_data)
+{
+	SbuDeviceImpl *self = SBU_DEVICE_IMPL (user_data);
+	self->flush_id = 0;
+	if (self->update_depth == 0)
+		sbu_device_impl_flush (self);
+	return FALSE;
+}
+
+void
+sbu_device_impl_set_flush_interval (SbuDeviceImpl *self, guint flush_interval)
+{
+	self->flush_interval = flush_interval;
+}
+
+/* how many PropertiesChanged would have been sent without the flush window,
+ * as the skeleton already sends one per object per main loop iteration */
+guint64
+sbu_device_impl_get_update_count (SbuDeviceImpl *self)
+{
+	return self->cnt_updates;
+}
+
+guint64
+sbu_device_impl_get_message_count (SbuDeviceImpl *self)
+{
+	return self->cnt_messages;
+}
+
+void
+sbu_device_impl_set_battery_capacity (SbuDeviceImpl *self, gdouble capacity)
+{
+	g_clear_object (&self->soc);
+	if (capacity > 0.f)
+		self->soc = sbu_soc_new (capacity);
+}
+
+void
+sbu_device_impl_set_battery_full (SbuDeviceImpl *self)
+{
+	if (self->soc == NULL)
+		return;
+	g_debug ("battery full, anchoring state of charge");
+	sbu_soc_anchor (self->soc, 100.f);
+}
+
+void
+sbu_device_impl_set_battery_estimate (SbuDeviceImpl *self, gdouble value)
+{
+	if (self->soc == NULL)
+		return;
+	sbu_soc_set_estimate (self->soc, value);
+}
+
+static void
+sbu_device_impl_update_state_of_charge (SbuDeviceImpl *self)
+{
+	gdouble current;
+	gdouble value;
 
+	if (self->soc == NULL)
+		return;
+	current = sbu_device_impl_get_node_value (self,
+						  SBU_NODE_KIND_BATTERY,
+						  SBU_DEVICE_PROPERTY_CURRENT);
+	sbu_soc_add_sample (self->soc, g_get_monotonic_time (), current);
+	value = sbu_soc_get_value (self->soc);
+	if (value < 0.f)
+		return;
+
+	/* 0.1% is plenty, and avoids a change every poll */
+	sbu_device_impl_set_node_value (self,
+					SBU_NODE_KIND_BATTERY,
+					SBU_DEVICE_PROPERTY_STATE_OF_CHARGE,
+					round (value * 10.f) / 10.f);
+}
+
+void
+sbu_device_impl_begin_update (SbuDeviceImpl *self)
+{
+	self->update_depth++;
+}
+
+void
+sbu_device_impl_commit_update (SbuDeviceImpl *self)
+{
+	g_return_if_fail (self->update_depth > 0);
+
+	/* still in an outer transaction */
+	if (self->update_depth > 1) {
+		self->update_depth--;
+		return;
+	}
+
+	/* once per transaction, while the battery current is staged */
+	sbu_device_impl_update_state_of_charge (self);
+	self->update_depth--;
+	sbu_device_impl_emit_changes (self);
+
+	/* coalesce with any later transactions in the window */
+	if (self->flush_interval == 0) {
+		sbu_device_impl_flush (self);
+		return;
+	}
+	if (self->flush_id == 0) {
+		self->flush_id = g_timeout_add (self->flush_interval,
+						sbu_device_impl_flush_cb,
+						self);
+	}
 }
 
 /* runs in thread dedicated to handling @invocation */
@@ -158,6 +468,7 @@ sbu_device_impl_get_nodes (SbuDevice *_device,
 {
 	SbuDeviceImpl *self = SBU_DEVICE_IMPL (_device);
 	GVariantBuilder builder;
+	gint64 ts = g_get_monotonic_time ();
 
 	g_debug ("handling GetNodes");
 	g_variant_builder_init (&builder, G_VARIANT_TYPE ("(ao)"));
@@ -170,6 +481,9 @@ sbu_device_impl_get_nodes (SbuDevice *_device,
 	g_variant_builder_close (&builder);
 	g_dbus_method_invocation_return_value (invocation,
 					       g_variant_builder_end (&builder));
+	sbu_metrics_observe (self->metrics, "sbud_dbus_method_seconds",
+			     "method=\"GetNodes\"",
+			     g_get_monotonic_time () - ts);
 	return TRUE;
 }
 
@@ -180,6 +494,7 @@ sbu_device_impl_get_links (SbuDevice *_device,
 {
 	SbuDeviceImpl *self = SBU_DEVICE_IMPL (_device);
 	GVariantBuilder builder;
+	gint64 ts = g_get_monotonic_time ();
 
 	g_debug ("handling GetLinks");
 	g_variant_builder_init (&builder, G_VARIANT_TYPE ("(ao)"));
@@ -192,17 +507,19 @@ sbu_device_impl_get_links (SbuDevice *_device,
 	g_variant_builder_close (&builder);
 	g_dbus_method_invocation_return_value (invocation,
 					       g_variant_builder_end (&builder));
+	sbu_metrics_observe (self->metrics, "sbud_dbus_method_seconds",
+			     "method=\"GetLinks\"",
+			     g_get_monotonic_time () - ts);
 	return TRUE;
 }
 
-/* runs in thread dedicated to handling @invocation */
 static gboolean
-sbu_device_impl_get_history (SbuDevice *_device,
-			     GDBusMethodInvocation *invocation,
-			     const gchar *arg_key,
-			     guint64 arg_start,
-			     guint64 arg_end,
-			     guint limit)
+sbu_device_impl_get_history_internal (SbuDevice *_device,
+				      GDBusMethodInvocation *invocation,
+				      const gchar *arg_key,
+				      guint64 arg_start,
+				      guint64 arg_end,
+				      guint limit)
 {
 	SbuDeviceImpl *self = SBU_DEVICE_IMPL (_device);
 	GVariantBuilder builder;
@@ -244,68 +561,8 @@ sbu_device_impl_get_history (SbuDevice *_device,
 		return FALSE;
 	}
 
-	/* no filter */
-	if (limit == 0) {
-		results2 = g_ptr_array_ref (results);
-
-	/* just one value */
-	} else if (limit == 1) {
-		SbuDatabaseItem *item;
-		gdouble ave_acc = 0;
-		gint ts = 0;
-		results2 = g_ptr_array_new_with_free_func (g_free);
-		for (guint i = 0; i < results->len; i++) {
-			item = g_ptr_array_index (results, i);
-			ave_acc += item->val;
-			ts = item->ts;
-		}
-		item = g_new0 (SbuDatabaseItem, 1);
-		item->ts = ts;
-		item->val = ave_acc / results->len;
-		g_ptr_array_add (results2, item);
-
-	/* bin into averaged groups */
-	} else {
-		gint ts_last_added = 0;
-		guint ave_cnt = 0;
-		gdouble ave_acc = 0;
-		gint64 interval = (arg_end - arg_start) / (limit - 1);
-
-		results2 = g_ptr_array_new_with_free_func (g_free);
-		for (guint i = 0; i < results->len; i++) {
-			SbuDatabaseItem *item = g_ptr_array_index (results, i);
-
-			if (ts_last_added == 0)
-				ts_last_added = item->ts;
-
-			/* first and last points */
-			if (i == 0 || i == results->len - 1) {
-				SbuDatabaseItem *item2 = g_new0 (SbuDatabaseItem, 1);
-				item2->ts = item->ts;
-				item2->val = item->val;
-				g_ptr_array_add (results2, item2);
-				continue;
-			}
-
-			/* add to moving average */
-			ave_acc += item->val;
-			ave_cnt += 1;
-
-			/* more than the interval */
-			if (item->ts - ts_last_added > interval) {
-				SbuDatabaseItem *item2 = g_new0 (SbuDatabaseItem, 1);
-				item2->ts = item->ts;
-				item2->val = ave_acc / (gdouble) ave_cnt;
-				g_ptr_array_add (results2, item2);
-				ts_last_added = item->ts;
-
-				/* reset moving average */
-				ave_cnt = 0;
-				ave_acc = 0.f;
-			}
-		}
-	}
-
+	/* no filter, one average or binned into averaged groups */
+	results2 = sbu_database_reduce_items (results, arg_start, arg_end, limit);
 
 	/* return as a GVariant */
 	g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a(td))"));
@@ -323,15 +580,120 @@ sbu_device_impl_get_history (SbuDevice *_device,
 	return TRUE;
 }
 
+/* runs in thread dedicated to handling @invocation */
+static gboolean
+sbu_device_impl_get_history (SbuDevice *_device,
+			     GDBusMethodInvocation *invocation,
+			     const gchar *arg_key,
+			     guint64 arg_start,
+			     guint64 arg_end,
+			     guint limit)
+{
+	SbuDeviceImpl *self = SBU_DEVICE_IMPL (_device);
+	gboolean ret;
+	gint64 ts = g_get_monotonic_time ();
+
+	ret = sbu_device_impl_get_history_internal (_device, invocation,
+						    arg_key, arg_start,
+						    arg_end, limit);
+	sbu_metrics_observe (self->metrics, "sbud_dbus_method_seconds",
+			     "method=\"GetHistory\"",
+			     g_get_monotonic_time () - ts);
+	return ret;
+}
+
+static gboolean
+sbu_device_impl_get_energy_internal (SbuDevice *_device,
+				     GDBusMethodInvocation *invocation,
+				     const gchar *arg_key,
+				     guint64 arg_start,
+				     guint64 arg_end,
+				     guint granularity)
+{
+	SbuDeviceImpl *self = SBU_DEVICE_IMPL (_device);
+	GVariantBuilder builder;
+	g_autoptr(GPtrArray) results = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GString) key = g_string_new (NULL);
+	const gchar *device_id_suffix = self->object_path;
+
+	/* sanity check */
+	if (self->database == NULL) {
+		g_dbus_method_invocation_return_error (invocation,
+						       G_IO_ERROR,
+						       G_IO_ERROR_FAILED,
+						       "no database to use");
+		return FALSE;
+	}
+
+	/* clients can query raw keys or those with a prefix */
+	if (g_strstr_len (arg_key, -1, ":") != NULL) {
+		if (g_str_has_prefix (device_id_suffix, SBU_DBUS_PATH_DEVICE))
+			device_id_suffix += strlen (SBU_DBUS_PATH_DEVICE);
+		g_string_printf (key, "%s/%s", device_id_suffix, arg_key);
+	} else {
+		g_string_assign (key, arg_key);
+	}
+
+	/* get the totals in each bucket */
+	g_debug ("handling GetEnergy %s for %" G_GUINT64_FORMAT
+		 "->%" G_GUINT64_FORMAT, key->str, arg_start, arg_end);
+	results = sbu_energy_query (self->database, key->str,
+				    arg_start, arg_end, granularity,
+				    &error);
+	if (results == NULL) {
+		g_dbus_method_invocation_return_gerror (invocation, error);
+		return FALSE;
+	}
+
+	/* return as a GVariant in Wh */
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("(a(tdd))"));
+	g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(tdd)"));
+	for (guint i = 0; i < results->len; i++) {
+		SbuDatabaseEnergy *item = g_ptr_array_index (results, i);
+		g_variant_builder_add (&builder, "(tdd)", item->ts,
+				       (gdouble) item->pos / 1000.f,
+				       (gdouble) item->neg / 1000.f);
+	}
+	g_variant_builder_close (&builder);
+	g_dbus_method_invocation_return_value (invocation,
+					       g_variant_builder_end (&builder));
+	return TRUE;
+}
+
+/* runs in thread dedicated to handling @invocation */
+static gboolean
+sbu_device_impl_get_energy (SbuDevice *_device,
+			    GDBusMethodInvocation *invocation,
+			    const gchar *arg_key,
+			    guint64 arg_start,
+			    guint64 arg_end,
+			    guint granularity)
+{
+	SbuDeviceImpl *self = SBU_DEVICE_IMPL (_device);
+	gboolean ret;
+	gint64 ts = g_get_monotonic_time ();
+
+	ret = sbu_device_impl_get_energy_internal (_device, invocation,
+						   arg_key, arg_start,
+						   arg_end, granularity);
+	sbu_metrics_observe (self->metrics, "sbud_dbus_method_seconds",
+			     "method=\"GetEnergy\"",
+			     g_get_monotonic_time () - ts);
+	return ret;
+}
+
 void
 sbu_device_impl_add_node (SbuDeviceImpl *self, SbuNodeImpl *node)
 {
+	g_return_if_fail (self->update_depth == 0);
 	g_ptr_array_add (self->nodes, g_object_ref (node));
 }
 
 void
 sbu_device_impl_add_link (SbuDeviceImpl *self, SbuLinkImpl *link)
 {
+	g_return_if_fail (self->update_depth == 0);
 	g_ptr_array_add (self->links, g_object_ref (link));
 }
 
@@ -399,6 +761,7 @@ sbu_device_iface_init (SbuDeviceIface *iface)
 	iface->handle_get_nodes = sbu_device_impl_get_nodes;
 	iface->handle_get_links = sbu_device_impl_get_links;
 	iface->handle_get_history = sbu_device_impl_get_history;
+	iface->handle_get_energy = sbu_device_impl_get_energy;
 }
 
 static void
@@ -480,6 +843,18 @@ sbu_device_set_database (SbuDeviceImpl *self, SbuDatabase *database)
 	g_set_object (&self->database, database);
 }
 
+SbuDatabase *
+sbu_device_impl_get_database (SbuDeviceImpl *self)
+{
+	return self->database;
+}
+
+void
+sbu_device_impl_set_metrics (SbuDeviceImpl *self, SbuMetrics *metrics)
+{
+	g_set_object (&self->metrics, metrics);
+}
+
 static void
 sbu_device_impl_set_property (GObject *object,
 			      guint prop_id,
@@ -507,9 +882,15 @@ static void
 sbu_device_impl_finalize (GObject *object)
 {
 	SbuDeviceImpl *self = SBU_DEVICE_IMPL (object);
+	if (self->flush_id != 0)
+		g_source_remove (self->flush_id);
 	g_free (self->object_path);
 	if (self->database != NULL)
 		g_object_unref (self->database);
+	if (self->metrics != NULL)
+		g_object_unref (self->metrics);
+	if (self->soc != NULL)
+		g_object_unref (self->soc);
 	g_ptr_array_unref (self->nodes);
 	g_ptr_array_unref (self->links);
 	G_OBJECT_CLASS (sbu_device_impl_parent_class)->finalize (object);
@@ -546,6 +927,14 @@ sbu_device_impl_class_init (SbuDeviceImplClass *klass_device)
 							      "D-Bus Object Path",
 							      NULL, NULL,
 							      G_PARAM_READWRITE));
+
+	/* a node or link value changed, even if not yet sent on the bus */
+	signals [SIGNAL_CHANGED] =
+		g_signal_new ("changed",
+			      G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, g_cclosure_marshal_generic,
+			      G_TYPE_NONE, 3, G_TYPE_STRING, G_TYPE_STRING,
+			      G_TYPE_DOUBLE);
 }
 
 SbuDeviceImpl *
@@ -29,6 +29,7 @@ G_BEGIN_DECLS
 
 #include "sbu-common.h"
 #include "sbu-database.h"
+#include "sbu-metrics.h"
 #include "sbu-node-impl.h"
 #include "sbu-link-impl.h"
 
@@ -49,6 +50,20 @@ void		 sbu_device_impl_export			(SbuDeviceImpl	*self);
 void		 sbu_device_impl_unexport		(SbuDeviceImpl	*self);
 void		 sbu_device_set_database		(SbuDeviceImpl	*self,
 							 SbuDatabase	*database);
+SbuDatabase	*sbu_device_impl_get_database		(SbuDeviceImpl	*self);
+void		 sbu_device_impl_set_metrics		(SbuDeviceImpl	*self,
+							 SbuMetrics	*metrics);
+void		 sbu_device_impl_begin_update		(SbuDeviceImpl	*self);
+void		 sbu_device_impl_commit_update		(SbuDeviceImpl	*self);
+void		 sbu_device_impl_set_flush_interval	(SbuDeviceImpl	*self,
+							 guint		 flush_interval);
+void		 sbu_device_impl_set_battery_capacity	(SbuDeviceImpl	*self,
+							 gdouble	 capacity);
+void		 sbu_device_impl_set_battery_full	(SbuDeviceImpl	*self);
+void		 sbu_device_impl_set_battery_estimate	(SbuDeviceImpl	*self,
+							 gdouble	 value);
+guint64		 sbu_device_impl_get_update_count	(SbuDeviceImpl	*self);
+guint64		 sbu_device_impl_get_message_count	(SbuDeviceImpl	*self);
 
 void		 sbu_device_impl_add_node		(SbuDeviceImpl	*self,
 							 SbuNodeImpl	*node);
@@ -0,0 +1,387 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <math.h>
+
+#include "sbu-energy.h"
+
+/* longer than this between samples is treated as missing data, in s */
+#define SBU_ENERGY_MAX_GAP		900
+
+typedef enum {
+	SBU_ENERGY_BUCKET_HOUR,
+	SBU_ENERGY_BUCKET_DAY,
+	SBU_ENERGY_BUCKET_LAST
+} SbuEnergyBucket;
+
+typedef struct {
+	gchar			*key;
+	gint64			 ts_last;	/* us */
+	gdouble			 power_last;	/* W */
+	gint64			 start[SBU_ENERGY_BUCKET_LAST];	/* s */
+	gint64			 end[SBU_ENERGY_BUCKET_LAST];	/* s */
+	gdouble			 pos[SBU_ENERGY_BUCKET_LAST];	/* Wh */
+	gdouble			 neg[SBU_ENERGY_BUCKET_LAST];	/* Wh */
+	gboolean		 dirty;
+} SbuEnergyCounter;
+
+struct _SbuEnergy
+{
+	GObject			 parent_instance;
+	SbuDatabase		*database;
+	GHashTable		*counters;	/* key:SbuEnergyCounter */
+	GPtrArray		*pending;	/* of SbuDatabaseEnergy, completed buckets */
+};
+
+G_DEFINE_TYPE (SbuEnergy, sbu_energy, G_TYPE_OBJECT)
+
+static const guint sbu_energy_widths[] = {
+	SBU_ENERGY_WIDTH_HOUR,
+	SBU_ENERGY_WIDTH_DAY,
+};
+
+static void
+sbu_energy_counter_free (SbuEnergyCounter *counter)
+{
+	g_free (counter->key);
+	g_free (counter);
+}
+
+/* hours are aligned to UTC, days to local midnight */
+static void
+sbu_energy_counter_set_bucket (SbuEnergyCounter *counter,
+			       SbuEnergyBucket bucket,
+			       gint64 ts)
+{
+	counter->pos[bucket] = 0.f;
+	counter->neg[bucket] = 0.f;
+	if (bucket == SBU_ENERGY_BUCKET_HOUR) {
+		counter->start[bucket] = ts - (ts % SBU_ENERGY_WIDTH_HOUR);
+		counter->end[bucket] = counter->start[bucket] + SBU_ENERGY_WIDTH_HOUR;
+	} else {
+		g_autoptr(GDateTime) dt = g_date_time_new_from_unix_local (ts);
+		g_autoptr(GDateTime) dt_start = NULL;
+		g_autoptr(GDateTime) dt_end = NULL;
+		dt_start = g_date_time_new_local (g_date_time_get_year (dt),
+						  g_date_time_get_month (dt),
+						  g_date_time_get_day_of_month (dt),
+						  0, 0, 0);
+		dt_end = g_date_time_add_days (dt_start, 1);
+		counter->start[bucket] = g_date_time_to_unix (dt_start);
+		counter->end[bucket] = g_date_time_to_unix (dt_end);
+	}
+}
+
+static SbuDatabaseEnergy *
+sbu_energy_counter_to_item (SbuEnergyCounter *counter, SbuEnergyBucket bucket)
+{
+	SbuDatabaseEnergy *item = g_new0 (SbuDatabaseEnergy, 1);
+	item->key = counter->key;
+	item->width = sbu_energy_widths[bucket];
+	item->ts = counter->start[bucket];
+	item->pos = (gint64) round (counter->pos[bucket] * 1000.f);
+	item->neg = (gint64) round (counter->neg[bucket] * 1000.f);
+	return item;
+}
+
+/* area under a straight line from @p0 to @p1 over @dt hours, by sign */
+static void
+sbu_energy_integrate (gdouble p0, gdouble p1, gdouble dt,
+		      gdouble *pos, gdouble *neg)
+{
+	gdouble t0;
+
+	if (p0 >= 0.f && p1 >= 0.f) {
+		*pos += (p0 + p1) / 2.f * dt;
+		return;
+	}
+	if (p0 <= 0.f && p1 <= 0.f) {
+		*neg -= (p0 + p1) / 2.f * dt;
+		return;
+	}
+
+	/* crosses zero at t0 */
+	t0 = dt * p0 / (p0 - p1);
+	if (p0 > 0.f) {
+		*pos += p0 * t0 / 2.f;
+		*neg -= p1 * (dt - t0) / 2.f;
+	} else {
+		*neg -= p0 * t0 / 2.f;
+		*pos += p1 * (dt - t0) / 2.f;
+	}
+}
+
+/* finish any bucket that @ts is past and start the one it is in */
+static void
+sbu_energy_counter_advance (SbuEnergy *self, SbuEnergyCounter *counter, gint64 ts)
+{
+	for (guint i = 0; i < SBU_ENERGY_BUCKET_LAST; i++) {
+		if (ts / G_USEC_PER_SEC < counter->end[i])
+			continue;
+		g_ptr_array_add (self->pending, sbu_energy_counter_to_item (counter, i));
+		sbu_energy_counter_set_bucket (counter, i, ts / G_USEC_PER_SEC);
+		counter->dirty = TRUE;
+	}
+}
+
+static SbuEnergyCounter *
+sbu_energy_counter_new (SbuEnergy *self, const gchar *key, gint64 ts)
+{
+	SbuEnergyCounter *counter = g_new0 (SbuEnergyCounter, 1);
+	counter->key = g_strdup (key);
+	for (guint i = 0; i < SBU_ENERGY_BUCKET_LAST; i++) {
+		g_autoptr(GPtrArray) items = NULL;
+		g_autoptr(GError) error = NULL;
+
+		/* carry on from the last checkpoint, e.g. after a restart */
+		sbu_energy_counter_set_bucket (counter, i, ts / G_USEC_PER_SEC);
+		items = sbu_database_query_energy (self->database, key,
+						   SBU_DEVICE_ID_DEFAULT,
+						   sbu_energy_widths[i],
+						   counter->start[i],
+						   counter->start[i] + 1,
+						   &error);
+		if (items == NULL) {
+			g_debug ("no energy for %s: %s", key, error->message);
+			continue;
+		}
+		if (items->len > 0) {
+			SbuDatabaseEnergy *item = g_ptr_array_index (items, 0);
+			counter->pos[i] = (gdouble) item->pos / 1000.f;
+			counter->neg[i] = (gdouble) item->neg / 1000.f;
+		}
+	}
+	return counter;
+}
+
+/**
+ * sbu_energy_add_sample:
+ * @self: a #SbuEnergy
+ * @key: a power key, e.g. "/0/node_battery:power"
+ * @ts: the real time in us
+ * @power: the power in W
+ *
+ * Adds the energy since the last sample to the hourly and daily counters
+ * using the trapezoid rule, so that it is cheap enough to call for every
+ * node on every poll. Positive and negative power are counted separately,
+ * and a line crossing zero is split at the crossing.
+ **/
+void
+sbu_energy_add_sample (SbuEnergy *self, const gchar *key, gint64 ts, gdouble power)
+{
+	SbuEnergyCounter *counter;
+
+	g_return_if_fail (SBU_IS_ENERGY (self));
+
+	counter = g_hash_table_lookup (self->counters, key);
+	if (counter == NULL) {
+		counter = sbu_energy_counter_new (self, key, ts);
+		counter->ts_last = ts;
+		counter->power_last = power;
+		g_hash_table_insert (self->counters, counter->key, counter);
+		return;
+	}
+	if (ts <= counter->ts_last)
+		return;
+
+	/* the device was not being polled */
+	if (ts - counter->ts_last > (gint64) SBU_ENERGY_MAX_GAP * G_USEC_PER_SEC) {
+		g_debug ("ignoring %" G_GINT64_FORMAT "s gap for %s",
+			 (ts - counter->ts_last) / G_USEC_PER_SEC, key);
+		sbu_energy_counter_advance (self, counter, ts);
+		counter->ts_last = ts;
+		counter->power_last = power;
+		return;
+	}
+
+	/* split the line at each bucket boundary */
+	while (counter->ts_last < ts) {
+		gdouble power_next = power;
+		gint64 ts_next = ts;
+		for (guint i = 0; i < SBU_ENERGY_BUCKET_LAST; i++)
+			ts_next = MIN (ts_next, counter->end[i] * G_USEC_PER_SEC);
+		if (ts_next < ts) {
+			power_next = counter->power_last +
+				     (power - counter->power_last) *
+				     (gdouble) (ts_next - counter->ts_last) /
+				     (gdouble) (ts - counter->ts_last);
+		}
+		for (guint i = 0; i < SBU_ENERGY_BUCKET_LAST; i++) {
+			sbu_energy_integrate (counter->power_last, power_next,
+					      (gdouble) (ts_next - counter->ts_last) /
+					      (3600.f * G_USEC_PER_SEC),
+					      &counter->pos[i], &counter->neg[i]);
+		}
+		counter->ts_last = ts_next;
+		counter->power_last = power_next;
+		counter->dirty = TRUE;
+		sbu_energy_counter_advance (self, counter, ts_next);
+	}
+}
+
+/**
+ * sbu_energy_checkpoint:
+ * @self: a #SbuEnergy
+ * @error: a #GError, or %NULL
+ *
+ * Saves all the completed buckets and the current value of the buckets in
+ * progress in one transaction.
+ *
+ * Return value: %TRUE for success
+ **/
+gboolean
+sbu_energy_checkpoint (SbuEnergy *self, GError **error)
+{
+	GHashTableIter iter;
+	gpointer value;
+	g_autoptr(GPtrArray) current = g_ptr_array_new_with_free_func (g_free);
+	g_autoptr(GPtrArray) items = g_ptr_array_new ();
+
+	g_return_val_if_fail (SBU_IS_ENERGY (self), FALSE);
+
+	for (guint i = 0; i < self->pending->len; i++)
+		g_ptr_array_add (items, g_ptr_array_index (self->pending, i));
+	g_hash_table_iter_init (&iter, self->counters);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		SbuEnergyCounter *counter = (SbuEnergyCounter *) value;
+		if (!counter->dirty)
+			continue;
+		for (guint i = 0; i < SBU_ENERGY_BUCKET_LAST; i++)
+			g_ptr_array_add (current, sbu_energy_counter_to_item (counter, i));
+	}
+	for (guint i = 0; i < current->len; i++)
+		g_ptr_array_add (items, g_ptr_array_index (current, i));
+	if (items->len == 0)
+		return TRUE;
+
+	/* keep everything for next time if this fails */
+	if (!sbu_database_save_energy (self->database, SBU_DEVICE_ID_DEFAULT, items, error))
+		return FALSE;
+	g_ptr_array_set_size (self->pending, 0);
+	g_hash_table_iter_init (&iter, self->counters);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		SbuEnergyCounter *counter = (SbuEnergyCounter *) value;
+		counter->dirty = FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * sbu_energy_query:
+ * @database: a #SbuDatabase
+ * @key: a power key, e.g. "/0/node_battery:power"
+ * @ts_start: start of the range
+ * @ts_end: end of the range, exclusive
+ * @granularity: a multiple of %SBU_ENERGY_WIDTH_HOUR, in s
+ * @error: a #GError, or %NULL
+ *
+ * Sums the saved hourly or daily counters into buckets of @granularity.
+ * The bucket in progress is only as recent as the last checkpoint.
+ *
+ * Return value: (transfer container): an array of #SbuDatabaseEnergy
+ **/
+GPtrArray *
+sbu_energy_query (SbuDatabase *database,
+		  const gchar *key,
+		  gint64 ts_start,
+		  gint64 ts_end,
+		  guint granularity,
+		  GError **error)
+{
+	guint width;
+	SbuDatabaseEnergy *last = NULL;
+	g_autoptr(GPtrArray) items = NULL;
+	g_autoptr(GPtrArray) results = g_ptr_array_new_with_free_func (g_free);
+
+	if (granularity == 0 || granularity % SBU_ENERGY_WIDTH_HOUR != 0) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_ARGUMENT,
+			     "granularity %us is not a multiple of %us",
+			     granularity, (guint) SBU_ENERGY_WIDTH_HOUR);
+		return NULL;
+	}
+
+	/* use the largest saved buckets that fit */
+	width = granularity % SBU_ENERGY_WIDTH_DAY == 0 ? SBU_ENERGY_WIDTH_DAY : SBU_ENERGY_WIDTH_HOUR;
+	items = sbu_database_query_energy (database, key, SBU_DEVICE_ID_DEFAULT,
+					   width, ts_start, ts_end, error);
+	if (items == NULL)
+		return NULL;
+	for (guint i = 0; i < items->len; i++) {
+		SbuDatabaseEnergy *item = g_ptr_array_index (items, i);
+		gint64 ts = ts_start + ((item->ts - ts_start) / granularity) * granularity;
+		if (last == NULL || last->ts != ts) {
+			last = g_new0 (SbuDatabaseEnergy, 1);
+			last->width = granularity;
+			last->ts = ts;
+			g_ptr_array_add (results, last);
+		}
+		last->pos += item->pos;
+		last->neg += item->neg;
+	}
+	return g_steal_pointer (&results);
+}
+
+static void
+sbu_energy_finalize (GObject *object)
+{
+	SbuEnergy *self = SBU_ENERGY (object);
+
+	g_object_unref (self->database);
+	g_ptr_array_unref (self->pending);
+	g_hash_table_unref (self->counters);
+
+	G_OBJECT_CLASS (sbu_energy_parent_class)->finalize (object);
+}
+
+static void
+sbu_energy_init (SbuEnergy *self)
+{
+	self->counters = g_hash_table_new_full (g_str_hash, g_str_equal,
+						NULL, (GDestroyNotify) sbu_energy_counter_free);
+	self->pending = g_ptr_array_new_with_free_func (g_free);
+}
+
+static void
+sbu_energy_class_init (SbuEnergyClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = sbu_energy_finalize;
+}
+
+/**
+ * sbu_energy_new:
+ * @database: a #SbuDatabase
+ *
+ * Return value: a new SbuEnergy object.
+ **/
+SbuEnergy *
+sbu_energy_new (SbuDatabase *database)
+{
+	SbuEnergy *self;
+	self = g_object_new (SBU_TYPE_ENERGY, NULL);
+	self->database = g_object_ref (database);
+	return SBU_ENERGY (self);
+}
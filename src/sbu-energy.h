@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __SBU_ENERGY_H
+#define __SBU_ENERGY_H
+
+#include <glib-object.h>
+
+#include "sbu-database.h"
+
+G_BEGIN_DECLS
+
+#define SBU_TYPE_ENERGY (sbu_energy_get_type ())
+
+G_DECLARE_FINAL_TYPE (SbuEnergy, sbu_energy, SBU, ENERGY, GObject)
+
+#define SBU_ENERGY_WIDTH_HOUR		3600
+#define SBU_ENERGY_WIDTH_DAY		86400
+
+SbuEnergy	*sbu_energy_new			(SbuDatabase	*database);
+void		 sbu_energy_add_sample		(SbuEnergy	*self,
+						 const gchar	*key,
+						 gint64		 ts,
+						 gdouble	 power);
+gboolean	 sbu_energy_checkpoint		(SbuEnergy	*self,
+						 GError		**error);
+GPtrArray	*sbu_energy_query		(SbuDatabase	*database,
+						 const gchar	*key,
+						 gint64		 ts_start,
+						 gint64		 ts_end,
+						 guint		 granularity,
+						 GError		**error);
+
+G_END_DECLS
+
+#endif /* __SBU_ENERGY_H */
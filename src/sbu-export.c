@@ -0,0 +1,566 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <cairo.h>
+#include <cairo-svg.h>
+#include <gio/gio.h>
+#include <math.h>
+
+#include "sbu-common.h"
+#include "sbu-export.h"
+
+#define SBU_EXPORT_MARGIN_LEFT		60
+#define SBU_EXPORT_MARGIN_RIGHT		15
+#define SBU_EXPORT_MARGIN_TOP		15
+#define SBU_EXPORT_MARGIN_BOTTOM	30
+#define SBU_EXPORT_GRID_LINES		5
+#define SBU_EXPORT_FONT_SIZE		10.f
+
+typedef struct {
+	gchar			*key;
+	guint32			 color;
+	GArray			*buckets;	/* of SbuExportBucket */
+} SbuExportKey;
+
+/* the first, last, minimum and maximum value seen in one pixel column, which
+ * is all that is needed to draw the column identically to the raw data */
+typedef struct {
+	guint			 count;
+	gint			 first;
+	gint			 last;
+	gint			 min;
+	gint			 max;
+	gint64			 ts_min;
+	gint64			 ts_max;
+} SbuExportBucket;
+
+typedef struct {
+	SbuExport		*self;
+	SbuExportKey		*key;
+	GOutputStream		*stream;
+	GCancellable		*cancellable;
+	GError			*error;
+} SbuExportHelper;
+
+struct _SbuExport
+{
+	GObject			 parent_instance;
+	SbuDatabase		*database;
+	GPtrArray		*keys;		/* of SbuExportKey */
+	guint			 width;
+	guint			 height;
+	gint64			 ts_start;
+	gint64			 ts_end;
+};
+
+G_DEFINE_TYPE (SbuExport, sbu_export, G_TYPE_OBJECT)
+
+static const guint32 sbu_export_colors[] = {
+	0xcc0000, 0x4444cc, 0x00cc00, 0xcccc00,
+	0xcc00cc, 0x00cccc, 0x888888, 0x000000 };
+
+SbuExportFormat
+sbu_export_format_from_filename (const gchar *filename)
+{
+	if (g_str_has_suffix (filename, ".csv"))
+		return SBU_EXPORT_FORMAT_CSV;
+	if (g_str_has_suffix (filename, ".svg"))
+		return SBU_EXPORT_FORMAT_SVG;
+	if (g_str_has_suffix (filename, ".png"))
+		return SBU_EXPORT_FORMAT_PNG;
+	return SBU_EXPORT_FORMAT_UNKNOWN;
+}
+
+static void
+sbu_export_key_free (SbuExportKey *key)
+{
+	if (key->buckets != NULL)
+		g_array_unref (key->buckets);
+	g_free (key->key);
+	g_free (key);
+}
+
+void
+sbu_export_set_size (SbuExport *self, guint width, guint height)
+{
+	g_return_if_fail (SBU_IS_EXPORT (self));
+	self->width = width;
+	self->height = height;
+}
+
+void
+sbu_export_set_range (SbuExport *self, gint64 ts_start, gint64 ts_end)
+{
+	g_return_if_fail (SBU_IS_EXPORT (self));
+	self->ts_start = ts_start;
+	self->ts_end = ts_end;
+}
+
+void
+sbu_export_add_key (SbuExport *self, const gchar *key, guint32 color)
+{
+	SbuExportKey *item;
+
+	g_return_if_fail (SBU_IS_EXPORT (self));
+
+	/* zero means "pick one for me" */
+	if (color == 0x000000) {
+		color = sbu_export_colors[self->keys->len %
+					 G_N_ELEMENTS (sbu_export_colors)];
+	}
+	item = g_new0 (SbuExportKey, 1);
+	item->key = g_strdup (key);
+	item->color = color;
+	g_ptr_array_add (self->keys, item);
+}
+
+/* booleans are saved as 0 or 1, everything else as thousandths */
+static gdouble
+sbu_export_value_from_raw (gdouble val)
+{
+	if (fabs (val) > 1.1f)
+		return val / 1000.f;
+	return val;
+}
+
+static gboolean
+sbu_export_csv_item_cb (const SbuDatabaseItem *item, gpointer user_data)
+{
+	SbuExportHelper *helper = (SbuExportHelper *) user_data;
+	return g_output_stream_printf (helper->stream, NULL,
+				       helper->cancellable,
+				       &helper->error,
+				       "%s,%" G_GINT64_FORMAT ",%.3f\n",
+				       helper->key->key,
+				       item->ts,
+				       sbu_export_value_from_raw (item->val));
+}
+
+static gboolean
+sbu_export_write_csv (SbuExport *self,
+		      GOutputStream *stream,
+		      GCancellable *cancellable,
+		      GError **error)
+{
+	if (!g_output_stream_write_all (stream, "key,ts,value\n", 13,
+					NULL, cancellable, error))
+		return FALSE;
+
+	/* each row is written as it is read, so nothing is kept in memory */
+	for (guint i = 0; i < self->keys->len; i++) {
+		SbuExportHelper helper = { self, NULL, stream, cancellable, NULL };
+		helper.key = g_ptr_array_index (self->keys, i);
+		if (!sbu_database_query_foreach (self->database,
+						 helper.key->key,
+						 SBU_DEVICE_ID_DEFAULT,
+						 self->ts_start,
+						 self->ts_end,
+						 sbu_export_csv_item_cb,
+						 &helper,
+						 error))
+			return FALSE;
+		if (helper.error != NULL) {
+			g_propagate_error (error, helper.error);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static gboolean
+sbu_export_bucket_item_cb (const SbuDatabaseItem *item, gpointer user_data)
+{
+	SbuExportHelper *helper = (SbuExportHelper *) user_data;
+	SbuExport *self = helper->self;
+	SbuExportBucket *bucket;
+	GArray *buckets = helper->key->buckets;
+	guint col;
+
+	/* find the pixel column */
+	col = (guint) ((item->ts - self->ts_start) * buckets->len /
+		       (self->ts_end - self->ts_start + 1));
+	if (col >= buckets->len)
+		col = buckets->len - 1;
+	bucket = &g_array_index (buckets, SbuExportBucket, col);
+	if (bucket->count++ == 0) {
+		bucket->first = item->val;
+		bucket->min = item->val;
+		bucket->max = item->val;
+		bucket->ts_min = item->ts;
+		bucket->ts_max = item->ts;
+	}
+	if (item->val < bucket->min) {
+		bucket->min = item->val;
+		bucket->ts_min = item->ts;
+	}
+	if (item->val > bucket->max) {
+		bucket->max = item->val;
+		bucket->ts_max = item->ts;
+	}
+	bucket->last = item->val;
+	return TRUE;
+}
+
+static gboolean
+sbu_export_load_buckets (SbuExport *self, guint columns, GError **error)
+{
+	for (guint i = 0; i < self->keys->len; i++) {
+		SbuExportHelper helper = { self, NULL, NULL, NULL, NULL };
+		helper.key = g_ptr_array_index (self->keys, i);
+		if (helper.key->buckets != NULL)
+			g_array_unref (helper.key->buckets);
+		helper.key->buckets = g_array_sized_new (FALSE, TRUE,
+							 sizeof (SbuExportBucket),
+							 columns);
+		g_array_set_size (helper.key->buckets, columns);
+		if (!sbu_database_query_foreach (self->database,
+						 helper.key->key,
+						 SBU_DEVICE_ID_DEFAULT,
+						 self->ts_start,
+						 self->ts_end,
+						 sbu_export_bucket_item_cb,
+						 &helper,
+						 error)) {
+			g_prefix_error (error, "failed to load %s: ",
+					helper.key->key);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static void
+sbu_export_set_color (cairo_t *cr, guint32 color)
+{
+	cairo_set_source_rgb (cr,
+			      (gdouble) ((color & 0xff0000) >> 16) / 0xff,
+			      (gdouble) ((color & 0x00ff00) >> 8) / 0xff,
+			      (gdouble) (color & 0x0000ff) / 0xff);
+}
+
+static void
+sbu_export_draw (SbuExport *self, cairo_t *cr)
+{
+	gboolean found = FALSE;
+	gdouble box_w = self->width - SBU_EXPORT_MARGIN_LEFT - SBU_EXPORT_MARGIN_RIGHT;
+	gdouble box_h = self->height - SBU_EXPORT_MARGIN_TOP - SBU_EXPORT_MARGIN_BOTTOM;
+	gdouble max_y = 0.f;
+	gdouble min_y = 0.f;
+	gint64 span = self->ts_end - self->ts_start;
+
+	/* get the extents from the buckets */
+	for (guint i = 0; i < self->keys->len; i++) {
+		SbuExportKey *key = g_ptr_array_index (self->keys, i);
+		for (guint j = 0; j < key->buckets->len; j++) {
+			SbuExportBucket *b = &g_array_index (key->buckets, SbuExportBucket, j);
+			if (b->count == 0)
+				continue;
+			if (!found || b->min < min_y)
+				min_y = b->min;
+			if (!found || b->max > max_y)
+				max_y = b->max;
+			found = TRUE;
+		}
+	}
+	min_y = floor (sbu_export_value_from_raw (min_y));
+	max_y = ceil (sbu_export_value_from_raw (max_y));
+	if (max_y - min_y < 1.f)
+		max_y = min_y + 1.f;
+
+	/* background */
+	cairo_set_source_rgb (cr, 1.f, 1.f, 1.f);
+	cairo_paint (cr);
+	cairo_select_font_face (cr, "sans-serif",
+				CAIRO_FONT_SLANT_NORMAL,
+				CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size (cr, SBU_EXPORT_FONT_SIZE);
+	cairo_set_line_width (cr, 1.f);
+
+	/* grid and Y labels */
+	for (guint i = 0; i <= SBU_EXPORT_GRID_LINES; i++) {
+		gdouble y = SBU_EXPORT_MARGIN_TOP + box_h * i / SBU_EXPORT_GRID_LINES;
+		gdouble val = max_y - (max_y - min_y) * i / SBU_EXPORT_GRID_LINES;
+		g_autofree gchar *tmp = sbu_format_for_display (val, "");
+		cairo_set_source_rgb (cr, 0.9f, 0.9f, 0.9f);
+		cairo_move_to (cr, SBU_EXPORT_MARGIN_LEFT, floor (y) + 0.5f);
+		cairo_rel_line_to (cr, box_w, 0.f);
+		cairo_stroke (cr);
+		cairo_set_source_rgb (cr, 0.2f, 0.2f, 0.2f);
+		cairo_move_to (cr, 5.f, y + SBU_EXPORT_FONT_SIZE / 2);
+		cairo_show_text (cr, tmp);
+	}
+
+	/* X labels */
+	for (guint i = 0; i <= SBU_EXPORT_GRID_LINES; i++) {
+		gdouble x = SBU_EXPORT_MARGIN_LEFT + box_w * i / SBU_EXPORT_GRID_LINES;
+		gint64 ts = self->ts_start + span * i / SBU_EXPORT_GRID_LINES;
+		cairo_text_extents_t extents;
+		g_autoptr(GDateTime) dt = g_date_time_new_from_unix_local (ts);
+		g_autofree gchar *tmp = NULL;
+		tmp = g_date_time_format (dt, span > 2 * 24 * 60 * 60 ? "%d/%m" : "%H:%M");
+		cairo_text_extents (cr, tmp, &extents);
+		cairo_move_to (cr, x - extents.width / 2,
+			       self->height - SBU_EXPORT_MARGIN_BOTTOM / 2);
+		cairo_show_text (cr, tmp);
+	}
+
+	/* outline */
+	cairo_rectangle (cr,
+			 SBU_EXPORT_MARGIN_LEFT + 0.5f,
+			 SBU_EXPORT_MARGIN_TOP + 0.5f,
+			 box_w, box_h);
+	cairo_stroke (cr);
+
+	/* one path per key, at most four points per pixel column */
+	cairo_save (cr);
+	cairo_rectangle (cr,
+			 SBU_EXPORT_MARGIN_LEFT, SBU_EXPORT_MARGIN_TOP,
+			 box_w, box_h);
+	cairo_clip (cr);
+	cairo_set_line_join (cr, CAIRO_LINE_JOIN_ROUND);
+	for (guint i = 0; i < self->keys->len; i++) {
+		SbuExportKey *key = g_ptr_array_index (self->keys, i);
+		cairo_new_path (cr);
+		for (guint j = 0; j < key->buckets->len; j++) {
+			SbuExportBucket *b = &g_array_index (key->buckets, SbuExportBucket, j);
+			gdouble x = SBU_EXPORT_MARGIN_LEFT + j + 0.5f;
+			gint vals[4];
+			if (b->count == 0)
+				continue;
+			vals[0] = b->first;
+			vals[1] = b->ts_min <= b->ts_max ? b->min : b->max;
+			vals[2] = b->ts_min <= b->ts_max ? b->max : b->min;
+			vals[3] = b->last;
+			for (guint k = 0; k < 4; k++) {
+				gdouble y = SBU_EXPORT_MARGIN_TOP + box_h -
+					    (sbu_export_value_from_raw (vals[k]) - min_y) * box_h / (max_y - min_y);
+				if (k > 0 && vals[k] == vals[k - 1])
+					continue;
+				cairo_line_to (cr, x, y);
+			}
+		}
+		sbu_export_set_color (cr, key->color);
+		cairo_set_line_width (cr, 1.5f);
+		cairo_stroke (cr);
+	}
+	cairo_restore (cr);
+
+	/* legend */
+	for (guint i = 0; i < self->keys->len; i++) {
+		SbuExportKey *key = g_ptr_array_index (self->keys, i);
+		gdouble y = SBU_EXPORT_MARGIN_TOP + 5.f + i * (SBU_EXPORT_FONT_SIZE + 4.f);
+		sbu_export_set_color (cr, key->color);
+		cairo_rectangle (cr, SBU_EXPORT_MARGIN_LEFT + 5.f, y,
+				 SBU_EXPORT_FONT_SIZE, SBU_EXPORT_FONT_SIZE);
+		cairo_fill (cr);
+		cairo_set_source_rgb (cr, 0.2f, 0.2f, 0.2f);
+		cairo_move_to (cr, SBU_EXPORT_MARGIN_LEFT + 10.f + SBU_EXPORT_FONT_SIZE,
+			       y + SBU_EXPORT_FONT_SIZE - 1.f);
+		cairo_show_text (cr, key->key);
+	}
+}
+
+static cairo_status_t
+sbu_export_write_cb (void *user_data, const unsigned char *data, unsigned int length)
+{
+	SbuExportHelper *helper = (SbuExportHelper *) user_data;
+	if (helper->error != NULL)
+		return CAIRO_STATUS_WRITE_ERROR;
+	if (!g_output_stream_write_all (helper->stream, data, length, NULL,
+					helper->cancellable, &helper->error))
+		return CAIRO_STATUS_WRITE_ERROR;
+	return CAIRO_STATUS_SUCCESS;
+}
+
+static gboolean
+sbu_export_write_image (SbuExport *self,
+			SbuExportFormat format,
+			GOutputStream *stream,
+			GCancellable *cancellable,
+			GError **error)
+{
+	SbuExportHelper helper = { self, NULL, stream, cancellable, NULL };
+	cairo_status_t status;
+	cairo_surface_t *surface;
+	cairo_t *cr;
+
+	/* check the plot area is sane */
+	if (self->width <= SBU_EXPORT_MARGIN_LEFT + SBU_EXPORT_MARGIN_RIGHT ||
+	    self->height <= SBU_EXPORT_MARGIN_TOP + SBU_EXPORT_MARGIN_BOTTOM) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_ARGUMENT,
+			     "image size %ux%u too small",
+			     self->width, self->height);
+		return FALSE;
+	}
+	if (self->width > SBU_EXPORT_SIZE_MAX || self->height > SBU_EXPORT_SIZE_MAX) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_ARGUMENT,
+			     "image size %ux%u too large",
+			     self->width, self->height);
+		return FALSE;
+	}
+
+	/* decimate each key into one bucket per pixel column */
+	if (!sbu_export_load_buckets (self,
+				      self->width -
+				      SBU_EXPORT_MARGIN_LEFT -
+				      SBU_EXPORT_MARGIN_RIGHT,
+				      error))
+		return FALSE;
+
+	/* SVG is streamed as it is drawn, PNG needs the whole image first */
+	if (format == SBU_EXPORT_FORMAT_SVG) {
+		surface = cairo_svg_surface_create_for_stream (sbu_export_write_cb,
+							       &helper,
+							       self->width,
+							       self->height);
+	} else {
+		surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24,
+						      (gint) self->width,
+						      (gint) self->height);
+	}
+	cr = cairo_create (surface);
+	sbu_export_draw (self, cr);
+	cairo_destroy (cr);
+	if (format == SBU_EXPORT_FORMAT_PNG) {
+		status = cairo_surface_write_to_png_stream (surface,
+							    sbu_export_write_cb,
+							    &helper);
+	} else {
+		cairo_surface_finish (surface);
+		status = cairo_surface_status (surface);
+	}
+	cairo_surface_destroy (surface);
+	if (helper.error != NULL) {
+		g_propagate_error (error, helper.error);
+		return FALSE;
+	}
+	if (status != CAIRO_STATUS_SUCCESS) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "failed to render: %s",
+			     cairo_status_to_string (status));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+gboolean
+sbu_export_to_file (SbuExport *self,
+		    SbuExportFormat format,
+		    const gchar *filename,
+		    GCancellable *cancellable,
+		    GError **error)
+{
+	gboolean ret;
+	g_autoptr(GFile) file = NULL;
+	g_autoptr(GFileOutputStream) file_stream = NULL;
+	g_autoptr(GOutputStream) stream = NULL;
+
+	g_return_val_if_fail (SBU_IS_EXPORT (self), FALSE);
+
+	if (self->keys->len == 0) {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_ARGUMENT,
+				     "no keys to export");
+		return FALSE;
+	}
+	if (self->ts_end <= self->ts_start) {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_ARGUMENT,
+				     "invalid time range");
+		return FALSE;
+	}
+
+	/* open file */
+	file = g_file_new_for_path (filename);
+	file_stream = g_file_replace (file, NULL, FALSE,
+				      G_FILE_CREATE_REPLACE_DESTINATION,
+				      cancellable, error);
+	if (file_stream == NULL)
+		return FALSE;
+	stream = g_buffered_output_stream_new (G_OUTPUT_STREAM (file_stream));
+
+	switch (format) {
+	case SBU_EXPORT_FORMAT_CSV:
+		ret = sbu_export_write_csv (self, stream, cancellable, error);
+		break;
+	case SBU_EXPORT_FORMAT_SVG:
+	case SBU_EXPORT_FORMAT_PNG:
+		ret = sbu_export_write_image (self, format, stream, cancellable, error);
+		break;
+	default:
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_NOT_SUPPORTED,
+				     "export format not supported");
+		ret = FALSE;
+		break;
+	}
+	if (!ret) {
+		g_prefix_error (error, "failed to export %s: ", filename);
+		return FALSE;
+	}
+	return g_output_stream_close (stream, cancellable, error);
+}
+
+static void
+sbu_export_finalize (GObject *object)
+{
+	SbuExport *self = SBU_EXPORT (object);
+
+	g_object_unref (self->database);
+	g_ptr_array_unref (self->keys);
+
+	G_OBJECT_CLASS (sbu_export_parent_class)->finalize (object);
+}
+
+static void
+sbu_export_init (SbuExport *self)
+{
+	self->keys = g_ptr_array_new_with_free_func ((GDestroyNotify) sbu_export_key_free);
+	self->width = 800;
+	self->height = 400;
+}
+
+static void
+sbu_export_class_init (SbuExportClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = sbu_export_finalize;
+}
+
+SbuExport *
+sbu_export_new (SbuDatabase *database)
+{
+	SbuExport *self;
+	self = g_object_new (SBU_TYPE_EXPORT, NULL);
+	self->database = g_object_ref (database);
+	return SBU_EXPORT (self);
+}
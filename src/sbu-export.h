@@ -0,0 +1,65 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __SBU_EXPORT_H
+#define __SBU_EXPORT_H
+
+#include <glib-object.h>
+
+#include "sbu-database.h"
+
+G_BEGIN_DECLS
+
+#define SBU_TYPE_EXPORT (sbu_export_get_type ())
+
+#define SBU_EXPORT_SIZE_MAX		8192	/* px */
+
+G_DECLARE_FINAL_TYPE (SbuExport, sbu_export, SBU, EXPORT, GObject)
+
+typedef enum {
+	SBU_EXPORT_FORMAT_UNKNOWN,
+	SBU_EXPORT_FORMAT_CSV,
+	SBU_EXPORT_FORMAT_SVG,
+	SBU_EXPORT_FORMAT_PNG,
+	SBU_EXPORT_FORMAT_LAST
+} SbuExportFormat;
+
+SbuExportFormat	 sbu_export_format_from_filename (const gchar	*filename);
+
+SbuExport	*sbu_export_new			(SbuDatabase	*database);
+void		 sbu_export_set_size		(SbuExport	*self,
+						 guint		 width,
+						 guint		 height);
+void		 sbu_export_set_range		(SbuExport	*self,
+						 gint64		 ts_start,
+						 gint64		 ts_end);
+void		 sbu_export_add_key		(SbuExport	*self,
+						 const gchar	*key,
+						 guint32	 color);
+gboolean	 sbu_export_to_file		(SbuExport	*self,
+						 SbuExportFormat format,
+						 const gchar	*filename,
+						 GCancellable	*cancellable,
+						 GError		**error);
+
+G_END_DECLS
+
+#endif /* __SBU_EXPORT_H */
@@ -26,6 +26,7 @@
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <appstream-glib.h>
+#include <librsvg/rsvg.h>
 
 #include "generated-gdbus.h"
 
@@ -45,6 +46,7 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuLink, g_object_unref)
 typedef struct {
 	GtkBuilder	*builder;
 	GCancellable	*cancellable;
+	GCancellable	*history_cancellable;	/* for the graph shown */
 	SbuConfig	*config;
 	SbuDatabase	*database;
 	SbuManager	*manager;
@@ -54,25 +56,99 @@ typedef struct {
 	GtkWidget	*graph_widget;
 	GPtrArray	*nodes;
 	GPtrArray	*links;
+	SbuXmlModifier	*xml_mod;
+	GdkPixbuf	*overview_background;
+	GPtrArray	*overview_layers;	/* of SbuGuiLayer */
 	guint		 refresh_id;
 	gint64		 history_interval;
 	gint64		 history_filter;
+	gint64		 history_now;		/* when the history was fetched */
+	GPtrArray	*history_keys;		/* of key, indexed by graph series */
+	GPtrArray	*history_lines;		/* of SbuGuiHistoryLine */
+	GHashTable	*history_tiles;		/* of tile-id:SbuGuiHistoryTile */
+	EggGraphWidgetPlot history_plot;
+	guint		 zoom_id;
 } SbuGui;
 
+typedef struct {
+	gchar		*key;
+	guint32		 color;
+} SbuGuiHistoryLine;
+
+/* part of the history for one key at a given resolution */
+typedef struct {
+	GArray		*ts;		/* of gdouble */
+	GArray		*val;		/* of gdouble */
+	gboolean	 pending;
+	gboolean	 complete;	/* not still being added to */
+	gint64		 fetched;	/* monotonic time, in seconds */
+} SbuGuiHistoryTile;
+
+static void
+sbu_gui_history_line_free (SbuGuiHistoryLine *line)
+{
+	g_free (line->key);
+	g_free (line);
+}
+
+static void
+sbu_gui_history_tile_free (SbuGuiHistoryTile *tile)
+{
+	g_array_unref (tile->ts);
+	g_array_unref (tile->val);
+	g_free (tile);
+}
+
+static gboolean
+sbu_gui_history_tile_is_pending_cb (gpointer key, gpointer value, gpointer user_data)
+{
+	SbuGuiHistoryTile *tile = (SbuGuiHistoryTile *) value;
+	return tile->pending;
+}
+
+typedef struct {
+	const gchar	*id;
+	gchar		*signature;	/* the values last rasterized */
+	GdkPixbuf	*pixbuf;	/* just the bounding box */
+	gint		 x;		/* px, in the overview */
+	gint		 y;
+} SbuGuiLayer;
+
+static void
+sbu_gui_layer_free (SbuGuiLayer *layer)
+{
+	if (layer->pixbuf != NULL)
+		g_object_unref (layer->pixbuf);
+	g_free (layer->signature);
+	g_free (layer);
+}
+
 static void
 sbu_gui_self_free (SbuGui *self)
 {
 	if (self->refresh_id != 0)
 		g_source_remove (self->refresh_id);
+	if (self->zoom_id != 0)
+		g_source_remove (self->zoom_id);
 	if (self->device != NULL)
 		g_object_unref (self->device);
 	if (self->manager != NULL)
 		g_object_unref (self->manager);
+	if (self->xml_mod != NULL)
+		g_object_unref (self->xml_mod);
+	if (self->overview_background != NULL)
+		g_object_unref (self->overview_background);
+	g_ptr_array_unref (self->overview_layers);
+	g_ptr_array_unref (self->history_keys);
+	g_ptr_array_unref (self->history_lines);
+	g_hash_table_unref (self->history_tiles);
 	g_ptr_array_unref (self->nodes);
 	g_ptr_array_unref (self->links);
 	g_object_unref (self->builder);
 	g_object_unref (self->database);
 	g_object_unref (self->config);
+	g_cancellable_cancel (self->history_cancellable);
+	g_object_unref (self->history_cancellable);
 	g_object_unref (self->cancellable);
 	g_free (self);
 }
@@ -195,42 +271,20 @@ sbu_gui_refresh_details (SbuGui *self)
 	gtk_list_box_invalidate_sort (GTK_LIST_BOX (widget));
 }
 
-static GPtrArray *
-mxs_gui_get_graph_data (SbuGui *self, const gchar *key, guint32 color, GError **error)
+static void
+mxs_gui_get_graph_data (SbuGui *self, GVariant *reply, GArray *data_x, GArray *data_y)
 {
 	GVariantIter iter;
 	gdouble val;
-	guint64 now = g_get_real_time () / G_USEC_PER_SEC;
 	guint64 ts;
-	guint limit = 0;
-	g_autoptr(GPtrArray) data = NULL;
-	g_autoptr(GVariant) reply = NULL;
-
-	/* query daemon */
-	if (self->history_filter > 0)
-		limit = 100 / self->history_filter;
-	if (!sbu_device_call_get_history_sync (self->device,
-					       key,
-					       now - self->history_interval,
-					       now, limit,
-					       &reply,
-					       self->cancellable,
-					       error)) {
-		g_prefix_error (error, "Cannot get history: ");
-		return FALSE;
-	}
 
 	/* create data for graph */
-	data = g_ptr_array_new_with_free_func ((GDestroyNotify) egg_graph_point_free);
 	g_variant_iter_init (&iter, reply);
 	while (g_variant_iter_next (&iter, "(td)", &ts, &val)) {
-		EggGraphPoint *point = egg_graph_point_new ();
-		point->x = ts + self->history_interval - now;
-		point->y = val;
-		point->color = color;
-		g_ptr_array_add (data, point);
+		gdouble x = ts + self->history_interval - self->history_now;
+		g_array_append_val (data_x, x);
+		g_array_append_val (data_y, val);
 	}
-	return g_steal_pointer (&data);
 }
 
 typedef struct {
@@ -239,31 +293,351 @@ typedef struct {
 	const gchar	*text;
 } PowerSBUGraphLine;
 
+/* the shortest interval scrolls as new values arrive */
+#define SBU_GUI_HISTORY_LIVE_INTERVAL	(60 * 60)
+#define SBU_GUI_HISTORY_LIVE_POINTS_MAX	3600
+
+typedef struct {
+	SbuGui			*self;
+	GCancellable		*cancellable;
+	gchar			*key;
+	guint32			 color;
+	EggGraphWidgetPlot	 plot;
+} SbuGuiHistoryHelper;
+
+static void
+sbu_gui_history_helper_free (SbuGuiHistoryHelper *helper)
+{
+	g_object_unref (helper->cancellable);
+	g_free (helper->key);
+	g_free (helper);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuGuiHistoryHelper, sbu_gui_history_helper_free)
+
+static void
+sbu_gui_history_get_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	guint idx;
+	g_autoptr(SbuGuiHistoryHelper) helper = (SbuGuiHistoryHelper *) user_data;
+	SbuGui *self = helper->self;
+	g_autoptr(GArray) data_x = g_array_new (FALSE, FALSE, sizeof (gdouble));
+	g_autoptr(GArray) data_y = g_array_new (FALSE, FALSE, sizeof (gdouble));
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) reply = NULL;
+
+	if (!sbu_device_call_get_history_finish (SBU_DEVICE (source), &reply, res, &error)) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning ("Cannot get history: %s", error->message);
+		return;
+	}
+
+	/* user has already moved to a different graph */
+	if (g_cancellable_is_cancelled (helper->cancellable))
+		return;
+
+	/* draw as soon as each line arrives */
+	mxs_gui_get_graph_data (self, reply, data_x, data_y);
+	idx = egg_graph_widget_data_add_values (EGG_GRAPH_WIDGET (self->graph_widget),
+						helper->plot,
+						(const gdouble *) data_x->data,
+						(const gdouble *) data_y->data,
+						data_x->len,
+						helper->color);
+	if (self->history_interval == SBU_GUI_HISTORY_LIVE_INTERVAL) {
+		egg_graph_widget_data_set_limit (EGG_GRAPH_WIDGET (self->graph_widget),
+						 idx, SBU_GUI_HISTORY_LIVE_POINTS_MAX);
+	}
+	g_ptr_array_add (self->history_keys, g_strdup (helper->key));
+}
+
 static void
 sbu_gui_history_setup_lines (SbuGui *self, PowerSBUGraphLine *lines)
 {
 	EggGraphWidgetPlot plot = EGG_GRAPH_WIDGET_PLOT_BOTH;
+	gboolean live = self->history_interval == SBU_GUI_HISTORY_LIVE_INTERVAL;
+	guint limit = 0;
 
 	/* no line when no filtering */
 	if (self->history_filter == 0)
 		plot = EGG_GRAPH_WIDGET_PLOT_POINTS;
 
+	/* abandon any requests for the previous graph */
+	g_cancellable_cancel (self->history_cancellable);
+	g_object_unref (self->history_cancellable);
+	self->history_cancellable = g_cancellable_new ();
+
+	/* those tiles will never arrive, so fetch them again when needed */
+	g_hash_table_foreach_remove (self->history_tiles,
+				     sbu_gui_history_tile_is_pending_cb,
+				     NULL);
+
+	if (self->zoom_id != 0) {
+		g_source_remove (self->zoom_id);
+		self->zoom_id = 0;
+	}
+
+	g_ptr_array_set_size (self->history_keys, 0);
+	g_ptr_array_set_size (self->history_lines, 0);
+	self->history_plot = plot;
+	g_object_set (self->graph_widget,
+		      "live-span", live ? (gdouble) self->history_interval : 0.f,
+		      "autorange-x", TRUE,
+		      NULL);
+	if (self->device == NULL)
+		return;
+
+	/* query daemon for all lines at once */
+	if (self->history_filter > 0)
+		limit = 100 / self->history_filter;
+	self->history_now = g_get_real_time () / G_USEC_PER_SEC;
 	for (guint i = 0; lines[i].key != NULL; i++) {
-		g_autoptr(GError) error = NULL;
-		g_autoptr(GPtrArray) data = NULL;
+		SbuGuiHistoryHelper *helper = g_new0 (SbuGuiHistoryHelper, 1);
+		SbuGuiHistoryLine *line = g_new0 (SbuGuiHistoryLine, 1);
+		line->key = g_strdup (lines[i].key);
+		line->color = lines[i].color;
+		g_ptr_array_add (self->history_lines, line);
+		helper->self = self;
+		helper->cancellable = g_object_ref (self->history_cancellable);
+		helper->key = g_strdup (lines[i].key);
+		helper->color = lines[i].color;
+		helper->plot = plot;
+		sbu_device_call_get_history (self->device,
+					     lines[i].key,
+					     self->history_now - self->history_interval,
+					     self->history_now, limit,
+					     self->history_cancellable,
+					     sbu_gui_history_get_cb,
+					     helper);
+		egg_graph_widget_key_legend_add	(EGG_GRAPH_WIDGET (self->graph_widget),
+						 lines[i].color, lines[i].text);
+	}
+}
+
+/* each tile is fetched with about one point per pixel */
+#define SBU_GUI_HISTORY_TILE_POINTS	256
+#define SBU_GUI_HISTORY_TILE_SPAN_MIN	(15 * 60)
+#define SBU_GUI_HISTORY_TILE_CACHE_MAX	1024
+#define SBU_GUI_HISTORY_TILE_MAX_AGE	60
+
+static void sbu_gui_history_zoom_refresh (SbuGui *self);
 
-		data = mxs_gui_get_graph_data (self, lines[i].key, lines[i].color, &error);
-		if (data == NULL) {
-			g_warning ("%s", error->message);
+typedef struct {
+	SbuGui			*self;
+	GCancellable		*cancellable;
+	gchar			*id;
+	guint64			 end;
+} SbuGuiHistoryTileHelper;
+
+static void
+sbu_gui_history_tile_helper_free (SbuGuiHistoryTileHelper *helper)
+{
+	g_object_unref (helper->cancellable);
+	g_free (helper->id);
+	g_free (helper);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuGuiHistoryTileHelper, sbu_gui_history_tile_helper_free)
+
+static SbuGuiHistoryTile *
+sbu_gui_history_tile_new (void)
+{
+	SbuGuiHistoryTile *tile = g_new0 (SbuGuiHistoryTile, 1);
+	tile->ts = g_array_new (FALSE, FALSE, sizeof (gdouble));
+	tile->val = g_array_new (FALSE, FALSE, sizeof (gdouble));
+	return tile;
+}
+
+static void
+sbu_gui_history_tile_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	GVariantIter iter;
+	SbuGuiHistoryTile *tile;
+	gdouble val;
+	guint64 ts;
+	g_autoptr(SbuGuiHistoryTileHelper) helper = (SbuGuiHistoryTileHelper *) user_data;
+	SbuGui *self = helper->self;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) reply = NULL;
+
+	if (!sbu_device_call_get_history_finish (SBU_DEVICE (source), &reply, res, &error)) {
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
 			return;
+		g_warning ("Cannot get history: %s", error->message);
+		g_hash_table_remove (self->history_tiles, helper->id);
+		return;
+	}
+	if (g_cancellable_is_cancelled (helper->cancellable))
+		return;
+
+	/* the cache may have been trimmed while waiting */
+	tile = g_hash_table_lookup (self->history_tiles, helper->id);
+	if (tile == NULL) {
+		tile = sbu_gui_history_tile_new ();
+		g_hash_table_insert (self->history_tiles, g_strdup (helper->id), tile);
+	}
+	g_array_set_size (tile->ts, 0);
+	g_array_set_size (tile->val, 0);
+	g_variant_iter_init (&iter, reply);
+	while (g_variant_iter_next (&iter, "(td)", &ts, &val)) {
+		gdouble tmp = ts;
+		g_array_append_val (tile->ts, tmp);
+		g_array_append_val (tile->val, val);
+	}
+	tile->pending = FALSE;
+	tile->complete = helper->end < (guint64) (g_get_real_time () / G_USEC_PER_SEC);
+	tile->fetched = g_get_monotonic_time () / G_USEC_PER_SEC;
+
+	/* redraw when everything has arrived */
+	sbu_gui_history_zoom_refresh (self);
+}
+
+/* replace the graph data with the tiles for the visible range */
+static void
+sbu_gui_history_zoom_rebuild (SbuGui *self, guint level, gint64 idx_start, gint64 idx_end)
+{
+	gdouble offset = self->history_now - self->history_interval;
+
+	egg_graph_widget_data_clear (EGG_GRAPH_WIDGET (self->graph_widget));
+	g_ptr_array_set_size (self->history_keys, 0);
+	for (guint i = 0; i < self->history_lines->len; i++) {
+		SbuGuiHistoryLine *line = g_ptr_array_index (self->history_lines, i);
+		g_autoptr(GArray) data_x = g_array_new (FALSE, FALSE, sizeof (gdouble));
+		g_autoptr(GArray) data_y = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+		for (gint64 idx = idx_start; idx <= idx_end; idx++) {
+			SbuGuiHistoryTile *tile;
+			g_autofree gchar *id = NULL;
+			id = g_strdup_printf ("%s/%u/%" G_GINT64_FORMAT, line->key, level, idx);
+			tile = g_hash_table_lookup (self->history_tiles, id);
+			if (tile == NULL)
+				continue;
+			for (guint j = 0; j < tile->ts->len; j++) {
+				gdouble x = g_array_index (tile->ts, gdouble, j) - offset;
+				gdouble y = g_array_index (tile->val, gdouble, j);
+				g_array_append_val (data_x, x);
+				g_array_append_val (data_y, y);
+			}
 		}
-		egg_graph_widget_data_add (EGG_GRAPH_WIDGET (self->graph_widget),
-					   plot, data);
-		egg_graph_widget_key_legend_add	(EGG_GRAPH_WIDGET (self->graph_widget),
-						 lines[i].color, lines[i].text);
+		egg_graph_widget_data_add_values (EGG_GRAPH_WIDGET (self->graph_widget),
+						  self->history_plot,
+						  (const gdouble *) data_x->data,
+						  (const gdouble *) data_y->data,
+						  data_x->len,
+						  line->color);
+		g_ptr_array_add (self->history_keys, g_strdup (line->key));
 	}
 }
 
+/**
+ * sbu_gui_history_zoom_refresh:
+ *
+ * Works out which tiles cover the visible range at about one point per pixel
+ * and requests any that are not cached. Each tile level covers twice the
+ * time of the level below, so zooming in on a long interval only fetches
+ * the short range that is actually visible, at the detail needed.
+ **/
+static void
+sbu_gui_history_zoom_refresh (SbuGui *self)
+{
+	gdouble start_x;
+	gdouble stop_x;
+	gdouble span_wanted;
+	gdouble t0, t1;
+	gint64 idx_start, idx_end;
+	gint64 now_mono = g_get_monotonic_time () / G_USEC_PER_SEC;
+	gint width;
+	guint level = 0;
+	guint64 span = SBU_GUI_HISTORY_TILE_SPAN_MIN;
+	guint missing = 0;
+
+	if (self->device == NULL)
+		return;
+
+	/* visible range as real timestamps */
+	g_object_get (self->graph_widget,
+		      "start-x", &start_x,
+		      "stop-x", &stop_x,
+		      NULL);
+	t0 = MAX (start_x + self->history_now - self->history_interval, 0);
+	t1 = MAX (stop_x + self->history_now - self->history_interval, t0 + 1);
+	width = MAX (gtk_widget_get_allocated_width (self->graph_widget), 1);
+
+	/* choose the level where one tile is about TILE_POINTS pixels wide */
+	span_wanted = SBU_GUI_HISTORY_TILE_POINTS * (t1 - t0) / width;
+	while (span < span_wanted) {
+		span *= 2;
+		level++;
+	}
+	idx_start = (gint64) t0 / span;
+	idx_end = (gint64) t1 / span;
+
+	/* keep the cache bounded */
+	if (g_hash_table_size (self->history_tiles) > SBU_GUI_HISTORY_TILE_CACHE_MAX)
+		g_hash_table_remove_all (self->history_tiles);
+
+	for (guint i = 0; i < self->history_lines->len; i++) {
+		SbuGuiHistoryLine *line = g_ptr_array_index (self->history_lines, i);
+		for (gint64 idx = idx_start; idx <= idx_end; idx++) {
+			SbuGuiHistoryTile *tile;
+			SbuGuiHistoryTileHelper *helper;
+			g_autofree gchar *id = NULL;
+
+			id = g_strdup_printf ("%s/%u/%" G_GINT64_FORMAT, line->key, level, idx);
+			tile = g_hash_table_lookup (self->history_tiles, id);
+			if (tile != NULL && tile->pending) {
+				missing++;
+				continue;
+			}
+			if (tile != NULL &&
+			    (tile->complete ||
+			     now_mono - tile->fetched < SBU_GUI_HISTORY_TILE_MAX_AGE))
+				continue;
+			if (tile == NULL) {
+				tile = sbu_gui_history_tile_new ();
+				g_hash_table_insert (self->history_tiles, g_strdup (id), tile);
+			}
+			tile->pending = TRUE;
+			missing++;
+
+			helper = g_new0 (SbuGuiHistoryTileHelper, 1);
+			helper->self = self;
+			helper->cancellable = g_object_ref (self->history_cancellable);
+			helper->id = g_steal_pointer (&id);
+			helper->end = (idx + 1) * span;
+			sbu_device_call_get_history (self->device,
+						     line->key,
+						     idx * span,
+						     helper->end,
+						     SBU_GUI_HISTORY_TILE_POINTS,
+						     self->history_cancellable,
+						     sbu_gui_history_tile_cb,
+						     helper);
+		}
+	}
+	g_debug ("zoom level %u needs tiles %" G_GINT64_FORMAT "->%" G_GINT64_FORMAT
+		 ", %u pending", level, idx_start, idx_end, missing);
+	if (missing == 0)
+		sbu_gui_history_zoom_rebuild (self, level, idx_start, idx_end);
+}
+
+static gboolean
+sbu_gui_history_zoom_delay_cb (gpointer user_data)
+{
+	SbuGui *self = (SbuGui *) user_data;
+	self->zoom_id = 0;
+	sbu_gui_history_zoom_refresh (self);
+	return FALSE;
+}
+
+static void
+sbu_gui_history_range_changed_cb (EggGraphWidget *graph, SbuGui *self)
+{
+	if (self->zoom_id != 0)
+		g_source_remove (self->zoom_id);
+	self->zoom_id = g_timeout_add (150, sbu_gui_history_zoom_delay_cb, self);
+}
+
 #define CC_BATTERY	0xcc0000
 #define CC_SOLAR	0xcccc00
 #define CC_UTILITY	0x00cc00
@@ -567,6 +941,7 @@ sbu_gui_format_watts (SbuNode *node)
 #define SBU_SVG_ID_PATH_BATTERY_TO_LOAD		"path6089-06"
 
 #define SBU_SVG_OFFSCREEN			"-999"
+#define SBU_GUI_LAYER_MARGIN			4	/* px */
 #define SBU_SVG_STYLE_INACTIVE			"fill:none;stroke:#cccccc;stroke-width:5;stroke-dasharray:5, 5;stroke-dashoffset:0"
 
 static void
@@ -584,25 +959,185 @@ sbu_gui_refresh_overview_link (SbuLink *l, SbuXmlModifier *xml_mod, const gchar
 	}
 }
 
+/* everything that can change, each drawn as a separate layer */
+static const gchar *sbu_gui_overview_layer_ids[] = {
+	SBU_SVG_ID_TEXT_SERIAL_NUMBER,
+	SBU_SVG_ID_TEXT_FIRMWARE_VERSION,
+	SBU_SVG_ID_TEXT_DEVICE_MODEL,
+	SBU_SVG_ID_TEXT_SOLAR_TO_UTILITY,
+	SBU_SVG_ID_TEXT_BATTERY_VOLTAGE,
+	SBU_SVG_ID_TEXT_BATTERY_TO_LOAD,
+	SBU_SVG_ID_TEXT_LOAD,
+	SBU_SVG_ID_TEXT_SOLAR,
+	SBU_SVG_ID_TEXT_UTILITY,
+	SBU_SVG_ID_PATH_SOLAR_TO_UTILITY,
+	SBU_SVG_ID_PATH_SOLAR_TO_LOAD,
+	SBU_SVG_ID_PATH_SOLAR_TO_BATTERY,
+	SBU_SVG_ID_PATH_UTILITY_TO_BATTERY,
+	SBU_SVG_ID_PATH_UTILITY_TO_LOAD,
+	SBU_SVG_ID_PATH_BATTERY_TO_LOAD,
+	NULL
+};
+
+/* rasterize the current document, restricted by a stylesheet */
+static GdkPixbuf *
+sbu_gui_overview_rasterize (SbuXmlModifier *xml_mod, const gchar *css, GError **error)
+{
+	const gchar *tmp;
+	g_autoptr(GInputStream) stream = NULL;
+	g_autoptr(GString) svg_data = NULL;
+	g_autofree gchar *style = NULL;
+
+	svg_data = sbu_xml_modifier_render (xml_mod);
+	if (svg_data == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+				     "no template");
+		return NULL;
+	}
+	tmp = g_strrstr (svg_data->str, "</svg>");
+	if (tmp == NULL) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+				     "no closing svg tag");
+		return NULL;
+	}
+	style = g_strdup_printf ("<style type=\"text/css\">%s</style>", css);
+	g_string_insert (svg_data, tmp - svg_data->str, style);
+
+	/* load as image */
+	stream = g_memory_input_stream_new_from_data (svg_data->str,
+						      (gssize) svg_data->len,
+						      NULL);
+	return gdk_pixbuf_new_from_stream_at_scale (stream, -1, 600, TRUE, NULL, error);
+}
+
+/* the static parts, i.e. everything apart from the layers */
+static GdkPixbuf *
+sbu_gui_overview_rasterize_background (SbuXmlModifier *xml_mod, GError **error)
+{
+	g_autoptr(GString) css = g_string_new (NULL);
+	for (guint i = 0; sbu_gui_overview_layer_ids[i] != NULL; i++) {
+		if (css->len > 0)
+			g_string_append (css, ", ");
+		g_string_append_printf (css, "#%s", sbu_gui_overview_layer_ids[i]);
+	}
+	g_string_append (css, " { visibility: hidden !important; }");
+	return sbu_gui_overview_rasterize (xml_mod, css->str, error);
+}
+
+/* just one element, cropped to where it is drawn with a little extra for
+ * the stroke and the antialiasing */
+static gboolean
+sbu_gui_overview_rasterize_layer (RsvgHandle *handle,
+				  SbuGuiLayer *layer,
+				  gdouble scale,
+				  GError **error)
+{
+	RsvgDimensionData dim;
+	RsvgPositionData pos;
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	gint height;
+	gint width;
+	g_autofree gchar *id = g_strdup_printf ("#%s", layer->id);
+
+	if (!rsvg_handle_get_position_sub (handle, &pos, id) ||
+	    !rsvg_handle_get_dimensions_sub (handle, &dim, id)) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+			     "no element %s", layer->id);
+		return FALSE;
+	}
+	layer->x = (gint) floor (pos.x * scale) - SBU_GUI_LAYER_MARGIN;
+	layer->y = (gint) floor (pos.y * scale) - SBU_GUI_LAYER_MARGIN;
+	width = (gint) ceil (dim.width * scale) + 2 * SBU_GUI_LAYER_MARGIN;
+	height = (gint) ceil (dim.height * scale) + 2 * SBU_GUI_LAYER_MARGIN;
+
+	surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+	cr = cairo_create (surface);
+	cairo_translate (cr, -layer->x, -layer->y);
+	cairo_scale (cr, scale, scale);
+	rsvg_handle_render_cairo_sub (handle, cr, id);
+	cairo_destroy (cr);
+	if (layer->pixbuf != NULL)
+		g_object_unref (layer->pixbuf);
+	layer->pixbuf = gdk_pixbuf_get_from_surface (surface, 0, 0, width, height);
+	cairo_surface_destroy (surface);
+	return TRUE;
+}
+
+/* the layer may be partly or entirely outside the overview */
+static void
+sbu_gui_overview_composite_layer (SbuGuiLayer *layer, GdkPixbuf *pixbuf)
+{
+	gint x1 = MAX (layer->x, 0);
+	gint y1 = MAX (layer->y, 0);
+	gint x2 = MIN (layer->x + gdk_pixbuf_get_width (layer->pixbuf),
+		       gdk_pixbuf_get_width (pixbuf));
+	gint y2 = MIN (layer->y + gdk_pixbuf_get_height (layer->pixbuf),
+		       gdk_pixbuf_get_height (pixbuf));
+	if (x2 <= x1 || y2 <= y1)
+		return;
+	gdk_pixbuf_composite (layer->pixbuf, pixbuf,
+			      x1, y1, x2 - x1, y2 - y1,
+			      layer->x, layer->y, 1.f, 1.f,
+			      GDK_INTERP_NEAREST, 255);
+}
+
+static gchar *
+sbu_gui_overview_layer_signature (SbuXmlModifier *xml_mod, const gchar *id)
+{
+	return g_strdup_printf ("%s|%s|%s",
+				sbu_xml_modifier_get_cdata (xml_mod, id),
+				sbu_xml_modifier_get_attr (xml_mod, id, "x"),
+				sbu_xml_modifier_get_attr (xml_mod, id, "style"));
+}
+
+static SbuXmlModifier *
+sbu_gui_get_overview_template (SbuGui *self, GError **error)
+{
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(SbuXmlModifier) xml_mod = NULL;
+
+	/* already compiled */
+	if (self->xml_mod != NULL) {
+		sbu_xml_modifier_reset (self->xml_mod);
+		return self->xml_mod;
+	}
+
+	/* load GResource */
+	bytes = g_resource_lookup_data (sbu_get_resource (),
+					"/com/hughski/PowerSBU/sbu-overview.svg",
+					G_RESOURCE_LOOKUP_FLAGS_NONE,
+					error);
+	if (bytes == NULL)
+		return NULL;
+
+	/* parse once, each refresh is then just a splice */
+	xml_mod = sbu_xml_modifier_new ();
+	if (!sbu_xml_modifier_compile (xml_mod,
+				       g_bytes_get_data (bytes, NULL),
+				       (gssize) g_bytes_get_size (bytes),
+				       error))
+		return NULL;
+	self->xml_mod = g_steal_pointer (&xml_mod);
+	return self->xml_mod;
+}
+
 static void
 sbu_gui_refresh_overview (SbuGui *self)
 {
 	GtkWidget *widget;
-	g_autoptr(GBytes) bytes = NULL;
+	RsvgHandle *handle = NULL;
+	gdouble scale = 1.f;
+	guint cnt_rendered = 0;
 	g_autoptr(GdkPixbuf) pixbuf = NULL;
 	g_autoptr(GError) error = NULL;
-	g_autoptr(GInputStream) stream = NULL;
-	g_autoptr(GString) svg_data = NULL;
 	SbuNode *n;
 	SbuLink *l;
-	g_autoptr(SbuXmlModifier) xml_mod = sbu_xml_modifier_new ();
+	SbuXmlModifier *xml_mod;
 
-	/* load GResource */
-	bytes = g_resource_lookup_data (sbu_get_resource (),
-					"/com/hughski/PowerSBU/sbu-overview.svg",
-					G_RESOURCE_LOOKUP_FLAGS_NONE,
-					&error);
-	if (bytes == NULL) {
+	/* load template */
+	xml_mod = sbu_gui_get_overview_template (self, &error);
+	if (xml_mod == NULL) {
 		g_warning ("failed to load image: %s", error->message);
 		return;
 	}
@@ -682,26 +1217,74 @@ sbu_gui_refresh_overview (SbuGui *self)
 		sbu_xml_modifier_replace_cdata (xml_mod, SBU_SVG_ID_TEXT_UTILITY, "?");
 	}
 
-	/* process replacements */
-	svg_data = sbu_xml_modifier_process (xml_mod,
-					     g_bytes_get_data (bytes, NULL),
-					     g_bytes_get_size (bytes),
-					     &error);
-	if (svg_data == NULL) {
-		g_warning ("failed to modify the SVG image: %s", error->message);
-		return;
+	/* static background is only rasterized once */
+	if (self->overview_background == NULL) {
+		self->overview_background = sbu_gui_overview_rasterize_background (xml_mod, &error);
+		if (self->overview_background == NULL) {
+			g_warning ("failed to load image: %s", error->message);
+			return;
+		}
 	}
 
-	/* load as image */
-	stream = g_memory_input_stream_new_from_data (svg_data->str,
-						      (gssize) svg_data->len,
-						      NULL);
-	pixbuf = gdk_pixbuf_new_from_stream_at_scale (stream, -1, 600, TRUE, NULL, &error);
-	if (pixbuf == NULL) {
-		g_warning ("failed to load image: %s", error->message);
-		return;
+	/* only rasterize the layers that have changed */
+	if (self->overview_layers->len == 0) {
+		for (guint i = 0; sbu_gui_overview_layer_ids[i] != NULL; i++) {
+			SbuGuiLayer *layer = g_new0 (SbuGuiLayer, 1);
+			layer->id = sbu_gui_overview_layer_ids[i];
+			g_ptr_array_add (self->overview_layers, layer);
+		}
+	}
+	for (guint i = 0; i < self->overview_layers->len; i++) {
+		SbuGuiLayer *layer = g_ptr_array_index (self->overview_layers, i);
+		g_autofree gchar *signature = NULL;
+
+		signature = sbu_gui_overview_layer_signature (xml_mod, layer->id);
+		if (layer->pixbuf != NULL &&
+		    g_strcmp0 (signature, layer->signature) == 0)
+			continue;
+
+		/* the document is parsed once for all the changed layers */
+		if (handle == NULL) {
+			RsvgDimensionData dim;
+			g_autoptr(GString) svg_data = sbu_xml_modifier_render (xml_mod);
+			if (svg_data == NULL) {
+				g_warning ("failed to load image: no template");
+				return;
+			}
+			handle = rsvg_handle_new_from_data ((const guint8 *) svg_data->str,
+							    svg_data->len, &error);
+			if (handle == NULL) {
+				g_warning ("failed to load image: %s", error->message);
+				return;
+			}
+			rsvg_handle_get_dimensions (handle, &dim);
+			scale = (gdouble) gdk_pixbuf_get_height (self->overview_background) /
+				(gdouble) dim.height;
+		}
+		if (!sbu_gui_overview_rasterize_layer (handle, layer, scale, &error)) {
+			g_warning ("failed to load image: %s", error->message);
+			g_object_unref (handle);
+			return;
+		}
+		g_free (layer->signature);
+		layer->signature = g_steal_pointer (&signature);
+		cnt_rendered++;
 	}
+	if (handle != NULL)
+		g_object_unref (handle);
+	g_debug ("rasterized %u/%u overview layers",
+		 cnt_rendered, self->overview_layers->len);
 	widget = GTK_WIDGET (gtk_builder_get_object (self->builder, "image_overview"));
+	if (cnt_rendered == 0 &&
+	    gtk_image_get_storage_type (GTK_IMAGE (widget)) == GTK_IMAGE_PIXBUF)
+		return;
+
+	/* composite the layers onto the background */
+	pixbuf = gdk_pixbuf_copy (self->overview_background);
+	for (guint i = 0; i < self->overview_layers->len; i++) {
+		SbuGuiLayer *layer = g_ptr_array_index (self->overview_layers, i);
+		sbu_gui_overview_composite_layer (layer, pixbuf);
+	}
 	gtk_image_set_from_pixbuf (GTK_IMAGE (widget), pixbuf);
 }
 
@@ -722,6 +1305,24 @@ sbu_gui_refresh_overview_delay (SbuGui *self)
 	self->refresh_id = g_timeout_add (500, sbu_gui_node_notify_delay_cb, self);
 }
 
+/* add the new value to the graph if it is being shown live */
+static void
+sbu_gui_history_append (SbuGui *self, const gchar *key, gdouble value)
+{
+	gint64 now;
+
+	if (self->history_interval != SBU_GUI_HISTORY_LIVE_INTERVAL)
+		return;
+	now = g_get_real_time () / G_USEC_PER_SEC;
+	for (guint i = 0; i < self->history_keys->len; i++) {
+		if (g_strcmp0 (key, g_ptr_array_index (self->history_keys, i)) != 0)
+			continue;
+		egg_graph_widget_data_append (EGG_GRAPH_WIDGET (self->graph_widget), i,
+					      now + self->history_interval - self->history_now,
+					      value);
+	}
+}
+
 static void
 sbu_gui_node_notify_cb (SbuNode *n, GParamSpec *pspec, gpointer user_data)
 {
@@ -729,6 +1330,15 @@ sbu_gui_node_notify_cb (SbuNode *n, GParamSpec *pspec, gpointer user_data)
 	g_debug ("changed %s:%s",
 		 sbu_node_kind_to_string (sbu_node_get_kind (n)),
 		 g_param_spec_get_name (pspec));
+	if (pspec->value_type == G_TYPE_DOUBLE) {
+		gdouble value;
+		g_autofree gchar *key = NULL;
+		key = g_strdup_printf ("node_%s:%s",
+				       sbu_node_kind_to_string (sbu_node_get_kind (n)),
+				       g_param_spec_get_name (pspec));
+		g_object_get (n, g_param_spec_get_name (pspec), &value, NULL);
+		sbu_gui_history_append (self, key, value);
+	}
 	sbu_gui_refresh_overview_delay (self);
 }
 
@@ -740,6 +1350,16 @@ sbu_gui_link_notify_cb (SbuLink *l, GParamSpec *pspec, gpointer user_data)
 		 sbu_node_kind_to_string (sbu_link_get_src (l)),
 		 sbu_node_kind_to_string (sbu_link_get_dst (l)),
 		 g_param_spec_get_name (pspec));
+	if (pspec->value_type == G_TYPE_BOOLEAN) {
+		gboolean value;
+		g_autofree gchar *key = NULL;
+		key = g_strdup_printf ("link_%s_%s:%s",
+				       sbu_node_kind_to_string (sbu_link_get_src (l)),
+				       sbu_node_kind_to_string (sbu_link_get_dst (l)),
+				       g_param_spec_get_name (pspec));
+		g_object_get (l, g_param_spec_get_name (pspec), &value, NULL);
+		sbu_gui_history_append (self, key, value ? 1.f : 0.f);
+	}
 	sbu_gui_refresh_overview_delay (self);
 }
 
@@ -1061,7 +1681,10 @@ sbu_gui_startup_cb (GApplication *application, SbuGui *self)
 	g_object_set (self->graph_widget,
 		      "type-x", EGG_GRAPH_WIDGET_KIND_TIME,
 		      "autorange-x", TRUE,
+		      "use-zoom", TRUE,
 		      NULL);
+	g_signal_connect (self->graph_widget, "range-changed",
+			  G_CALLBACK (sbu_gui_history_range_changed_cb), self);
 	widget = GTK_WIDGET (gtk_builder_get_object (self->builder, "listbox_history"));
 	g_signal_connect (widget, "row-selected",
 			  G_CALLBACK (sbu_gui_history_row_selected_cb), self);
@@ -1105,11 +1728,17 @@ sbu_gui_self_new (void)
 {
 	SbuGui *self = g_new0 (SbuGui, 1);
 	self->cancellable = g_cancellable_new ();
+	self->history_cancellable = g_cancellable_new ();
 	self->config = sbu_config_new ();
 	self->database = sbu_database_new ();
 	self->builder = gtk_builder_new ();
 	self->nodes = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 	self->links = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	self->overview_layers = g_ptr_array_new_with_free_func ((GDestroyNotify) sbu_gui_layer_free);
+	self->history_keys = g_ptr_array_new_with_free_func (g_free);
+	self->history_lines = g_ptr_array_new_with_free_func ((GDestroyNotify) sbu_gui_history_line_free);
+	self->history_tiles = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+						     (GDestroyNotify) sbu_gui_history_tile_free);
 	self->details_sizegroup_title = gtk_size_group_new (GTK_SIZE_GROUP_HORIZONTAL);
 	self->details_sizegroup_value = gtk_size_group_new (GTK_SIZE_GROUP_HORIZONTAL);
 	return self;
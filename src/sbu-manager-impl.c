@@ -26,9 +26,14 @@
 #include "sbu-common.h"
 #include "sbu-config.h"
 #include "sbu-database.h"
+#include "sbu-derived.h"
 #include "sbu-device-impl.h"
+#include "sbu-energy.h"
 #include "sbu-manager-impl.h"
+#include "sbu-metrics.h"
+#include "sbu-node-impl.h"
 #include "sbu-plugin-private.h"
+#include "sbu-rules.h"
 
 typedef struct _SbuManagerImplClass	SbuManagerImplClass;
 
@@ -38,16 +43,18 @@ struct _SbuManagerImpl
 	GDBusObjectManagerServer	*object_manager; /* no ref */
 	guint				 poll_id;
 	guint				 poll_interval;
+	guint				 flush_interval;
+	guint				 battery_capacity;	/* Ah */
 	GPtrArray			*plugins;
 	GPtrArray			*devices;
 	SbuDatabase			*database;
+	SbuDerived			*derived;
+	SbuEnergy			*energy;
+	guint				 energy_id;
+	SbuRules			*rules;
+	SbuMetrics			*metrics;
 };
 
-typedef void		 (*SbuPluginFunc)		(SbuPlugin	*plugin);
-typedef gboolean	 (*SbuPluginSetupFunc)		(SbuPlugin	*plugin,
-							 GCancellable	*cancellable,
-							 GError		**error);
-
 struct _SbuManagerImplClass
 {
 	SbuManagerSkeletonClass	 parent_class;
@@ -65,64 +72,90 @@ static void sbu_manager_iface_init (SbuManagerIface *iface);
 G_DEFINE_TYPE_WITH_CODE (SbuManagerImpl, sbu_manager_impl, SBU_TYPE_MANAGER_SKELETON,
 			 G_IMPLEMENT_INTERFACE(SBU_TYPE_MANAGER, sbu_manager_iface_init));
 
-static gboolean
-sbu_manager_impl_plugins_call_vfunc (SbuPlugin *plugin,
-				     const gchar *function_name,
-				     GCancellable *cancellable,
-				     GError **error)
+/* how often the energy counters in progress are saved, in s */
+#define SBU_MANAGER_ENERGY_CHECKPOINT_INTERVAL	60
+
+/* integrate every poll, as the saved history skips small changes */
+static void
+sbu_manager_impl_energy_add_samples (SbuManagerImpl *self, SbuDeviceImpl *device)
 {
-	gpointer func = NULL;
-
-	/* load the possible symbol */
-	func = sbu_plugin_get_symbol (plugin, function_name);
-	if (func == NULL) {
-		g_debug ("no %s for %s, skipping",
-			 function_name,
-			 sbu_plugin_get_name (plugin));
-		return TRUE;
-	}
+	GPtrArray *nodes = sbu_device_impl_get_node_array (device);
+	gint64 ts = g_get_real_time ();
+
+	for (guint i = 0; i < nodes->len; i++) {
+		SbuNodeImpl *node = g_ptr_array_index (nodes, i);
+		const gchar *object_path = sbu_node_impl_get_object_path (node);
+		SbuNodeKind kind;
+		gdouble power;
+		g_autofree gchar *key = NULL;
 
-	/* run the correct vfunc */
-	if (g_strcmp0 (function_name, "sbu_plugin_initialize") == 0 ||
-	    g_strcmp0 (function_name, "sbu_plugin_destroy") == 0) {
-		SbuPluginFunc plugin_func = func;
-		plugin_func (plugin);
-		return TRUE;
-	}
-	if (g_strcmp0 (function_name, "sbu_plugin_setup") == 0 ||
-	    g_strcmp0 (function_name, "sbu_plugin_refresh") == 0) {
-		SbuPluginSetupFunc plugin_func = func;
-		return plugin_func (plugin, cancellable, error);
+		if (object_path == NULL)
+			continue;
+
+		/* includes anything still waiting for the flush */
+		g_object_get (node, "kind", &kind, NULL);
+		power = sbu_device_impl_get_node_value (device, kind, SBU_DEVICE_PROPERTY_POWER);
+		key = g_strdup_printf ("%s:power",
+				       object_path + strlen (SBU_DBUS_PATH_DEVICE));
+		sbu_energy_add_sample (self->energy, key, ts, power);
 	}
-	
-	/* failed */
-	g_set_error (error,
-		     G_IO_ERROR,
-		     G_IO_ERROR_FAILED,
-		     "function_name %s invalid",
-		     function_name);
-	return FALSE;
+}
+
+static gboolean
+sbu_manager_impl_energy_checkpoint_cb (gpointer user_data)
+{
+	SbuManagerImpl *self = SBU_MANAGER_IMPL (user_data);
+	g_autoptr(GError) error = NULL;
+	if (!sbu_energy_checkpoint (self->energy, &error))
+		g_warning ("failed to save energy: %s", error->message);
+	return TRUE;
 }
 
 static gboolean
 sbu_manager_impl_poll_cb (gpointer user_data)
 {
 	SbuManagerImpl *self = SBU_MANAGER_IMPL (user_data);
+	gint64 ts = g_get_monotonic_time ();
+	g_autoptr(GPtrArray) devices = NULL;
+
+	/* devices may be added or removed by the plugins */
+	devices = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	for (guint i = 0; i < self->devices->len; i++) {
+		SbuDeviceImpl *device = g_ptr_array_index (self->devices, i);
+		sbu_device_impl_begin_update (device);
+		g_ptr_array_add (devices, g_object_ref (device));
+	}
 
 	/* rescan stuff that can change at runtime */
 	for (guint i = 0; i < self->plugins->len; i++) {
 		SbuPlugin *plugin = g_ptr_array_index (self->plugins, i);
+		gint64 ts_plugin = g_get_monotonic_time ();
+		g_autofree gchar *labels = NULL;
 		g_autoptr(GError) error = NULL;
-		if (!sbu_manager_impl_plugins_call_vfunc (plugin,
-							  "sbu_plugin_refresh",
-						          NULL,
-						          &error)) {
+		labels = g_strdup_printf ("plugin=\"%s\"", sbu_plugin_get_name (plugin));
+		if (!sbu_plugin_runner_refresh (plugin, NULL, &error)) {
 			g_warning ("failed to refresh %s: %s",
 				   sbu_plugin_get_name (plugin),
 				   error->message);
+			sbu_metrics_increment (self->metrics,
+					       "sbud_plugin_refresh_errors_total",
+					       labels, 1);
 		}
+		sbu_metrics_observe (self->metrics,
+				     "sbud_plugin_refresh_seconds", labels,
+				     g_get_monotonic_time () - ts_plugin);
 	}
 
+	/* send all the property changes from this poll together */
+	for (guint i = 0; i < devices->len; i++) {
+		SbuDeviceImpl *device = g_ptr_array_index (devices, i);
+		sbu_device_impl_commit_update (device);
+		sbu_manager_impl_energy_add_samples (self, device);
+	}
+	sbu_rules_check (self->rules, g_get_monotonic_time ());
+	sbu_metrics_observe (self->metrics, "sbud_poll_seconds", NULL,
+			     g_get_monotonic_time () - ts);
+
 	return TRUE;
 }
 
@@ -164,29 +197,27 @@ sbu_manager_impl_plugins_remove_device_cb (SbuPlugin *plugin,
 {
 	g_debug ("removing device %s", sbu_device_impl_get_object_path (device));
 	sbu_device_impl_unexport (device);
+	g_signal_handlers_disconnect_by_data (device, self);
 	g_ptr_array_remove (self->devices, device);
 	if (self->devices->len == 0)
 		sbu_manager_impl_poll_stop (self);
 }
 
 static void
-sbu_manager_impl_save_history (SbuManagerImpl *self, const gchar *object_path, const gchar *propname, GObject *obj)
+sbu_manager_impl_save_history (SbuManagerImpl *self, const gchar *object_path, const gchar *propname, gdouble tmp)
 {
 	gint value = -1;
 
 	/* boolean */
 	if (g_strcmp0 (propname, "active") == 0) {
-		gboolean tmp;
-		g_object_get (obj, propname, &tmp, NULL);
-		value = (guint) tmp;
+		value = tmp > 0.f ? 1 : 0;
 
 	/* double */
 	} else if (g_strcmp0 (propname, "power") == 0 ||
 		   g_strcmp0 (propname, "current") == 0 ||
 		   g_strcmp0 (propname, "voltage") == 0 ||
-		   g_strcmp0 (propname, "frequency") == 0) {
-		gdouble tmp;
-		g_object_get (obj, propname, &tmp, NULL);
+		   g_strcmp0 (propname, "frequency") == 0 ||
+		   g_strcmp0 (propname, "state-of-charge") == 0) {
 		value = tmp * 1000.f;
 	}
 
@@ -199,33 +230,60 @@ sbu_manager_impl_save_history (SbuManagerImpl *self, const gchar *object_path, c
 				       propname);
 		if (!sbu_database_save_value (self->database, key, value, &error))
 			g_warning ("%s", error->message);
+
+		/* update any virtual keys and rules that use this */
+		sbu_derived_set_value (self->derived, key, tmp);
+		sbu_rules_set_value (self->rules, key, g_get_monotonic_time (), tmp);
 	}
 }
 
 static void
-sbu_manager_impl_node_notify_cb (SbuNodeImpl *n, GParamSpec *pspec, gpointer user_data)
+sbu_manager_impl_derived_changed_cb (SbuDerived *derived,
+				     const gchar *key,
+				     gdouble value,
+				     SbuManagerImpl *self)
 {
-	SbuManagerImpl *self = SBU_MANAGER_IMPL (user_data);
-	g_debug ("changed %s:%s",
-		 sbu_node_impl_get_object_path (n),
-		 g_param_spec_get_name (pspec));
-	sbu_manager_impl_save_history (self,
-				       sbu_node_impl_get_object_path (n),
-				       g_param_spec_get_name (pspec),
-				       G_OBJECT (n));
+	g_autoptr(GError) error = NULL;
+	g_debug ("derived %s=%f", key, value);
+	if (!sbu_database_save_value (self->database, key, value * 1000.f, &error))
+		g_warning ("%s", error->message);
+	sbu_rules_set_value (self->rules, key, g_get_monotonic_time (), value);
 }
 
 static void
-sbu_manager_impl_link_notify_cb (SbuLinkImpl *l, GParamSpec *pspec, gpointer user_data)
+sbu_manager_impl_rules_fired_cb (SbuRules *rules,
+				 const gchar *name,
+				 const gchar *key,
+				 gdouble value,
+				 SbuManagerImpl *self)
 {
-	SbuManagerImpl *self = SBU_MANAGER_IMPL (user_data);
-	g_debug ("changed %s:%s",
-		 sbu_link_impl_get_object_path (l),
-		 g_param_spec_get_name (pspec));
-	sbu_manager_impl_save_history (self,
-				       sbu_link_impl_get_object_path (l),
-				       g_param_spec_get_name (pspec),
-				       G_OBJECT (l));
+	g_autofree gchar *labels = g_strdup_printf ("rule=\"%s\"", name);
+	g_message ("alert %s fired: %s=%.3f", name, key, value);
+	sbu_metrics_increment (self->metrics, "sbud_alerts_total", labels, 1);
+	sbu_manager_emit_alert_fired (SBU_MANAGER (self), name, key, value);
+}
+
+static void
+sbu_manager_impl_rules_cleared_cb (SbuRules *rules,
+				   const gchar *name,
+				   const gchar *key,
+				   gdouble value,
+				   SbuManagerImpl *self)
+{
+	g_message ("alert %s cleared: %s=%.3f", name, key, value);
+	sbu_manager_emit_alert_cleared (SBU_MANAGER (self), name, key, value);
+}
+
+/* every committed value, which may not be on the bus until the next flush */
+static void
+sbu_manager_impl_device_changed_cb (SbuDeviceImpl *device,
+				    const gchar *object_path,
+				    const gchar *propname,
+				    gdouble value,
+				    SbuManagerImpl *self)
+{
+	g_debug ("changed %s:%s", object_path, propname);
+	sbu_manager_impl_save_history (self, object_path, propname, value);
 }
 
 static void
@@ -233,7 +291,6 @@ sbu_manager_impl_plugins_add_device_cb (SbuPlugin *plugin,
 					SbuDeviceImpl *device,
 					SbuManagerImpl *self)
 {
-	GPtrArray *array;
 	g_autofree gchar *object_path = NULL;
 
 	/* just use the array position as the ID */
@@ -247,23 +304,15 @@ sbu_manager_impl_plugins_add_device_cb (SbuPlugin *plugin,
 		      NULL);
 
 	/* watch all links and nodes */
-	array = sbu_device_impl_get_link_array (device);
-	for (guint i = 0; i < array->len; i++) {
-		SbuLink *link = g_ptr_array_index (array, i);
-		g_signal_connect (link, "notify",
-				  G_CALLBACK (sbu_manager_impl_link_notify_cb),
-				  self);
-	}
-	array = sbu_device_impl_get_node_array (device);
-	for (guint i = 0; i < array->len; i++) {
-		SbuNode *node = g_ptr_array_index (array, i);
-		g_signal_connect (node, "notify",
-				  G_CALLBACK (sbu_manager_impl_node_notify_cb),
-				  self);
-	}
+	g_signal_connect (device, "changed",
+			  G_CALLBACK (sbu_manager_impl_device_changed_cb),
+			  self);
 
 	/* export and save device */
 	sbu_device_set_database (device, self->database);
+	sbu_device_impl_set_metrics (device, self->metrics);
+	sbu_device_impl_set_flush_interval (device, self->flush_interval);
+	sbu_device_impl_set_battery_capacity (device, self->battery_capacity);
 	sbu_device_impl_export (device);
 	g_ptr_array_add (self->devices, g_object_ref (device));
 
@@ -284,6 +333,7 @@ sbu_manager_impl_plugins_open_plugin (SbuManagerImpl *self,
 		g_warning ("Failed to load %s: %s", filename, error->message);
 		return;
 	}
+	sbu_plugin_set_metrics (plugin, self->metrics);
 	g_signal_connect (plugin, "update-metadata",
 			  G_CALLBACK (sbu_manager_impl_plugins_update_metadata_cb),
 			  self);
@@ -330,8 +380,7 @@ sbu_manager_impl_plugins_setup (SbuManagerImpl *self,
 	/* run the initialize */
 	for (guint i = 0; i < self->plugins->len; i++) {
 		SbuPlugin *plugin = g_ptr_array_index (self->plugins, i);
-		sbu_manager_impl_plugins_call_vfunc (plugin, "sbu_plugin_initialize",
-						     cancellable, NULL);
+		sbu_plugin_runner_initialize (plugin);
 	}
 
 	return TRUE;
@@ -344,6 +393,7 @@ sbu_manager_impl_get_devices (SbuManager *manager,
 {
 	SbuManagerImpl *self = SBU_MANAGER_IMPL (manager);
 	GVariantBuilder builder;
+	gint64 ts = g_get_monotonic_time ();
 
 	g_debug ("handling GetDevices");
 	g_variant_builder_init (&builder, G_VARIANT_TYPE ("(ao)"));
@@ -356,6 +406,27 @@ sbu_manager_impl_get_devices (SbuManager *manager,
 	g_variant_builder_close (&builder);
 	g_dbus_method_invocation_return_value (invocation,
 					       g_variant_builder_end (&builder));
+	sbu_metrics_observe (self->metrics, "sbud_dbus_method_seconds",
+			     "method=\"GetDevices\"",
+			     g_get_monotonic_time () - ts);
+	return TRUE;
+}
+
+/* runs in thread dedicated to handling @invocation */
+static gboolean
+sbu_manager_impl_get_metrics (SbuManager *manager,
+			      GDBusMethodInvocation *invocation)
+{
+	SbuManagerImpl *self = SBU_MANAGER_IMPL (manager);
+	gint64 ts = g_get_monotonic_time ();
+
+	g_debug ("handling GetMetrics");
+	g_dbus_method_invocation_return_value (invocation,
+					       g_variant_new ("(@a{s(sttt)})",
+							      sbu_metrics_to_variant (self->metrics)));
+	sbu_metrics_observe (self->metrics, "sbud_dbus_method_seconds",
+			     "method=\"GetMetrics\"",
+			     g_get_monotonic_time () - ts);
 	return TRUE;
 }
 
@@ -363,6 +434,7 @@ static void
 sbu_manager_iface_init (SbuManagerIface *iface)
 {
 	iface->handle_get_devices = sbu_manager_impl_get_devices;
+	iface->handle_get_metrics = sbu_manager_impl_get_metrics;
 }
 
 static void
@@ -408,12 +480,22 @@ sbu_manager_impl_finalize (GObject *object)
 	SbuManagerImpl *self = SBU_MANAGER_IMPL (object);
 
 	sbu_manager_impl_poll_stop (self);
+	if (self->energy_id != 0) {
+		g_autoptr(GError) error = NULL;
+		g_source_remove (self->energy_id);
+		if (!sbu_energy_checkpoint (self->energy, &error))
+			g_warning ("failed to save energy: %s", error->message);
+	}
 	for (guint i = 0; i < self->plugins->len; i++) {
 		SbuPlugin *plugin = g_ptr_array_index (self->plugins, i);
-		sbu_manager_impl_plugins_call_vfunc (plugin, "sbu_plugin_destroy", NULL, NULL);
+		sbu_plugin_runner_destroy (plugin);
 	}
 
 	g_object_unref (self->database);
+	g_object_unref (self->derived);
+	g_object_unref (self->energy);
+	g_object_unref (self->rules);
+	g_object_unref (self->metrics);
 	g_ptr_array_unref (self->plugins);
 	g_ptr_array_unref (self->devices);
 	G_OBJECT_CLASS (sbu_manager_impl_parent_class)->finalize (object);
@@ -436,8 +518,7 @@ sbu_manager_impl_start (SbuManagerImpl *self)
 	for (guint i = 0; i < self->plugins->len; i++) {
 		g_autoptr(GError) error_local = NULL;
 		SbuPlugin *plugin = g_ptr_array_index (self->plugins, i);
-		if (!sbu_manager_impl_plugins_call_vfunc (plugin, "sbu_plugin_setup",
-							  NULL, &error_local)) {
+		if (!sbu_plugin_runner_setup (plugin, NULL, &error_local)) {
 			g_debug ("disabling %s as setup failed: %s",
 				 sbu_plugin_get_name (plugin),
 				 error_local->message);
@@ -451,6 +532,20 @@ static void
 sbu_manager_impl_init (SbuManagerImpl *self)
 {
 	self->database = sbu_database_new ();
+	self->derived = sbu_derived_new ();
+	self->energy = sbu_energy_new (self->database);
+	self->rules = sbu_rules_new ();
+	self->metrics = sbu_metrics_new ();
+	g_signal_connect (self->derived, "changed",
+			  G_CALLBACK (sbu_manager_impl_derived_changed_cb),
+			  self);
+	g_signal_connect (self->rules, "fired",
+			  G_CALLBACK (sbu_manager_impl_rules_fired_cb),
+			  self);
+	g_signal_connect (self->rules, "cleared",
+			  G_CALLBACK (sbu_manager_impl_rules_cleared_cb),
+			  self);
+	sbu_database_set_metrics (self->database, self->metrics);
 	self->devices = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 	self->plugins = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 
@@ -494,7 +589,10 @@ sbu_manager_impl_new (GDBusObjectManagerServer *object_manager)
 gboolean
 sbu_manager_impl_setup (SbuManagerImpl *self, GError **error)
 {
+	g_autofree gchar *alert_rules = NULL;
+	g_autofree gchar *derived_keys = NULL;
 	g_autofree gchar *location = NULL;
+	g_autofree gchar *metrics_address = NULL;
 	g_autoptr(SbuConfig) config = sbu_config_new ();
 
 	/* use the system-wide database */
@@ -506,15 +604,67 @@ sbu_manager_impl_setup (SbuManagerImpl *self, GError **error)
 		g_prefix_error (error, "failed to open database %s: ", location);
 		return FALSE;
 	}
+	self->energy_id = g_timeout_add_seconds (SBU_MANAGER_ENERGY_CHECKPOINT_INTERVAL,
+						 sbu_manager_impl_energy_checkpoint_cb,
+						 self);
 
 	/* set the poll interval */
 	self->poll_interval = sbu_config_get_integer (config, "DevicePollInterval", error);
 	if (self->poll_interval == 0)
 		return FALSE;
 
-	/* enable test device */
-	if (sbu_config_get_boolean (config, "EnableDummyDevice", NULL))
+	/* optionally coalesce property changes over several polls */
+	self->flush_interval = sbu_config_get_integer (config, "PropertiesChangedInterval", NULL);
+
+	/* optionally estimate the state of charge by counting the current */
+	self->battery_capacity = sbu_config_get_integer (config, "BatteryCapacity", NULL);
+
+	/* optionally serve the metrics to a local scraper */
+	metrics_address = sbu_config_get_string (config, "MetricsAddress", NULL);
+	if (metrics_address != NULL && metrics_address[0] != '\0') {
+		if (!sbu_metrics_listen (self->metrics, metrics_address, error))
+			return FALSE;
+	}
+
+	/* virtual keys computed from the real ones */
+	derived_keys = sbu_config_get_string (config, "DerivedKeys", NULL);
+	if (derived_keys != NULL && derived_keys[0] != '\0') {
+		if (!sbu_derived_add_from_string (self->derived, derived_keys, error)) {
+			g_prefix_error (error, "failed to parse DerivedKeys: ");
+			return FALSE;
+		}
+		if (!sbu_derived_compile (self->derived, error)) {
+			g_prefix_error (error, "failed to parse DerivedKeys: ");
+			return FALSE;
+		}
+		g_debug ("using %u derived keys", sbu_derived_get_size (self->derived));
+	}
+
+	/* conditions to alert on */
+	alert_rules = sbu_config_get_string (config, "AlertRules", NULL);
+	if (alert_rules != NULL && alert_rules[0] != '\0') {
+		if (!sbu_rules_add_from_string (self->rules, alert_rules, error)) {
+			g_prefix_error (error, "failed to parse AlertRules: ");
+			return FALSE;
+		}
+		g_debug ("using %u alert rules", sbu_rules_get_size (self->rules));
+	}
+
+	/* enable test device, where the environment overrides the config */
+	if (sbu_config_get_boolean (config, "EnableDummyDevice", NULL)) {
+		const gchar *dummy_keys[] = {
+			"DummyDeviceCount",	"SBU_DUMMY_DEVICES",
+			"DummySampleInterval",	"SBU_DUMMY_INTERVAL",
+			"DummyBackfillDays",	"SBU_DUMMY_BACKFILL_DAYS",
+			NULL,			NULL };
 		g_setenv ("SBU_DUMMY_ENABLE", "", TRUE);
+		for (guint i = 0; dummy_keys[i] != NULL; i += 2) {
+			g_autofree gchar *tmp = NULL;
+			tmp = sbu_config_get_string (config, dummy_keys[i], NULL);
+			if (tmp != NULL && tmp[0] != '\0')
+				g_setenv (dummy_keys[i + 1], tmp, FALSE);
+		}
+	}
 
 	/* success */
 	return TRUE;
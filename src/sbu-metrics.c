@@ -0,0 +1,433 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "sbu-metrics.h"
+
+typedef enum {
+	SBU_METRIC_KIND_COUNTER,
+	SBU_METRIC_KIND_HISTOGRAM,
+	SBU_METRIC_KIND_LAST
+} SbuMetricKind;
+
+/* upper bounds of the histogram buckets, in us */
+static const gint64 sbu_metrics_bounds[] = {
+	100, 250, 500, 1000, 2500, 5000, 10000, 25000,
+	50000, 100000, 250000, 500000, 1000000, 5000000 };
+
+typedef struct {
+	gchar			*name;
+	gchar			*labels;
+	SbuMetricKind		 kind;
+	guint64			 count;		/* or value for counters */
+	guint64			 sum;		/* us */
+	guint64			 max;		/* us */
+	guint64			 buckets[G_N_ELEMENTS (sbu_metrics_bounds)];
+} SbuMetric;
+
+struct _SbuMetrics
+{
+	GObject			 parent_instance;
+	GMutex			 mutex;
+	GHashTable		*hash;		/* name{labels}:SbuMetric */
+	GSocketService		*service;
+	gchar			*socket_path;
+	gboolean		 use_http;
+};
+
+G_DEFINE_TYPE (SbuMetrics, sbu_metrics, G_TYPE_OBJECT)
+
+/* as used by Prometheus */
+static const gchar *
+sbu_metric_kind_to_string (SbuMetricKind kind)
+{
+	if (kind == SBU_METRIC_KIND_COUNTER)
+		return "counter";
+	if (kind == SBU_METRIC_KIND_HISTOGRAM)
+		return "histogram";
+	return NULL;
+}
+
+static void
+sbu_metric_free (SbuMetric *metric)
+{
+	g_free (metric->name);
+	g_free (metric->labels);
+	g_free (metric);
+}
+
+/* must be called with the mutex held */
+static SbuMetric *
+sbu_metrics_ensure (SbuMetrics *self,
+		    const gchar *name,
+		    const gchar *labels,
+		    SbuMetricKind kind)
+{
+	SbuMetric *metric;
+	g_autofree gchar *id = NULL;
+
+	id = labels != NULL ? g_strdup_printf ("%s{%s}", name, labels) : g_strdup (name);
+	metric = g_hash_table_lookup (self->hash, id);
+	if (metric != NULL)
+		return metric;
+	metric = g_new0 (SbuMetric, 1);
+	metric->name = g_strdup (name);
+	metric->labels = g_strdup (labels);
+	metric->kind = kind;
+	g_hash_table_insert (self->hash, g_steal_pointer (&id), metric);
+	return metric;
+}
+
+/**
+ * sbu_metrics_increment:
+ * @self: a #SbuMetrics, or %NULL
+ * @name: a metric name, e.g. "sbud_database_errors_total"
+ * @labels: optional labels, e.g. "cmd=\"QPIGS\""
+ * @value: amount to add
+ *
+ * Adds to a counter. This is safe to call from any thread.
+ **/
+void
+sbu_metrics_increment (SbuMetrics *self,
+		       const gchar *name,
+		       const gchar *labels,
+		       guint64 value)
+{
+	SbuMetric *metric;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	/* instrumentation is optional */
+	if (self == NULL)
+		return;
+
+	locker = g_mutex_locker_new (&self->mutex);
+	metric = sbu_metrics_ensure (self, name, labels, SBU_METRIC_KIND_COUNTER);
+	metric->count += value;
+}
+
+/**
+ * sbu_metrics_observe:
+ * @self: a #SbuMetrics, or %NULL
+ * @name: a metric name, e.g. "sbud_database_insert_seconds"
+ * @labels: optional labels
+ * @duration: elapsed time in us
+ *
+ * Adds a duration to a histogram. This is safe to call from any thread.
+ **/
+void
+sbu_metrics_observe (SbuMetrics *self,
+		     const gchar *name,
+		     const gchar *labels,
+		     gint64 duration)
+{
+	SbuMetric *metric;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	/* instrumentation is optional */
+	if (self == NULL)
+		return;
+	if (duration < 0)
+		duration = 0;
+
+	locker = g_mutex_locker_new (&self->mutex);
+	metric = sbu_metrics_ensure (self, name, labels, SBU_METRIC_KIND_HISTOGRAM);
+	metric->count++;
+	metric->sum += duration;
+	if ((guint64) duration > metric->max)
+		metric->max = duration;
+	for (guint i = 0; i < G_N_ELEMENTS (sbu_metrics_bounds); i++) {
+		if (duration <= sbu_metrics_bounds[i]) {
+			metric->buckets[i]++;
+			break;
+		}
+	}
+}
+
+/**
+ * sbu_metrics_to_variant:
+ * @self: a #SbuMetrics
+ *
+ * Gets all the metrics as a dictionary of "name{labels}" to the tuple
+ * (kind, count, total us, maximum us), where the kind is "counter" or
+ * "histogram". Counters only set the count.
+ *
+ * Return value: a floating #GVariant of type a{s(sttt)}
+ **/
+GVariant *
+sbu_metrics_to_variant (SbuMetrics *self)
+{
+	GHashTableIter iter;
+	GVariantBuilder builder;
+	gpointer key;
+	gpointer value;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->mutex);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(sttt)}"));
+	g_hash_table_iter_init (&iter, self->hash);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		SbuMetric *metric = (SbuMetric *) value;
+		g_variant_builder_add (&builder, "{s(sttt)}",
+				       (const gchar *) key,
+				       sbu_metric_kind_to_string (metric->kind),
+				       metric->count,
+				       metric->sum,
+				       metric->max);
+	}
+	return g_variant_builder_end (&builder);
+}
+
+static gint
+sbu_metrics_sort_cb (gconstpointer a, gconstpointer b)
+{
+	const SbuMetric *metric1 = *((const SbuMetric **) a);
+	const SbuMetric *metric2 = *((const SbuMetric **) b);
+	gint rc = g_strcmp0 (metric1->name, metric2->name);
+	if (rc != 0)
+		return rc;
+	return g_strcmp0 (metric1->labels, metric2->labels);
+}
+
+static void
+sbu_metrics_append_bucket (GString *str, SbuMetric *metric,
+			   const gchar *le, guint64 value)
+{
+	g_string_append_printf (str, "%s_bucket{%s%sle=\"%s\"} %" G_GUINT64_FORMAT "\n",
+				metric->name,
+				metric->labels != NULL ? metric->labels : "",
+				metric->labels != NULL ? "," : "",
+				le, value);
+}
+
+static void
+sbu_metrics_append_value (GString *str, SbuMetric *metric,
+			  const gchar *suffix, const gchar *value)
+{
+	g_string_append_printf (str, "%s%s%s%s%s %s\n",
+				metric->name, suffix,
+				metric->labels != NULL ? "{" : "",
+				metric->labels != NULL ? metric->labels : "",
+				metric->labels != NULL ? "}" : "",
+				value);
+}
+
+/**
+ * sbu_metrics_to_prometheus:
+ * @self: a #SbuMetrics
+ *
+ * Gets all the metrics in the Prometheus text exposition format, with
+ * durations converted to seconds.
+ *
+ * Return value: a string
+ **/
+gchar *
+sbu_metrics_to_prometheus (SbuMetrics *self)
+{
+	GString *str = g_string_new (NULL);
+	const gchar *name_last = NULL;
+	g_autoptr(GList) values = NULL;
+	g_autoptr(GPtrArray) metrics = g_ptr_array_new ();
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&self->mutex);
+
+	/* each name has to be contiguous */
+	values = g_hash_table_get_values (self->hash);
+	for (GList *l = values; l != NULL; l = l->next)
+		g_ptr_array_add (metrics, l->data);
+	g_ptr_array_sort (metrics, sbu_metrics_sort_cb);
+
+	for (guint i = 0; i < metrics->len; i++) {
+		SbuMetric *metric = g_ptr_array_index (metrics, i);
+		gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+		guint64 acc = 0;
+		g_autofree gchar *tmp = NULL;
+
+		if (g_strcmp0 (metric->name, name_last) != 0) {
+			g_string_append_printf (str, "# TYPE %s %s\n", metric->name,
+						sbu_metric_kind_to_string (metric->kind));
+			name_last = metric->name;
+		}
+		if (metric->kind == SBU_METRIC_KIND_COUNTER) {
+			tmp = g_strdup_printf ("%" G_GUINT64_FORMAT, metric->count);
+			sbu_metrics_append_value (str, metric, "", tmp);
+			continue;
+		}
+
+		/* buckets are cumulative */
+		for (guint j = 0; j < G_N_ELEMENTS (sbu_metrics_bounds); j++) {
+			acc += metric->buckets[j];
+			g_ascii_dtostr (buf, sizeof (buf),
+					(gdouble) sbu_metrics_bounds[j] / G_USEC_PER_SEC);
+			sbu_metrics_append_bucket (str, metric, buf, acc);
+		}
+		sbu_metrics_append_bucket (str, metric, "+Inf", metric->count);
+		g_ascii_dtostr (buf, sizeof (buf), (gdouble) metric->sum / G_USEC_PER_SEC);
+		sbu_metrics_append_value (str, metric, "_sum", buf);
+		tmp = g_strdup_printf ("%" G_GUINT64_FORMAT, metric->count);
+		sbu_metrics_append_value (str, metric, "_count", tmp);
+	}
+	return g_string_free (str, FALSE);
+}
+
+/* runs in a thread owned by the GThreadedSocketService */
+static gboolean
+sbu_metrics_run_cb (GThreadedSocketService *service,
+		    GSocketConnection *connection,
+		    GObject *source_object,
+		    SbuMetrics *self)
+{
+	GInputStream *istream;
+	GOutputStream *ostream;
+	g_autofree gchar *body = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GString) str = g_string_new (NULL);
+
+	body = sbu_metrics_to_prometheus (self);
+
+	/* consume the HTTP request, we only serve one document */
+	if (self->use_http) {
+		gchar buf[4096];
+		istream = g_io_stream_get_input_stream (G_IO_STREAM (connection));
+		if (g_input_stream_read (istream, buf, sizeof (buf), NULL, &error) < 0) {
+			g_debug ("failed to read request: %s", error->message);
+			return TRUE;
+		}
+		g_string_append_printf (str,
+					"HTTP/1.0 200 OK\r\n"
+					"Content-Type: text/plain; version=0.0.4\r\n"
+					"Content-Length: %" G_GSIZE_FORMAT "\r\n"
+					"\r\n",
+					strlen (body));
+	}
+	g_string_append (str, body);
+	ostream = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+	if (!g_output_stream_write_all (ostream, str->str, str->len,
+					NULL, NULL, &error))
+		g_debug ("failed to write metrics: %s", error->message);
+	return TRUE;
+}
+
+/**
+ * sbu_metrics_listen:
+ * @self: a #SbuMetrics
+ * @address: "unix:/path/to/socket" or "tcp:PORT"
+ * @error: a #GError, or %NULL
+ *
+ * Serves the Prometheus text on a local socket. TCP ports are only bound
+ * to the loopback address and speak just enough HTTP for a scraper.
+ *
+ * Return value: %TRUE for success
+ **/
+gboolean
+sbu_metrics_listen (SbuMetrics *self, const gchar *address, GError **error)
+{
+	g_autoptr(GSocketAddress) socket_address = NULL;
+
+	g_return_val_if_fail (SBU_IS_METRICS (self), FALSE);
+	g_return_val_if_fail (self->service == NULL, FALSE);
+
+	if (g_str_has_prefix (address, "unix:")) {
+		self->socket_path = g_strdup (address + 5);
+		g_unlink (self->socket_path);
+		socket_address = g_unix_socket_address_new (self->socket_path);
+	} else if (g_str_has_prefix (address, "tcp:")) {
+		g_autoptr(GInetAddress) inet_address = NULL;
+		guint64 port = g_ascii_strtoull (address + 4, NULL, 10);
+		if (port == 0 || port > G_MAXUINT16) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_ARGUMENT,
+				     "invalid metrics port: %s", address + 4);
+			return FALSE;
+		}
+		inet_address = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+		socket_address = g_inet_socket_address_new (inet_address, port);
+		self->use_http = TRUE;
+	} else {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_ARGUMENT,
+			     "invalid metrics address: %s", address);
+		return FALSE;
+	}
+
+	self->service = g_threaded_socket_service_new (2);
+	if (!g_socket_listener_add_address (G_SOCKET_LISTENER (self->service),
+					    socket_address,
+					    G_SOCKET_TYPE_STREAM,
+					    G_SOCKET_PROTOCOL_DEFAULT,
+					    NULL, NULL, error)) {
+		g_prefix_error (error, "failed to listen on %s: ", address);
+		g_clear_object (&self->service);
+		return FALSE;
+	}
+	g_signal_connect (self->service, "run",
+			  G_CALLBACK (sbu_metrics_run_cb), self);
+	g_socket_service_start (self->service);
+	g_debug ("serving metrics on %s", address);
+	return TRUE;
+}
+
+static void
+sbu_metrics_finalize (GObject *object)
+{
+	SbuMetrics *self = SBU_METRICS (object);
+
+	if (self->service != NULL) {
+		g_socket_service_stop (self->service);
+		g_socket_listener_close (G_SOCKET_LISTENER (self->service));
+		g_object_unref (self->service);
+	}
+	if (self->socket_path != NULL) {
+		g_unlink (self->socket_path);
+		g_free (self->socket_path);
+	}
+	g_hash_table_unref (self->hash);
+	g_mutex_clear (&self->mutex);
+
+	G_OBJECT_CLASS (sbu_metrics_parent_class)->finalize (object);
+}
+
+static void
+sbu_metrics_init (SbuMetrics *self)
+{
+	g_mutex_init (&self->mutex);
+	self->hash = g_hash_table_new_full (g_str_hash, g_str_equal,
+					    g_free, (GDestroyNotify) sbu_metric_free);
+}
+
+static void
+sbu_metrics_class_init (SbuMetricsClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = sbu_metrics_finalize;
+}
+
+SbuMetrics *
+sbu_metrics_new (void)
+{
+	SbuMetrics *self;
+	self = g_object_new (SBU_TYPE_METRICS, NULL);
+	return SBU_METRICS (self);
+}
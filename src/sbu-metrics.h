@@ -0,0 +1,50 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __SBU_METRICS_H
+#define __SBU_METRICS_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define SBU_TYPE_METRICS (sbu_metrics_get_type ())
+
+G_DECLARE_FINAL_TYPE (SbuMetrics, sbu_metrics, SBU, METRICS, GObject)
+
+SbuMetrics	*sbu_metrics_new		(void);
+void		 sbu_metrics_increment		(SbuMetrics	*self,
+						 const gchar	*name,
+						 const gchar	*labels,
+						 guint64	 value);
+void		 sbu_metrics_observe		(SbuMetrics	*self,
+						 const gchar	*name,
+						 const gchar	*labels,
+						 gint64		 duration);
+GVariant	*sbu_metrics_to_variant		(SbuMetrics	*self);
+gchar		*sbu_metrics_to_prometheus	(SbuMetrics	*self);
+gboolean	 sbu_metrics_listen		(SbuMetrics	*self,
+						 const gchar	*address,
+						 GError		**error);
+
+G_END_DECLS
+
+#endif /* __SBU_METRICS_H */
@@ -28,11 +28,32 @@
 
 G_BEGIN_DECLS
 
+typedef guint		 (*SbuPluginAbiVersionFunc)	(void);
+typedef void		 (*SbuPluginFunc)		(SbuPlugin	*plugin);
+typedef gboolean	 (*SbuPluginSetupFunc)		(SbuPlugin	*plugin,
+							 GCancellable	*cancellable,
+							 GError		**error);
+
+typedef struct {
+	SbuPluginFunc		 initialize;
+	SbuPluginFunc		 destroy;
+	SbuPluginSetupFunc	 setup;
+	SbuPluginSetupFunc	 refresh;
+} SbuPluginVfuncs;
+
 SbuPlugin	*sbu_plugin_new				(void);
 SbuPlugin	*sbu_plugin_create			(const gchar	*filename,
 							 GError		**error);
-gpointer	 sbu_plugin_get_symbol			(SbuPlugin	*plugin,
-							 const gchar	*function_name);
+void		 sbu_plugin_runner_initialize		(SbuPlugin	*plugin);
+void		 sbu_plugin_runner_destroy		(SbuPlugin	*plugin);
+gboolean	 sbu_plugin_runner_setup		(SbuPlugin	*plugin,
+							 GCancellable	*cancellable,
+							 GError		**error);
+gboolean	 sbu_plugin_runner_refresh		(SbuPlugin	*plugin,
+							 GCancellable	*cancellable,
+							 GError		**error);
+void		 sbu_plugin_set_metrics			(SbuPlugin	*plugin,
+							 SbuMetrics	*metrics);
 
 G_END_DECLS
 
@@ -26,6 +26,7 @@
 
 G_BEGIN_DECLS
 
+guint		 sbu_plugin_get_abi_version		(void);
 void		 sbu_plugin_initialize			(SbuPlugin	*plugin);
 void		 sbu_plugin_destroy			(SbuPlugin	*plugin);
 gboolean	 sbu_plugin_setup			(SbuPlugin	*plugin,
@@ -34,8 +34,9 @@ typedef struct
 	SbuPluginData		*data;			/* for sbu-plugin-{name}.c */
 	guint64			 flags;
 	gboolean		 enabled;
-	GHashTable		*vfuncs;		/* string:pointer */
+	SbuPluginVfuncs		 vfuncs;
 	gchar			*name;
+	SbuMetrics		*metrics;
 } SbuPluginPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (SbuPlugin, sbu_plugin, G_TYPE_OBJECT)
@@ -74,6 +75,8 @@ sbu_plugin_create (const gchar *filename, GError **error)
 {
 	SbuPlugin *plugin = NULL;
 	SbuPluginPrivate *priv;
+	SbuPluginAbiVersionFunc abi_version_func = NULL;
+	guint abi_version;
 	g_autofree gchar *basename = NULL;
 
 	/* get the plugin name from the basename */
@@ -99,8 +102,43 @@ sbu_plugin_create (const gchar *filename, GError **error)
 			     G_IO_ERROR_FAILED,
 			     "failed to open plugin %s: %s",
 			     filename, g_module_error ());
+		g_object_unref (plugin);
 		return NULL;
 	}
+
+	/* refuse to call into a plugin built against a different API */
+	g_module_symbol (priv->module, "sbu_plugin_get_abi_version",
+			 (gpointer *) &abi_version_func);
+	if (abi_version_func == NULL) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "plugin %s has no ABI version",
+			     filename);
+		g_object_unref (plugin);
+		return NULL;
+	}
+	abi_version = abi_version_func ();
+	if (abi_version != SBU_PLUGIN_ABI_VERSION) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "plugin %s has ABI version %u, expected %u",
+			     filename, abi_version,
+			     (guint) SBU_PLUGIN_ABI_VERSION);
+		g_object_unref (plugin);
+		return NULL;
+	}
+
+	/* look up the symbols using the elf headers just once */
+	g_module_symbol (priv->module, "sbu_plugin_initialize",
+			 (gpointer *) &priv->vfuncs.initialize);
+	g_module_symbol (priv->module, "sbu_plugin_destroy",
+			 (gpointer *) &priv->vfuncs.destroy);
+	g_module_symbol (priv->module, "sbu_plugin_setup",
+			 (gpointer *) &priv->vfuncs.setup);
+	g_module_symbol (priv->module, "sbu_plugin_refresh",
+			 (gpointer *) &priv->vfuncs.refresh);
 	return plugin;
 }
 
@@ -111,11 +149,14 @@ sbu_plugin_finalize (GObject *object)
 	SbuPluginPrivate *priv = sbu_plugin_get_instance_private (plugin);
 	g_free (priv->name);
 	g_free (priv->data);
-	g_hash_table_unref (priv->vfuncs);
+	if (priv->metrics != NULL)
+		g_object_unref (priv->metrics);
 #ifndef RUNNING_ON_VALGRIND
 	if (priv->module != NULL)
 		g_module_close (priv->module);
 #endif
+
+	G_OBJECT_CLASS (sbu_plugin_parent_class)->finalize (object);
 }
 
 SbuPluginData *
@@ -135,27 +176,40 @@ sbu_plugin_alloc_data (SbuPlugin *plugin, gsize sz)
 	return priv->data;
 }
 
-gpointer
-sbu_plugin_get_symbol (SbuPlugin *plugin, const gchar *function_name)
+void
+sbu_plugin_runner_initialize (SbuPlugin *plugin)
 {
 	SbuPluginPrivate *priv = sbu_plugin_get_instance_private (plugin);
-	gpointer func = NULL;
-
-	g_return_val_if_fail (function_name != NULL, NULL);
-
-	/* disabled plugins shouldn't be checked */
-	if (!priv->enabled)
-		return NULL;
+	if (!priv->enabled || priv->vfuncs.initialize == NULL)
+		return;
+	priv->vfuncs.initialize (plugin);
+}
 
-	/* look up the symbol from the cache */
-	if (g_hash_table_lookup_extended (priv->vfuncs, function_name, NULL, &func))
-		return func;
+void
+sbu_plugin_runner_destroy (SbuPlugin *plugin)
+{
+	SbuPluginPrivate *priv = sbu_plugin_get_instance_private (plugin);
+	if (!priv->enabled || priv->vfuncs.destroy == NULL)
+		return;
+	priv->vfuncs.destroy (plugin);
+}
 
-	/* look up the symbol using the elf headers */
-	g_module_symbol (priv->module, function_name, &func);
-	g_hash_table_insert (priv->vfuncs, g_strdup (function_name), func);
+gboolean
+sbu_plugin_runner_setup (SbuPlugin *plugin, GCancellable *cancellable, GError **error)
+{
+	SbuPluginPrivate *priv = sbu_plugin_get_instance_private (plugin);
+	if (!priv->enabled || priv->vfuncs.setup == NULL)
+		return TRUE;
+	return priv->vfuncs.setup (plugin, cancellable, error);
+}
 
-	return func;
+gboolean
+sbu_plugin_runner_refresh (SbuPlugin *plugin, GCancellable *cancellable, GError **error)
+{
+	SbuPluginPrivate *priv = sbu_plugin_get_instance_private (plugin);
+	if (!priv->enabled || priv->vfuncs.refresh == NULL)
+		return TRUE;
+	return priv->vfuncs.refresh (plugin, cancellable, error);
 }
 
 const gchar *
@@ -165,6 +219,20 @@ sbu_plugin_get_name (SbuPlugin *plugin)
 	return priv->name;
 }
 
+SbuMetrics *
+sbu_plugin_get_metrics (SbuPlugin *plugin)
+{
+	SbuPluginPrivate *priv = sbu_plugin_get_instance_private (plugin);
+	return priv->metrics;
+}
+
+void
+sbu_plugin_set_metrics (SbuPlugin *plugin, SbuMetrics *metrics)
+{
+	SbuPluginPrivate *priv = sbu_plugin_get_instance_private (plugin);
+	g_set_object (&priv->metrics, metrics);
+}
+
 void
 sbu_plugin_update_metadata (SbuPlugin *plugin,
 			    SbuDeviceImpl *device,
@@ -257,8 +325,6 @@ sbu_plugin_init (SbuPlugin *plugin)
 {
 	SbuPluginPrivate *priv = sbu_plugin_get_instance_private (plugin);
 	priv->enabled = TRUE;
-	priv->vfuncs = g_hash_table_new_full (g_str_hash, g_str_equal,
-					      g_free, NULL);
 }
 
 SbuPlugin *
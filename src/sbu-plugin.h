@@ -28,11 +28,15 @@
 
 #include "sbu-common.h"
 #include "sbu-device-impl.h"
+#include "sbu-metrics.h"
 
 G_BEGIN_DECLS
 
 #define SBU_TYPE_PLUGIN (sbu_plugin_get_type ())
 
+/* bump this when the vfuncs or the plugin API changes incompatibly */
+#define SBU_PLUGIN_ABI_VERSION		1
+
 G_DECLARE_DERIVABLE_TYPE (SbuPlugin, sbu_plugin, SBU, PLUGIN, GObject)
 
 struct _SbuPluginClass
@@ -57,6 +61,7 @@ const gchar	*sbu_plugin_get_name			(SbuPlugin	*plugin);
 gboolean	 sbu_plugin_get_enabled			(SbuPlugin	*plugin);
 void		 sbu_plugin_set_enabled			(SbuPlugin	*plugin,
 							 gboolean	 enabled);
+SbuMetrics	*sbu_plugin_get_metrics			(SbuPlugin	*plugin);
 
 void		 sbu_plugin_update_metadata		(SbuPlugin	*plugin,
 							 SbuDeviceImpl	*device,
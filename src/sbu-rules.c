@@ -0,0 +1,614 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#include "sbu-common.h"
+#include "sbu-rules.h"
+
+typedef enum {
+	SBU_RULES_COMPARE_LT,
+	SBU_RULES_COMPARE_LE,
+	SBU_RULES_COMPARE_GT,
+	SBU_RULES_COMPARE_GE,
+	SBU_RULES_COMPARE_EQ,
+	SBU_RULES_COMPARE_NE,
+	SBU_RULES_COMPARE_LAST
+} SbuRulesCompare;
+
+typedef struct {
+	gchar			*name;
+	gchar			*key;		/* e.g. node_battery:voltage */
+	gboolean		 rate;		/* change per minute */
+	SbuRulesCompare		 compare;
+	gdouble			 threshold;
+	gint64			 duration;	/* us */
+} SbuRulesRule;
+
+/* everything a rule needs to remember for one device */
+typedef struct {
+	gint64			 ts_since;	/* us, when first matched */
+	gint64			 ts_last;	/* us, of the last sample */
+	gint64			 ts_prev;	/* us, of the sample before */
+	gdouble			 value_last;	/* the last sample */
+	gdouble			 value_prev;	/* the sample before */
+	gdouble			 value;		/* the last compared value */
+	gboolean		 has_last;
+	gboolean		 has_prev;
+	gboolean		 matched;
+	gboolean		 active;	/* fired and not yet cleared */
+} SbuRulesRuleState;
+
+typedef struct {
+	gchar			*prefix;	/* e.g. /0/ */
+	gsize			 prefix_len;
+	SbuRulesRuleState	*rules;		/* by rule index */
+	GArray			*pending;	/* of guint rule index, matched and
+						 * waiting for the duration */
+} SbuRulesState;
+
+struct _SbuRules
+{
+	GObject			 parent_instance;
+	GPtrArray		*rules;		/* of SbuRulesRule */
+	GHashTable		*hash_rules;	/* key:GArray of rule index */
+	GPtrArray		*states;	/* of SbuRulesState, by device */
+	GArray			*rate_rules;	/* of guint rule index */
+	guint64			 cnt_evaluations;
+};
+
+enum {
+	SIGNAL_FIRED,
+	SIGNAL_CLEARED,
+	SIGNAL_LAST
+};
+
+static guint signals [SIGNAL_LAST] = { 0 };
+
+G_DEFINE_TYPE (SbuRules, sbu_rules, G_TYPE_OBJECT)
+
+static void
+sbu_rules_rule_free (SbuRulesRule *rule)
+{
+	g_free (rule->name);
+	g_free (rule->key);
+	g_free (rule);
+}
+
+static void
+sbu_rules_state_free (SbuRulesState *state)
+{
+	g_free (state->prefix);
+	g_free (state->rules);
+	g_array_unref (state->pending);
+	g_free (state);
+}
+
+static void
+sbu_rules_skip_space (const gchar **pos)
+{
+	while (g_ascii_isspace (**pos))
+		(*pos)++;
+}
+
+static gboolean
+sbu_rules_parse_compare (const gchar **pos, SbuRulesCompare *compare)
+{
+	const struct {
+		const gchar		*str;
+		SbuRulesCompare		 compare;
+	} map[] = {
+		{ "<=",	SBU_RULES_COMPARE_LE },
+		{ ">=",	SBU_RULES_COMPARE_GE },
+		{ "==",	SBU_RULES_COMPARE_EQ },
+		{ "!=",	SBU_RULES_COMPARE_NE },
+		{ "<",	SBU_RULES_COMPARE_LT },
+		{ ">",	SBU_RULES_COMPARE_GT },
+		{ NULL,	SBU_RULES_COMPARE_LAST }
+	};
+	for (guint i = 0; map[i].str != NULL; i++) {
+		if (g_str_has_prefix (*pos, map[i].str)) {
+			*compare = map[i].compare;
+			*pos += strlen (map[i].str);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/* e.g. "300", "300s", "5m" or "1h" */
+static gboolean
+sbu_rules_parse_duration (const gchar **pos, gint64 *duration)
+{
+	gchar *endptr = NULL;
+	guint64 tmp = g_ascii_strtoull (*pos, &endptr, 10);
+
+	if (endptr == *pos || tmp > G_MAXUINT32)
+		return FALSE;
+	if (*endptr == 'h') {
+		tmp *= 3600;
+		endptr++;
+	} else if (*endptr == 'm') {
+		tmp *= 60;
+		endptr++;
+	} else if (*endptr == 's') {
+		endptr++;
+	}
+	*duration = (gint64) tmp * G_USEC_PER_SEC;
+	*pos = endptr;
+	return TRUE;
+}
+
+static gboolean
+sbu_rules_parse_condition (SbuRulesRule *rule, const gchar *condition, GError **error)
+{
+	const gchar *pos = condition;
+	const gchar *start;
+	gchar *endptr = NULL;
+	g_autofree gchar *key = NULL;
+
+	/* [rate(]key[)] */
+	sbu_rules_skip_space (&pos);
+	if (g_str_has_prefix (pos, "rate(")) {
+		rule->rate = TRUE;
+		pos += 5;
+		sbu_rules_skip_space (&pos);
+	}
+	start = pos;
+	while (*pos != '\0' && !g_ascii_isspace (*pos) && strchr ("<>=!()", *pos) == NULL)
+		pos++;
+	key = g_strndup (start, (gsize) (pos - start));
+	rule->key = sbu_key_normalize (key, error);
+	if (rule->key == NULL)
+		return FALSE;
+	sbu_rules_skip_space (&pos);
+	if (rule->rate) {
+		if (*pos != ')')
+			goto fail;
+		pos++;
+		sbu_rules_skip_space (&pos);
+	}
+
+	/* operator and threshold */
+	if (!sbu_rules_parse_compare (&pos, &rule->compare))
+		goto fail;
+	sbu_rules_skip_space (&pos);
+	rule->threshold = g_ascii_strtod (pos, &endptr);
+	if (endptr == pos)
+		goto fail;
+	pos = endptr;
+
+	/* optional duration */
+	sbu_rules_skip_space (&pos);
+	if (g_str_has_prefix (pos, "for") && g_ascii_isspace (pos[3])) {
+		pos += 3;
+		sbu_rules_skip_space (&pos);
+		if (!sbu_rules_parse_duration (&pos, &rule->duration))
+			goto fail;
+		sbu_rules_skip_space (&pos);
+	}
+	if (*pos != '\0')
+		goto fail;
+	return TRUE;
+fail:
+	g_set_error (error,
+		     G_IO_ERROR,
+		     G_IO_ERROR_INVALID_DATA,
+		     "unexpected '%s' at position %u of '%s'",
+		     pos, (guint) (pos - condition), condition);
+	return FALSE;
+}
+
+/**
+ * sbu_rules_add:
+ * @self: a #SbuRules
+ * @name: a unique rule name, e.g. "battery_low"
+ * @condition: e.g. "battery:voltage < 46 for 5m"
+ * @error: a #GError, or %NULL
+ *
+ * Adds a rule that fires when the condition has been true for the duration,
+ * and clears when it is next false. The value can be a key or rate(key) for
+ * the change per minute since the sample before the last one, which falls
+ * towards zero while the value stays the same. They are compared using
+ * < <= > >= == or !=.
+ * The duration is optional and defaults to seconds, or can use s, m or h.
+ *
+ * Return value: %TRUE if the condition was valid
+ **/
+gboolean
+sbu_rules_add (SbuRules *self, const gchar *name, const gchar *condition, GError **error)
+{
+	GArray *indexes;
+	guint idx;
+	SbuRulesRule *rule;
+
+	g_return_val_if_fail (SBU_IS_RULES (self), FALSE);
+
+	/* states are sized for the rules that exist when first used */
+	if (self->states->len > 0) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_NOT_SUPPORTED,
+			     "cannot add %s after values have been set", name);
+		return FALSE;
+	}
+	if (name[0] == '\0') {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_DATA,
+				     "rule name cannot be empty");
+		return FALSE;
+	}
+	for (guint i = 0; i < self->rules->len; i++) {
+		SbuRulesRule *tmp = g_ptr_array_index (self->rules, i);
+		if (g_strcmp0 (tmp->name, name) == 0) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_EXISTS,
+				     "%s is already defined", name);
+			return FALSE;
+		}
+	}
+
+	rule = g_new0 (SbuRulesRule, 1);
+	rule->name = g_strdup (name);
+	if (!sbu_rules_parse_condition (rule, condition, error)) {
+		g_prefix_error (error, "failed to parse %s: ", name);
+		sbu_rules_rule_free (rule);
+		return FALSE;
+	}
+	idx = self->rules->len;
+	g_ptr_array_add (self->rules, rule);
+	if (rule->rate)
+		g_array_append_val (self->rate_rules, idx);
+
+	/* only the rules using a key are looked at when it changes */
+	indexes = g_hash_table_lookup (self->hash_rules, rule->key);
+	if (indexes == NULL) {
+		indexes = g_array_new (FALSE, FALSE, sizeof (guint));
+		g_hash_table_insert (self->hash_rules, g_strdup (rule->key), indexes);
+	}
+	g_array_append_val (indexes, idx);
+	return TRUE;
+}
+
+/**
+ * sbu_rules_add_from_string:
+ * @self: a #SbuRules
+ * @definitions: e.g. "battery_low=battery:voltage<46 for 5m"
+ * @error: a #GError, or %NULL
+ *
+ * Adds rules separated by ';' or newlines, as used in the config file.
+ *
+ * Return value: %TRUE if all the definitions were valid
+ **/
+gboolean
+sbu_rules_add_from_string (SbuRules *self, const gchar *definitions, GError **error)
+{
+	g_auto(GStrv) split = NULL;
+
+	g_return_val_if_fail (SBU_IS_RULES (self), FALSE);
+
+	split = g_strsplit_set (definitions, ";\n", -1);
+	for (guint i = 0; split[i] != NULL; i++) {
+		gchar *tmp;
+		g_strstrip (split[i]);
+		if (split[i][0] == '\0')
+			continue;
+		tmp = strchr (split[i], '=');
+		if (tmp == NULL || tmp[1] == '=') {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_DATA,
+				     "expected name=condition, got '%s'",
+				     split[i]);
+			return FALSE;
+		}
+		*tmp = '\0';
+		if (!sbu_rules_add (self, g_strstrip (split[i]), tmp + 1, error))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+sbu_rules_compare (SbuRulesCompare compare, gdouble value, gdouble threshold)
+{
+	switch (compare) {
+	case SBU_RULES_COMPARE_LT:
+		return value < threshold;
+	case SBU_RULES_COMPARE_LE:
+		return value <= threshold;
+	case SBU_RULES_COMPARE_GT:
+		return value > threshold;
+	case SBU_RULES_COMPARE_GE:
+		return value >= threshold;
+	case SBU_RULES_COMPARE_EQ:
+		return value == threshold;
+	case SBU_RULES_COMPARE_NE:
+		return value != threshold;
+	default:
+		break;
+	}
+	return FALSE;
+}
+
+/* change per minute */
+static gdouble
+sbu_rules_rate (gint64 ts_from, gdouble value_from, gint64 ts_to, gdouble value_to)
+{
+	return (value_to - value_from) * 60.f * G_USEC_PER_SEC / (gdouble) (ts_to - ts_from);
+}
+
+static void
+sbu_rules_emit (SbuRules *self, SbuRulesState *state, guint idx, guint signal_id)
+{
+	SbuRulesRule *rule = g_ptr_array_index (self->rules, idx);
+	g_autofree gchar *key = g_strdup_printf ("%s%s", state->prefix, rule->key);
+	g_signal_emit (self, signals[signal_id], 0, rule->name, key, state->rules[idx].value);
+}
+
+static void
+sbu_rules_remove_pending (SbuRulesState *state, guint idx)
+{
+	for (guint i = 0; i < state->pending->len; i++) {
+		if (g_array_index (state->pending, guint, i) == idx) {
+			g_array_remove_index_fast (state->pending, i);
+			return;
+		}
+	}
+}
+
+static void
+sbu_rules_fire (SbuRules *self, SbuRulesState *state, guint idx)
+{
+	SbuRulesRule *rule = g_ptr_array_index (self->rules, idx);
+	SbuRulesRuleState *rs = &state->rules[idx];
+
+	rs->active = TRUE;
+	if (rule->duration > 0)
+		sbu_rules_remove_pending (state, idx);
+	sbu_rules_emit (self, state, idx, SIGNAL_FIRED);
+}
+
+static void
+sbu_rules_update (SbuRules *self, SbuRulesState *state, guint idx,
+		  gint64 ts, gdouble value)
+{
+	SbuRulesRule *rule = g_ptr_array_index (self->rules, idx);
+	SbuRulesRuleState *rs = &state->rules[idx];
+
+	self->cnt_evaluations++;
+	rs->value = value;
+
+	/* not matched, so start again */
+	if (!sbu_rules_compare (rule->compare, value, rule->threshold)) {
+		if (rs->active) {
+			rs->active = FALSE;
+			sbu_rules_emit (self, state, idx, SIGNAL_CLEARED);
+		} else if (rs->matched && rule->duration > 0) {
+			sbu_rules_remove_pending (state, idx);
+		}
+		rs->matched = FALSE;
+		return;
+	}
+
+	/* matched, and for long enough */
+	if (!rs->matched) {
+		rs->matched = TRUE;
+		rs->ts_since = ts;
+		if (rule->duration > 0)
+			g_array_append_val (state->pending, idx);
+	}
+	if (!rs->active && ts - rs->ts_since >= rule->duration)
+		sbu_rules_fire (self, state, idx);
+}
+
+static SbuRulesState *
+sbu_rules_ensure_state (SbuRules *self, const gchar *key, gsize prefix_len)
+{
+	SbuRulesState *state;
+
+	for (guint i = 0; i < self->states->len; i++) {
+		state = g_ptr_array_index (self->states, i);
+		if (state->prefix_len == prefix_len &&
+		    strncmp (state->prefix, key, prefix_len) == 0)
+			return state;
+	}
+	state = g_new0 (SbuRulesState, 1);
+	state->prefix = g_strndup (key, prefix_len);
+	state->prefix_len = prefix_len;
+	state->rules = g_new0 (SbuRulesRuleState, self->rules->len);
+	state->pending = g_array_new (FALSE, FALSE, sizeof (guint));
+	g_ptr_array_add (self->states, state);
+	return state;
+}
+
+/**
+ * sbu_rules_set_value:
+ * @self: a #SbuRules
+ * @key: a history key, e.g. "/0/node_battery:voltage"
+ * @ts: a monotonic time in us
+ * @value: the new value
+ *
+ * Evaluates only the rules that use @key, emitting ::fired or ::cleared
+ * if the state changes. Each device, i.e. the part of @key before the last
+ * '/', has its own state for every rule.
+ **/
+void
+sbu_rules_set_value (SbuRules *self, const gchar *key, gint64 ts, gdouble value)
+{
+	GArray *indexes;
+	SbuRulesState *state;
+	const gchar *name;
+	gsize prefix_len = 0;
+
+	g_return_if_fail (SBU_IS_RULES (self));
+
+	name = strrchr (key, '/');
+	if (name != NULL) {
+		name++;
+		prefix_len = (gsize) (name - key);
+	} else {
+		name = key;
+	}
+
+	/* not used by anything */
+	indexes = g_hash_table_lookup (self->hash_rules, name);
+	if (indexes == NULL)
+		return;
+	state = sbu_rules_ensure_state (self, key, prefix_len);
+	for (guint i = 0; i < indexes->len; i++) {
+		guint idx = g_array_index (indexes, guint, i);
+		SbuRulesRule *rule = g_ptr_array_index (self->rules, idx);
+		SbuRulesRuleState *rs = &state->rules[idx];
+		gdouble tmp = value;
+
+		/* needs two samples at different times */
+		if (rule->rate) {
+			gboolean is_later = rs->has_last && ts > rs->ts_last;
+			if (is_later) {
+				rs->has_prev = TRUE;
+				rs->ts_prev = rs->ts_last;
+				rs->value_prev = rs->value_last;
+			}
+			rs->has_last = TRUE;
+			rs->ts_last = ts;
+			rs->value_last = value;
+			if (!is_later)
+				continue;
+			tmp = sbu_rules_rate (rs->ts_prev, rs->value_prev, ts, value);
+		}
+		sbu_rules_update (self, state, idx, ts, tmp);
+	}
+}
+
+/**
+ * sbu_rules_check:
+ * @self: a #SbuRules
+ * @ts: a monotonic time in us
+ *
+ * Fires any rules that have now been matched for long enough without the
+ * value changing. Values are only set when they change, so rate() rules are
+ * also evaluated again as if the last value was seen at @ts. Only the rate()
+ * rules and the rules waiting to fire are looked at.
+ **/
+void
+sbu_rules_check (SbuRules *self, gint64 ts)
+{
+	g_return_if_fail (SBU_IS_RULES (self));
+
+	for (guint i = 0; i < self->states->len; i++) {
+		SbuRulesState *state = g_ptr_array_index (self->states, i);
+
+		for (guint j = 0; j < self->rate_rules->len; j++) {
+			guint idx = g_array_index (self->rate_rules, guint, j);
+			SbuRulesRuleState *rs = &state->rules[idx];
+			if (!rs->has_prev || ts <= rs->ts_last)
+				continue;
+			sbu_rules_update (self, state, idx, ts,
+					  sbu_rules_rate (rs->ts_prev,
+							  rs->value_prev,
+							  ts,
+							  rs->value_last));
+		}
+
+		/* firing removes the rule, which moves the last one to here */
+		for (guint j = state->pending->len; j > 0; j--) {
+			guint idx = g_array_index (state->pending, guint, j - 1);
+			SbuRulesRule *rule = g_ptr_array_index (self->rules, idx);
+			SbuRulesRuleState *rs = &state->rules[idx];
+			if (ts - rs->ts_since >= rule->duration)
+				sbu_rules_fire (self, state, idx);
+		}
+	}
+}
+
+guint
+sbu_rules_get_size (SbuRules *self)
+{
+	g_return_val_if_fail (SBU_IS_RULES (self), 0);
+	return self->rules->len;
+}
+
+guint64
+sbu_rules_get_evaluation_count (SbuRules *self)
+{
+	g_return_val_if_fail (SBU_IS_RULES (self), 0);
+	return self->cnt_evaluations;
+}
+
+static void
+sbu_rules_finalize (GObject *object)
+{
+	SbuRules *self = SBU_RULES (object);
+
+	g_ptr_array_unref (self->rules);
+	g_ptr_array_unref (self->states);
+	g_array_unref (self->rate_rules);
+	g_hash_table_unref (self->hash_rules);
+
+	G_OBJECT_CLASS (sbu_rules_parent_class)->finalize (object);
+}
+
+static void
+sbu_rules_init (SbuRules *self)
+{
+	self->rules = g_ptr_array_new_with_free_func ((GDestroyNotify) sbu_rules_rule_free);
+	self->states = g_ptr_array_new_with_free_func ((GDestroyNotify) sbu_rules_state_free);
+	self->rate_rules = g_array_new (FALSE, FALSE, sizeof (guint));
+	self->hash_rules = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  g_free, (GDestroyNotify) g_array_unref);
+}
+
+static void
+sbu_rules_class_init (SbuRulesClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = sbu_rules_finalize;
+
+	signals [SIGNAL_FIRED] =
+		g_signal_new ("fired",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, g_cclosure_marshal_generic,
+			      G_TYPE_NONE, 3, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_DOUBLE);
+	signals [SIGNAL_CLEARED] =
+		g_signal_new ("cleared",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, g_cclosure_marshal_generic,
+			      G_TYPE_NONE, 3, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_DOUBLE);
+}
+
+/**
+ * sbu_rules_new:
+ *
+ * Return value: a new SbuRules object.
+ **/
+SbuRules *
+sbu_rules_new (void)
+{
+	SbuRules *self;
+	self = g_object_new (SBU_TYPE_RULES, NULL);
+	return SBU_RULES (self);
+}
@@ -0,0 +1,52 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __SBU_RULES_H
+#define __SBU_RULES_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define SBU_TYPE_RULES (sbu_rules_get_type ())
+
+G_DECLARE_FINAL_TYPE (SbuRules, sbu_rules, SBU, RULES, GObject)
+
+SbuRules	*sbu_rules_new			(void);
+gboolean	 sbu_rules_add			(SbuRules	*self,
+						 const gchar	*name,
+						 const gchar	*condition,
+						 GError		**error);
+gboolean	 sbu_rules_add_from_string	(SbuRules	*self,
+						 const gchar	*definitions,
+						 GError		**error);
+guint		 sbu_rules_get_size		(SbuRules	*self);
+void		 sbu_rules_set_value		(SbuRules	*self,
+						 const gchar	*key,
+						 gint64		 ts,
+						 gdouble	 value);
+void		 sbu_rules_check		(SbuRules	*self,
+						 gint64		 ts);
+guint64		 sbu_rules_get_evaluation_count	(SbuRules	*self);
+
+G_END_DECLS
+
+#endif /* __SBU_RULES_H */
@@ -0,0 +1,425 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <math.h>
+#include <sqlite3.h>
+
+#include "egg-graph-widget.h"
+#include "sbu-benchmark.h"
+#include "sbu-database.h"
+#include "sbu-xml-modifier.h"
+
+/* keys are interleaved in the fixture like the daemon writes them */
+static const gchar *sbu_benchmark_keys[] = {
+	"node:battery:voltage",
+	"node:solar:power",
+	"node:load:power",
+	"node:utility:voltage",
+	NULL };
+
+#define SBU_BENCHMARK_SEED		0x5b0
+#define SBU_BENCHMARK_INSERTS		20000
+#define SBU_BENCHMARK_QUERIES		10
+#define SBU_BENCHMARK_REDUCE_LIMIT	256
+#define SBU_BENCHMARK_XML_LOOPS		1000
+#define SBU_BENCHMARK_DRAW_LOOPS	50
+
+static gboolean
+sbu_benchmark_fixture_create (const gchar *filename, guint rows, gint64 ts_start,
+			      GError **error)
+{
+	sqlite3 *db = NULL;
+	sqlite3_stmt *stmt = NULL;
+	gboolean ret = FALSE;
+	gint rc;
+	g_autoptr(GRand) rand = g_rand_new_with_seed (SBU_BENCHMARK_SEED);
+	g_autoptr(SbuDatabase) database = sbu_database_new ();
+
+	/* let the database create the schema */
+	sbu_database_set_location (database, filename);
+	if (!sbu_database_open (database, error))
+		return FALSE;
+
+	/* use a private handle as the rows are not going via the cache */
+	rc = sqlite3_open (filename, &db);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "failed to open fixture: %s",
+			     sqlite3_errmsg (db));
+		goto out;
+	}
+	rc = sqlite3_exec (db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
+	if (rc == SQLITE_OK) {
+		rc = sqlite3_prepare_v2 (db,
+					 "INSERT INTO log (ts, key, val) "
+					 "VALUES (?1, ?2, ?3);",
+					 -1, &stmt, NULL);
+	}
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "failed to prepare fixture: %s",
+			     sqlite3_errmsg (db));
+		goto out;
+	}
+	for (guint i = 0; i < rows; i++) {
+		guint key_idx = i % (G_N_ELEMENTS (sbu_benchmark_keys) - 1);
+		sqlite3_bind_int64 (stmt, 1, ts_start + i / 2);
+		sqlite3_bind_text (stmt, 2, sbu_benchmark_keys[key_idx], -1, SQLITE_STATIC);
+		sqlite3_bind_int (stmt, 3, g_rand_int_range (rand, 0, 5000000));
+		if (sqlite3_step (stmt) != SQLITE_DONE) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_FAILED,
+				     "failed to insert fixture row: %s",
+				     sqlite3_errmsg (db));
+			goto out;
+		}
+		sqlite3_reset (stmt);
+	}
+	rc = sqlite3_exec (db, "COMMIT;", NULL, NULL, NULL);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "failed to commit fixture: %s",
+			     sqlite3_errmsg (db));
+		goto out;
+	}
+
+	/* success */
+	ret = TRUE;
+out:
+	if (stmt != NULL)
+		sqlite3_finalize (stmt);
+	if (db != NULL)
+		sqlite3_close (db);
+	return ret;
+}
+
+static gboolean
+sbu_benchmark_fixture_get_rows (const gchar *filename, guint *rows, GError **error)
+{
+	sqlite3 *db = NULL;
+	sqlite3_stmt *stmt = NULL;
+	gboolean ret = FALSE;
+	gint rc;
+
+	rc = sqlite3_open_v2 (filename, &db, SQLITE_OPEN_READONLY, NULL);
+	if (rc == SQLITE_OK)
+		rc = sqlite3_prepare_v2 (db, "SELECT COUNT(*) FROM log;", -1, &stmt, NULL);
+	if (rc != SQLITE_OK) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "failed to query fixture: %s",
+			     sqlite3_errmsg (db));
+		goto out;
+	}
+	if (sqlite3_step (stmt) != SQLITE_ROW) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_FAILED,
+			     "failed to count fixture rows: %s",
+			     sqlite3_errmsg (db));
+		goto out;
+	}
+	*rows = (guint) sqlite3_column_int64 (stmt, 0);
+
+	/* success */
+	ret = TRUE;
+out:
+	if (stmt != NULL)
+		sqlite3_finalize (stmt);
+	if (db != NULL)
+		sqlite3_close (db);
+	return ret;
+}
+
+/* reuse the fixture only if a previous run finished writing all of it */
+static gboolean
+sbu_benchmark_fixture_is_valid (const gchar *filename, guint rows)
+{
+	guint rows_actual = 0;
+	g_autoptr(GError) error_local = NULL;
+
+	if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+		return FALSE;
+	if (!sbu_benchmark_fixture_get_rows (filename, &rows_actual, &error_local)) {
+		g_debug ("ignoring fixture %s: %s", filename, error_local->message);
+		return FALSE;
+	}
+	if (rows_actual != rows) {
+		g_debug ("ignoring fixture %s: %u rows, expected %u",
+			 filename, rows_actual, rows);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+sbu_benchmark_database_insert (SbuBenchmark *bench, GError **error)
+{
+	g_autofree gchar *filename = NULL;
+	g_autoptr(SbuDatabase) database = sbu_database_new ();
+
+	filename = g_build_filename (g_get_tmp_dir (), "sbu-benchmark-insert.db", NULL);
+	g_unlink (filename);
+	sbu_database_set_location (database, filename);
+	if (!sbu_database_open (database, error))
+		return FALSE;
+
+	/* alternate by more than the delta so that every value is saved */
+	sbu_benchmark_start (bench);
+	for (guint i = 0; i < SBU_BENCHMARK_INSERTS; i++) {
+		if (!sbu_database_save_value (database, "node:battery:voltage",
+					      i % 2 == 0 ? 24000 : 26000, error))
+			return FALSE;
+	}
+	sbu_benchmark_stop (bench, "database-insert", SBU_BENCHMARK_INSERTS);
+	g_unlink (filename);
+	return TRUE;
+}
+
+static gboolean
+sbu_benchmark_database_query (SbuBenchmark *bench, guint rows, GError **error)
+{
+	gint64 ts_start = 1500000000;
+	gint64 ts_end = ts_start + rows / 2;
+	guint64 items = 0;
+	g_autofree gchar *basename = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *filename_tmp = NULL;
+	g_autoptr(GPtrArray) results = NULL;
+	g_autoptr(SbuDatabase) database = sbu_database_new ();
+
+	/* the fixture is deterministic, so only generate it once; it is
+	 * written to a temporary name so an interrupted run is not reused */
+	basename = g_strdup_printf ("sbu-benchmark-%x-v%u-%u.db",
+				    (guint) SBU_BENCHMARK_SEED,
+				    (guint) SBU_DATABASE_SCHEMA_VERSION,
+				    rows);
+	filename = g_build_filename (g_get_tmp_dir (), basename, NULL);
+	if (sbu_benchmark_fixture_is_valid (filename, rows)) {
+		sbu_benchmark_skip (bench, "database-fixture", "cached");
+	} else {
+		filename_tmp = g_strdup_printf ("%s.tmp", filename);
+		g_unlink (filename_tmp);
+		sbu_benchmark_start (bench);
+		if (!sbu_benchmark_fixture_create (filename_tmp, rows, ts_start, error)) {
+			g_unlink (filename_tmp);
+			return FALSE;
+		}
+		sbu_benchmark_stop (bench, "database-fixture", rows);
+		if (g_rename (filename_tmp, filename) != 0) {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_FAILED,
+				     "failed to rename %s: %s",
+				     filename_tmp, g_strerror (errno));
+			g_unlink (filename_tmp);
+			return FALSE;
+		}
+	}
+	sbu_database_set_location (database, filename);
+	if (!sbu_database_open (database, error))
+		return FALSE;
+
+	/* the full range of one key, as GetHistory would do */
+	sbu_benchmark_start (bench);
+	for (guint i = 0; i < SBU_BENCHMARK_QUERIES; i++) {
+		g_autoptr(GPtrArray) tmp = NULL;
+		tmp = sbu_database_query (database, sbu_benchmark_keys[0],
+					  SBU_DEVICE_ID_DEFAULT,
+					  ts_start, ts_end, error);
+		if (tmp == NULL)
+			return FALSE;
+		items += tmp->len;
+		if (results == NULL)
+			results = g_ptr_array_ref (tmp);
+	}
+	sbu_benchmark_stop (bench, "database-query-rows", items);
+
+	/* bin down to what the graph can show */
+	sbu_benchmark_start (bench);
+	for (guint i = 0; i < SBU_BENCHMARK_QUERIES; i++) {
+		g_autoptr(GPtrArray) tmp = NULL;
+		tmp = sbu_database_reduce_items (results, ts_start, ts_end,
+						 SBU_BENCHMARK_REDUCE_LIMIT);
+		g_assert (tmp != NULL);
+	}
+	sbu_benchmark_stop (bench, "database-reduce-rows",
+			    (guint64) results->len * SBU_BENCHMARK_QUERIES);
+	return TRUE;
+}
+
+static gboolean
+sbu_benchmark_xml_modifier (SbuBenchmark *bench, GError **error)
+{
+	g_autoptr(GString) xml_in = g_string_new ("<svg>");
+	g_autoptr(SbuXmlModifier) xml_mod = sbu_xml_modifier_new ();
+
+	/* something about the size of the overview */
+	for (guint i = 0; i < 500; i++) {
+		g_string_append_printf (xml_in,
+					"<g id=\"g%u\" style=\"fill:none\">"
+					"<path id=\"path%u\" d=\"m 0,0 %u,%u\"/>"
+					"<text x=\"%u\" y=\"0\"><tspan id=\"tspan%u\">%u</tspan></text>"
+					"</g>", i, i, i, i, i, i, i);
+	}
+	g_string_append (xml_in, "</svg>");
+
+	/* parse every time */
+	sbu_benchmark_start (bench);
+	for (guint i = 0; i < SBU_BENCHMARK_XML_LOOPS; i++) {
+		g_autoptr(GString) str = NULL;
+		sbu_xml_modifier_replace_cdata (xml_mod, "tspan42", "123W");
+		sbu_xml_modifier_replace_attr (xml_mod, "path42", "style", "");
+		str = sbu_xml_modifier_process (xml_mod, xml_in->str,
+						(gssize) xml_in->len, error);
+		if (str == NULL)
+			return FALSE;
+	}
+	sbu_benchmark_stop (bench, "xml-modifier-process", SBU_BENCHMARK_XML_LOOPS);
+
+	/* compile once, splice every time */
+	sbu_benchmark_start (bench);
+	if (!sbu_xml_modifier_compile (xml_mod, xml_in->str, (gssize) xml_in->len, error))
+		return FALSE;
+	for (guint i = 0; i < SBU_BENCHMARK_XML_LOOPS; i++) {
+		g_autoptr(GString) str = NULL;
+		sbu_xml_modifier_replace_cdata (xml_mod, "tspan42", "123W");
+		sbu_xml_modifier_replace_attr (xml_mod, "path42", "style", "");
+		str = sbu_xml_modifier_render (xml_mod);
+	}
+	sbu_benchmark_stop (bench, "xml-modifier-render", SBU_BENCHMARK_XML_LOOPS);
+	return TRUE;
+}
+
+static void
+sbu_benchmark_graph_widget (SbuBenchmark *bench)
+{
+	GtkWidget *window;
+	GtkWidget *graph;
+	cairo_surface_t *surface;
+	g_autoptr(GArray) data_x = g_array_new (FALSE, FALSE, sizeof(gdouble));
+	g_autoptr(GArray) data_y = g_array_new (FALSE, FALSE, sizeof(gdouble));
+
+	/* offscreen still needs a display connection */
+	if (!gtk_init_check (NULL, NULL)) {
+		sbu_benchmark_skip (bench, "graph-widget-draw", "no display");
+		sbu_benchmark_skip (bench, "graph-widget-export-svg", "no display");
+		return;
+	}
+
+	/* about what the GUI shows for a day of history */
+	for (guint i = 0; i < 2000; i++) {
+		gdouble x = (gdouble) i * 43.2;
+		gdouble y = 24.f + 2.f * sin ((gdouble) i / 100.f);
+		g_array_append_val (data_x, x);
+		g_array_append_val (data_y, y);
+	}
+	window = gtk_offscreen_window_new ();
+	graph = egg_graph_widget_new ();
+	gtk_widget_set_size_request (graph, 800, 400);
+	gtk_container_add (GTK_CONTAINER (window), graph);
+	for (guint j = 0; j < 3; j++) {
+		egg_graph_widget_data_add_values (EGG_GRAPH_WIDGET (graph),
+						  EGG_GRAPH_WIDGET_PLOT_LINE,
+						  (const gdouble *) data_x->data,
+						  (const gdouble *) data_y->data,
+						  data_x->len,
+						  0xcc0000 >> (j * 8));
+	}
+	gtk_widget_show_all (window);
+	while (gtk_events_pending ())
+		gtk_main_iteration ();
+
+	/* draw the whole widget each time */
+	surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 800, 400);
+	sbu_benchmark_start (bench);
+	for (guint i = 0; i < SBU_BENCHMARK_DRAW_LOOPS; i++) {
+		cairo_t *cr = cairo_create (surface);
+		gtk_widget_draw (graph, cr);
+		cairo_destroy (cr);
+	}
+	sbu_benchmark_stop (bench, "graph-widget-draw", SBU_BENCHMARK_DRAW_LOOPS);
+	cairo_surface_destroy (surface);
+
+	sbu_benchmark_start (bench);
+	for (guint i = 0; i < SBU_BENCHMARK_DRAW_LOOPS; i++) {
+		g_autofree gchar *svg = egg_graph_widget_export_to_svg (EGG_GRAPH_WIDGET (graph),
+									800, 400);
+	}
+	sbu_benchmark_stop (bench, "graph-widget-export-svg", SBU_BENCHMARK_DRAW_LOOPS);
+	gtk_widget_destroy (window);
+}
+
+int
+main (int argc, char **argv)
+{
+	gint rows = 2000000;
+	g_autofree gchar *output = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GOptionContext) context = g_option_context_new (NULL);
+	g_autoptr(SbuBenchmark) bench = sbu_benchmark_new ("sbu");
+	const GOptionEntry options[] = {
+		{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output,
+			"Write the results as JSON to a file", NULL },
+		{ "rows", '\0', 0, G_OPTION_ARG_INT, &rows,
+			"Number of rows in the query fixture", NULL },
+		{ NULL}
+	};
+
+	g_option_context_add_main_entries (context, options, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("Failed to parse arguments: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	if (rows <= 0) {
+		g_printerr ("Invalid number of rows: %i\n", rows);
+		return EXIT_FAILURE;
+	}
+
+	/* benchmarks go here */
+	if (!sbu_benchmark_database_insert (bench, &error) ||
+	    !sbu_benchmark_database_query (bench, (guint) rows, &error) ||
+	    !sbu_benchmark_xml_modifier (bench, &error)) {
+		g_printerr ("Failed to run benchmark: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	sbu_benchmark_graph_widget (bench);
+
+	/* save for comparing with the last release */
+	if (!sbu_benchmark_write (bench, output, &error)) {
+		g_printerr ("Failed to write results: %s\n", error->message);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
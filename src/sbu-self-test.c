@@ -27,8 +27,19 @@
 
 #include "sbu-common.h"
 #include "sbu-database.h"
+#include "sbu-derived.h"
+#include "sbu-energy.h"
+#include "sbu-export.h"
+#include "sbu-metrics.h"
+#include "sbu-rules.h"
+#include "sbu-site.h"
+#include "sbu-soc.h"
 #include "sbu-xml-modifier.h"
 
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuDevice, g_object_unref)
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuNode, g_object_unref)
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuSites, g_object_unref)
+
 static void
 sbu_test_database_func (void)
 {
@@ -39,6 +50,8 @@ sbu_test_database_func (void)
 	g_autoptr(GHashTable) latest = NULL;
 	g_autoptr(GPtrArray) array1 = NULL;
 	g_autoptr(GPtrArray) array2 = NULL;
+	g_autoptr(GPtrArray) array3 = NULL;
+	g_autoptr(GPtrArray) backfill = g_ptr_array_new_with_free_func (g_free);
 	g_autoptr(SbuDatabase) db = NULL;
 
 	location = g_build_filename ("/tmp", "sbu-self-test", "raw.db", NULL);
@@ -73,6 +86,21 @@ sbu_test_database_func (void)
 	g_assert (array2 != NULL);
 	g_assert_cmpint (array2->len, ==, 0);
 
+	/* save historical values, which are never filtered */
+	for (guint i = 0; i < 100; i++) {
+		SbuDatabaseItem *item = g_new0 (SbuDatabaseItem, 1);
+		item->ts = 1000 + i;
+		item->val = 24000;
+		g_ptr_array_add (backfill, item);
+	}
+	ret = sbu_database_save_items (db, "BatteryVoltage", backfill, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	array3 = sbu_database_query (db, "BatteryVoltage", SBU_DEVICE_ID_DEFAULT, 0, 1049, &error);
+	g_assert_no_error (error);
+	g_assert (array3 != NULL);
+	g_assert_cmpint (array3->len, ==, 50);
+
 	/* close, and reload */
 	g_debug ("loading again...");
 	g_object_unref (db);
@@ -94,6 +122,540 @@ sbu_test_database_func (void)
 	g_unlink (location);
 }
 
+static gboolean
+sbu_test_export_count_cb (const SbuDatabaseItem *item, gpointer user_data)
+{
+	guint *cnt = (guint *) user_data;
+	(*cnt)++;
+	return TRUE;
+}
+
+static void
+sbu_test_export_func (void)
+{
+	gboolean ret;
+	gint64 ts = g_get_real_time () / G_USEC_PER_SEC;
+	guint cnt = 0;
+	g_autofree gchar *csv = NULL;
+	g_autofree gchar *location = NULL;
+	g_autofree gchar *svg = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(SbuDatabase) db = NULL;
+	g_autoptr(SbuExport) export = NULL;
+
+	location = g_build_filename ("/tmp", "sbu-self-test", "export.db", NULL);
+	g_unlink (location);
+	db = sbu_database_new ();
+	sbu_database_set_location (db, location);
+	ret = sbu_database_open (db, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	sbu_database_save_value (db, "GridFrequency", 50000, NULL);
+	sbu_database_save_value (db, "GridFrequency", 51000, NULL);
+	sbu_database_save_value (db, "AcOutputVoltage", 230000, NULL);
+	sbu_database_save_value (db, "/0/link_solar_load:active", 1, NULL);
+
+	/* streaming query */
+	ret = sbu_database_query_foreach (db, "GridFrequency", SBU_DEVICE_ID_DEFAULT,
+					  0, ts + 1, sbu_test_export_count_cb,
+					  &cnt, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (cnt, ==, 2);
+
+	/* detect formats */
+	g_assert_cmpint (sbu_export_format_from_filename ("foo.csv"), ==, SBU_EXPORT_FORMAT_CSV);
+	g_assert_cmpint (sbu_export_format_from_filename ("foo.svg"), ==, SBU_EXPORT_FORMAT_SVG);
+	g_assert_cmpint (sbu_export_format_from_filename ("foo.png"), ==, SBU_EXPORT_FORMAT_PNG);
+	g_assert_cmpint (sbu_export_format_from_filename ("foo"), ==, SBU_EXPORT_FORMAT_UNKNOWN);
+
+	/* CSV has one row per value */
+	export = sbu_export_new (db);
+	sbu_export_set_range (export, ts - 3600, ts + 1);
+	sbu_export_add_key (export, "GridFrequency", 0x000000);
+	sbu_export_add_key (export, "AcOutputVoltage", 0xff0000);
+	sbu_export_add_key (export, "/0/link_solar_load:active", 0x000000);
+	ret = sbu_export_to_file (export, SBU_EXPORT_FORMAT_CSV,
+				  "/tmp/sbu-self-test/export.csv", NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = g_file_get_contents ("/tmp/sbu-self-test/export.csv", &csv, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert (g_str_has_prefix (csv, "key,ts,value\n"));
+	g_assert (g_strstr_len (csv, -1, ",51.000\n") != NULL);
+	g_assert (g_strstr_len (csv, -1, ",230.000\n") != NULL);
+
+	/* booleans are not scaled */
+	g_assert (g_strstr_len (csv, -1, ",1.000\n") != NULL);
+	g_assert (g_strstr_len (csv, -1, ",0.001\n") == NULL);
+
+	/* SVG has one path per key */
+	sbu_export_set_size (export, 320, 200);
+	ret = sbu_export_to_file (export, SBU_EXPORT_FORMAT_SVG,
+				  "/tmp/sbu-self-test/export.svg", NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = g_file_get_contents ("/tmp/sbu-self-test/export.svg", &svg, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert (g_strstr_len (svg, -1, "<svg") != NULL);
+
+	/* too small to draw anything */
+	sbu_export_set_size (export, 10, 10);
+	ret = sbu_export_to_file (export, SBU_EXPORT_FORMAT_PNG,
+				  "/tmp/sbu-self-test/export.png", NULL, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT);
+	g_assert (!ret);
+	g_clear_error (&error);
+
+	/* too large to allocate */
+	sbu_export_set_size (export, SBU_EXPORT_SIZE_MAX + 1, 200);
+	ret = sbu_export_to_file (export, SBU_EXPORT_FORMAT_PNG,
+				  "/tmp/sbu-self-test/export.png", NULL, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT);
+	g_assert (!ret);
+
+	/* cleanup */
+	g_unlink ("/tmp/sbu-self-test/export.csv");
+	g_unlink ("/tmp/sbu-self-test/export.svg");
+	g_unlink ("/tmp/sbu-self-test/export.png");
+	g_unlink (location);
+}
+
+static void
+sbu_test_derived_changed_cb (SbuDerived *derived,
+			     const gchar *key,
+			     gdouble value,
+			     GHashTable *results)
+{
+	gdouble *tmp = g_new0 (gdouble, 1);
+	*tmp = value;
+	g_hash_table_insert (results, g_strdup (key), tmp);
+}
+
+static void
+sbu_test_derived_func (void)
+{
+	gboolean ret;
+	gdouble *tmp;
+	guint64 cnt;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GHashTable) results = NULL;
+	g_autoptr(GString) deep = g_string_new (NULL);
+	g_autoptr(SbuDerived) derived = sbu_derived_new ();
+	g_autoptr(SbuDerived) derived_bad = sbu_derived_new ();
+
+	results = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	g_signal_connect (derived, "changed",
+			  G_CALLBACK (sbu_test_derived_changed_cb), results);
+	ret = sbu_derived_add_from_string (derived,
+					   "battery:power_kw = battery:power_dc / 1000;"
+					   "battery:power_dc = battery:voltage * battery:current;"
+					   "load:test = load:power * 0 - 2 + 3 * (4 - 1) / max(1, abs(-2));"
+					   "solar_load:test = 1 - solar_load:active",
+					   &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = sbu_derived_compile (derived, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (sbu_derived_get_size (derived), ==, 4);
+
+	/* only computed once all the inputs are known */
+	sbu_derived_set_value (derived, "/0/node_battery:voltage", 26.5);
+	g_assert_cmpint (g_hash_table_size (results), ==, 0);
+	sbu_derived_set_value (derived, "/0/node_battery:current", 2.f);
+	g_assert_cmpint (g_hash_table_size (results), ==, 2);
+	tmp = g_hash_table_lookup (results, "/0/node_battery:power_dc");
+	g_assert (tmp != NULL);
+	g_assert_cmpfloat (fabs (*tmp - 53.f), <, 0.001);
+	tmp = g_hash_table_lookup (results, "/0/node_battery:power_kw");
+	g_assert (tmp != NULL);
+	g_assert_cmpfloat (fabs (*tmp - 0.053), <, 0.001);
+
+	/* unchanged inputs do nothing */
+	cnt = sbu_derived_get_evaluation_count (derived);
+	g_hash_table_remove_all (results);
+	sbu_derived_set_value (derived, "/0/node_battery:current", 2.f);
+	sbu_derived_set_value (derived, "/0/node_solar:power", 100.f);
+	g_assert_cmpint (sbu_derived_get_evaluation_count (derived), ==, cnt);
+	g_assert_cmpint (g_hash_table_size (results), ==, 0);
+
+	/* each device is separate */
+	sbu_derived_set_value (derived, "/1/node_battery:voltage", 26.5);
+	g_assert_cmpint (g_hash_table_size (results), ==, 0);
+
+	/* precedence, functions and links */
+	sbu_derived_set_value (derived, "/0/node_load:power", 500.f);
+	tmp = g_hash_table_lookup (results, "/0/node_load:test");
+	g_assert (tmp != NULL);
+	g_assert_cmpfloat (fabs (*tmp - 2.5), <, 0.001);
+	sbu_derived_set_value (derived, "/0/link_solar_load:active", 1.f);
+	tmp = g_hash_table_lookup (results, "/0/link_solar_load:test");
+	g_assert (tmp != NULL);
+	g_assert_cmpfloat (fabs (*tmp), <, 0.001);
+
+	/* invalid */
+	for (guint i = 0; i < 10000; i++)
+		g_string_append_c (deep, '(');
+	ret = sbu_derived_add (derived_bad, "battery", "battery:voltage", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert (!ret);
+	g_clear_error (&error);
+	ret = sbu_derived_add (derived_bad, "battery:x", "battery:voltage +", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert (!ret);
+	g_clear_error (&error);
+	ret = sbu_derived_add (derived_bad, "battery:x", "sqrt(battery:voltage)", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert (!ret);
+	g_clear_error (&error);
+	ret = sbu_derived_add (derived_bad, "battery:x", "(battery:voltage", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert (!ret);
+	g_clear_error (&error);
+	ret = sbu_derived_add (derived_bad, "battery:x", deep->str, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert (!ret);
+	g_clear_error (&error);
+
+	/* cannot hide what the device reports */
+	ret = sbu_derived_add (derived_bad, "battery:power", "battery:voltage * 2", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_EXISTS);
+	g_assert (!ret);
+	g_clear_error (&error);
+	ret = sbu_derived_add (derived_bad, "solar_load:active", "1", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_EXISTS);
+	g_assert (!ret);
+	g_clear_error (&error);
+
+	/* circular */
+	ret = sbu_derived_add_from_string (derived_bad, "battery:x=battery:y+1;battery:y=battery:x*2", &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = sbu_derived_add (derived_bad, "battery:x", "1", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_EXISTS);
+	g_assert (!ret);
+	g_clear_error (&error);
+	ret = sbu_derived_compile (derived_bad, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert (!ret);
+}
+
+static void
+sbu_test_energy_func (void)
+{
+	SbuDatabaseEnergy *item;
+	gboolean ret;
+	const gint64 base = 1700000000 - (1700000000 % SBU_ENERGY_WIDTH_HOUR);
+	g_autofree gchar *location = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) array1 = NULL;
+	g_autoptr(GPtrArray) array2 = NULL;
+	g_autoptr(GPtrArray) array3 = NULL;
+	g_autoptr(GPtrArray) array4 = NULL;
+	g_autoptr(GPtrArray) array5 = NULL;
+	g_autoptr(SbuDatabase) db = NULL;
+	g_autoptr(SbuEnergy) energy1 = NULL;
+	g_autoptr(SbuEnergy) energy2 = NULL;
+
+	location = g_build_filename ("/tmp", "sbu-self-test", "energy.db", NULL);
+	g_unlink (location);
+	db = sbu_database_new ();
+	sbu_database_set_location (db, location);
+	ret = sbu_database_open (db, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* 100W for half an hour, then to -100W crossing zero */
+	energy1 = sbu_energy_new (db);
+	sbu_energy_add_sample (energy1, "/0/node_battery:power",
+			       (base + 1800) * G_USEC_PER_SEC, 100.f);
+	sbu_energy_add_sample (energy1, "/0/node_battery:power",
+			       (base + 3600) * G_USEC_PER_SEC, 100.f);
+	sbu_energy_add_sample (energy1, "/0/node_battery:power",
+			       (base + 5400) * G_USEC_PER_SEC, -100.f);
+
+	/* a gap is not counted */
+	sbu_energy_add_sample (energy1, "/0/node_battery:power",
+			       (base + 6400) * G_USEC_PER_SEC, 100.f);
+
+	/* 0W to 120W, split at the hour */
+	sbu_energy_add_sample (energy1, "/0/node_solar:power",
+			       (base + 3000) * G_USEC_PER_SEC, 0.f);
+	sbu_energy_add_sample (energy1, "/0/node_solar:power",
+			       (base + 4200) * G_USEC_PER_SEC, 120.f);
+	ret = sbu_energy_checkpoint (energy1, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* hourly */
+	array1 = sbu_energy_query (db, "/0/node_battery:power", base, base + 7200,
+				   SBU_ENERGY_WIDTH_HOUR, &error);
+	g_assert_no_error (error);
+	g_assert (array1 != NULL);
+	g_assert_cmpint (array1->len, ==, 2);
+	item = g_ptr_array_index (array1, 0);
+	g_assert_cmpint (item->ts, ==, base);
+	g_assert_cmpint (item->pos, ==, 50000);
+	g_assert_cmpint (item->neg, ==, 0);
+	item = g_ptr_array_index (array1, 1);
+	g_assert_cmpint (item->ts, ==, base + 3600);
+	g_assert_cmpint (item->pos, ==, 12500);
+	g_assert_cmpint (item->neg, ==, 12500);
+	array2 = sbu_energy_query (db, "/0/node_solar:power", base, base + 7200,
+				   SBU_ENERGY_WIDTH_HOUR, &error);
+	g_assert_no_error (error);
+	g_assert (array2 != NULL);
+	g_assert_cmpint (array2->len, ==, 2);
+	item = g_ptr_array_index (array2, 0);
+	g_assert_cmpint (item->pos, ==, 5000);
+	item = g_ptr_array_index (array2, 1);
+	g_assert_cmpint (item->pos, ==, 15000);
+
+	/* summed */
+	array3 = sbu_energy_query (db, "/0/node_battery:power", base, base + 7200,
+				   2 * SBU_ENERGY_WIDTH_HOUR, &error);
+	g_assert_no_error (error);
+	g_assert (array3 != NULL);
+	g_assert_cmpint (array3->len, ==, 1);
+	item = g_ptr_array_index (array3, 0);
+	g_assert_cmpint (item->ts, ==, base);
+	g_assert_cmpint (item->pos, ==, 62500);
+	g_assert_cmpint (item->neg, ==, 12500);
+
+	/* invalid */
+	array4 = sbu_energy_query (db, "/0/node_battery:power", base, base + 7200,
+				   100, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT);
+	g_assert (array4 == NULL);
+	g_clear_error (&error);
+
+	/* restarting continues the hour in progress */
+	energy2 = sbu_energy_new (db);
+	sbu_energy_add_sample (energy2, "/0/node_battery:power",
+			       (base + 6400) * G_USEC_PER_SEC, 100.f);
+	sbu_energy_add_sample (energy2, "/0/node_battery:power",
+			       (base + 6760) * G_USEC_PER_SEC, 100.f);
+	ret = sbu_energy_checkpoint (energy2, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	array5 = sbu_energy_query (db, "/0/node_battery:power", base + 3600, base + 7200,
+				   SBU_ENERGY_WIDTH_HOUR, &error);
+	g_assert_no_error (error);
+	g_assert (array5 != NULL);
+	g_assert_cmpint (array5->len, ==, 1);
+	item = g_ptr_array_index (array5, 0);
+	g_assert_cmpint (item->pos, ==, 22500);
+	g_assert_cmpint (item->neg, ==, 12500);
+}
+
+static void
+sbu_test_rules_cb (SbuRules *rules,
+		   const gchar *name,
+		   const gchar *key,
+		   gdouble value,
+		   GPtrArray *events)
+{
+	g_ptr_array_add (events, g_strdup_printf ("%s:%s", name, key));
+}
+
+static void
+sbu_test_rules_func (void)
+{
+	gboolean ret;
+	guint64 cnt;
+	const gint64 ts = 1000 * G_USEC_PER_SEC;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) cleared = g_ptr_array_new_with_free_func (g_free);
+	g_autoptr(GPtrArray) fired = g_ptr_array_new_with_free_func (g_free);
+	g_autoptr(SbuRules) rules = sbu_rules_new ();
+	g_autoptr(SbuRules) rules_bad = sbu_rules_new ();
+	g_autoptr(SbuRules) rules_rate = sbu_rules_new ();
+
+	g_signal_connect (rules, "fired",
+			  G_CALLBACK (sbu_test_rules_cb), fired);
+	g_signal_connect (rules, "cleared",
+			  G_CALLBACK (sbu_test_rules_cb), cleared);
+	ret = sbu_rules_add_from_string (rules,
+					 "battery_low = battery:voltage < 46 for 5m;"
+					 "battery_drop=rate(battery:voltage)<-1\n"
+					 "overload=load:power>=3000",
+					 &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (sbu_rules_get_size (rules), ==, 3);
+
+	/* only fires after the duration, even if the value does not change */
+	sbu_rules_set_value (rules, "/0/node_battery:voltage", ts, 45.f);
+	g_assert_cmpint (fired->len, ==, 0);
+	sbu_rules_check (rules, ts + 200 * G_USEC_PER_SEC);
+	g_assert_cmpint (fired->len, ==, 0);
+	sbu_rules_check (rules, ts + 300 * G_USEC_PER_SEC);
+	g_assert_cmpint (fired->len, ==, 1);
+	g_assert_cmpstr (g_ptr_array_index (fired, 0), ==, "battery_low:/0/node_battery:voltage");
+	sbu_rules_set_value (rules, "/0/node_battery:voltage", ts + 301 * G_USEC_PER_SEC, 45.5);
+	g_assert_cmpint (fired->len, ==, 1);
+
+	/* 2V in 10s */
+	sbu_rules_set_value (rules, "/0/node_battery:voltage", ts + 311 * G_USEC_PER_SEC, 43.5);
+	g_assert_cmpint (fired->len, ==, 2);
+	g_assert_cmpstr (g_ptr_array_index (fired, 1), ==, "battery_drop:/0/node_battery:voltage");
+
+	/* both clear */
+	sbu_rules_set_value (rules, "/0/node_battery:voltage", ts + 400 * G_USEC_PER_SEC, 47.f);
+	g_assert_cmpint (cleared->len, ==, 2);
+
+	/* devices are separate, and no duration fires immediately */
+	sbu_rules_set_value (rules, "/0/node_load:power", ts, 100.f);
+	sbu_rules_set_value (rules, "/1/node_load:power", ts, 3000.f);
+	g_assert_cmpint (fired->len, ==, 3);
+	g_assert_cmpstr (g_ptr_array_index (fired, 2), ==, "overload:/1/node_load:power");
+
+	/* unused keys are not evaluated */
+	cnt = sbu_rules_get_evaluation_count (rules);
+	sbu_rules_set_value (rules, "/0/node_solar:power", ts, 100.f);
+	g_assert_cmpint (sbu_rules_get_evaluation_count (rules), ==, cnt);
+
+	/* a rate falls towards zero when the value stops changing */
+	g_ptr_array_set_size (fired, 0);
+	g_ptr_array_set_size (cleared, 0);
+	g_signal_connect (rules_rate, "fired",
+			  G_CALLBACK (sbu_test_rules_cb), fired);
+	g_signal_connect (rules_rate, "cleared",
+			  G_CALLBACK (sbu_test_rules_cb), cleared);
+	ret = sbu_rules_add_from_string (rules_rate,
+					 "rising=rate(battery:voltage)>1 for 5m;"
+					 "falling=rate(battery:voltage)<-1",
+					 &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	sbu_rules_set_value (rules_rate, "/0/node_battery:voltage", ts, 48.f);
+	sbu_rules_set_value (rules_rate, "/0/node_battery:voltage", ts + 10 * G_USEC_PER_SEC, 50.f);
+	sbu_rules_check (rules_rate, ts + 300 * G_USEC_PER_SEC);
+	sbu_rules_check (rules_rate, ts + 400 * G_USEC_PER_SEC);
+	g_assert_cmpint (fired->len, ==, 0);
+
+	/* 4V in 10s, then nothing for a long time */
+	sbu_rules_set_value (rules_rate, "/0/node_battery:voltage", ts + 410 * G_USEC_PER_SEC, 48.f);
+	sbu_rules_set_value (rules_rate, "/0/node_battery:voltage", ts + 420 * G_USEC_PER_SEC, 44.f);
+	g_assert_cmpint (fired->len, ==, 1);
+	g_assert_cmpstr (g_ptr_array_index (fired, 0), ==, "falling:/0/node_battery:voltage");
+	sbu_rules_check (rules_rate, ts + 430 * G_USEC_PER_SEC);
+	g_assert_cmpint (cleared->len, ==, 0);
+	sbu_rules_check (rules_rate, ts + 700 * G_USEC_PER_SEC);
+	g_assert_cmpint (cleared->len, ==, 1);
+	g_assert_cmpstr (g_ptr_array_index (cleared, 0), ==, "falling:/0/node_battery:voltage");
+
+	/* invalid */
+	ret = sbu_rules_add (rules_bad, "x", "battery:voltage", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert (!ret);
+	g_clear_error (&error);
+	ret = sbu_rules_add (rules_bad, "x", "battery:voltage < 4 for", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert (!ret);
+	g_clear_error (&error);
+	ret = sbu_rules_add (rules_bad, "x", "rate(battery:voltage < 4", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert (!ret);
+	g_clear_error (&error);
+	ret = sbu_rules_add (rules_bad, "x", "battery < 4", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert (!ret);
+	g_clear_error (&error);
+	ret = sbu_rules_add (rules_bad, "x", "battery:voltage < 4", &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = sbu_rules_add (rules_bad, "x", "battery:voltage > 60", &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_EXISTS);
+	g_assert (!ret);
+	g_clear_error (&error);
+}
+
+static void
+sbu_test_soc_func (void)
+{
+	const gint64 ts = 1000 * G_USEC_PER_SEC;
+	g_autoptr(SbuSoc) soc = sbu_soc_new (100.f);
+
+	/* unknown until there is somewhere to start */
+	g_assert_cmpfloat (sbu_soc_get_value (soc), <, 0.f);
+	sbu_soc_add_sample (soc, ts, 10.f);
+	g_assert_cmpfloat (sbu_soc_get_value (soc), <, 0.f);
+	sbu_soc_set_estimate (soc, 50.f);
+	g_assert_cmpfloat (fabs (sbu_soc_get_value (soc) - 50.f), <, 0.001);
+
+	/* 10A for 10 minutes from 100Ah */
+	sbu_soc_add_sample (soc, ts + 600 * G_USEC_PER_SEC, 10.f);
+	g_assert_cmpfloat (fabs (sbu_soc_get_value (soc) - 48.333), <, 0.001);
+
+	/* the estimate is ignored once anchored */
+	sbu_soc_anchor (soc, 100.f);
+	sbu_soc_set_estimate (soc, 20.f);
+	g_assert_cmpfloat (fabs (sbu_soc_get_value (soc) - 100.f), <, 0.001);
+
+	/* cannot charge past full */
+	sbu_soc_add_sample (soc, ts + 1200 * G_USEC_PER_SEC, -10.f);
+	sbu_soc_add_sample (soc, ts + 1800 * G_USEC_PER_SEC, -10.f);
+	g_assert_cmpfloat (fabs (sbu_soc_get_value (soc) - 100.f), <, 0.001);
+
+	/* 20A out then in, with losses charging */
+	sbu_soc_add_sample (soc, ts + 1800 * G_USEC_PER_SEC + 1, 20.f);
+	sbu_soc_add_sample (soc, ts + 2400 * G_USEC_PER_SEC + 1, 20.f);
+	g_assert_cmpfloat (fabs (sbu_soc_get_value (soc) - 96.667), <, 0.001);
+	sbu_soc_add_sample (soc, ts + 2400 * G_USEC_PER_SEC + 2, -20.f);
+	sbu_soc_add_sample (soc, ts + 3000 * G_USEC_PER_SEC + 2, -20.f);
+	g_assert_cmpfloat (fabs (sbu_soc_get_value (soc) - 99.833), <, 0.001);
+
+	/* a gap is not counted */
+	sbu_soc_add_sample (soc, ts + 5000 * G_USEC_PER_SEC, 20.f);
+	g_assert_cmpfloat (fabs (sbu_soc_get_value (soc) - 99.833), <, 0.001);
+}
+
+static void
+sbu_test_metrics_func (void)
+{
+	const gchar *kind = NULL;
+	guint64 count = 0;
+	guint64 max = 0;
+	guint64 sum = 0;
+	g_autofree gchar *str = NULL;
+	g_autoptr(GVariant) value = NULL;
+	g_autoptr(SbuMetrics) metrics = sbu_metrics_new ();
+
+	/* optional */
+	sbu_metrics_increment (NULL, "sbud_test_total", NULL, 1);
+	sbu_metrics_observe (NULL, "sbud_test_seconds", NULL, 1);
+
+	sbu_metrics_increment (metrics, "sbud_test_total", NULL, 2);
+	sbu_metrics_increment (metrics, "sbud_test_total", NULL, 3);
+	sbu_metrics_observe (metrics, "sbud_test_seconds", "cmd=\"QPI\"", 200);
+	sbu_metrics_observe (metrics, "sbud_test_seconds", "cmd=\"QPI\"", 3000000);
+	sbu_metrics_observe (metrics, "sbud_test_seconds", "cmd=\"QID\"", 50);
+
+	/* D-Bus */
+	value = g_variant_ref_sink (sbu_metrics_to_variant (metrics));
+	g_assert (g_variant_lookup (value, "sbud_test_total", "(&sttt)", &kind, &count, &sum, &max));
+	g_assert_cmpstr (kind, ==, "counter");
+	g_assert_cmpint (count, ==, 5);
+	g_assert (g_variant_lookup (value, "sbud_test_seconds{cmd=\"QPI\"}", "(&sttt)", &kind, &count, &sum, &max));
+	g_assert_cmpstr (kind, ==, "histogram");
+	g_assert_cmpint (count, ==, 2);
+	g_assert_cmpint (sum, ==, 3000200);
+	g_assert_cmpint (max, ==, 3000000);
+
+	/* Prometheus, with cumulative buckets */
+	str = sbu_metrics_to_prometheus (metrics);
+	g_assert (g_strstr_len (str, -1, "# TYPE sbud_test_total counter\nsbud_test_total 5\n") != NULL);
+	g_assert (g_strstr_len (str, -1, "# TYPE sbud_test_seconds histogram\n") != NULL);
+	g_assert (g_strstr_len (str, -1, "sbud_test_seconds_bucket{cmd=\"QPI\",le=\"0.00025\"} 1\n") != NULL);
+	g_assert (g_strstr_len (str, -1, "sbud_test_seconds_bucket{cmd=\"QPI\",le=\"5\"} 2\n") != NULL);
+	g_assert (g_strstr_len (str, -1, "sbud_test_seconds_bucket{cmd=\"QID\",le=\"+Inf\"} 1\n") != NULL);
+	g_assert (g_strstr_len (str, -1, "sbud_test_seconds_count{cmd=\"QPI\"} 2\n") != NULL);
+}
+
 static void
 sbu_test_xml_modifier_func (void)
 {
@@ -116,6 +678,101 @@ sbu_test_xml_modifier_func (void)
 	g_assert_cmpstr (str->str, ==, xml_out);
 }
 
+static void
+sbu_test_xml_modifier_compile_func (void)
+{
+	gboolean ret;
+	g_autoptr(SbuXmlModifier) xml_mod = sbu_xml_modifier_new ();
+	g_autoptr(GString) str1 = NULL;
+	g_autoptr(GString) str2 = NULL;
+	g_autoptr(GString) str3 = NULL;
+	g_autoptr(GError) error = NULL;
+	const gchar *xml_in =
+		"<body>"
+		"<person id=\"name\" age=\"18\">Unknown</person>"
+		"<!-- comment -->"
+		"</body>";
+
+	/* replacements before compile are used */
+	sbu_xml_modifier_replace_attr (xml_mod, "name", "age", "33");
+	ret = sbu_xml_modifier_compile (xml_mod, xml_in, -1, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	str1 = sbu_xml_modifier_render (xml_mod);
+	g_assert_cmpstr (str1->str, ==,
+			 "<body>"
+			 "<person id=\"name\" age=\"33\">Unknown</person>"
+			 "<!-- comment -->"
+			 "</body>");
+
+	/* and after compile */
+	sbu_xml_modifier_replace_cdata (xml_mod, "name", "Richard");
+	str2 = sbu_xml_modifier_render (xml_mod);
+	g_assert_cmpstr (str2->str, ==,
+			 "<body>"
+			 "<person id=\"name\" age=\"33\">Richard</person>"
+			 "<!-- comment -->"
+			 "</body>");
+
+	/* back to the template */
+	sbu_xml_modifier_reset (xml_mod);
+	str3 = sbu_xml_modifier_render (xml_mod);
+	g_assert_cmpstr (str3->str, ==, xml_in);
+}
+
+static void
+sbu_test_xml_modifier_benchmark_func (void)
+{
+	gboolean ret;
+	gdouble elapsed_compiled;
+	gdouble elapsed_process;
+	guint loops = 1000;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GString) xml_in = g_string_new ("<svg>");
+	g_autoptr(SbuXmlModifier) xml_mod = sbu_xml_modifier_new ();
+
+	/* something about the size of the overview */
+	for (guint i = 0; i < 500; i++) {
+		g_string_append_printf (xml_in,
+					"<g id=\"g%u\" style=\"fill:none\">"
+					"<path id=\"path%u\" d=\"m 0,0 %u,%u\"/>"
+					"<text x=\"%u\" y=\"0\"><tspan id=\"tspan%u\">%u</tspan></text>"
+					"</g>", i, i, i, i, i, i, i);
+	}
+	g_string_append (xml_in, "</svg>");
+
+	/* the old way: parse every time */
+	g_test_timer_start ();
+	for (guint i = 0; i < loops; i++) {
+		g_autoptr(GString) str = NULL;
+		sbu_xml_modifier_replace_cdata (xml_mod, "tspan42", "123W");
+		sbu_xml_modifier_replace_attr (xml_mod, "path42", "style", "");
+		str = sbu_xml_modifier_process (xml_mod, xml_in->str, (gssize) xml_in->len, &error);
+		g_assert_no_error (error);
+		g_assert (str != NULL);
+	}
+	elapsed_process = g_test_timer_elapsed ();
+
+	/* the new way: compile once, splice every time */
+	g_test_timer_start ();
+	ret = sbu_xml_modifier_compile (xml_mod, xml_in->str, (gssize) xml_in->len, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	for (guint i = 0; i < loops; i++) {
+		g_autoptr(GString) str = NULL;
+		sbu_xml_modifier_replace_cdata (xml_mod, "tspan42", "123W");
+		sbu_xml_modifier_replace_attr (xml_mod, "path42", "style", "");
+		str = sbu_xml_modifier_render (xml_mod);
+		g_assert (str != NULL);
+	}
+	elapsed_compiled = g_test_timer_elapsed ();
+
+	g_test_minimized_result (elapsed_process, "process: %.3fs for %u loops",
+				 elapsed_process, loops);
+	g_test_minimized_result (elapsed_compiled, "compiled: %.3fs for %u loops",
+				 elapsed_compiled, loops);
+}
+
 
 static void
 sbu_test_common_func (void)
@@ -146,6 +803,418 @@ sbu_test_common_func (void)
 	}
 }
 
+/* the site and the aggregator share the default main context */
+static void
+sbu_test_iterate (gint64 ts_start)
+{
+	g_assert_cmpint (g_get_monotonic_time () - ts_start, <, 10 * G_USEC_PER_SEC);
+	if (!g_main_context_iteration (NULL, FALSE))
+		g_usleep (1000);
+}
+
+static void
+sbu_test_async_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	GAsyncResult **result = (GAsyncResult **) user_data;
+	*result = g_object_ref (res);
+}
+
+static GVariant *
+sbu_test_call (GDBusConnection *connection, const gchar *bus_name,
+	       const gchar *object_path, const gchar *interface_name,
+	       const gchar *method_name, GVariant *parameters, GError **error)
+{
+	gint64 ts = g_get_monotonic_time ();
+	g_autoptr(GAsyncResult) res = NULL;
+
+	/* the reply needs the main context, so cannot use the sync version */
+	g_dbus_connection_call (connection, bus_name, object_path,
+				interface_name, method_name, parameters,
+				NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+				sbu_test_async_cb, &res);
+	while (res == NULL)
+		sbu_test_iterate (ts);
+	return g_dbus_connection_call_finish (connection, res, error);
+}
+
+static GDBusObject *
+sbu_test_get_object (GDBusObjectManagerServer *manager, const gchar *object_path)
+{
+	return g_dbus_object_manager_get_object (G_DBUS_OBJECT_MANAGER (manager),
+						 object_path);
+}
+
+/* a fake sbud in its own thread, as GDBusObjectManagerClient makes a sync
+ * call to it when the name owner comes back */
+typedef struct {
+	gchar				*address;
+	GMainContext			*context;
+	GMainLoop			*loop;
+	GThread				*thread;
+	GDBusConnection			*connection;
+	GDBusObjectManagerServer	*manager;
+	guint				 name_owner_id;
+	gint				 owned;		/* atomic */
+} SbuTestSbud;
+
+static gboolean
+sbu_test_sbud_get_nodes_cb (SbuDevice *device,
+			    GDBusMethodInvocation *invocation,
+			    gpointer user_data)
+{
+	const gchar *const nodes[] = { SBU_DBUS_PATH_DEVICE "/0/node_battery", NULL };
+	sbu_device_complete_get_nodes (device, invocation, nodes);
+	return TRUE;
+}
+
+static gboolean
+sbu_test_sbud_get_links_cb (SbuDevice *device,
+			    GDBusMethodInvocation *invocation,
+			    gpointer user_data)
+{
+	const gchar *const links[] = { SBU_DBUS_PATH_DEVICE "/0/link_solar_load", NULL };
+	sbu_device_complete_get_links (device, invocation, links);
+	return TRUE;
+}
+
+static gboolean
+sbu_test_sbud_get_history_cb (SbuDevice *device,
+			      GDBusMethodInvocation *invocation,
+			      const gchar *key,
+			      guint64 start,
+			      guint64 end,
+			      guint limit,
+			      gpointer user_data)
+{
+	g_assert_cmpstr (key, ==, "node_battery:voltage");
+	sbu_device_complete_get_history (device, invocation,
+					 g_variant_new_parsed ("[(@t 1500000000, 26.5)]"));
+	return TRUE;
+}
+
+static void
+sbu_test_sbud_name_acquired_cb (GDBusConnection *connection,
+				const gchar *name,
+				gpointer user_data)
+{
+	SbuTestSbud *sbud = (SbuTestSbud *) user_data;
+	g_atomic_int_set (&sbud->owned, TRUE);
+}
+
+static void
+sbu_test_sbud_name_lost_cb (GDBusConnection *connection,
+			    const gchar *name,
+			    gpointer user_data)
+{
+	SbuTestSbud *sbud = (SbuTestSbud *) user_data;
+	g_atomic_int_set (&sbud->owned, FALSE);
+}
+
+static gboolean
+sbu_test_sbud_own_cb (gpointer user_data)
+{
+	SbuTestSbud *sbud = (SbuTestSbud *) user_data;
+	sbud->name_owner_id = g_bus_own_name_on_connection (sbud->connection,
+							    SBU_DBUS_NAME,
+							    G_BUS_NAME_OWNER_FLAGS_NONE,
+							    sbu_test_sbud_name_acquired_cb,
+							    sbu_test_sbud_name_lost_cb,
+							    sbud, NULL);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean
+sbu_test_sbud_unown_cb (gpointer user_data)
+{
+	SbuTestSbud *sbud = (SbuTestSbud *) user_data;
+	g_bus_unown_name (sbud->name_owner_id);
+	sbud->name_owner_id = 0;
+	g_atomic_int_set (&sbud->owned, FALSE);
+	return G_SOURCE_REMOVE;
+}
+
+static gpointer
+sbu_test_sbud_thread_cb (gpointer user_data)
+{
+	SbuTestSbud *sbud = (SbuTestSbud *) user_data;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(SbuDevice) device = sbu_device_skeleton_new ();
+	g_autoptr(SbuNode) node = sbu_node_skeleton_new ();
+	g_autoptr(SbuObjectSkeleton) device_object = NULL;
+	g_autoptr(SbuObjectSkeleton) node_object = NULL;
+
+	/* everything exported here is dispatched in this thread */
+	g_main_context_push_thread_default (sbud->context);
+	sbud->connection = g_dbus_connection_new_for_address_sync (sbud->address,
+								   G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+								   G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+								   NULL, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (sbud->connection != NULL);
+
+	/* one device with one node */
+	sbud->manager = g_dbus_object_manager_server_new ("/com/hughski/PowerSBU");
+	g_signal_connect (device, "handle-get-nodes",
+			  G_CALLBACK (sbu_test_sbud_get_nodes_cb), NULL);
+	g_signal_connect (device, "handle-get-links",
+			  G_CALLBACK (sbu_test_sbud_get_links_cb), NULL);
+	g_signal_connect (device, "handle-get-history",
+			  G_CALLBACK (sbu_test_sbud_get_history_cb), NULL);
+	device_object = sbu_object_skeleton_new (SBU_DBUS_PATH_DEVICE "/0");
+	sbu_object_skeleton_set_device (device_object, device);
+	g_dbus_object_manager_server_export (sbud->manager, G_DBUS_OBJECT_SKELETON (device_object));
+	sbu_node_set_power (node, 123.f);
+	node_object = sbu_object_skeleton_new (SBU_DBUS_PATH_DEVICE "/0/node_battery");
+	sbu_object_skeleton_set_node (node_object, node);
+	g_dbus_object_manager_server_export (sbud->manager, G_DBUS_OBJECT_SKELETON (node_object));
+	g_dbus_object_manager_server_set_connection (sbud->manager, sbud->connection);
+	sbu_test_sbud_own_cb (sbud);
+	g_main_loop_run (sbud->loop);
+
+	/* the connection may already have gone with the bus */
+	if (sbud->name_owner_id != 0)
+		g_bus_unown_name (sbud->name_owner_id);
+	g_dbus_object_manager_server_set_connection (sbud->manager, NULL);
+	g_clear_object (&sbud->manager);
+	g_clear_object (&sbud->connection);
+	g_main_context_pop_thread_default (sbud->context);
+	return NULL;
+}
+
+static void
+sbu_test_sbud_free (SbuTestSbud *sbud)
+{
+	g_main_loop_quit (sbud->loop);
+	g_thread_join (sbud->thread);
+	g_main_loop_unref (sbud->loop);
+	g_main_context_unref (sbud->context);
+	g_free (sbud->address);
+	g_free (sbud);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuTestSbud, sbu_test_sbud_free)
+
+static SbuTestSbud *
+sbu_test_sbud_new (const gchar *address)
+{
+	SbuTestSbud *sbud = g_new0 (SbuTestSbud, 1);
+	gint64 ts = g_get_monotonic_time ();
+
+	sbud->address = g_strdup (address);
+	sbud->context = g_main_context_new ();
+	sbud->loop = g_main_loop_new (sbud->context, FALSE);
+	sbud->thread = g_thread_new ("sbud", sbu_test_sbud_thread_cb, sbud);
+	while (!g_atomic_int_get (&sbud->owned))
+		sbu_test_iterate (ts);
+	return sbud;
+}
+
+static gboolean
+sbu_test_aggregator_get_history_cb (SbuSites *sites_iface,
+				    GDBusMethodInvocation *invocation,
+				    const gchar *key,
+				    guint64 start,
+				    guint64 end,
+				    guint limit,
+				    GPtrArray *sites)
+{
+	sbu_site_return_history (sites, invocation, key, start, end, limit);
+	return TRUE;
+}
+
+typedef struct {
+	guint			 cnt_lost;
+	guint			 cnt_failed;
+} SbuTestSiteWarnings;
+
+/* losing the bus is expected, anything else is still fatal */
+static gboolean
+sbu_test_site_fatal_cb (const gchar *log_domain,
+			GLogLevelFlags log_level,
+			const gchar *message,
+			gpointer user_data)
+{
+	SbuTestSiteWarnings *warnings = (SbuTestSiteWarnings *) user_data;
+	if (g_str_has_prefix (message, "lost connection to home")) {
+		warnings->cnt_lost++;
+		return FALSE;
+	}
+	if (g_str_has_prefix (message, "failed to connect to home")) {
+		warnings->cnt_failed++;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+sbu_test_site_func (void)
+{
+	const gchar *aggregator_name;
+	const gchar *device_path = SBU_DBUS_PATH_DEVICE "/home/0";
+	const gchar *node_path = SBU_DBUS_PATH_DEVICE "/home/0/node_battery";
+	gdouble value = 0.f;
+	gint64 ts;
+	SbuTestSiteWarnings warnings = { 0, 0 };
+	g_autofree gchar *history_str = NULL;
+	g_autofree gchar *links_str = NULL;
+	g_autofree gchar *nodes_str = NULL;
+	g_autoptr(GDBusConnection) aggregator_connection = NULL;
+	g_autoptr(GDBusConnection) client_connection = NULL;
+	g_autoptr(GDBusObject) mirror = NULL;
+	g_autoptr(GDBusObjectManagerServer) aggregator_manager = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) sites = g_ptr_array_new_with_free_func (g_object_unref);
+	g_autoptr(GTestDBus) bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+	g_autoptr(GVariant) data = NULL;
+	g_autoptr(GVariant) history = NULL;
+	g_autoptr(GVariant) links = NULL;
+	g_autoptr(GVariant) nodes = NULL;
+	g_autoptr(GVariant) values = NULL;
+	g_autoptr(SbuNode) node_mirror = NULL;
+	g_autoptr(SbuObjectSkeleton) sites_object = NULL;
+	g_autoptr(SbuSite) site = NULL;
+	g_autoptr(SbuSites) sites_iface = sbu_sites_skeleton_new ();
+	g_autoptr(SbuTestSbud) sbud = NULL;
+
+	/* a private bus, so that nothing on the session bus is used */
+	g_test_dbus_up (bus);
+	sbud = sbu_test_sbud_new (g_test_dbus_get_bus_address (bus));
+
+	/* the aggregator */
+	aggregator_connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (bus),
+									G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+									G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+									NULL, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (aggregator_connection != NULL);
+	aggregator_name = g_dbus_connection_get_unique_name (aggregator_connection);
+	aggregator_manager = g_dbus_object_manager_server_new ("/com/hughski/PowerSBU");
+	g_signal_connect (sites_iface, "handle-get-history",
+			  G_CALLBACK (sbu_test_aggregator_get_history_cb), sites);
+	sites_object = sbu_object_skeleton_new (SBU_DBUS_PATH_MANAGER);
+	sbu_object_skeleton_set_sites (sites_object, sites_iface);
+	g_dbus_object_manager_server_export (aggregator_manager, G_DBUS_OBJECT_SKELETON (sites_object));
+	g_dbus_object_manager_server_set_connection (aggregator_manager, aggregator_connection);
+	site = sbu_site_new (aggregator_manager, "home", g_test_dbus_get_bus_address (bus), &error);
+	g_assert_no_error (error);
+	g_assert (site != NULL);
+	sbu_site_set_reconnect_interval (site, 1);
+	g_ptr_array_add (sites, g_object_ref (site));
+	sbu_site_connect (site);
+
+	/* something using the aggregator */
+	client_connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (bus),
+								    G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+								    G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+								    NULL, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (client_connection != NULL);
+
+	/* the objects are mirrored with the site name added */
+	ts = g_get_monotonic_time ();
+	while (mirror == NULL) {
+		sbu_test_iterate (ts);
+		mirror = sbu_test_get_object (aggregator_manager, node_path);
+	}
+	g_assert (sbu_site_is_connected (site));
+	node_mirror = sbu_object_get_node (SBU_OBJECT (mirror));
+	g_assert (node_mirror != NULL);
+	g_assert_cmpfloat (fabs (sbu_node_get_power (node_mirror) - 123.f), <, 0.001);
+	g_clear_object (&mirror);
+	mirror = sbu_test_get_object (aggregator_manager, device_path);
+	g_assert (mirror != NULL);
+	g_clear_object (&mirror);
+
+	/* the returned paths point at the mirrors too */
+	nodes = sbu_test_call (client_connection, aggregator_name, device_path,
+			       "com.hughski.PowerSBU.Device", "GetNodes",
+			       NULL, &error);
+	g_assert_no_error (error);
+	g_assert (nodes != NULL);
+	nodes_str = g_variant_print (nodes, FALSE);
+	g_assert_cmpstr (nodes_str, ==,
+			 "(['/com/hughski/PowerSBU/Device/home/0/node_battery'],)");
+	links = sbu_test_call (client_connection, aggregator_name, device_path,
+			       "com.hughski.PowerSBU.Device", "GetLinks",
+			       NULL, &error);
+	g_assert_no_error (error);
+	g_assert (links != NULL);
+	links_str = g_variant_print (links, FALSE);
+	g_assert_cmpstr (links_str, ==,
+			 "(['/com/hughski/PowerSBU/Device/home/0/link_solar_load'],)");
+
+	/* history from every device, by mirrored path */
+	history = sbu_test_call (client_connection, aggregator_name,
+				 SBU_DBUS_PATH_MANAGER,
+				 "com.hughski.PowerSBU.Sites", "GetHistory",
+				 g_variant_new ("(sttu)", "node_battery:voltage",
+						(guint64) 0, G_MAXUINT64, (guint) 100),
+				 &error);
+	g_assert_no_error (error);
+	g_assert (history != NULL);
+	values = g_variant_get_child_value (history, 0);
+	g_assert_cmpint (g_variant_n_children (values), ==, 1);
+	data = g_variant_lookup_value (values, device_path, G_VARIANT_TYPE ("a(td)"));
+	g_assert (data != NULL);
+	g_assert_cmpint (g_variant_n_children (data), ==, 1);
+	g_variant_get_child (data, 0, "(td)", NULL, &value);
+	g_assert_cmpfloat (fabs (value - 26.5), <, 0.001);
+
+	/* the mirrors go when sbud stops, though the bus is still there */
+	g_main_context_invoke (sbud->context, sbu_test_sbud_unown_cb, sbud);
+	ts = g_get_monotonic_time ();
+	do {
+		g_clear_object (&mirror);
+		sbu_test_iterate (ts);
+		mirror = sbu_test_get_object (aggregator_manager, device_path);
+	} while (mirror != NULL);
+	mirror = sbu_test_get_object (aggregator_manager, node_path);
+	g_assert (mirror == NULL);
+	g_assert (!sbu_site_is_connected (site));
+
+	/* no devices left, so an empty reply rather than waiting */
+	g_clear_pointer (&history, g_variant_unref);
+	history = sbu_test_call (client_connection, aggregator_name,
+				 SBU_DBUS_PATH_MANAGER,
+				 "com.hughski.PowerSBU.Sites", "GetHistory",
+				 g_variant_new ("(sttu)", "node_battery:voltage",
+						(guint64) 0, G_MAXUINT64, (guint) 100),
+				 &error);
+	g_assert_no_error (error);
+	history_str = g_variant_print (history, TRUE);
+	g_assert_cmpstr (history_str, ==, "(@a{sa(td)} {},)");
+
+	/* and come back when it starts again */
+	g_main_context_invoke (sbud->context, sbu_test_sbud_own_cb, sbud);
+	ts = g_get_monotonic_time ();
+	while (mirror == NULL) {
+		sbu_test_iterate (ts);
+		mirror = sbu_test_get_object (aggregator_manager, node_path);
+	}
+	g_clear_object (&mirror);
+	g_assert (sbu_site_is_connected (site));
+
+	/* losing the connection to the site itself unexports everything
+	 * and then tries to connect again after the interval */
+	g_test_log_set_fatal_handler (sbu_test_site_fatal_cb, &warnings);
+	g_test_dbus_stop (bus);
+	ts = g_get_monotonic_time ();
+	do {
+		g_clear_object (&mirror);
+		sbu_test_iterate (ts);
+		mirror = sbu_test_get_object (aggregator_manager, device_path);
+	} while (mirror != NULL || warnings.cnt_failed == 0);
+	g_test_log_set_fatal_handler (NULL, NULL);
+	g_assert_cmpint (warnings.cnt_lost, ==, 1);
+	mirror = sbu_test_get_object (aggregator_manager, node_path);
+	g_assert (mirror == NULL);
+	g_assert (!sbu_site_is_connected (site));
+
+	/* the site cancels the pending reconnect */
+	g_clear_object (&site);
+	g_ptr_array_set_size (sites, 0);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -156,7 +1225,17 @@ main (int argc, char **argv)
 	/* tests go here */
 	g_test_add_func ("/database", sbu_test_database_func);
 	g_test_add_func ("/common", sbu_test_common_func);
+	g_test_add_func ("/export", sbu_test_export_func);
+	g_test_add_func ("/derived", sbu_test_derived_func);
+	g_test_add_func ("/energy", sbu_test_energy_func);
+	g_test_add_func ("/rules", sbu_test_rules_func);
+	g_test_add_func ("/soc", sbu_test_soc_func);
+	g_test_add_func ("/site", sbu_test_site_func);
+	g_test_add_func ("/metrics", sbu_test_metrics_func);
 	g_test_add_func ("/xml-modifier", sbu_test_xml_modifier_func);
+	g_test_add_func ("/xml-modifier{compile}", sbu_test_xml_modifier_compile_func);
+	if (g_test_perf ())
+		g_test_add_func ("/xml-modifier{benchmark}", sbu_test_xml_modifier_benchmark_func);
 
 	return g_test_run ();
 }
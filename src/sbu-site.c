@@ -0,0 +1,733 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "sbu-common.h"
+#include "sbu-site.h"
+
+/* how long to wait before connecting again, in s */
+#define SBU_SITE_RECONNECT_INTERVAL	30
+
+/* how long to wait for the history of each device, in ms */
+#define SBU_SITE_HISTORY_TIMEOUT	10000
+
+struct _SbuSite
+{
+	GObject				 parent_instance;
+	GDBusObjectManagerServer	*object_manager;
+	gchar				*name;
+	gchar				*address;
+	GDBusConnection			*connection;
+	GDBusObjectManager		*client;
+	GHashTable			*objects;	/* remote path:SbuObjectSkeleton */
+	GCancellable			*cancellable;
+	guint				 reconnect_id;
+	guint				 reconnect_interval;	/* s */
+};
+
+G_DEFINE_TYPE (SbuSite, sbu_site, G_TYPE_OBJECT)
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuDevice, g_object_unref)
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuNode, g_object_unref)
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuLink, g_object_unref)
+
+/* mirrored so that the local objects update when the remote ones do */
+static const gchar *sbu_site_device_props[] = {
+	"firmware-version", "serial-number", "description", NULL };
+static const gchar *sbu_site_node_props[] = {
+	"kind", "voltage", "voltage-max", "current", "current-max", "power",
+	"power-max", "frequency", "state-of-charge", NULL };
+static const gchar *sbu_site_link_props[] = {
+	"src", "dst", "active", NULL };
+
+static void sbu_site_reconnect (SbuSite *self);
+
+/**
+ * sbu_site_get_object_path:
+ * @self: a #SbuSite
+ * @remote_path: an object path on the site, e.g. "/com/hughski/PowerSBU/Device/0"
+ *
+ * Gets where a remote object is mirrored, with the site name added after
+ * the device prefix so that each site keeps its own device numbers.
+ *
+ * Return value: a local object path, e.g. "/com/hughski/PowerSBU/Device/home/0"
+ **/
+gchar *
+sbu_site_get_object_path (SbuSite *self, const gchar *remote_path)
+{
+	const gchar *suffix = remote_path;
+	if (g_str_has_prefix (suffix, SBU_DBUS_PATH_DEVICE))
+		suffix += strlen (SBU_DBUS_PATH_DEVICE);
+	if (suffix[0] == '/')
+		suffix++;
+	return g_strdup_printf ("%s/%s/%s", SBU_DBUS_PATH_DEVICE, self->name, suffix);
+}
+
+static void
+sbu_site_forward_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	g_autoptr(GDBusMethodInvocation) invocation = G_DBUS_METHOD_INVOCATION (user_data);
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) reply = NULL;
+
+	reply = g_dbus_proxy_call_finish (G_DBUS_PROXY (source), res, &error);
+	if (reply == NULL) {
+		g_dbus_method_invocation_return_gerror (invocation, error);
+		return;
+	}
+	g_dbus_method_invocation_return_value (invocation, reply);
+}
+
+/* pass the call on unchanged, without blocking the other sites */
+static gboolean
+sbu_site_forward (SbuSite *self, GObject *skeleton, GDBusMethodInvocation *invocation)
+{
+	GDBusProxy *remote = g_object_get_data (skeleton, "sbu-site-remote");
+	g_dbus_proxy_call (remote,
+			   g_dbus_method_invocation_get_method_name (invocation),
+			   g_dbus_method_invocation_get_parameters (invocation),
+			   G_DBUS_CALL_FLAGS_NONE, -1,
+			   self->cancellable,
+			   sbu_site_forward_cb,
+			   g_object_ref (invocation));
+	return TRUE;
+}
+
+typedef struct {
+	SbuSite			*self;
+	GDBusMethodInvocation	*invocation;
+} SbuSiteHelper;
+
+static void
+sbu_site_helper_free (SbuSiteHelper *helper)
+{
+	g_object_unref (helper->self);
+	g_object_unref (helper->invocation);
+	g_free (helper);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuSiteHelper, sbu_site_helper_free)
+
+/* the node and link paths have to point at the mirrors */
+static void
+sbu_site_forward_paths_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	g_autoptr(SbuSiteHelper) helper = (SbuSiteHelper *) user_data;
+	GVariantBuilder builder;
+	GVariantIter iter;
+	const gchar *object_path;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) paths = NULL;
+	g_autoptr(GVariant) reply = NULL;
+
+	reply = g_dbus_proxy_call_finish (G_DBUS_PROXY (source), res, &error);
+	if (reply == NULL) {
+		g_dbus_method_invocation_return_gerror (helper->invocation, error);
+		return;
+	}
+	paths = g_variant_get_child_value (reply, 0);
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("ao"));
+	g_variant_iter_init (&iter, paths);
+	while (g_variant_iter_next (&iter, "&o", &object_path)) {
+		g_autofree gchar *tmp = sbu_site_get_object_path (helper->self, object_path);
+		g_variant_builder_add (&builder, "o", tmp);
+	}
+	g_dbus_method_invocation_return_value (helper->invocation,
+					       g_variant_new ("(ao)", &builder));
+}
+
+static gboolean
+sbu_site_forward_paths (SbuSite *self, GObject *skeleton, GDBusMethodInvocation *invocation)
+{
+	GDBusProxy *remote = g_object_get_data (skeleton, "sbu-site-remote");
+	SbuSiteHelper *helper = g_new0 (SbuSiteHelper, 1);
+	helper->self = g_object_ref (self);
+	helper->invocation = g_object_ref (invocation);
+	g_dbus_proxy_call (remote,
+			   g_dbus_method_invocation_get_method_name (invocation),
+			   g_dbus_method_invocation_get_parameters (invocation),
+			   G_DBUS_CALL_FLAGS_NONE, -1,
+			   self->cancellable,
+			   sbu_site_forward_paths_cb,
+			   helper);
+	return TRUE;
+}
+
+static gboolean
+sbu_site_handle_get_nodes_cb (SbuDevice *skeleton,
+			      GDBusMethodInvocation *invocation,
+			      SbuSite *self)
+{
+	return sbu_site_forward_paths (self, G_OBJECT (skeleton), invocation);
+}
+
+static gboolean
+sbu_site_handle_get_links_cb (SbuDevice *skeleton,
+			      GDBusMethodInvocation *invocation,
+			      SbuSite *self)
+{
+	return sbu_site_forward_paths (self, G_OBJECT (skeleton), invocation);
+}
+
+static gboolean
+sbu_site_handle_get_history_cb (SbuDevice *skeleton,
+				GDBusMethodInvocation *invocation,
+				const gchar *key,
+				guint64 start,
+				guint64 end,
+				guint limit,
+				SbuSite *self)
+{
+	return sbu_site_forward (self, G_OBJECT (skeleton), invocation);
+}
+
+static gboolean
+sbu_site_handle_get_energy_cb (SbuDevice *skeleton,
+			       GDBusMethodInvocation *invocation,
+			       const gchar *key,
+			       guint64 start,
+			       guint64 end,
+			       guint granularity,
+			       SbuSite *self)
+{
+	return sbu_site_forward (self, G_OBJECT (skeleton), invocation);
+}
+
+static void
+sbu_site_bind_properties (gpointer remote, gpointer skeleton, const gchar **props)
+{
+	g_object_set_data_full (G_OBJECT (skeleton), "sbu-site-remote",
+				g_object_ref (remote), g_object_unref);
+	for (guint i = 0; props[i] != NULL; i++) {
+		g_object_bind_property (remote, props[i],
+					skeleton, props[i],
+					G_BINDING_SYNC_CREATE);
+	}
+}
+
+static void
+sbu_site_object_added_cb (GDBusObjectManager *client,
+			  GDBusObject *object,
+			  SbuSite *self)
+{
+	const gchar *remote_path = g_dbus_object_get_object_path (object);
+	g_autofree gchar *object_path = NULL;
+	g_autoptr(SbuDevice) device = NULL;
+	g_autoptr(SbuLink) link = NULL;
+	g_autoptr(SbuNode) node = NULL;
+	g_autoptr(SbuObjectSkeleton) mirror = NULL;
+
+	/* the manager is provided by the aggregator itself */
+	if (!g_str_has_prefix (remote_path, SBU_DBUS_PATH_DEVICE "/"))
+		return;
+
+	object_path = sbu_site_get_object_path (self, remote_path);
+	mirror = sbu_object_skeleton_new (object_path);
+	device = sbu_object_get_device (SBU_OBJECT (object));
+	if (device != NULL) {
+		g_autoptr(SbuDevice) skeleton = sbu_device_skeleton_new ();
+		sbu_site_bind_properties (device, skeleton, sbu_site_device_props);
+		g_signal_connect (skeleton, "handle-get-nodes",
+				  G_CALLBACK (sbu_site_handle_get_nodes_cb), self);
+		g_signal_connect (skeleton, "handle-get-links",
+				  G_CALLBACK (sbu_site_handle_get_links_cb), self);
+		g_signal_connect (skeleton, "handle-get-history",
+				  G_CALLBACK (sbu_site_handle_get_history_cb), self);
+		g_signal_connect (skeleton, "handle-get-energy",
+				  G_CALLBACK (sbu_site_handle_get_energy_cb), self);
+		sbu_object_skeleton_set_device (mirror, skeleton);
+	}
+	node = sbu_object_get_node (SBU_OBJECT (object));
+	if (node != NULL) {
+		g_autoptr(SbuNode) skeleton = sbu_node_skeleton_new ();
+		sbu_site_bind_properties (node, skeleton, sbu_site_node_props);
+		sbu_object_skeleton_set_node (mirror, skeleton);
+	}
+	link = sbu_object_get_link (SBU_OBJECT (object));
+	if (link != NULL) {
+		g_autoptr(SbuLink) skeleton = sbu_link_skeleton_new ();
+		sbu_site_bind_properties (link, skeleton, sbu_site_link_props);
+		sbu_object_skeleton_set_link (mirror, skeleton);
+	}
+
+	g_debug ("mirroring %s as %s", remote_path, object_path);
+	g_dbus_object_manager_server_export (self->object_manager,
+					     G_DBUS_OBJECT_SKELETON (mirror));
+	g_hash_table_insert (self->objects,
+			     g_strdup (remote_path),
+			     g_steal_pointer (&mirror));
+}
+
+static void
+sbu_site_object_removed_cb (GDBusObjectManager *client,
+			    GDBusObject *object,
+			    SbuSite *self)
+{
+	const gchar *remote_path = g_dbus_object_get_object_path (object);
+	GDBusObject *mirror = g_hash_table_lookup (self->objects, remote_path);
+	if (mirror == NULL)
+		return;
+	g_debug ("removing mirror of %s", remote_path);
+	g_dbus_object_manager_server_unexport (self->object_manager,
+					       g_dbus_object_get_object_path (mirror));
+	g_hash_table_remove (self->objects, remote_path);
+}
+
+static void
+sbu_site_unexport_all (SbuSite *self)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	g_hash_table_iter_init (&iter, self->objects);
+	while (g_hash_table_iter_next (&iter, NULL, &value)) {
+		GDBusObject *mirror = G_DBUS_OBJECT (value);
+		g_dbus_object_manager_server_unexport (self->object_manager,
+						       g_dbus_object_get_object_path (mirror));
+	}
+	g_hash_table_remove_all (self->objects);
+}
+
+static void
+sbu_site_client_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuSite *self;
+	GList *objects;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GDBusObjectManager) client = NULL;
+
+	client = sbu_object_manager_client_new_finish (res, &error);
+	if (client == NULL) {
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			return;
+		self = SBU_SITE (user_data);
+		g_warning ("failed to get objects from %s: %s",
+			   self->name, error->message);
+		g_signal_handlers_disconnect_by_data (self->connection, self);
+		g_clear_object (&self->connection);
+		sbu_site_reconnect (self);
+		return;
+	}
+	self = SBU_SITE (user_data);
+	self->client = g_steal_pointer (&client);
+	g_signal_connect (self->client, "object-added",
+			  G_CALLBACK (sbu_site_object_added_cb), self);
+	g_signal_connect (self->client, "object-removed",
+			  G_CALLBACK (sbu_site_object_removed_cb), self);
+
+	/* objects that already exist */
+	objects = g_dbus_object_manager_get_objects (self->client);
+	for (GList *l = objects; l != NULL; l = l->next)
+		sbu_site_object_added_cb (self->client, G_DBUS_OBJECT (l->data), self);
+	g_list_free_full (objects, g_object_unref);
+}
+
+static void
+sbu_site_closed_cb (GDBusConnection *connection,
+		    gboolean remote_peer_vanished,
+		    GError *error,
+		    SbuSite *self)
+{
+	g_warning ("lost connection to %s: %s", self->name,
+		   error != NULL ? error->message : "closed");
+	sbu_site_unexport_all (self);
+	if (self->client != NULL) {
+		g_signal_handlers_disconnect_by_data (self->client, self);
+		g_clear_object (&self->client);
+	}
+	g_signal_handlers_disconnect_by_data (self->connection, self);
+	g_clear_object (&self->connection);
+	sbu_site_reconnect (self);
+}
+
+static void
+sbu_site_connect_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuSite *self;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GDBusConnection) connection = NULL;
+
+	connection = g_dbus_connection_new_for_address_finish (res, &error);
+	if (connection == NULL) {
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			return;
+		self = SBU_SITE (user_data);
+		g_warning ("failed to connect to %s: %s", self->name, error->message);
+		sbu_site_reconnect (self);
+		return;
+	}
+	self = SBU_SITE (user_data);
+	g_debug ("connected to %s", self->name);
+	self->connection = g_steal_pointer (&connection);
+	g_signal_connect (self->connection, "closed",
+			  G_CALLBACK (sbu_site_closed_cb), self);
+	sbu_object_manager_client_new (self->connection,
+				       G_DBUS_OBJECT_MANAGER_CLIENT_FLAGS_DO_NOT_AUTO_START,
+				       SBU_DBUS_NAME,
+				       "/com/hughski/PowerSBU",
+				       self->cancellable,
+				       sbu_site_client_cb,
+				       self);
+}
+
+/**
+ * sbu_site_connect:
+ * @self: a #SbuSite
+ *
+ * Connects to the site in the background, mirroring its devices, nodes and
+ * links as they appear. A lost or failed connection is retried.
+ **/
+void
+sbu_site_connect (SbuSite *self)
+{
+	g_return_if_fail (SBU_IS_SITE (self));
+	g_return_if_fail (self->connection == NULL);
+
+	g_debug ("connecting to %s at %s", self->name, self->address);
+	g_dbus_connection_new_for_address (self->address,
+					   G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+					   G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+					   NULL,
+					   self->cancellable,
+					   sbu_site_connect_cb,
+					   self);
+}
+
+static gboolean
+sbu_site_reconnect_cb (gpointer user_data)
+{
+	SbuSite *self = SBU_SITE (user_data);
+	self->reconnect_id = 0;
+	sbu_site_connect (self);
+	return FALSE;
+}
+
+static void
+sbu_site_reconnect (SbuSite *self)
+{
+	if (self->reconnect_id != 0)
+		return;
+	self->reconnect_id = g_timeout_add_seconds (self->reconnect_interval,
+						    sbu_site_reconnect_cb,
+						    self);
+}
+
+/**
+ * sbu_site_set_reconnect_interval:
+ * @self: a #SbuSite
+ * @reconnect_interval: a time in s
+ *
+ * Sets how long to wait before connecting again after the connection to
+ * the site is lost or cannot be made. The default is 30 s.
+ **/
+void
+sbu_site_set_reconnect_interval (SbuSite *self, guint reconnect_interval)
+{
+	g_return_if_fail (SBU_IS_SITE (self));
+	g_return_if_fail (reconnect_interval > 0);
+	self->reconnect_interval = reconnect_interval;
+}
+
+const gchar *
+sbu_site_get_name (SbuSite *self)
+{
+	g_return_val_if_fail (SBU_IS_SITE (self), NULL);
+	return self->name;
+}
+
+const gchar *
+sbu_site_get_address (SbuSite *self)
+{
+	g_return_val_if_fail (SBU_IS_SITE (self), NULL);
+	return self->address;
+}
+
+/**
+ * sbu_site_is_connected:
+ * @self: a #SbuSite
+ *
+ * Gets if the site can be used, which needs both a connection to the bus
+ * and sbud to be running on it.
+ *
+ * Return value: %TRUE if connected
+ **/
+gboolean
+sbu_site_is_connected (SbuSite *self)
+{
+	g_autofree gchar *name_owner = NULL;
+
+	g_return_val_if_fail (SBU_IS_SITE (self), FALSE);
+
+	if (self->client == NULL)
+		return FALSE;
+	name_owner = g_dbus_object_manager_client_get_name_owner (G_DBUS_OBJECT_MANAGER_CLIENT (self->client));
+	return name_owner != NULL;
+}
+
+/**
+ * sbu_site_get_devices:
+ * @self: a #SbuSite
+ *
+ * Gets the devices on the site, which can be called directly.
+ *
+ * Return value: (transfer container): an array of remote #SbuDevice
+ **/
+GPtrArray *
+sbu_site_get_devices (SbuSite *self)
+{
+	GPtrArray *devices;
+	GList *objects;
+
+	g_return_val_if_fail (SBU_IS_SITE (self), NULL);
+
+	devices = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	if (self->client == NULL)
+		return devices;
+	objects = g_dbus_object_manager_get_objects (self->client);
+	for (GList *l = objects; l != NULL; l = l->next) {
+		SbuDevice *device = sbu_object_get_device (SBU_OBJECT (l->data));
+		if (device != NULL)
+			g_ptr_array_add (devices, device);
+	}
+	g_list_free_full (objects, g_object_unref);
+	return devices;
+}
+
+typedef struct {
+	GDBusMethodInvocation	*invocation;
+	GVariantBuilder		 builder;
+	guint			 pending;
+} SbuSiteHistoryHelper;
+
+typedef struct {
+	SbuSiteHistoryHelper	*helper;
+	gchar			*object_path;	/* local */
+	gchar			*site_name;
+} SbuSiteHistoryItem;
+
+static void
+sbu_site_history_helper_unref (SbuSiteHistoryHelper *helper)
+{
+	if (--helper->pending > 0)
+		return;
+	g_dbus_method_invocation_return_value (helper->invocation,
+					       g_variant_new ("(@a{sa(td)})",
+							      g_variant_builder_end (&helper->builder)));
+	g_object_unref (helper->invocation);
+	g_free (helper);
+}
+
+static void
+sbu_site_history_item_free (SbuSiteHistoryItem *item)
+{
+	sbu_site_history_helper_unref (item->helper);
+	g_free (item->object_path);
+	g_free (item->site_name);
+	g_free (item);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuSiteHistoryItem, sbu_site_history_item_free)
+
+static void
+sbu_site_get_history_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	g_autoptr(SbuSiteHistoryItem) item = (SbuSiteHistoryItem *) user_data;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) data = NULL;
+	g_autoptr(GVariant) reply = NULL;
+
+	/* one slow or missing site should not hide the others */
+	reply = g_dbus_proxy_call_finish (G_DBUS_PROXY (source), res, &error);
+	if (reply == NULL) {
+		g_warning ("failed to get history for %s from %s: %s",
+			   item->object_path, item->site_name, error->message);
+		return;
+	}
+	data = g_variant_get_child_value (reply, 0);
+	g_variant_builder_add (&item->helper->builder, "{s@a(td)}",
+			       item->object_path, data);
+}
+
+/**
+ * sbu_site_return_history:
+ * @sites: an array of #SbuSite
+ * @invocation: a #GDBusMethodInvocation for Sites.GetHistory
+ * @key: a history key, e.g. "node_battery:voltage"
+ * @start: the start time
+ * @end: the end time
+ * @limit: the maximum number of values from each device
+ *
+ * Queries every device on every site at once and returns the history to
+ * @invocation, using the mirrored object paths as keys. The reply takes as
+ * long as the slowest device rather than the sum of them, and a device that
+ * fails or does not reply within SBU_SITE_HISTORY_TIMEOUT is left out.
+ **/
+void
+sbu_site_return_history (GPtrArray *sites,
+			 GDBusMethodInvocation *invocation,
+			 const gchar *key,
+			 guint64 start,
+			 guint64 end,
+			 guint limit)
+{
+	SbuSiteHistoryHelper *helper = g_new0 (SbuSiteHistoryHelper, 1);
+
+	helper->invocation = g_object_ref (invocation);
+	helper->pending = 1;
+	g_variant_builder_init (&helper->builder, G_VARIANT_TYPE ("a{sa(td)}"));
+	for (guint i = 0; i < sites->len; i++) {
+		SbuSite *site = g_ptr_array_index (sites, i);
+		g_autoptr(GPtrArray) devices = sbu_site_get_devices (site);
+		for (guint j = 0; j < devices->len; j++) {
+			GDBusProxy *device = g_ptr_array_index (devices, j);
+			SbuSiteHistoryItem *item = g_new0 (SbuSiteHistoryItem, 1);
+			item->helper = helper;
+			item->object_path = sbu_site_get_object_path (site, g_dbus_proxy_get_object_path (device));
+			item->site_name = g_strdup (site->name);
+			helper->pending++;
+			g_dbus_proxy_call (device, "GetHistory",
+					   g_variant_new ("(sttu)", key, start, end, limit),
+					   G_DBUS_CALL_FLAGS_NONE,
+					   SBU_SITE_HISTORY_TIMEOUT,
+					   NULL,
+					   sbu_site_get_history_cb,
+					   item);
+		}
+	}
+
+	/* replies once every device has answered, or now if there are none */
+	sbu_site_history_helper_unref (helper);
+}
+
+static void
+sbu_site_dispose (GObject *object)
+{
+	SbuSite *self = SBU_SITE (object);
+
+	g_cancellable_cancel (self->cancellable);
+	if (self->reconnect_id != 0) {
+		g_source_remove (self->reconnect_id);
+		self->reconnect_id = 0;
+	}
+	sbu_site_unexport_all (self);
+	if (self->client != NULL) {
+		g_signal_handlers_disconnect_by_data (self->client, self);
+		g_clear_object (&self->client);
+	}
+	if (self->connection != NULL) {
+		g_signal_handlers_disconnect_by_data (self->connection, self);
+		g_clear_object (&self->connection);
+	}
+
+	G_OBJECT_CLASS (sbu_site_parent_class)->dispose (object);
+}
+
+static void
+sbu_site_finalize (GObject *object)
+{
+	SbuSite *self = SBU_SITE (object);
+
+	g_object_unref (self->cancellable);
+	g_object_unref (self->object_manager);
+	g_hash_table_unref (self->objects);
+	g_free (self->name);
+	g_free (self->address);
+
+	G_OBJECT_CLASS (sbu_site_parent_class)->finalize (object);
+}
+
+static void
+sbu_site_init (SbuSite *self)
+{
+	self->cancellable = g_cancellable_new ();
+	self->reconnect_interval = SBU_SITE_RECONNECT_INTERVAL;
+	self->objects = g_hash_table_new_full (g_str_hash, g_str_equal,
+					       g_free, g_object_unref);
+}
+
+static void
+sbu_site_class_init (SbuSiteClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->dispose = sbu_site_dispose;
+	object_class->finalize = sbu_site_finalize;
+}
+
+/**
+ * sbu_site_new:
+ * @object_manager: where to export the mirrored objects
+ * @name: a short unique name, e.g. "home"
+ * @address: a D-Bus address, or "system" or "session"
+ * @error: a #GError, or %NULL
+ *
+ * Return value: a new SbuSite object, or %NULL if @name or @address is invalid
+ **/
+SbuSite *
+sbu_site_new (GDBusObjectManagerServer *object_manager,
+	      const gchar *name,
+	      const gchar *address,
+	      GError **error)
+{
+	SbuSite *self;
+	g_autofree gchar *address_bus = NULL;
+
+	/* this is used as an object path element */
+	if (name[0] == '\0') {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_ARGUMENT,
+				     "site name cannot be empty");
+		return NULL;
+	}
+	for (guint i = 0; name[i] != '\0'; i++) {
+		if (!g_ascii_isalnum (name[i]) && name[i] != '_') {
+			g_set_error (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_ARGUMENT,
+				     "site name '%s' can only use A-Z, a-z, 0-9 and _",
+				     name);
+			return NULL;
+		}
+	}
+
+	/* the buses this machine would use */
+	if (g_strcmp0 (address, "system") == 0) {
+		address_bus = g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SYSTEM, NULL, error);
+		if (address_bus == NULL)
+			return NULL;
+	} else if (g_strcmp0 (address, "session") == 0) {
+		address_bus = g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SESSION, NULL, error);
+		if (address_bus == NULL)
+			return NULL;
+	} else if (!g_dbus_is_supported_address (address, error)) {
+		g_prefix_error (error, "site %s: ", name);
+		return NULL;
+	}
+
+	self = g_object_new (SBU_TYPE_SITE, NULL);
+	self->object_manager = g_object_ref (object_manager);
+	self->name = g_strdup (name);
+	self->address = address_bus != NULL ? g_steal_pointer (&address_bus) : g_strdup (address);
+	return self;
+}
@@ -0,0 +1,57 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __SBU_SITE_H
+#define __SBU_SITE_H
+
+#include <gio/gio.h>
+
+#include "generated-gdbus.h"
+
+G_BEGIN_DECLS
+
+#define SBU_TYPE_SITE (sbu_site_get_type ())
+
+G_DECLARE_FINAL_TYPE (SbuSite, sbu_site, SBU, SITE, GObject)
+
+SbuSite		*sbu_site_new			(GDBusObjectManagerServer *object_manager,
+						 const gchar	*name,
+						 const gchar	*address,
+						 GError		**error);
+void		 sbu_site_connect		(SbuSite	*self);
+const gchar	*sbu_site_get_name		(SbuSite	*self);
+const gchar	*sbu_site_get_address		(SbuSite	*self);
+gboolean	 sbu_site_is_connected		(SbuSite	*self);
+void		 sbu_site_set_reconnect_interval (SbuSite	*self,
+						 guint		 reconnect_interval);
+GPtrArray	*sbu_site_get_devices		(SbuSite	*self);
+gchar		*sbu_site_get_object_path	(SbuSite	*self,
+						 const gchar	*remote_path);
+void		 sbu_site_return_history	(GPtrArray	*sites,
+						 GDBusMethodInvocation *invocation,
+						 const gchar	*key,
+						 guint64	 start,
+						 guint64	 end,
+						 guint		 limit);
+
+G_END_DECLS
+
+#endif /* __SBU_SITE_H */
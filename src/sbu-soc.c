@@ -0,0 +1,152 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "sbu-soc.h"
+
+/* longer than this between samples is treated as missing data, in s */
+#define SBU_SOC_MAX_GAP			900
+
+/* fraction of the charge going in that can be taken out again */
+#define SBU_SOC_CHARGE_EFFICIENCY	0.95f
+
+struct _SbuSoc
+{
+	GObject			 parent_instance;
+	gdouble			 capacity;	/* Ah */
+	gdouble			 value;		/* %, or -1 when unknown */
+	gboolean		 anchored;
+	gint64			 ts_last;	/* us, or 0 */
+	gdouble			 current_last;	/* A */
+};
+
+G_DEFINE_TYPE (SbuSoc, sbu_soc, G_TYPE_OBJECT)
+
+/**
+ * sbu_soc_add_sample:
+ * @self: a #SbuSoc
+ * @ts: a monotonic time in us
+ * @current: the battery current in A, positive when discharging
+ *
+ * Counts the charge since the last sample using the trapezoid rule, so
+ * that it only costs a few operations per device for each poll.
+ **/
+void
+sbu_soc_add_sample (SbuSoc *self, gint64 ts, gdouble current)
+{
+	gdouble ah;
+
+	g_return_if_fail (SBU_IS_SOC (self));
+
+	/* nothing to count from */
+	if (self->ts_last == 0 || ts <= self->ts_last ||
+	    ts - self->ts_last > (gint64) SBU_SOC_MAX_GAP * G_USEC_PER_SEC) {
+		self->ts_last = ts;
+		self->current_last = current;
+		return;
+	}
+	ah = (self->current_last + current) / 2.f *
+	     (gdouble) (ts - self->ts_last) / (3600.f * G_USEC_PER_SEC);
+	self->ts_last = ts;
+	self->current_last = current;
+	if (self->value < 0.f)
+		return;
+
+	/* charging is not perfectly efficient */
+	if (ah < 0.f)
+		ah *= SBU_SOC_CHARGE_EFFICIENCY;
+	self->value -= 100.f * ah / self->capacity;
+	self->value = CLAMP (self->value, 0.f, 100.f);
+}
+
+/**
+ * sbu_soc_anchor:
+ * @self: a #SbuSoc
+ * @value: a known state of charge in %, e.g. 100 when the charger floats
+ *
+ * Resets any error that has built up from counting the charge.
+ **/
+void
+sbu_soc_anchor (SbuSoc *self, gdouble value)
+{
+	g_return_if_fail (SBU_IS_SOC (self));
+	self->value = CLAMP (value, 0.f, 100.f);
+	self->anchored = TRUE;
+}
+
+/**
+ * sbu_soc_set_estimate:
+ * @self: a #SbuSoc
+ * @value: a rough state of charge in %, e.g. one derived from the voltage
+ *
+ * Sets a starting point that is only used until the first anchor.
+ **/
+void
+sbu_soc_set_estimate (SbuSoc *self, gdouble value)
+{
+	g_return_if_fail (SBU_IS_SOC (self));
+	if (self->anchored)
+		return;
+	self->value = CLAMP (value, 0.f, 100.f);
+}
+
+/**
+ * sbu_soc_get_value:
+ * @self: a #SbuSoc
+ *
+ * Return value: the state of charge in %, or -1 if not yet known
+ **/
+gdouble
+sbu_soc_get_value (SbuSoc *self)
+{
+	g_return_val_if_fail (SBU_IS_SOC (self), -1.f);
+	return self->value;
+}
+
+static void
+sbu_soc_init (SbuSoc *self)
+{
+	self->value = -1.f;
+}
+
+static void
+sbu_soc_class_init (SbuSocClass *klass)
+{
+}
+
+/**
+ * sbu_soc_new:
+ * @capacity: the usable battery capacity in Ah
+ *
+ * Return value: a new SbuSoc object.
+ **/
+SbuSoc *
+sbu_soc_new (gdouble capacity)
+{
+	SbuSoc *self;
+	g_return_val_if_fail (capacity > 0.f, NULL);
+	self = g_object_new (SBU_TYPE_SOC, NULL);
+	self->capacity = capacity;
+	return SBU_SOC (self);
+}
@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2017 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __SBU_SOC_H
+#define __SBU_SOC_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define SBU_TYPE_SOC (sbu_soc_get_type ())
+
+G_DECLARE_FINAL_TYPE (SbuSoc, sbu_soc, SBU, SOC, GObject)
+
+SbuSoc		*sbu_soc_new			(gdouble	 capacity);
+void		 sbu_soc_add_sample		(SbuSoc		*self,
+						 gint64		 ts,
+						 gdouble	 current);
+void		 sbu_soc_anchor			(SbuSoc		*self,
+						 gdouble	 value);
+void		 sbu_soc_set_estimate		(SbuSoc		*self,
+						 gdouble	 value);
+gdouble		 sbu_soc_get_value		(SbuSoc		*self);
+
+G_END_DECLS
+
+#endif /* __SBU_SOC_H */
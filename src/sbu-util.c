@@ -32,6 +32,10 @@
 #include "sbu-common.h"
 #include "sbu-config.h"
 #include "sbu-database.h"
+#include "sbu-export.h"
+
+/* ten years, which is more than any database will hold */
+#define SBU_UTIL_EXPORT_HOURS_MAX	(24 * 366 * 10)
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuManager, g_object_unref)
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuDevice, g_object_unref)
@@ -45,6 +49,9 @@ typedef struct {
 	GPtrArray		*cmd_array;
 	SbuDatabase		*sbu_database;
 	SbuConfig		*sbu_config;
+	gint			 export_width;
+	gint			 export_height;
+	gint			 export_hours;
 } SbuUtil;
 
 typedef gboolean (*SbuUtilPrivateCb)	(SbuUtil	*util,
@@ -172,6 +179,47 @@ sbu_util_repair (SbuUtil *self, gchar **values, GError **error)
 	return sbu_database_repair (self->sbu_database, error);
 }
 
+static gboolean
+sbu_util_metrics (SbuUtil *self, gchar **values, GError **error)
+{
+	GVariantIter iter;
+	const gchar *key;
+	const gchar *kind;
+	guint64 count;
+	guint64 max;
+	guint64 sum;
+	g_autoptr(GVariant) reply = NULL;
+	g_autoptr(SbuManager) manager = NULL;
+
+	manager = sbu_manager_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
+						      G_DBUS_PROXY_FLAGS_NONE,
+						      SBU_DBUS_NAME,
+						      SBU_DBUS_PATH_MANAGER,
+						      self->cancellable,
+						      error);
+	if (manager == NULL)
+		return FALSE;
+	if (!sbu_manager_call_get_metrics_sync (manager, &reply,
+						self->cancellable, error)) {
+		g_prefix_error (error, "Cannot get metrics: ");
+		return FALSE;
+	}
+
+	/* print reply, with durations in ms */
+	g_variant_iter_init (&iter, reply);
+	while (g_variant_iter_next (&iter, "{&s(&sttt)}", &key, &kind, &count, &sum, &max)) {
+		if (g_strcmp0 (kind, "counter") == 0) {
+			g_print ("%s\t%" G_GUINT64_FORMAT "\n", key, count);
+			continue;
+		}
+		g_print ("%s\tcount:%" G_GUINT64_FORMAT "\tave:%.1fms\tmax:%.1fms\n",
+			 key, count,
+			 (gdouble) sum / (count * 1000.f),
+			 (gdouble) max / 1000.f);
+	}
+	return TRUE;
+}
+
 static gboolean
 sbu_util_query_remote (SbuUtil *self, gchar **values, GError **error)
 {
@@ -221,6 +269,64 @@ sbu_util_query_remote (SbuUtil *self, gchar **values, GError **error)
 	return TRUE;
 }
 
+static gboolean
+sbu_util_export (SbuUtil *self, gchar **values, GError **error)
+{
+	SbuExportFormat format;
+	gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+	g_autoptr(SbuExport) export = NULL;
+
+	/* check args */
+	if (g_strv_length (values) < 2) {
+		g_set_error_literal (error,
+				     G_IO_ERROR,
+				     G_IO_ERROR_INVALID_ARGUMENT,
+				     "Invalid arguments: expected filename and device key");
+		return FALSE;
+	}
+	if (self->export_width <= 0 || self->export_width > SBU_EXPORT_SIZE_MAX ||
+	    self->export_height <= 0 || self->export_height > SBU_EXPORT_SIZE_MAX) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_ARGUMENT,
+			     "Invalid arguments: size must be 1 to %u pixels",
+			     (guint) SBU_EXPORT_SIZE_MAX);
+		return FALSE;
+	}
+	if (self->export_hours <= 0 || self->export_hours > SBU_UTIL_EXPORT_HOURS_MAX) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_ARGUMENT,
+			     "Invalid arguments: hours must be 1 to %u",
+			     (guint) SBU_UTIL_EXPORT_HOURS_MAX);
+		return FALSE;
+	}
+	format = sbu_export_format_from_filename (values[0]);
+	if (format == SBU_EXPORT_FORMAT_UNKNOWN) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     G_IO_ERROR_INVALID_ARGUMENT,
+			     "Invalid arguments: %s is not .csv, .svg or .png",
+			     values[0]);
+		return FALSE;
+	}
+
+	/* use the system-wide database */
+	if (!sbu_database_open (self->sbu_database, error))
+		return FALSE;
+
+	/* stream each key straight from the database */
+	export = sbu_export_new (self->sbu_database);
+	sbu_export_set_size (export, (guint) self->export_width, (guint) self->export_height);
+	sbu_export_set_range (export,
+			      now - (gint64) self->export_hours * 60 * 60,
+			      now);
+	for (guint i = 1; values[i] != NULL; i++)
+		sbu_export_add_key (export, values[i], 0x000000);
+	return sbu_export_to_file (export, format, values[0],
+				   self->cancellable, error);
+}
+
 static gboolean
 sbu_util_query (SbuUtil *self, gchar **values, GError **error)
 {
@@ -425,6 +531,9 @@ sbu_util_self_new (void)
 	self->context = g_option_context_new (NULL);
 	self->sbu_database = sbu_database_new ();
 	self->sbu_config = sbu_config_new ();
+	self->export_width = 800;
+	self->export_height = 400;
+	self->export_hours = 24;
 	return self;
 }
 
@@ -441,6 +550,15 @@ main (int argc, char *argv[])
 		{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
 			/* TRANSLATORS: command line option */
 			_("Show extra debugging information"), NULL },
+		{ "width", '\0', 0, G_OPTION_ARG_INT, &self->export_width,
+			/* TRANSLATORS: command line option */
+			_("Width of exported graphs in pixels"), NULL },
+		{ "height", '\0', 0, G_OPTION_ARG_INT, &self->export_height,
+			/* TRANSLATORS: command line option */
+			_("Height of exported graphs in pixels"), NULL },
+		{ "hours", '\0', 0, G_OPTION_ARG_INT, &self->export_hours,
+			/* TRANSLATORS: command line option */
+			_("Number of hours of history to export"), NULL },
 		{ NULL}
 	};
 
@@ -457,6 +575,18 @@ main (int argc, char *argv[])
 		      /* TRANSLATORS: command description */
 		      _("Dump all properties on all devices"),
 		      sbu_util_dump);
+	sbu_util_add (self->cmd_array,
+		      "export",
+		      "FILENAME KEY...",
+		      /* TRANSLATORS: command description */
+		      _("Export device history as CSV, SVG or PNG"),
+		      sbu_util_export);
+	sbu_util_add (self->cmd_array,
+		      "metrics",
+		      NULL,
+		      /* TRANSLATORS: command description */
+		      _("Show daemon performance metrics"),
+		      sbu_util_metrics);
 	sbu_util_add (self->cmd_array,
 		      "query",
 		      NULL,
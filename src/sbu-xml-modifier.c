@@ -25,11 +25,21 @@
 
 #include "sbu-xml-modifier.h"
 
+#define SBU_XML_SEGMENT_LITERAL		G_MAXUINT
+
+typedef struct {
+	guint			 slot;		/* or SBU_XML_SEGMENT_LITERAL */
+	gchar			*text;		/* literal, or default value */
+} SbuXmlSegment;
+
 struct _SbuXmlModifier
 {
 	GObject			 parent_instance;
 	GHashTable		*hash_cdata;
-	GHashTable		*hash_attrs;
+	GHashTable		*hash_slots;	/* key:slot+1 */
+	GPtrArray		*segments;	/* of SbuXmlSegment */
+	GPtrArray		*slot_values;	/* of gchar*, NULL for default */
+	gsize			 template_len;
 };
 
 G_DEFINE_TYPE (SbuXmlModifier, sbu_xml_modifier, G_TYPE_OBJECT)
@@ -38,8 +48,69 @@ typedef struct {
 	GString		*out;
 	SbuXmlModifier	*self;
 	gchar		*id;
+	gboolean	 compile;
 } SbuXmlHelper;
 
+static void
+sbu_xml_modifier_segment_free (SbuXmlSegment *seg)
+{
+	g_free (seg->text);
+	g_free (seg);
+}
+
+/* when compiling, everything written so far becomes one literal segment */
+static void
+sbu_xml_modifier_flush_literal (SbuXmlHelper *helper)
+{
+	SbuXmlSegment *seg;
+	if (helper->out->len == 0)
+		return;
+	seg = g_new0 (SbuXmlSegment, 1);
+	seg->slot = SBU_XML_SEGMENT_LITERAL;
+	seg->text = g_strndup (helper->out->str, helper->out->len);
+	g_ptr_array_add (helper->self->segments, seg);
+	g_string_truncate (helper->out, 0);
+}
+
+/* when compiling, add a replaceable slot; otherwise just copy the value */
+static void
+sbu_xml_modifier_add_slot (SbuXmlHelper *helper,
+			   const gchar *key,
+			   const gchar *text,
+			   gsize text_len)
+{
+	SbuXmlModifier *self = helper->self;
+	SbuXmlSegment *seg;
+	const gchar *text_replace;
+	guint slot;
+
+	/* not compiling */
+	if (!helper->compile) {
+		text_replace = g_hash_table_lookup (self->hash_cdata, key);
+		if (text_replace != NULL) {
+			g_string_append (helper->out, text_replace);
+			return;
+		}
+		g_string_append_len (helper->out, text, text_len);
+		return;
+	}
+
+	/* the same key may appear more than once */
+	slot = GPOINTER_TO_UINT (g_hash_table_lookup (self->hash_slots, key));
+	if (slot == 0) {
+		text_replace = g_hash_table_lookup (self->hash_cdata, key);
+		g_ptr_array_add (self->slot_values, g_strdup (text_replace));
+		slot = self->slot_values->len;
+		g_hash_table_insert (self->hash_slots, g_strdup (key),
+				     GUINT_TO_POINTER (slot));
+	}
+	sbu_xml_modifier_flush_literal (helper);
+	seg = g_new0 (SbuXmlSegment, 1);
+	seg->slot = slot - 1;
+	seg->text = g_strndup (text, text_len);
+	g_ptr_array_add (self->segments, seg);
+}
+
 static void
 sbu_xml_modifier_start_element (GMarkupParseContext *context,
 				const gchar *element_name,
@@ -65,23 +136,15 @@ sbu_xml_modifier_start_element (GMarkupParseContext *context,
 
 	g_string_append_printf (helper->out, "<%s", element_name);
 	for (guint i = 0; attribute_names[i] != NULL; i++) {
-		const gchar *text_replace;
 		g_autofree gchar *key = NULL;
 
 		/* anything to replace */
 		key = g_strdup_printf ("%s-%s", helper->id, attribute_names[i]);
-		text_replace = g_hash_table_lookup (helper->self->hash_cdata, key);
-		if (text_replace != NULL) {
-			g_string_append_printf (helper->out, " %s=\"%s\"",
-						attribute_names[i],
-						text_replace);
-			continue;
-		}
-
-		/* as per usual */
-		g_string_append_printf (helper->out, " %s=\"%s\"",
-					attribute_names[i],
-					attribute_values[i]);
+		g_string_append_printf (helper->out, " %s=\"", attribute_names[i]);
+		sbu_xml_modifier_add_slot (helper, key,
+					   attribute_values[i],
+					   strlen (attribute_values[i]));
+		g_string_append (helper->out, "\"");
 	}
 	g_string_append (helper->out, ">");
 }
@@ -114,21 +177,19 @@ sbu_xml_modifier_text (GMarkupParseContext *context,
 		       GError **error)
 {
 	SbuXmlHelper *helper = (SbuXmlHelper *) user_data;
-	const gchar *text_replace;
 
 	/* all whitespace */
 	if (sbu_xml_modifier_is_all_whitespace (text, text_len))
 		return;
 
-	/* is replaced */
-	text_replace = g_hash_table_lookup (helper->self->hash_cdata, helper->id);
-	if (text_replace != NULL) {
-		g_string_append (helper->out, text_replace);
+	/* no ID seen yet */
+	if (helper->id == NULL) {
+		g_string_append_len (helper->out, text, text_len);
 		return;
 	}
 
-	/* as per usual */
-	g_string_append_len (helper->out, text, text_len);
+	/* possibly replaced */
+	sbu_xml_modifier_add_slot (helper, helper->id, text, text_len);
 }
 
 static void
@@ -179,12 +240,110 @@ sbu_xml_modifier_process (SbuXmlModifier *self,
 	return g_steal_pointer (&helper->out);
 }
 
+/**
+ * sbu_xml_modifier_compile:
+ * @self: a #SbuXmlModifier
+ * @text: XML template
+ * @text_len: size of @text, or -1 if NUL terminated
+ * @error: a #GError, or %NULL
+ *
+ * Parses the template once into a list of literal segments and slots for
+ * each element CDATA and attribute that could be replaced. Any replacements
+ * set before or after this call are used by sbu_xml_modifier_render(),
+ * which just splices the slot values between the literal segments.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_xml_modifier_compile (SbuXmlModifier *self,
+			  const gchar *text,
+			  gssize text_len,
+			  GError **error)
+{
+	GMarkupParser parser = {
+		sbu_xml_modifier_start_element,
+		sbu_xml_modifier_end_element,
+		sbu_xml_modifier_text,
+		sbu_xml_modifier_passthrough,
+		NULL
+	};
+	g_autoptr(SbuXmlHelper) helper = g_new0 (SbuXmlHelper, 1);
+	g_autoptr(GMarkupParseContext) ctx = NULL;
+
+	g_return_val_if_fail (SBU_IS_XML_MODIFIER (self), FALSE);
+
+	/* invalidate any previous template */
+	g_ptr_array_set_size (self->segments, 0);
+	g_ptr_array_set_size (self->slot_values, 0);
+	g_hash_table_remove_all (self->hash_slots);
+	self->template_len = 0;
+
+	helper->out = g_string_new (NULL);
+	helper->self = self;
+	helper->compile = TRUE;
+
+	ctx = g_markup_parse_context_new (&parser, 0, helper, NULL);
+	if (!g_markup_parse_context_parse (ctx, text, text_len, error) ||
+	    !g_markup_parse_context_end_parse (ctx, error)) {
+		g_ptr_array_set_size (self->segments, 0);
+		g_ptr_array_set_size (self->slot_values, 0);
+		g_hash_table_remove_all (self->hash_slots);
+		return FALSE;
+	}
+	sbu_xml_modifier_flush_literal (helper);
+	self->template_len = text_len >= 0 ? (gsize) text_len : strlen (text);
+	g_debug ("compiled template into %u segments with %u slots",
+		 self->segments->len, self->slot_values->len);
+	return TRUE;
+}
+
+/**
+ * sbu_xml_modifier_render:
+ * @self: a #SbuXmlModifier
+ *
+ * Renders the template from sbu_xml_modifier_compile() using the current
+ * replacements. The output is identical to sbu_xml_modifier_process().
+ *
+ * Returns: a #GString, or %NULL if no template has been compiled
+ **/
+GString *
+sbu_xml_modifier_render (SbuXmlModifier *self)
+{
+	GString *out;
+
+	g_return_val_if_fail (SBU_IS_XML_MODIFIER (self), NULL);
+
+	if (self->segments->len == 0)
+		return NULL;
+	out = g_string_sized_new (self->template_len);
+	for (guint i = 0; i < self->segments->len; i++) {
+		SbuXmlSegment *seg = g_ptr_array_index (self->segments, i);
+		const gchar *value = NULL;
+		if (seg->slot != SBU_XML_SEGMENT_LITERAL)
+			value = g_ptr_array_index (self->slot_values, seg->slot);
+		g_string_append (out, value != NULL ? value : seg->text);
+	}
+	return out;
+}
+
+static void
+sbu_xml_modifier_set_value (SbuXmlModifier *self, gchar *key, const gchar *value)
+{
+	guint slot = GPOINTER_TO_UINT (g_hash_table_lookup (self->hash_slots, key));
+	if (slot != 0) {
+		gchar **value_slot = (gchar **) &g_ptr_array_index (self->slot_values, slot - 1);
+		g_free (*value_slot);
+		*value_slot = g_strdup (value);
+	}
+	g_hash_table_insert (self->hash_cdata, key, g_strdup (value));
+}
+
 void
 sbu_xml_modifier_replace_cdata (SbuXmlModifier *self,
 				const gchar *id,
 				const gchar *value)
 {
-	g_hash_table_insert (self->hash_cdata, g_strdup (id), g_strdup (value));
+	sbu_xml_modifier_set_value (self, g_strdup (id), value);
 }
 
 void
@@ -193,9 +352,37 @@ sbu_xml_modifier_replace_attr (SbuXmlModifier *self,
 			       const gchar *attr,
 			       const gchar *value)
 {
-	g_hash_table_insert (self->hash_cdata,
-			     g_strdup_printf ("%s-%s", id, attr),
-			     g_strdup (value));
+	sbu_xml_modifier_set_value (self, g_strdup_printf ("%s-%s", id, attr), value);
+}
+
+const gchar *
+sbu_xml_modifier_get_cdata (SbuXmlModifier *self, const gchar *id)
+{
+	return g_hash_table_lookup (self->hash_cdata, id);
+}
+
+const gchar *
+sbu_xml_modifier_get_attr (SbuXmlModifier *self, const gchar *id, const gchar *attr)
+{
+	g_autofree gchar *key = g_strdup_printf ("%s-%s", id, attr);
+	return g_hash_table_lookup (self->hash_cdata, key);
+}
+
+/**
+ * sbu_xml_modifier_reset:
+ * @self: a #SbuXmlModifier
+ *
+ * Removes all replacements, keeping any compiled template.
+ **/
+void
+sbu_xml_modifier_reset (SbuXmlModifier *self)
+{
+	g_return_if_fail (SBU_IS_XML_MODIFIER (self));
+	g_hash_table_remove_all (self->hash_cdata);
+	for (guint i = 0; i < self->slot_values->len; i++) {
+		gchar **value_slot = (gchar **) &g_ptr_array_index (self->slot_values, i);
+		g_clear_pointer (value_slot, g_free);
+	}
 }
 
 static void
@@ -204,7 +391,9 @@ sbu_xml_modifier_finalize (GObject *object)
 	SbuXmlModifier *self = SBU_XML_MODIFIER (object);
 
 	g_hash_table_unref (self->hash_cdata);
-	g_hash_table_unref (self->hash_attrs);
+	g_hash_table_unref (self->hash_slots);
+	g_ptr_array_unref (self->segments);
+	g_ptr_array_unref (self->slot_values);
 
 	G_OBJECT_CLASS (sbu_xml_modifier_parent_class)->finalize (object);
 }
@@ -213,7 +402,9 @@ static void
 sbu_xml_modifier_init (SbuXmlModifier *self)
 {
 	self->hash_cdata = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
-	self->hash_attrs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	self->hash_slots = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	self->segments = g_ptr_array_new_with_free_func ((GDestroyNotify) sbu_xml_modifier_segment_free);
+	self->slot_values = g_ptr_array_new_with_free_func (g_free);
 }
 
 static void
@@ -39,10 +39,21 @@ void		 sbu_xml_modifier_replace_attr	(SbuXmlModifier	*self,
 						 const gchar	*id,
 						 const gchar	*attr,
 						 const gchar	*value);
+const gchar	*sbu_xml_modifier_get_cdata	(SbuXmlModifier	*self,
+						 const gchar	*id);
+const gchar	*sbu_xml_modifier_get_attr	(SbuXmlModifier	*self,
+						 const gchar	*id,
+						 const gchar	*attr);
 GString		*sbu_xml_modifier_process	(SbuXmlModifier	*self,
 						 const gchar	*text,
 						 gssize		 text_len,
 						 GError		**error);
+gboolean	 sbu_xml_modifier_compile	(SbuXmlModifier	*self,
+						 const gchar	*text,
+						 gssize		 text_len,
+						 GError		**error);
+GString		*sbu_xml_modifier_render	(SbuXmlModifier	*self);
+void		 sbu_xml_modifier_reset		(SbuXmlModifier	*self);
 
 G_END_DECLS
 